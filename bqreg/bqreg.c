@@ -34,6 +34,9 @@
 #include <sys/module.h>
 #include <sys/endian.h>
 #include <sys/rman.h>
+#include <sys/lock.h>
+#include <sys/sx.h>
+#include <sys/sysctl.h>
 
 #include <machine/bus.h>
 #include <machine/resource.h>
@@ -41,9 +44,16 @@
 #include <dev/iicbus/iicbus.h>
 #include <dev/iicbus/iiconf.h>
 
+#include "bqreg_var.h"
+
 struct bqreg_softc {
 	device_t			sc_dev;
+	struct sx			sc_lock;
 	uint8_t				sc_config;
+	int				sc_limit_ma;	/* asked for, 0 if none */
+	int				sc_input_ma;	/* IINLIM last set */
+	int				sc_source;	/* VBUS_STAT then */
+	uint64_t			sc_changes;
 };
 
 #define BQREG_SADDR	0x54 // datasheet disagrees with acpi
@@ -60,7 +70,13 @@ struct bqreg_softc {
 #define BQREG_FAULT	0x09
 #define BQREG_VENDER	0x0A
 
+#define BQREG_INPUT_IINLIM	0x07
+
 #define BQREG_STAT_VBUS		6	// 2 bits
+#define BQREG_VBUS_UNKNOWN	0	/* or D+/D- detection running */
+#define BQREG_VBUS_USB		1
+#define BQREG_VBUS_ADAPTER	2
+#define BQREG_VBUS_OTG		3
 #define BQREG_STAT_CHRG		4	// 2 bits
 #define BQREG_STAT_DPM		3
 #define BQREG_STAT_PG		2
@@ -78,6 +94,21 @@ static int bqreg_detach(device_t);
 static int bqreg_read(device_t, uint8_t, uint8_t *);
 static int bqreg_write(device_t, uint8_t, uint8_t);
 
+/*
+ * IINLIM in mA. Code 4 is 1.2 A on the bq24190 and 1 A on the bq24296
+ * the Pocket has, so take the lower.
+ */
+static const int bqreg_iinlim_ma[] = {
+	100, 150, 500, 900, 1000, 1500, 2000, 3000
+};
+
+static const char *bqreg_source_names[] = {
+	[BQREG_VBUS_UNKNOWN] = "unknown",
+	[BQREG_VBUS_USB] = "usb",
+	[BQREG_VBUS_ADAPTER] = "adapter",
+	[BQREG_VBUS_OTG] = "otg",
+};
+
 static int
 bqreg_probe(device_t dev)
 {
@@ -86,14 +117,32 @@ bqreg_probe(device_t dev)
 	return (0);
 }
 
+static int
+bqreg_sysctl_source(SYSCTL_HANDLER_ARGS)
+{
+	struct bqreg_softc *sc;
+	char buf[16];
+
+	sc = (struct bqreg_softc *)arg1;
+
+	sx_slock(&sc->sc_lock);
+	strlcpy(buf, bqreg_source_names[sc->sc_source], sizeof(buf));
+	sx_sunlock(&sc->sc_lock);
+
+	return (sysctl_handle_string(oidp, buf, sizeof(buf), req));
+}
+
 static int
 bqreg_attach(device_t dev)
 {
 	struct bqreg_softc *sc = device_get_softc(dev);
+	struct sysctl_ctx_list *sysctl_ctx;
+	struct sysctl_oid *sysctl_tree;
 	int rv; 
 	uint8_t config = 0;
 
 	sc->sc_dev = dev;
+	sx_init(&sc->sc_lock, "bqreg");
 
 	if ((rv = bqreg_read(dev, BQREG_VENDER, &config)) != 0)	
 		device_printf(dev, "read config failed rv: %d errno: %d\n", rv, iic2errno(rv));
@@ -102,26 +151,106 @@ bqreg_attach(device_t dev)
 		sc->sc_config = config;
 	}
 
+	sysctl_ctx = device_get_sysctl_ctx(dev);
+	sysctl_tree = device_get_sysctl_tree(dev);
+
+	SYSCTL_ADD_INT(sysctl_ctx, SYSCTL_CHILDREN(sysctl_tree), OID_AUTO,
+		"limit_ma", CTLFLAG_RD, &sc->sc_limit_ma, 0,
+		"Input current the Type-C source offers in mA, 0 if unknown");
+	SYSCTL_ADD_INT(sysctl_ctx, SYSCTL_CHILDREN(sysctl_tree), OID_AUTO,
+		"input_ma", CTLFLAG_RD, &sc->sc_input_ma, 0,
+		"Input current limit last set in mA, 0 if left to the charger");
+	SYSCTL_ADD_PROC(sysctl_ctx, SYSCTL_CHILDREN(sysctl_tree), OID_AUTO,
+		"source", CTLTYPE_STRING | CTLFLAG_RD, sc, 0,
+		bqreg_sysctl_source, "A",
+		"Input source from D+/D- detection when the limit was set");
+	SYSCTL_ADD_U64(sysctl_ctx, SYSCTL_CHILDREN(sysctl_tree), OID_AUTO,
+		"changes", CTLFLAG_RD, &sc->sc_changes, 0,
+		"Times the input current limit was changed");
+
 	return (0);
 }
 
 static int
 bqreg_detach(device_t dev)
 {
+	struct bqreg_softc *sc = device_get_softc(dev);
+
+	sx_destroy(&sc->sc_lock);
 	return (0);
 }
 
+/*
+ * Raise the input current limit to what the source offers. The charger's
+ * D+/D- detection has to finish first, it sets the limit itself then; a
+ * dedicated or charging downstream port it finds is good for 1.5 A even
+ * when Rp only says default USB power. 0 leaves the limit to the charger,
+ * which starts again from its own detection on the next input.
+ */
+int
+bqreg_set_input_limit(device_t dev, int ma)
+{
+	struct bqreg_softc *sc = device_get_softc(dev);
+	uint8_t status, input, code;
+	int rv, source, min_ma;
+
+	if (ma < 0)
+		return (EINVAL);
+
+	sx_xlock(&sc->sc_lock);
+	sc->sc_limit_ma = ma;
+	if (ma == 0) {
+		sc->sc_input_ma = 0;
+		sx_xunlock(&sc->sc_lock);
+		return (0);
+	}
+
+	if ((rv = bqreg_read(dev, BQREG_STATUS, &status)) != 0)
+		goto out;
+	source = (status >> BQREG_STAT_VBUS) & 3;
+	if (source == BQREG_VBUS_UNKNOWN ||
+	    (status & (1 << BQREG_STAT_PG)) == 0) {
+		sx_xunlock(&sc->sc_lock);
+		return (EAGAIN);
+	}
+	if (source == BQREG_VBUS_OTG) {
+		/* We are the one supplying VBUS */
+		sx_xunlock(&sc->sc_lock);
+		return (EBUSY);
+	}
+	sc->sc_source = source;
+
+	min_ma = source == BQREG_VBUS_ADAPTER ? 1500 : 500;
+	ma = MAX(ma, min_ma);
+	for (code = nitems(bqreg_iinlim_ma) - 1; code > 0; code--)
+		if (bqreg_iinlim_ma[code] <= ma)
+			break;
+
+	if ((rv = bqreg_read(dev, BQREG_INPUT, &input)) != 0)
+		goto out;
+	if ((input & BQREG_INPUT_IINLIM) != code) {
+		input = (input & ~BQREG_INPUT_IINLIM) | code;
+		if ((rv = bqreg_write(dev, BQREG_INPUT, input)) != 0)
+			goto out;
+		sc->sc_changes++;
+	}
+	sc->sc_input_ma = bqreg_iinlim_ma[code];
+out:
+	if (rv != 0)
+		device_printf(dev, "input limit failed rv: %d errno: %d\n",
+		    rv, iic2errno(rv));
+	sx_xunlock(&sc->sc_lock);
+	return (iic2errno(rv));
+}
+
 static int 
 bqreg_read(device_t dev, uint8_t reg, uint8_t *val)
 {
-	struct bqreg_softc *sc;
 	struct iic_msg msg[2];
 	uint8_t data;
 	int rv;
 	uint16_t addr = iicbus_get_addr(dev); 
 
-	sc = device_get_softc(dev);
-
 	msg[0].slave = addr;
 	msg[0].flags = IIC_M_WR;
 	msg[0].len = 1;
@@ -132,7 +261,7 @@ bqreg_read(device_t dev, uint8_t reg, uint8_t *val)
 	msg[1].len = 1;
 	msg[1].buf = &data;
 
-	rv = iicbus_transfer(dev, msg, 1);
+	rv = iicbus_transfer(dev, msg, 2);
 	*val = data;
 
 	return (rv);
@@ -141,7 +270,6 @@ bqreg_read(device_t dev, uint8_t reg, uint8_t *val)
 static int 
 bqreg_write(device_t dev, uint8_t reg, uint8_t val)
 {
-	struct bqreg_softc *sc;
 	struct iic_msg msg[1];
 	uint8_t buf[2];
 	uint16_t addr = iicbus_get_addr(dev); 
@@ -149,8 +277,6 @@ bqreg_write(device_t dev, uint8_t reg, uint8_t val)
 	buf[0] = reg;
 	buf[1] = val;
 
-	sc = device_get_softc(dev);
-
 	msg[0].slave = addr;
 	msg[0].flags = IIC_M_WR;
 	msg[0].len = 2;
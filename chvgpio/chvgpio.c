@@ -55,6 +55,10 @@ __FBSDID("$FreeBSD$");
 #include <sys/rman.h>
 #include <sys/types.h>
 #include <sys/malloc.h>
+#include <sys/sysctl.h>
+#include <sys/sbuf.h>
+#include <sys/taskqueue.h>
+#include <sys/callout.h>
 
 #include <machine/bus.h>
 #include <machine/resource.h>
@@ -70,6 +74,7 @@ __FBSDID("$FreeBSD$");
 #include "gpio_if.h"
 
 #include "chvgpio_reg.h"
+#include "chvgpio_var.h"
 
 /*
  *     Macros for driver mutex locking
@@ -83,6 +88,53 @@ __FBSDID("$FreeBSD$");
 #define CHVGPIO_ASSERT_LOCKED(_sc)      mtx_assert(&(_sc)->sc_mtx, MA_OWNED)
 #define CHVGPIO_ASSERT_UNLOCKED(_sc) 	mtx_assert(&(_sc)->sc_mtx, MA_NOTOWNED)
 
+/* Latency histogram buckets, bucket n counts latencies below 2^n us */
+#define CHVGPIO_LAT_BUCKETS		20
+
+/* Lines firing faster than this per second are masked for a while */
+#define CHVGPIO_STORM_THRESHOLD		2000
+#define CHVGPIO_STORM_BACKOFF_MIN	(SBT_1MS * 100)
+#define CHVGPIO_STORM_BACKOFF_MAX	(SBT_1S * 30)
+
+/* Who armed a line for wake */
+#define CHVGPIO_WAKE_AEI	0x01	/* wake capable GpioInt in _AEI */
+#define CHVGPIO_WAKE_PIN	0x02	/* CHVGPIO_PIN_WAKE pin flag */
+
+/*
+ * Each pad selects one of the 16 interrupt lines of its community through
+ * INTSEL, firmware assigns them.
+ */
+struct chvgpio_line {
+	struct chvgpio_softc *cl_sc;
+	int		cl_pin;		/* pad routed to this line, -1 if none */
+	int		cl_wake;	/* line may wake the SoC, CHVGPIO_WAKE_* */
+
+	/* ACPI event from _AEI */
+	ACPI_HANDLE	cl_event;	/* _Exx, _Lxx or _EVT method */
+	int		cl_evt;		/* method is _EVT, pass the pin */
+	int		cl_level;	/* level triggered, mask until serviced */
+	int		cl_masked;
+	struct task	cl_task;
+	sbintime_t	cl_ack_time;	/* when the pending event was acked */
+
+	/* Another driver's GpioInt, see chvgpio_setup_intr */
+	driver_intr_t	*cl_handler;
+	void		*cl_arg;
+
+	/* Statistics */
+	uint64_t	cl_count;
+	uint64_t	cl_stray;	/* fired with nobody listening */
+	uint64_t	cl_latency[CHVGPIO_LAT_BUCKETS];
+
+	/* Storm throttling */
+	sbintime_t	cl_window;	/* start of the current second */
+	u_int		cl_window_count;
+	int		cl_throttled;
+	uint64_t	cl_storms;
+	sbintime_t	cl_backoff;
+	struct callout	cl_callout;
+};
+
 struct chvgpio_softc {
 	device_t 	sc_dev;
 	device_t 	sc_busdev;
@@ -102,12 +154,34 @@ struct chvgpio_softc {
 	int 		sc_npins;
 	int 		sc_ngroups;
 	const char **sc_pin_names;
+
+	struct chvgpio_line sc_lines[CHVGPIO_NLINES];
+	uint32_t	sc_intr_mask;		/* lines unmasked at attach */
+	struct taskqueue *sc_tq;		/* runs ACPI event methods */
+
+	uint64_t	sc_spurious;		/* interrupts with no line pending */
+	u_int		sc_storm_threshold;	/* per line, per second */
+
+	/* Pad state saved across suspend */
+	uint32_t	*sc_pad_cfg0;
+	uint32_t	*sc_pad_cfg1;
+
+	uint32_t	sc_wake_status;		/* wake lines pending on resume */
+	u_int		sc_wake_count;
+
+	uint64_t	sc_resume_us;		/* duration of last resume */
+	uint64_t	sc_resume_max_us;
+	u_int		sc_resume_pads;		/* pads rewritten on last resume */
 };
 
 static void chvgpio_intr(void *);
 static int chvgpio_probe(device_t);
 static int chvgpio_attach(device_t);
 static int chvgpio_detach(device_t);
+static int chvgpio_suspend(device_t);
+static int chvgpio_resume(device_t);
+
+static driver_t chvgpio_driver;
 
 static inline int
 chvgpio_pad_cfg0_offset(int pin)
@@ -133,6 +207,12 @@ chvgpio_read_pad_cfg1(struct chvgpio_softc *sc, int pin)
 	return bus_read_4(sc->sc_mem_res, chvgpio_pad_cfg0_offset(pin) + 4);
 }
 
+static inline void
+chvgpio_write_pad_cfg1(struct chvgpio_softc *sc, int pin, uint32_t val)
+{
+	bus_write_4(sc->sc_mem_res, chvgpio_pad_cfg0_offset(pin) + 4, val);
+}
+
 static device_t
 chvgpio_get_bus(device_t dev)
 {
@@ -167,6 +247,540 @@ chvgpio_valid_pin(struct chvgpio_softc *sc, int pin)
 	return (0);
 }
 
+static inline int
+chvgpio_pad_line(struct chvgpio_softc *sc, int pin)
+{
+	return ((chvgpio_read_pad_cfg0(sc, pin) & CHVGPIO_PAD_CFG0_INTSEL_MASK)
+		>> CHVGPIO_PAD_CFG0_INTSEL_SHIFT);
+}
+
+static uint32_t
+chvgpio_wake_lines(struct chvgpio_softc *sc)
+{
+	uint32_t mask;
+	int line;
+
+	mask = 0;
+	for (line = 0; line < CHVGPIO_NLINES; line++)
+		if (sc->sc_lines[line].cl_wake)
+			mask |= 1 << line;
+	return (mask);
+}
+
+/*
+ * Lines which should be unmasked while running, those set up at attach,
+ * wake sources, interrupts handed out to other drivers and ACPI events
+ * which are not being serviced. Storming lines
+ * stay masked until their backoff expires.
+ */
+static uint32_t
+chvgpio_active_lines(struct chvgpio_softc *sc)
+{
+	struct chvgpio_line *cl;
+	uint32_t mask;
+	int line;
+
+	mask = sc->sc_intr_mask | chvgpio_wake_lines(sc);
+	for (line = 0; line < CHVGPIO_NLINES; line++) {
+		cl = &sc->sc_lines[line];
+		if (cl->cl_event != NULL && !cl->cl_masked)
+			mask |= 1 << line;
+		if (cl->cl_handler != NULL)
+			mask |= 1 << line;
+		if (cl->cl_throttled)
+			mask &= ~(1 << line);
+	}
+	return (mask);
+}
+
+static inline void
+chvgpio_update_mask(struct chvgpio_softc *sc)
+{
+	CHVGPIO_ASSERT_LOCKED(sc);
+
+	bus_write_4(sc->sc_mem_res, CHVGPIO_INTERRUPT_MASK,
+		chvgpio_active_lines(sc));
+}
+
+/*
+ * Take ownership of the interrupt line a pad is routed to. The trigger in
+ * INTWAKECFG is replaced by intcfg when it is given, otherwise the firmware
+ * setting is kept and a pad with no trigger at all fires on both edges.
+ */
+static int
+chvgpio_claim_line(struct chvgpio_softc *sc, int pin, uint32_t intcfg,
+    struct chvgpio_line **clp)
+{
+	struct chvgpio_line *cl;
+	uint32_t val, oval;
+	int line;
+
+	CHVGPIO_ASSERT_LOCKED(sc);
+
+	line = chvgpio_pad_line(sc, pin);
+	cl = &sc->sc_lines[line];
+
+	if (cl->cl_pin != -1 && cl->cl_pin != pin)
+		return (EBUSY);
+
+	oval = val = chvgpio_read_pad_cfg1(sc, pin);
+	if ((val & CHVGPIO_PAD_CFG1_CFGLOCK) == 0) {
+		if (intcfg != 0) {
+			val &= ~(CHVGPIO_PAD_CFG1_INTWAKECFG_MASK |
+				CHVGPIO_PAD_CFG1_INVRXTX_RXDATA);
+			val |= intcfg;
+		} else if ((val & CHVGPIO_PAD_CFG1_INTWAKECFG_MASK) == 0)
+			val |= CHVGPIO_PAD_CFG1_INTWAKECFG_BOTH;
+		if (val != oval)
+			chvgpio_write_pad_cfg1(sc, pin, val);
+	}
+
+	if (cl->cl_pin == -1)
+		bus_write_4(sc->sc_mem_res, CHVGPIO_INTERRUPT_STATUS,
+			1 << line);
+	cl->cl_pin = pin;
+	*clp = cl;
+
+	return (0);
+}
+
+static void
+chvgpio_release_line(struct chvgpio_softc *sc, struct chvgpio_line *cl)
+{
+	CHVGPIO_ASSERT_LOCKED(sc);
+
+	if (!cl->cl_wake && cl->cl_event == NULL && cl->cl_handler == NULL)
+		cl->cl_pin = -1;
+}
+
+/*
+ * Arm or disarm a pad as a wake source through CHVGPIO_PIN_WAKE, wakecfg
+ * is handed to chvgpio_claim_line. A wake armed from _AEI is left alone.
+ */
+static int
+chvgpio_set_wake(struct chvgpio_softc *sc, int pin, uint32_t wakecfg,
+    int enable)
+{
+	struct chvgpio_line *cl;
+	int error;
+
+	CHVGPIO_ASSERT_LOCKED(sc);
+
+	if (!enable) {
+		cl = &sc->sc_lines[chvgpio_pad_line(sc, pin)];
+		if (cl->cl_pin != pin || (cl->cl_wake & CHVGPIO_WAKE_PIN) == 0)
+			return (0);
+		cl->cl_wake &= ~CHVGPIO_WAKE_PIN;
+		chvgpio_release_line(sc, cl);
+	} else {
+		error = chvgpio_claim_line(sc, pin, wakecfg, &cl);
+		if (error)
+			return (error);
+		cl->cl_wake |= CHVGPIO_WAKE_PIN;
+	}
+
+	chvgpio_update_mask(sc);
+
+	return (0);
+}
+
+static uint32_t
+chvgpio_acpi_intcfg(int triggering, int polarity)
+{
+	if (triggering == ACPI_LEVEL_SENSITIVE) {
+		if (polarity == ACPI_ACTIVE_LOW)
+			return (CHVGPIO_PAD_CFG1_INTWAKECFG_LEVEL |
+				CHVGPIO_PAD_CFG1_INVRXTX_RXDATA);
+		return (CHVGPIO_PAD_CFG1_INTWAKECFG_LEVEL);
+	}
+
+	switch (polarity) {
+	case ACPI_ACTIVE_HIGH:
+		return (CHVGPIO_PAD_CFG1_INTWAKECFG_RISING);
+	case ACPI_ACTIVE_LOW:
+		return (CHVGPIO_PAD_CFG1_INTWAKECFG_FALLING);
+	default:
+		return (CHVGPIO_PAD_CFG1_INTWAKECFG_BOTH);
+	}
+}
+
+/*
+ * Interrupts for drivers whose GpioInt sits in their own _CRS, such as
+ * fusb3(4), rather than in our _AEI. The handler is called from
+ * chvgpio_intr with the lock held, like a filter, so it may do no more
+ * than queue work on a fast taskqueue. Only edge triggered pins are
+ * handed out, a level line would have to stay masked until its consumer
+ * had serviced the device.
+ */
+int
+chvgpio_setup_intr(device_t dev, int pin, int triggering, int polarity,
+    driver_intr_t *handler, void *arg)
+{
+	struct chvgpio_softc *sc;
+	struct chvgpio_line *cl;
+	int error;
+
+	/* The driver's name is "gpio" for gpiobus, so ask newbus */
+	if (device_get_driver(dev) != &chvgpio_driver)
+		return (ENXIO);
+	if (triggering != ACPI_EDGE_SENSITIVE)
+		return (EOPNOTSUPP);
+
+	sc = device_get_softc(dev);
+	if (chvgpio_valid_pin(sc, pin) != 0)
+		return (EINVAL);
+
+	CHVGPIO_LOCK(sc);
+	cl = &sc->sc_lines[chvgpio_pad_line(sc, pin)];
+	if (cl->cl_pin == pin &&
+	    (cl->cl_handler != NULL || cl->cl_event != NULL))
+		error = EBUSY;
+	else
+		error = chvgpio_claim_line(sc, pin,
+			chvgpio_acpi_intcfg(triggering, polarity), &cl);
+	if (error == 0) {
+		cl->cl_handler = handler;
+		cl->cl_arg = arg;
+		chvgpio_update_mask(sc);
+	}
+	CHVGPIO_UNLOCK(sc);
+
+	return (error);
+}
+
+/*
+ * Once this returns the handler will not be called again, the caller
+ * still has to drain whatever it queued.
+ */
+void
+chvgpio_teardown_intr(device_t dev, int pin)
+{
+	struct chvgpio_softc *sc;
+	struct chvgpio_line *cl;
+
+	sc = device_get_softc(dev);
+	if (chvgpio_valid_pin(sc, pin) != 0)
+		return;
+
+	CHVGPIO_LOCK(sc);
+	cl = &sc->sc_lines[chvgpio_pad_line(sc, pin)];
+	if (cl->cl_pin == pin && cl->cl_handler != NULL) {
+		cl->cl_handler = NULL;
+		cl->cl_arg = NULL;
+		chvgpio_release_line(sc, cl);
+		chvgpio_update_mask(sc);
+	}
+	CHVGPIO_UNLOCK(sc);
+}
+
+/*
+ * Find the method firmware wants run for an event on pin. Pins up to 255
+ * may have a dedicated _Exx or _Lxx method, everything else goes through
+ * _EVT with the pin number as argument.
+ */
+static ACPI_HANDLE
+chvgpio_aei_method(struct chvgpio_softc *sc, int pin, int triggering,
+    int *evt)
+{
+	ACPI_HANDLE handle;
+	char name[5];
+
+	*evt = 0;
+	if (pin <= 255) {
+		snprintf(name, sizeof(name), "_%c%02X",
+			triggering == ACPI_EDGE_SENSITIVE ? 'E' : 'L', pin);
+		if (ACPI_SUCCESS(AcpiGetHandle(sc->sc_handle, name, &handle)))
+			return (handle);
+	}
+
+	if (ACPI_SUCCESS(AcpiGetHandle(sc->sc_handle, "_EVT", &handle))) {
+		*evt = 1;
+		return (handle);
+	}
+
+	return (NULL);
+}
+
+/*
+ * Arm each GpioInt listed in _AEI as an interrupt which runs its event
+ * method, pins firmware marks as wake capable are armed as wake sources
+ * too.
+ */
+static ACPI_STATUS
+chvgpio_aei_resource(ACPI_RESOURCE *res, void *context)
+{
+	struct chvgpio_softc *sc;
+	struct chvgpio_line *cl;
+	ACPI_RESOURCE_GPIO *gpio;
+	ACPI_HANDLE method;
+	uint32_t intcfg;
+	int error;
+	int i, pin, evt;
+
+	sc = context;
+
+	if (res->Type != ACPI_RESOURCE_TYPE_GPIO)
+		return (AE_OK);
+
+	gpio = &res->Data.Gpio;
+	if (gpio->ConnectionType != ACPI_RESOURCE_GPIO_TYPE_INT)
+		return (AE_OK);
+
+	intcfg = chvgpio_acpi_intcfg(gpio->Triggering, gpio->Polarity);
+	for (i = 0; i < gpio->PinTableLength; i++) {
+		pin = gpio->PinTable[i];
+		if (chvgpio_valid_pin(sc, pin) != 0) {
+			device_printf(sc->sc_dev,
+				"_AEI references invalid pin %d\n", pin);
+			continue;
+		}
+
+		method = chvgpio_aei_method(sc, pin, gpio->Triggering, &evt);
+		if (method == NULL &&
+		    gpio->WakeCapable != ACPI_WAKE_CAPABLE) {
+			device_printf(sc->sc_dev,
+				"no event method for pin %d\n", pin);
+			continue;
+		}
+
+		CHVGPIO_LOCK(sc);
+		error = chvgpio_claim_line(sc, pin, intcfg, &cl);
+		if (error == 0) {
+			cl->cl_event = method;
+			cl->cl_evt = evt;
+			cl->cl_level =
+				(gpio->Triggering == ACPI_LEVEL_SENSITIVE);
+			if (gpio->WakeCapable == ACPI_WAKE_CAPABLE)
+				cl->cl_wake |= CHVGPIO_WAKE_AEI;
+			chvgpio_update_mask(sc);
+		}
+		CHVGPIO_UNLOCK(sc);
+		if (error)
+			device_printf(sc->sc_dev,
+				"unable to arm event on pin %d: error %d\n",
+				pin, error);
+	}
+
+	return (AE_OK);
+}
+
+static void
+chvgpio_record_latency(struct chvgpio_softc *sc, struct chvgpio_line *cl)
+{
+	uint64_t us;
+	int bucket;
+
+	CHVGPIO_LOCK(sc);
+	us = sbttous(sbinuptime() - cl->cl_ack_time);
+	bucket = flsll(us);
+	if (bucket >= CHVGPIO_LAT_BUCKETS)
+		bucket = CHVGPIO_LAT_BUCKETS - 1;
+	cl->cl_latency[bucket]++;
+	CHVGPIO_UNLOCK(sc);
+}
+
+static void
+chvgpio_storm_rearm(void *arg)
+{
+	struct chvgpio_line *cl;
+	struct chvgpio_softc *sc;
+
+	cl = arg;
+	sc = cl->cl_sc;
+
+	CHVGPIO_LOCK(sc);
+	bus_write_4(sc->sc_mem_res, CHVGPIO_INTERRUPT_STATUS,
+		1 << (cl - sc->sc_lines));
+	cl->cl_throttled = 0;
+	cl->cl_window = sbinuptime();
+	cl->cl_window_count = 0;
+	chvgpio_update_mask(sc);
+	CHVGPIO_UNLOCK(sc);
+}
+
+/*
+ * Count an interrupt against the line's rate for the current second. A line
+ * over the threshold is masked and rearmed from a callout, the backoff
+ * doubles each time the line storms again and is reset once it stays under
+ * the threshold for a whole second.
+ */
+static int
+chvgpio_storm_check(struct chvgpio_softc *sc, struct chvgpio_line *cl,
+    sbintime_t now)
+{
+	CHVGPIO_ASSERT_LOCKED(sc);
+
+	if (now - cl->cl_window >= SBT_1S) {
+		if (cl->cl_window_count <= sc->sc_storm_threshold)
+			cl->cl_backoff = CHVGPIO_STORM_BACKOFF_MIN;
+		cl->cl_window = now;
+		cl->cl_window_count = 0;
+	}
+
+	if (++cl->cl_window_count <= sc->sc_storm_threshold ||
+	    sc->sc_storm_threshold == 0)
+		return (0);
+
+	cl->cl_throttled = 1;
+	cl->cl_storms++;
+	chvgpio_update_mask(sc);
+	callout_reset_sbt(&cl->cl_callout, cl->cl_backoff, 0,
+		chvgpio_storm_rearm, cl, 0);
+	if (cl->cl_backoff < CHVGPIO_STORM_BACKOFF_MAX)
+		cl->cl_backoff *= 2;
+
+	return (1);
+}
+
+/*
+ * Run the event method for a line. Level triggered lines stay masked from
+ * the interrupt until the method has dealt with the source.
+ */
+static void
+chvgpio_event_task(void *arg, int pending)
+{
+	struct chvgpio_line *cl;
+	struct chvgpio_softc *sc;
+	ACPI_OBJECT_LIST args;
+	ACPI_OBJECT obj;
+	int line;
+
+	cl = arg;
+	sc = cl->cl_sc;
+	line = cl - sc->sc_lines;
+
+	chvgpio_record_latency(sc, cl);
+
+	if (cl->cl_evt) {
+		obj.Type = ACPI_TYPE_INTEGER;
+		obj.Integer.Value = cl->cl_pin;
+		args.Count = 1;
+		args.Pointer = &obj;
+		AcpiEvaluateObject(cl->cl_event, NULL, &args, NULL);
+	} else
+		AcpiEvaluateObject(cl->cl_event, NULL, NULL, NULL);
+
+	if (cl->cl_level) {
+		CHVGPIO_LOCK(sc);
+		bus_write_4(sc->sc_mem_res, CHVGPIO_INTERRUPT_STATUS,
+			1 << line);
+		cl->cl_masked = 0;
+		chvgpio_update_mask(sc);
+		CHVGPIO_UNLOCK(sc);
+	}
+}
+
+static int
+chvgpio_sysctl_wake(SYSCTL_HANDLER_ARGS)
+{
+	struct chvgpio_softc *sc;
+	struct sbuf *sb;
+	static const char *triggers[] = {
+		"none", "falling", "rising", "both", "level"
+	};
+	int pins[CHVGPIO_NLINES];
+	uint32_t cfg[CHVGPIO_NLINES];
+	int error;
+	int line;
+
+	sc = (struct chvgpio_softc *)arg1;
+
+	/* Snapshot under the spin lock, the sbuf may sleep when draining */
+	CHVGPIO_LOCK(sc);
+	for (line = 0; line < CHVGPIO_NLINES; line++) {
+		pins[line] = -1;
+		if (!sc->sc_lines[line].cl_wake)
+			continue;
+		pins[line] = sc->sc_lines[line].cl_pin;
+		cfg[line] = chvgpio_read_pad_cfg1(sc, pins[line]);
+	}
+	CHVGPIO_UNLOCK(sc);
+
+	sb = sbuf_new_for_sysctl(NULL, NULL, 128, req);
+	for (line = 0; line < CHVGPIO_NLINES; line++) {
+		if (pins[line] == -1)
+			continue;
+		sbuf_printf(sb, "\npin %d line %d %s%s", pins[line], line,
+			triggers[cfg[line] & CHVGPIO_PAD_CFG1_INTWAKECFG_MASK],
+			(cfg[line] & CHVGPIO_PAD_CFG1_INVRXTX_RXDATA) ?
+			" inverted" : "");
+	}
+	error = sbuf_finish(sb);
+	sbuf_delete(sb);
+
+	return (error);
+}
+
+static int
+chvgpio_sysctl_latency(SYSCTL_HANDLER_ARGS)
+{
+	struct chvgpio_line *cl;
+	struct chvgpio_softc *sc;
+	struct sbuf *sb;
+	uint64_t hist[CHVGPIO_LAT_BUCKETS];
+	int error;
+	int i;
+
+	cl = (struct chvgpio_line *)arg1;
+	sc = cl->cl_sc;
+
+	CHVGPIO_LOCK(sc);
+	memcpy(hist, cl->cl_latency, sizeof(hist));
+	CHVGPIO_UNLOCK(sc);
+
+	sb = sbuf_new_for_sysctl(NULL, NULL, 128, req);
+	for (i = 0; i < CHVGPIO_LAT_BUCKETS; i++) {
+		if (hist[i] == 0)
+			continue;
+		sbuf_printf(sb, "\n<%juus: %ju", (uintmax_t)1 << i,
+			(uintmax_t)hist[i]);
+	}
+	error = sbuf_finish(sb);
+	sbuf_delete(sb);
+
+	return (error);
+}
+
+static void
+chvgpio_sysctl_lines(struct chvgpio_softc *sc, struct sysctl_ctx_list *ctx,
+    struct sysctl_oid *tree)
+{
+	struct chvgpio_line *cl;
+	struct sysctl_oid *node, *lnode;
+	char name[4];
+	int line;
+
+	node = SYSCTL_ADD_NODE(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+		"line", CTLFLAG_RD, NULL, "Interrupt lines");
+
+	for (line = 0; line < CHVGPIO_NLINES; line++) {
+		cl = &sc->sc_lines[line];
+		snprintf(name, sizeof(name), "%d", line);
+		lnode = SYSCTL_ADD_NODE(ctx, SYSCTL_CHILDREN(node), OID_AUTO,
+			name, CTLFLAG_RD, NULL, "Interrupt line");
+
+		SYSCTL_ADD_INT(ctx, SYSCTL_CHILDREN(lnode), OID_AUTO,
+			"pin", CTLFLAG_RD, &cl->cl_pin, 0,
+			"Pad routed to the line, -1 if none");
+		SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(lnode), OID_AUTO,
+			"count", CTLFLAG_RD, &cl->cl_count, 0,
+			"Interrupts taken");
+		SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(lnode), OID_AUTO,
+			"stray", CTLFLAG_RD, &cl->cl_stray, 0,
+			"Interrupts with no consumer for the line");
+		SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(lnode), OID_AUTO,
+			"storms", CTLFLAG_RD, &cl->cl_storms, 0,
+			"Times the line was masked for storming");
+		SYSCTL_ADD_INT(ctx, SYSCTL_CHILDREN(lnode), OID_AUTO,
+			"throttled", CTLFLAG_RD, &cl->cl_throttled, 0,
+			"Line is currently masked for storming");
+		SYSCTL_ADD_PROC(ctx, SYSCTL_CHILDREN(lnode), OID_AUTO,
+			"latency", CTLTYPE_STRING | CTLFLAG_RD, cl, 0,
+			chvgpio_sysctl_latency, "A",
+			"Histogram of ack to handler latency");
+	}
+}
+
 static int
 chvgpio_pin_getname(device_t dev, uint32_t pin, char *name)
 {
@@ -191,9 +805,7 @@ chvgpio_pin_getcaps(device_t dev, uint32_t pin, uint32_t *caps)
 	if (chvgpio_valid_pin(sc, pin) != 0)
 		return (EINVAL);
 
-	*caps = 0;
-	if (chvgpio_valid_pin(sc, pin))
-		*caps = GPIO_PIN_INPUT | GPIO_PIN_OUTPUT;
+	*caps = GPIO_PIN_INPUT | GPIO_PIN_OUTPUT | CHVGPIO_PIN_WAKE;
 
 	return (0);
 }
@@ -202,7 +814,9 @@ static int
 chvgpio_pin_getflags(device_t dev, uint32_t pin, uint32_t *flags)
 {
 	struct chvgpio_softc *sc;
+	struct chvgpio_line *cl;
 	uint32_t val;
+	uint32_t cfg;
 
 	sc = device_get_softc(dev);
 	if (chvgpio_valid_pin(sc, pin) != 0)
@@ -213,16 +827,20 @@ chvgpio_pin_getflags(device_t dev, uint32_t pin, uint32_t *flags)
 	/* Get the current pin state */
 	CHVGPIO_LOCK(sc);
 	val = chvgpio_read_pad_cfg0(sc, pin);
+	cfg = (val & CHVGPIO_PAD_CFG0_GPIOCFG_MASK) >>
+		CHVGPIO_PAD_CFG0_GPIOCFG_SHIFT;
 
-	if (val & CHVGPIO_PAD_CFG0_GPIOCFG_GPIO ||
-		val & CHVGPIO_PAD_CFG0_GPIOCFG_GPO)
+	if (cfg == CHVGPIO_PAD_CFG0_GPIOCFG_GPIO ||
+		cfg == CHVGPIO_PAD_CFG0_GPIOCFG_GPO)
 		*flags |= GPIO_PIN_OUTPUT;
 
-	if (val & CHVGPIO_PAD_CFG0_GPIOCFG_GPIO ||
-		val & CHVGPIO_PAD_CFG0_GPIOCFG_GPI)
+	if (cfg == CHVGPIO_PAD_CFG0_GPIOCFG_GPIO ||
+		cfg == CHVGPIO_PAD_CFG0_GPIOCFG_GPI)
 		*flags |= GPIO_PIN_INPUT;
 
-	val = chvgpio_read_pad_cfg1(sc, pin);
+	cl = &sc->sc_lines[chvgpio_pad_line(sc, pin)];
+	if (cl->cl_pin == (int)pin && cl->cl_wake)
+		*flags |= CHVGPIO_PIN_WAKE;
 
 	CHVGPIO_UNLOCK(sc);
 	return (0);
@@ -233,34 +851,50 @@ chvgpio_pin_setflags(device_t dev, uint32_t pin, uint32_t flags)
 {
 	struct chvgpio_softc *sc;
 	uint32_t val;
-	uint32_t allowed;
+	uint32_t direction;
+	int error;
 
 	sc = device_get_softc(dev);
 	if (chvgpio_valid_pin(sc, pin) != 0)
 		return (EINVAL);
 
-	allowed = GPIO_PIN_INPUT | GPIO_PIN_OUTPUT;
+	direction = GPIO_PIN_INPUT | GPIO_PIN_OUTPUT;
 
 	/*
-	 * Only direction flag allowed
+	 * Only direction and wake flags allowed
 	 */
-	if (flags & ~allowed)
+	if (flags & ~(direction | CHVGPIO_PIN_WAKE))
 		return (EINVAL);
 
 	/*
 	 * Not both directions simultaneously
 	 */
-	if ((flags & allowed) == allowed)
+	if ((flags & direction) == direction)
 		return (EINVAL);
 
-	/* Set the GPIO mode and state */
+	/*
+	 * Claim the wake line first so a pad that cannot be armed is left
+	 * as it was
+	 */
 	CHVGPIO_LOCK(sc);
-	val = chvgpio_read_pad_cfg0(sc, pin);
-	if (flags & GPIO_PIN_INPUT)
-		val = val & CHVGPIO_PAD_CFG0_GPIOCFG_GPI;
-	if (flags & GPIO_PIN_OUTPUT)
-		val = val & CHVGPIO_PAD_CFG0_GPIOCFG_GPO;
-	chvgpio_write_pad_cfg0(sc, pin, val);
+	error = chvgpio_set_wake(sc, pin, 0, (flags & CHVGPIO_PIN_WAKE) != 0);
+	if (error) {
+		CHVGPIO_UNLOCK(sc);
+		return (error);
+	}
+
+	/* Set the GPIO mode and state */
+	if (flags & direction) {
+		val = chvgpio_read_pad_cfg0(sc, pin);
+		val &= ~CHVGPIO_PAD_CFG0_GPIOCFG_MASK;
+		if (flags & GPIO_PIN_INPUT)
+			val |= CHVGPIO_PAD_CFG0_GPIOCFG_GPI <<
+				CHVGPIO_PAD_CFG0_GPIOCFG_SHIFT;
+		if (flags & GPIO_PIN_OUTPUT)
+			val |= CHVGPIO_PAD_CFG0_GPIOCFG_GPO <<
+				CHVGPIO_PAD_CFG0_GPIOCFG_SHIFT;
+		chvgpio_write_pad_cfg0(sc, pin, val);
+	}
 	CHVGPIO_UNLOCK(sc);
 
 	return (0);
@@ -354,6 +988,8 @@ static int
 chvgpio_attach(device_t dev)
 {
 	struct chvgpio_softc *sc;
+	struct sysctl_ctx_list *ctx;
+	struct sysctl_oid *tree;
 	ACPI_STATUS status;
 	int uid;
 	int i;
@@ -363,6 +999,16 @@ chvgpio_attach(device_t dev)
 	sc->sc_dev = dev;
 	sc->sc_handle = acpi_get_handle(dev);
 
+	sc->sc_storm_threshold = CHVGPIO_STORM_THRESHOLD;
+	for (i = 0; i < CHVGPIO_NLINES; i++) {
+		sc->sc_lines[i].cl_sc = sc;
+		sc->sc_lines[i].cl_pin = -1;
+		sc->sc_lines[i].cl_backoff = CHVGPIO_STORM_BACKOFF_MIN;
+		TASK_INIT(&sc->sc_lines[i].cl_task, 0, chvgpio_event_task,
+			&sc->sc_lines[i]);
+		callout_init(&sc->sc_lines[i].cl_callout, 1);
+	}
+
 	status = acpi_GetInteger(sc->sc_handle, "_UID", &uid);
 	if (ACPI_FAILURE(status)) {
 		device_printf(dev, "failed to read _UID\n");
@@ -439,21 +1085,64 @@ chvgpio_attach(device_t dev)
 	/* Mask and ack all interrupts. */
 	//fusb is pin 0x0005 on \_SB.GPO1
 	if (uid == 4)	// 1 (goes 1-4) 2 
-		bus_write_4(sc->sc_mem_res, CHVGPIO_INTERRUPT_MASK, 0x0020);
+		sc->sc_intr_mask = 0x0020;
 	else
-		bus_write_4(sc->sc_mem_res, CHVGPIO_INTERRUPT_MASK, 0);
+		sc->sc_intr_mask = 0;
+	bus_write_4(sc->sc_mem_res, CHVGPIO_INTERRUPT_MASK, sc->sc_intr_mask);
 	bus_write_4(sc->sc_mem_res, CHVGPIO_INTERRUPT_STATUS, 0xffff);
 
+	sc->sc_tq = taskqueue_create("chvgpio", M_WAITOK,
+		taskqueue_thread_enqueue, &sc->sc_tq);
+	taskqueue_start_threads(&sc->sc_tq, 1, PWAIT, "%s event",
+		device_get_nameunit(dev));
+
+	AcpiWalkResources(sc->sc_handle, "_AEI", chvgpio_aei_resource, sc);
+
 	sc->sc_busdev = gpiobus_attach_bus(dev);
 	if (sc->sc_busdev == NULL) {
-		CHVGPIO_LOCK_DESTROY(sc);
-		bus_release_resource(dev, SYS_RES_MEMORY,
-			sc->sc_mem_rid, sc->sc_mem_res);
-		bus_release_resource(dev, SYS_RES_IRQ,
-			sc->sc_irq_rid, sc->sc_irq_res);
+		device_printf(dev, "unable to attach gpiobus\n");
+		/* _AEI may have unmasked lines, detach unwinds the rest */
+		bus_write_4(sc->sc_mem_res, CHVGPIO_INTERRUPT_MASK, 0);
+		chvgpio_detach(dev);
 		return (ENXIO);
 	}
 
+	sc->sc_pad_cfg0 = malloc(sizeof(uint32_t) * sc->sc_ngroups * 15,
+		M_DEVBUF, M_WAITOK | M_ZERO);
+	sc->sc_pad_cfg1 = malloc(sizeof(uint32_t) * sc->sc_ngroups * 15,
+		M_DEVBUF, M_WAITOK | M_ZERO);
+
+	ctx = device_get_sysctl_ctx(dev);
+	tree = device_get_sysctl_tree(dev);
+
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+		"resume_us", CTLFLAG_RD, &sc->sc_resume_us, 0,
+		"Time spent restoring pads on last resume (us)");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+		"resume_max_us", CTLFLAG_RD, &sc->sc_resume_max_us, 0,
+		"Longest time spent restoring pads on resume (us)");
+	SYSCTL_ADD_UINT(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+		"resume_pads", CTLFLAG_RD, &sc->sc_resume_pads, 0,
+		"Pads rewritten on last resume");
+
+	SYSCTL_ADD_PROC(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+		"wake_sources", CTLTYPE_STRING | CTLFLAG_RD, sc, 0,
+		chvgpio_sysctl_wake, "A", "Pads armed to wake the SoC");
+	SYSCTL_ADD_UINT(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+		"wake_status", CTLFLAG_RD, &sc->sc_wake_status, 0,
+		"Wake lines pending on last resume");
+	SYSCTL_ADD_UINT(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+		"wake_count", CTLFLAG_RD, &sc->sc_wake_count, 0,
+		"Resumes caused by a wake line of this bank");
+
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+		"spurious", CTLFLAG_RD, &sc->sc_spurious, 0,
+		"Interrupts with no line pending");
+	SYSCTL_ADD_UINT(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+		"storm_threshold", CTLFLAG_RWTUN, &sc->sc_storm_threshold, 0,
+		"Interrupts per second before a line is masked, 0 to disable");
+	chvgpio_sysctl_lines(sc, ctx, tree);
+
 	return (0);
 }
 
@@ -461,21 +1150,56 @@ static void
 chvgpio_intr(void *arg)
 {
 	struct chvgpio_softc *sc = arg;
-	uint32_t reg;
+	struct chvgpio_line *cl;
+	sbintime_t now;
+	uint32_t reg, events, storms;
 	int line;
 
+	events = storms = 0;
+	now = sbinuptime();
+
+	CHVGPIO_LOCK(sc);
 	reg = bus_read_4(sc->sc_mem_res, CHVGPIO_INTERRUPT_STATUS);
+	if (reg == 0)
+		sc->sc_spurious++;
 	for (line = 0; line < 16; line++) {
 		if ((reg & (1 << line)) == 0)
 			continue;
+		cl = &sc->sc_lines[line];
+		cl->cl_count++;
+		if (cl->cl_pin == -1 && (sc->sc_intr_mask & (1 << line)) == 0)
+			cl->cl_stray++;
+		if (chvgpio_storm_check(sc, cl, now))
+			storms |= 1 << line;
+		if (cl->cl_handler != NULL)
+			cl->cl_handler(cl->cl_arg);
+		if (cl->cl_event != NULL) {
+			if (cl->cl_level) {
+				cl->cl_masked = 1;
+				chvgpio_update_mask(sc);
+			}
+			cl->cl_ack_time = now;
+			events |= 1 << line;
+		}
 		bus_write_4(sc->sc_mem_res, CHVGPIO_INTERRUPT_STATUS, 1 << line);
 	}
+	CHVGPIO_UNLOCK(sc);
+
+	for (line = 0; line < 16; line++) {
+		if (events & (1 << line))
+			taskqueue_enqueue(sc->sc_tq, &sc->sc_lines[line].cl_task);
+		if (storms & (1 << line))
+			device_printf(sc->sc_dev,
+				"interrupt storm on line %d, masked\n", line);
+	}
 }
 
 static int
 chvgpio_detach(device_t dev)
 {
 	struct chvgpio_softc *sc;
+	int i;
+
 	sc = device_get_softc(dev);
 
 	if (sc->sc_busdev)
@@ -483,20 +1207,137 @@ chvgpio_detach(device_t dev)
 
 	if (sc->intr_handle != NULL)
 	    bus_teardown_intr(sc->sc_dev, sc->sc_irq_res, sc->intr_handle);
+	for (i = 0; i < CHVGPIO_NLINES; i++)
+		callout_drain(&sc->sc_lines[i].cl_callout);
+	if (sc->sc_tq != NULL) {
+		for (i = 0; i < CHVGPIO_NLINES; i++)
+			taskqueue_drain(sc->sc_tq, &sc->sc_lines[i].cl_task);
+		taskqueue_free(sc->sc_tq);
+	}
 	if (sc->sc_irq_res != NULL)
 		bus_release_resource(dev, SYS_RES_IRQ, sc->sc_irq_rid, sc->sc_irq_res);
 	if (sc->sc_mem_res != NULL)
 		bus_release_resource(dev, SYS_RES_MEMORY, sc->sc_mem_rid, sc->sc_mem_res);
 
+	if (sc->sc_pad_cfg0 != NULL)
+		free(sc->sc_pad_cfg0, M_DEVBUF);
+	if (sc->sc_pad_cfg1 != NULL)
+		free(sc->sc_pad_cfg1, M_DEVBUF);
+
 	CHVGPIO_LOCK_DESTROY(sc);
 
     return (0);
 }
 
+/*
+ * Save the configuration of every pad in the community. Firmware is free to
+ * clobber it while we are in S3 or S0ix, the receive state is masked out as
+ * it is not configuration. Only lines armed for wake stay unmasked while
+ * asleep.
+ */
+static int
+chvgpio_suspend(device_t dev)
+{
+	struct chvgpio_softc *sc;
+	uint32_t wake;
+	int error;
+	int group, pin;
+
+	sc = device_get_softc(dev);
+
+	error = bus_generic_suspend(dev);
+	if (error)
+		return (error);
+
+	CHVGPIO_LOCK(sc);
+	for (group = 0; group < sc->sc_ngroups; group++) {
+		for (pin = group * 15; pin < group * 15 + sc->sc_pins[group];
+		    pin++) {
+			sc->sc_pad_cfg0[pin] = chvgpio_read_pad_cfg0(sc, pin) &
+				~CHVGPIO_PAD_CFG0_GPIORXSTATE;
+			sc->sc_pad_cfg1[pin] = chvgpio_read_pad_cfg1(sc, pin);
+		}
+	}
+	wake = chvgpio_wake_lines(sc);
+	bus_write_4(sc->sc_mem_res, CHVGPIO_INTERRUPT_STATUS, wake);
+	bus_write_4(sc->sc_mem_res, CHVGPIO_INTERRUPT_MASK, wake);
+	CHVGPIO_UNLOCK(sc);
+
+	/* Communities with a _PRW get their wake GPE armed as well */
+	acpi_wake_set_enable(dev, wake != 0);
+
+	return (0);
+}
+
+/*
+ * Restore the state saved in chvgpio_suspend. Most pads survive sleep
+ * untouched, so only those that differ from the shadow are written back.
+ * Locked pads are owned by firmware and are left alone.
+ */
+static int
+chvgpio_resume(device_t dev)
+{
+	struct chvgpio_softc *sc;
+	sbintime_t start;
+	uint32_t val0, val1;
+	u_int npads;
+	int group, pin;
+
+	sc = device_get_softc(dev);
+	start = sbinuptime();
+	npads = 0;
+
+	CHVGPIO_LOCK(sc);
+
+	/* Note which wake source brought us back */
+	sc->sc_wake_status = bus_read_4(sc->sc_mem_res,
+		CHVGPIO_INTERRUPT_STATUS) & chvgpio_wake_lines(sc);
+	if (sc->sc_wake_status != 0)
+		sc->sc_wake_count++;
+
+	/* Keep lines quiet while the pads are in flux */
+	bus_write_4(sc->sc_mem_res, CHVGPIO_INTERRUPT_MASK, 0);
+
+	for (group = 0; group < sc->sc_ngroups; group++) {
+		for (pin = group * 15; pin < group * 15 + sc->sc_pins[group];
+		    pin++) {
+			val1 = chvgpio_read_pad_cfg1(sc, pin);
+			if (val1 & CHVGPIO_PAD_CFG1_CFGLOCK)
+				continue;
+			val0 = chvgpio_read_pad_cfg0(sc, pin) &
+				~CHVGPIO_PAD_CFG0_GPIORXSTATE;
+
+			if (val0 == sc->sc_pad_cfg0[pin] &&
+			    val1 == sc->sc_pad_cfg1[pin])
+				continue;
+
+			if (val0 != sc->sc_pad_cfg0[pin])
+				chvgpio_write_pad_cfg0(sc, pin, sc->sc_pad_cfg0[pin]);
+			if (val1 != sc->sc_pad_cfg1[pin])
+				chvgpio_write_pad_cfg1(sc, pin, sc->sc_pad_cfg1[pin]);
+			npads++;
+		}
+	}
+
+	bus_write_4(sc->sc_mem_res, CHVGPIO_INTERRUPT_STATUS, 0xffff);
+	bus_write_4(sc->sc_mem_res, CHVGPIO_INTERRUPT_MASK,
+		chvgpio_active_lines(sc));
+	CHVGPIO_UNLOCK(sc);
+
+	sc->sc_resume_pads = npads;
+	sc->sc_resume_us = sbttous(sbinuptime() - start);
+	if (sc->sc_resume_us > sc->sc_resume_max_us)
+		sc->sc_resume_max_us = sc->sc_resume_us;
+
+	return (bus_generic_resume(dev));
+}
+
 static device_method_t chvgpio_methods[] = {
 	DEVMETHOD(device_probe,     	chvgpio_probe),
 	DEVMETHOD(device_attach,    	chvgpio_attach),
 	DEVMETHOD(device_detach,    	chvgpio_detach),
+	DEVMETHOD(device_suspend,   	chvgpio_suspend),
+	DEVMETHOD(device_resume,    	chvgpio_resume),
 
 	/* GPIO protocol */
 	DEVMETHOD(gpio_get_bus, 	chvgpio_get_bus),
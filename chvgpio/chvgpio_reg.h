@@ -51,6 +51,8 @@
 #define CHVGPIO_PAD_CFG0			0x4400
 #define CHVGPIO_PAD_CFG1			0x4404
 
+#define CHVGPIO_NLINES				16
+
 #define CHVGPIO_PAD_CFG0_GPIORXSTATE		0x00000001
 #define CHVGPIO_PAD_CFG0_GPIOTXSTATE		0x00000002
 #define CHVGPIO_PAD_CFG0_INTSEL_MASK		0xf0000000
@@ -70,6 +72,10 @@
 #define CHVGPIO_PAD_CFG1_INTWAKECFG_LEVEL	0x00000004
 #define CHVGPIO_PAD_CFG1_INVRXTX_MASK		0x000000f0
 #define CHVGPIO_PAD_CFG1_INVRXTX_RXDATA		0x00000040
+#define CHVGPIO_PAD_CFG1_CFGLOCK		0x80000000
+
+/* Driver private pin flag, the pad may wake the SoC from S3/S0ix */
+#define CHVGPIO_PIN_WAKE			0x80000000
 
 /*
  * The pads for the pins are arranged in groups of maximal 15 pins.
@@ -28,15 +28,20 @@
 #include <sys/param.h>
 #include <sys/systm.h>
 #include <sys/bus.h>
+#include <sys/callout.h>
 #include <sys/gpio.h>
 #include <sys/clock.h>
 #include <sys/kernel.h>
+#include <sys/lock.h>
 #include <sys/module.h>
+#include <sys/mutex.h>
 #include <sys/endian.h>
 #include <sys/rman.h>
+#include <sys/sysctl.h>
 #include <sys/types.h>
 #include <sys/malloc.h>
 
+#include <machine/bus.h>
 #include <machine/resource.h>
 
 #include <contrib/dev/acpica/include/acpi.h>
@@ -44,51 +49,139 @@
 
 #include <dev/acpica/acpivar.h>
 
+#include <dev/pwm/pwmbus.h>
+
 #include "opt_platform.h"
 #include "opt_acpi.h"
 
+#include "pwmbus_if.h"
+
 #define CHVPWM_CTRL	0
-#define CHVPWM_RESET	0x804
-#define CHVPWM_GENERAL	0x808
+#define CHVPWM_PRIV	0x800	/* Bay Trail and Cherry View */
+#define CHVPWM_RESET	0x04	/* in the private block */
+#define CHVPWM_GENERAL	0x08
+
+/*
+ * The output frequency is the input clock times the base unit over
+ * 2^base bits, the base unit being a fraction. The output is high for
+ * (255 - on time divisor) / 255 of each period. Neither field takes
+ * effect until UPDATE is set, the controller clears it once the new
+ * values are latched at the end of the running period.
+ */
+#define CHVPWM_CTRL_ENABLE	(1U << 31)
+#define CHVPWM_CTRL_UPDATE	(1U << 30)
+#define CHVPWM_CTRL_BASE_SHIFT	8		/* 23:8, 29:8 on Broxton */
+#define CHVPWM_CTRL_DIV_MASK	0xff		/* 7:0 */
+
+/* LPSS private registers, the block is held in reset until both are set */
+#define CHVPWM_RESET_FUNC	(1 << 0)
+#define CHVPWM_RESET_APB	(1 << 1)
+#define CHVPWM_RESET_RELEASE	(CHVPWM_RESET_FUNC | CHVPWM_RESET_APB)
 
-#define CHVPWM_CTRL_ENABLE	31
-#define CHVPWM_CTRL_UPDATE	30
-#define CHVPWM_CTRL_FREQ	((x) << 7)	//23:8 base unit register. 8 integer bits 8 fraction bits. used to determine PWM output frequency
+#define CHVPWM_CLK_HZ		19200000	/* Cherry View and Broxton */
+#define CHVPWM_DIV_MAX		255
+#define CHVPWM_PERIOD_LIMIT	4000000		/* ns, past 16 bit's slowest */
+#define CHVPWM_UPDATE_US	10000		/* two periods at the slowest */
 
-#define CHVPWM_CTRL_DIV		0			//7:0
+/* Each controller drives a single output */
+#define CHVPWM_NCHANNELS	1
+
+/*
+ * Brightness levels 0 - 100 map through a gamma 2.2 curve to the on time,
+ * ramps step between levels in 1/256ths.
+ */
+#define CHVPWM_LEVEL_MAX	100
+#define CHVPWM_LEVEL_SHIFT	8
+#define CHVPWM_RAMP_MS		200
 
 /*
  *     Macros for driver mutex locking
  */
-#define CHVPWM_LOCK(_sc)               mtx_lock_spin(&(_sc)->sc_mtx)
-#define CHVPWM_UNLOCK(_sc)             mtx_unlock_spin(&(_sc)->sc_mtx)
+#define CHVPWM_LOCK(_sc)               mtx_lock(&(_sc)->sc_mtx)
+#define CHVPWM_UNLOCK(_sc)             mtx_unlock(&(_sc)->sc_mtx)
 #define CHVPWM_LOCK_INIT(_sc) \
 	mtx_init(&_sc->sc_mtx, device_get_nameunit((_sc)->sc_dev), \
-	"chvpwm", MTX_SPIN)                      
+	"chvpwm", MTX_DEF)
 #define CHVPWM_LOCK_DESTROY(_sc)       mtx_destroy(&(_sc)->sc_mtx)
 #define CHVPWM_ASSERT_LOCKED(_sc)      mtx_assert(&(_sc)->sc_mtx, MA_OWNED)
 #define CHVPWM_ASSERT_UNLOCKED(_sc) 	mtx_assert(&(_sc)->sc_mtx, MA_NOTOWNED)
 
+/*
+ * The LPSS PWM differs between SoCs in its input clock, the width of the
+ * base unit and whether the LPSS private registers follow it. Broxton's
+ * controller has four outputs 0x400 apart and no private block of its
+ * own, only the first output is driven.
+ */
+struct chvpwm_info {
+	char		*ci_hid;
+	const char	*ci_desc;
+	u_int		ci_clk_hz;
+	u_int		ci_base_bits;
+	bus_size_t	ci_priv;	/* private registers, 0 if none */
+};
+
+static const struct chvpwm_info chvpwm_infos[] = {
+	{ "80860F09", "Intel Bay Trail PWM", 25000000, 16, CHVPWM_PRIV },
+	{ "80862288", "Intel Cherry View PWM", CHVPWM_CLK_HZ, 16, CHVPWM_PRIV },
+	{ "80862289", "Intel Cherry View PWM", CHVPWM_CLK_HZ, 16, CHVPWM_PRIV },
+	{ "80865AC8", "Intel Broxton PWM", CHVPWM_CLK_HZ, 22, 0 },
+};
+
 struct chvpwm_softc {
 	device_t 	sc_dev;
 	device_t 	sc_busdev;
 	struct mtx 	sc_mtx;
 
 	ACPI_HANDLE	sc_handle;
+	const struct chvpwm_info *sc_info;
+	uint32_t	sc_base_mask;	/* in CTRL */
+	u_int		sc_period_max;	/* ns, base unit 1 */
 
 	int		sc_mem_rid;
 	struct resource *sc_mem_res;
 
-	struct sysctl_oid *sc_clkdiv_oid;
-
-	uint32_t	sc_pwm_period;
-	uint32_t	sc_pwm_dutyA;
-	uint32_t	sc_pwm_dutyB;
+	uint32_t	sc_ctrl;	/* latest settings, without UPDATE */
+	u_int		sc_period;	/* ns, as programmed */
+	u_int		sc_duty;
+
+	/*
+	 * One update is latched at a time. Settings made while it is in
+	 * flight wait in sc_ctrl for the flush callout, which holds sc_mtx,
+	 * the last of them is written.
+	 */
+	struct callout	sc_flush;
+	bool		sc_inflight;
+	bool		sc_pending;
+	u_int		sc_out_period;	/* last sent to the output */
+	sbintime_t	sc_update_at;	/* UPDATE written */
+	sbintime_t	sc_latch_at;	/* expected latched by */
+
+	uint64_t	sc_updates;
+	uint64_t	sc_updates_deferred;
+	uint64_t	sc_updates_merged;
+	uint64_t	sc_update_timeouts;
+
+	/* Brightness ramp, the callout holds sc_mtx */
+	struct callout	sc_ramp;
+	u_int		sc_level;	/* target brightness */
+	u_int		sc_ramp_ms;
+	u_int		sc_ramp_from;	/* 1/256th levels */
+	u_int		sc_ramp_to;
+	sbintime_t	sc_ramp_start;
+	sbintime_t	sc_ramp_len;
+	uint64_t	sc_ramp_steps;
+
+	/* Saved over suspend */
+	bool		sc_suspended;
+	uint32_t	sc_reset;
+	uint32_t	sc_general;
 };
 
 static int chvpwm_probe(device_t);
 static int chvpwm_attach(device_t);
 static int chvpwm_detach(device_t);
+static int chvpwm_suspend(device_t);
+static int chvpwm_resume(device_t);
 
 static inline int
 chvpwm_read_ctrl(struct chvpwm_softc *sc)
@@ -101,127 +194,744 @@ chvpwm_write_ctrl(struct chvpwm_softc *sc, uint32_t val)
 {
 	bus_write_4(sc->sc_mem_res, CHVPWM_CTRL, val);
 }
-#if 0
+
 static inline int
 chvpwm_read_reset(struct chvpwm_softc *sc)
 {
-	return bus_read_4(sc->sc_mem_res, CHVPWM_CTRL_RESET);
+	return bus_read_4(sc->sc_mem_res, sc->sc_info->ci_priv + CHVPWM_RESET);
 }
 
 static inline void
 chvpwm_write_reset(struct chvpwm_softc *sc, uint32_t val)
 {
-	bus_write_4(sc->sc_mem_res, CHVPWM_CTRL_RESET, val);
+	bus_write_4(sc->sc_mem_res, sc->sc_info->ci_priv + CHVPWM_RESET, val);
 }
 
 static inline int
 chvpwm_read_general(struct chvpwm_softc *sc)
 {
-	return bus_read_4(sc->sc_mem_res, CHVPWM_CTRL_GENERAL);
+	return bus_read_4(sc->sc_mem_res,
+		sc->sc_info->ci_priv + CHVPWM_GENERAL);
 }
 
 static inline void
 chvpwm_write_general(struct chvpwm_softc *sc, uint32_t val)
 {
-	bus_write_4(sc->sc_mem_res, CHVPWM_CTRL_GENERAL, val);
+	bus_write_4(sc->sc_mem_res, sc->sc_info->ci_priv + CHVPWM_GENERAL,
+		val);
+}
+
+/*
+ * Base unit for a period in ns, 2^bits * 10^9 / (period * clock) rounded
+ * to nearest. Both products fit in 64 bits for any u_int period.
+ */
+static uint32_t
+chvpwm_base_unit(struct chvpwm_softc *sc, u_int period)
+{
+	uint64_t num, den;
+
+	num = (uint64_t)1000000000 << sc->sc_info->ci_base_bits;
+	den = (uint64_t)period * sc->sc_info->ci_clk_hz;
+	return ((num + den / 2) / den);
+}
+
+/* The period in ns a base unit gives, past UINT_MAX is UINT_MAX */
+static u_int
+chvpwm_base_period(struct chvpwm_softc *sc, uint32_t base)
+{
+	uint64_t num, den;
+
+	if (base == 0)
+		return (0);
+	num = (uint64_t)1000000000 << sc->sc_info->ci_base_bits;
+	den = (uint64_t)base * sc->sc_info->ci_clk_hz;
+	return (MIN((num + den / 2) / den, UINT_MAX));
+}
+
+/* On time divisor for duty ns of period ns, and back */
+static uint32_t
+chvpwm_on_time_div(u_int period, u_int duty)
+{
+	uint64_t on;
+
+	on = ((uint64_t)duty * CHVPWM_DIV_MAX + period / 2) / period;
+	return (CHVPWM_DIV_MAX - on);
+}
+
+static u_int
+chvpwm_div_duty(u_int period, uint32_t div)
+{
+	return (((uint64_t)period * (CHVPWM_DIV_MAX - div) +
+		CHVPWM_DIV_MAX / 2) / CHVPWM_DIV_MAX);
+}
+
+/* On time as a fraction of 2^16 for each brightness level, gamma 2.2 */
+static const uint16_t chvpwm_gamma[CHVPWM_LEVEL_MAX + 1] = {
+	    0,     3,    12,    29,    55,    90,   134,   189,
+	  253,   328,   413,   510,   618,   736,   867,  1009,
+	 1163,  1329,  1507,  1697,  1900,  2115,  2343,  2584,
+	 2838,  3104,  3384,  3677,  3983,  4303,  4636,  4983,
+	 5343,  5717,  6106,  6508,  6924,  7354,  7798,  8257,
+	 8730,  9217,  9719, 10235, 10766, 11312, 11872, 12448,
+	13038, 13643, 14263, 14898, 15548, 16214, 16894, 17590,
+	18302, 19028, 19770, 20528, 21301, 22090, 22895, 23715,
+	24551, 25403, 26271, 27154, 28054, 28970, 29901, 30849,
+	31813, 32793, 33790, 34802, 35831, 36877, 37939, 39017,
+	40112, 41223, 42351, 43496, 44657, 45835, 47029, 48241,
+	49469, 50714, 51976, 53255, 54551, 55864, 57195, 58542,
+	59906, 61287, 62686, 64102, 65535,
+};
+
+/* The on time for a level in 1/256ths, between table entries linearly */
+static u_int
+chvpwm_level_frac(u_int level)
+{
+	u_int i, f;
+
+	i = level >> CHVPWM_LEVEL_SHIFT;
+	f = level & ((1 << CHVPWM_LEVEL_SHIFT) - 1);
+	if (i >= CHVPWM_LEVEL_MAX)
+		return (chvpwm_gamma[CHVPWM_LEVEL_MAX]);
+	return (chvpwm_gamma[i] + (((chvpwm_gamma[i + 1] - chvpwm_gamma[i]) *
+		f) >> CHVPWM_LEVEL_SHIFT));
+}
+
+static uint32_t
+chvpwm_level_div(u_int level)
+{
+	return (CHVPWM_DIV_MAX - ((chvpwm_level_frac(level) * CHVPWM_DIV_MAX +
+		(1 << 15)) >> 16));
+}
+
+/* The lowest level, in 1/256ths, giving at least the current duty */
+static u_int
+chvpwm_duty_level(struct chvpwm_softc *sc)
+{
+	u_int frac, lo, hi, mid;
+
+	if (sc->sc_period == 0)
+		return (0);
+	frac = MIN(((uint64_t)sc->sc_duty << 16) / sc->sc_period,
+		chvpwm_gamma[CHVPWM_LEVEL_MAX]);
+	lo = 0;
+	hi = CHVPWM_LEVEL_MAX << CHVPWM_LEVEL_SHIFT;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (chvpwm_level_frac(mid) < frac)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return (lo);
+}
+
+/* New settings latch at the end of the period running when UPDATE is set */
+static void
+chvpwm_update(struct chvpwm_softc *sc)
+{
+	CHVPWM_ASSERT_LOCKED(sc);
+
+	chvpwm_write_ctrl(sc, sc->sc_ctrl | CHVPWM_CTRL_UPDATE);
+	sc->sc_updates++;
+	sc->sc_inflight = true;
+	sc->sc_update_at = sbinuptime();
+	sc->sc_latch_at = sc->sc_update_at +
+		nstosbt(MAX(sc->sc_out_period, sc->sc_period));
+	sc->sc_out_period = sc->sc_period;
+}
+
+static void
+chvpwm_flush(void *arg)
+{
+	struct chvpwm_softc *sc;
+	sbintime_t now;
+
+	sc = arg;
+	CHVPWM_ASSERT_LOCKED(sc);
+
+	now = sbinuptime();
+	if (chvpwm_read_ctrl(sc) & CHVPWM_CTRL_UPDATE) {
+		if (now - sc->sc_update_at < ustosbt(CHVPWM_UPDATE_US)) {
+			callout_reset_sbt(&sc->sc_flush, nstosbt(sc->sc_period),
+				0, chvpwm_flush, sc, 0);
+			return;
+		}
+		/* Write it again rather than hold the settings back */
+		sc->sc_update_timeouts++;
+		device_printf(sc->sc_dev, "update not latched, CTRL %#x\n",
+			chvpwm_read_ctrl(sc));
+	}
+	sc->sc_pending = false;
+	chvpwm_update(sc);
+}
+
+/*
+ * Write CTRL as a whole, dropping anything waiting for the flush callout.
+ * With the output disabled the values are only stored, enabling sends them
+ * out through UPDATE like any other change, nothing waits for the latch.
+ */
+static void
+chvpwm_program(struct chvpwm_softc *sc, uint32_t ctrl)
+{
+	CHVPWM_ASSERT_LOCKED(sc);
+
+	callout_stop(&sc->sc_flush);
+	sc->sc_pending = false;
+	sc->sc_inflight = false;
+
+	sc->sc_ctrl = ctrl;
+	sc->sc_out_period = sc->sc_period;
+	if (sc->sc_suspended)
+		return;
+	chvpwm_write_ctrl(sc, ctrl);
+	if (ctrl & CHVPWM_CTRL_ENABLE)
+		chvpwm_update(sc);
+}
+
+/*
+ * Queue new CTRL settings. They are written straight away unless an update
+ * is still in flight, then the flush callout writes whatever is latest
+ * once it has latched: at most one CTRL write a period, last writer wins.
+ */
+static void
+chvpwm_submit(struct chvpwm_softc *sc, uint32_t ctrl)
+{
+	sbintime_t now;
+
+	CHVPWM_ASSERT_LOCKED(sc);
+
+	sc->sc_ctrl = ctrl;
+	if (sc->sc_suspended)
+		return;
+	if ((ctrl & CHVPWM_CTRL_ENABLE) == 0) {
+		chvpwm_write_ctrl(sc, ctrl);
+		return;
+	}
+	if (sc->sc_pending) {
+		sc->sc_updates_merged++;
+		return;
+	}
+
+	now = sbinuptime();
+	if (sc->sc_inflight && (now < sc->sc_latch_at ||
+	    (chvpwm_read_ctrl(sc) & CHVPWM_CTRL_UPDATE))) {
+		sc->sc_pending = true;
+		sc->sc_updates_deferred++;
+		callout_reset_sbt(&sc->sc_flush, MAX(sc->sc_latch_at - now, 0),
+			0, chvpwm_flush, sc, 0);
+		return;
+	}
+	chvpwm_update(sc);
+}
+
+static int
+chvpwm_config(struct chvpwm_softc *sc, u_int period, u_int duty)
+{
+	uint32_t base, div, ctrl;
+
+	CHVPWM_ASSERT_LOCKED(sc);
+
+	/* Whoever sets the duty directly wins over a ramp */
+	callout_stop(&sc->sc_ramp);
+
+	if (period == 0 || period > sc->sc_period_max || duty > period)
+		return (EINVAL);
+	base = chvpwm_base_unit(sc, period);
+	if (base == 0 || base > sc->sc_base_mask >> CHVPWM_CTRL_BASE_SHIFT)
+		return (EINVAL);
+	div = chvpwm_on_time_div(period, duty);
+
+	ctrl = sc->sc_ctrl & ~(sc->sc_base_mask | CHVPWM_CTRL_DIV_MASK);
+	ctrl |= (base << CHVPWM_CTRL_BASE_SHIFT) | div;
+	sc->sc_period = chvpwm_base_period(sc, base);
+	sc->sc_duty = chvpwm_div_duty(sc->sc_period, div);
+	sc->sc_level = (chvpwm_duty_level(sc) +
+		(1 << (CHVPWM_LEVEL_SHIFT - 1))) >> CHVPWM_LEVEL_SHIFT;
+	chvpwm_submit(sc, ctrl);
+	return (0);
+}
+
+static int
+chvpwm_enable(struct chvpwm_softc *sc, bool enable)
+{
+	CHVPWM_ASSERT_LOCKED(sc);
+
+	if (enable == ((sc->sc_ctrl & CHVPWM_CTRL_ENABLE) != 0))
+		return (0);
+	callout_stop(&sc->sc_ramp);
+	if (!enable) {
+		chvpwm_program(sc, sc->sc_ctrl & ~CHVPWM_CTRL_ENABLE);
+		return (0);
+	}
+	if (sc->sc_period == 0)
+		return (EINVAL);
+	chvpwm_program(sc, sc->sc_ctrl | CHVPWM_CTRL_ENABLE);
+	return (0);
+}
+
+/*
+ * Ramps are stepped no faster than once a PWM period, steps made while
+ * one is still latching are merged by chvpwm_submit.
+ */
+static sbintime_t
+chvpwm_ramp_tick(struct chvpwm_softc *sc)
+{
+	return (MAX(nstosbt(sc->sc_period), tick_sbt));
+}
+
+static void
+chvpwm_ramp_step(void *arg)
+{
+	struct chvpwm_softc *sc;
+	sbintime_t elapsed;
+	uint32_t div;
+	u_int level;
+
+	sc = arg;
+	CHVPWM_ASSERT_LOCKED(sc);
+
+	elapsed = sbinuptime() - sc->sc_ramp_start;
+	if (elapsed >= sc->sc_ramp_len)
+		level = sc->sc_ramp_to;
+	else
+		level = sc->sc_ramp_from + ((int64_t)sc->sc_ramp_to -
+			sc->sc_ramp_from) * elapsed / sc->sc_ramp_len;
+
+	div = chvpwm_level_div(level);
+	if (div != (sc->sc_ctrl & CHVPWM_CTRL_DIV_MASK)) {
+		sc->sc_duty = chvpwm_div_duty(sc->sc_period, div);
+		sc->sc_ramp_steps++;
+		chvpwm_submit(sc, (sc->sc_ctrl & ~CHVPWM_CTRL_DIV_MASK) | div);
+	}
+
+	if (level != sc->sc_ramp_to)
+		callout_reset_sbt(&sc->sc_ramp, chvpwm_ramp_tick(sc), 0,
+			chvpwm_ramp_step, sc, 0);
+}
+
+/*
+ * Move to a brightness level over sc_ramp_ms, starting from wherever the
+ * output is now. With the output off or no ramp time it is set at once.
+ */
+static int
+chvpwm_set_level(struct chvpwm_softc *sc, u_int level)
+{
+	int error;
+
+	CHVPWM_ASSERT_LOCKED(sc);
+
+	if (level > CHVPWM_LEVEL_MAX || sc->sc_period == 0)
+		return (EINVAL);
+
+	if (sc->sc_ramp_ms == 0 || sc->sc_suspended ||
+	    (sc->sc_ctrl & CHVPWM_CTRL_ENABLE) == 0) {
+		error = chvpwm_config(sc, sc->sc_period,
+			((uint64_t)sc->sc_period * chvpwm_level_frac(level <<
+			CHVPWM_LEVEL_SHIFT)) >> 16);
+		if (error == 0)
+			sc->sc_level = level;
+		return (error);
+	}
+
+	sc->sc_ramp_from = chvpwm_duty_level(sc);
+	sc->sc_ramp_to = level << CHVPWM_LEVEL_SHIFT;
+	sc->sc_ramp_start = sbinuptime();
+	sc->sc_ramp_len = mstosbt(sc->sc_ramp_ms);
+	sc->sc_level = level;
+	chvpwm_ramp_step(sc);
+	return (0);
+}
+
+/* pwmbus(9) methods, the single channel is 0 */
+static int
+chvpwm_channel_count(device_t dev, u_int *nchannel)
+{
+	*nchannel = CHVPWM_NCHANNELS;
+	return (0);
+}
+
+static int
+chvpwm_channel_config(device_t dev, u_int channel, u_int period, u_int duty)
+{
+	struct chvpwm_softc *sc;
+	int error;
+
+	if (channel >= CHVPWM_NCHANNELS)
+		return (EINVAL);
+	sc = device_get_softc(dev);
+
+	CHVPWM_LOCK(sc);
+	error = chvpwm_config(sc, period, duty);
+	CHVPWM_UNLOCK(sc);
+
+	return (error);
 }
-#endif
 
 static int
-chvpwm_sysctl_freq(SYSCTL_HANDLER_ARGS)
+chvpwm_channel_get_config(device_t dev, u_int channel, u_int *period,
+    u_int *duty)
 {
-     int error, freq;
-     struct chvpwm_softc *sc;
-//     uint32_t reg;
+	struct chvpwm_softc *sc;
+
+	if (channel >= CHVPWM_NCHANNELS)
+		return (EINVAL);
+	sc = device_get_softc(dev);
+
+	CHVPWM_LOCK(sc);
+	*period = sc->sc_period;
+	*duty = sc->sc_duty;
+	CHVPWM_UNLOCK(sc);
+
+	return (0);
+}
+
+static int
+chvpwm_channel_enable(device_t dev, u_int channel, bool enable)
+{
+	struct chvpwm_softc *sc;
+	int error;
+
+	if (channel >= CHVPWM_NCHANNELS)
+		return (EINVAL);
+	sc = device_get_softc(dev);
+
+	CHVPWM_LOCK(sc);
+	error = chvpwm_enable(sc, enable);
+	CHVPWM_UNLOCK(sc);
+
+	return (error);
+}
+
+static int
+chvpwm_channel_is_enabled(device_t dev, u_int channel, bool *enabled)
+{
+	struct chvpwm_softc *sc;
+
+	if (channel >= CHVPWM_NCHANNELS)
+		return (EINVAL);
+	sc = device_get_softc(dev);
+
+	CHVPWM_LOCK(sc);
+	*enabled = (sc->sc_ctrl & CHVPWM_CTRL_ENABLE) != 0;
+	CHVPWM_UNLOCK(sc);
 
-     sc = (struct chvpwm_softc *)arg1;
+	return (0);
+}
 
-     error = sysctl_handle_int(oidp, &freq, sizeof(freq), req);
-     if (error != 0 || req->newptr == NULL)
-         return (error);
+/* Selectors for chvpwm_sysctl */
+#define CHVPWM_SYSCTL_FREQ	0
+#define CHVPWM_SYSCTL_PERIOD	1
+#define CHVPWM_SYSCTL_DUTY	2
+#define CHVPWM_SYSCTL_ENABLE	3
+#define CHVPWM_SYSCTL_BRIGHTNESS 4
 
-	device_printf(sc->sc_dev, "frequency %d Hz requested", freq);
+static int
+chvpwm_sysctl(SYSCTL_HANDLER_ARGS)
+{
+	struct chvpwm_softc *sc;
+	u_int period, duty;
+	int error, val;
+
+	sc = (struct chvpwm_softc *)arg1;
+
+	CHVPWM_LOCK(sc);
+	switch (arg2) {
+	case CHVPWM_SYSCTL_FREQ:
+		val = sc->sc_period == 0 ? 0 :
+			(1000000000 + sc->sc_period / 2) / sc->sc_period;
+		break;
+	case CHVPWM_SYSCTL_PERIOD:
+		val = sc->sc_period;
+		break;
+	case CHVPWM_SYSCTL_DUTY:
+		val = sc->sc_duty;
+		break;
+	case CHVPWM_SYSCTL_BRIGHTNESS:
+		val = sc->sc_level;
+		break;
+	default:
+		val = (sc->sc_ctrl & CHVPWM_CTRL_ENABLE) != 0;
+		break;
+	}
+	CHVPWM_UNLOCK(sc);
+
+	error = sysctl_handle_int(oidp, &val, 0, req);
+	if (error != 0 || req->newptr == NULL)
+		return (error);
+	if (val < 0)
+		return (EINVAL);
+
+	CHVPWM_LOCK(sc);
+	period = sc->sc_period;
+	duty = sc->sc_duty;
+	switch (arg2) {
+	case CHVPWM_SYSCTL_FREQ:
+		if (val == 0) {
+			error = EINVAL;
+			break;
+		}
+		/* Keep the duty cycle as a fraction of the period */
+		period = (1000000000 + val / 2) / val;
+		duty = sc->sc_period == 0 ? 0 :
+			(uint64_t)sc->sc_duty * period / sc->sc_period;
+		error = chvpwm_config(sc, period, duty);
+		break;
+	case CHVPWM_SYSCTL_PERIOD:
+		duty = sc->sc_period == 0 ? 0 :
+			(uint64_t)sc->sc_duty * val / sc->sc_period;
+		error = chvpwm_config(sc, val, duty);
+		break;
+	case CHVPWM_SYSCTL_DUTY:
+		error = chvpwm_config(sc, period, val);
+		break;
+	case CHVPWM_SYSCTL_BRIGHTNESS:
+		error = chvpwm_set_level(sc, val);
+		break;
+	default:
+		error = chvpwm_enable(sc, val != 0);
+		break;
+	}
+	CHVPWM_UNLOCK(sc);
 
-     return (0);
+	return (error);
 }
 
 static char *chvpwm_hids[] = {
+	"80860F09",
 	"80862288",
 	"80862289",
-
-"80860F09",
-"80865AC8"
+	"80865AC8",
 	NULL
 };
 
+static const struct chvpwm_info *
+chvpwm_lookup(device_t dev)
+{
+	char *hid;
+	u_int i;
+
+	hid = ACPI_ID_PROBE(device_get_parent(dev), dev, chvpwm_hids);
+	if (hid == NULL)
+		return (NULL);
+	for (i = 0; i < nitems(chvpwm_infos); i++)
+		if (strcmp(chvpwm_infos[i].ci_hid, hid) == 0)
+			return (&chvpwm_infos[i]);
+	return (NULL);
+}
+
 static int
 chvpwm_probe(device_t dev)
 {
-    if (acpi_disabled("chvpwm") ||
-    ACPI_ID_PROBE(device_get_parent(dev), dev, chvpwm_hids) == NULL)
-        return (ENXIO);
+	const struct chvpwm_info *info;
 
-    device_set_desc(dev, "Intel Cherry View PWM");
-    return (0);
+	if (acpi_disabled("chvpwm") || (info = chvpwm_lookup(dev)) == NULL)
+		return (ENXIO);
+
+	device_set_desc(dev, info->ci_desc);
+	return (0);
 }
 
 static int
 chvpwm_attach(device_t dev)
 {
 	struct chvpwm_softc *sc;
-//	ACPI_STATUS status;
-//	int uid;
-//	struct sysctl_ctx_list *ctx;
-//	struct sysctl_oid *tree;
+	struct sysctl_ctx_list *ctx;
+	struct sysctl_oid *tree;
+	uint32_t base;
 
 	sc = device_get_softc(dev);
 	sc->sc_dev = dev;
+	sc->sc_handle = acpi_get_handle(dev);
+	sc->sc_info = chvpwm_lookup(dev);
+	if (sc->sc_info == NULL)
+		return (ENXIO);
+	sc->sc_base_mask = ((1U << sc->sc_info->ci_base_bits) - 1) <<
+		CHVPWM_CTRL_BASE_SHIFT;
+	sc->sc_period_max = MIN(chvpwm_base_period(sc, 1), CHVPWM_PERIOD_LIMIT);
 
 	sc->sc_mem_rid = 0;
 	sc->sc_mem_res = bus_alloc_resource_any(sc->sc_dev, SYS_RES_MEMORY, 
 		&sc->sc_mem_rid, RF_ACTIVE);
 
 	if (sc->sc_mem_res == NULL) {
-		CHVPWM_LOCK_DESTROY(sc);
 		device_printf(dev, "can't allocate memory resource\n");
 		return (ENOMEM);
 	}
 
-	uint32_t regval;
-	regval = chvpwm_read_ctrl(sc);
+	CHVPWM_LOCK_INIT(sc);
+	callout_init_mtx(&sc->sc_ramp, &sc->sc_mtx, 0);
+	callout_init_mtx(&sc->sc_flush, &sc->sc_mtx, 0);
+	sc->sc_ramp_ms = CHVPWM_RAMP_MS;
+
+	/*
+	 * Firmware normally has the block out of reset, make sure. Without
+	 * a private block that is left to whoever owns the LPSS wrapper.
+	 */
+	if (sc->sc_info->ci_priv != 0) {
+		sc->sc_reset = chvpwm_read_reset(sc);
+		if ((sc->sc_reset & CHVPWM_RESET_RELEASE) !=
+		    CHVPWM_RESET_RELEASE) {
+			sc->sc_reset |= CHVPWM_RESET_RELEASE;
+			chvpwm_write_reset(sc, sc->sc_reset);
+		}
+		sc->sc_general = chvpwm_read_general(sc);
+	}
 
-	device_printf(dev, "CTRL REG: %x\n", regval);
+	/* Pick up whatever firmware left running */
+	sc->sc_ctrl = chvpwm_read_ctrl(sc) & ~CHVPWM_CTRL_UPDATE;
+	base = (sc->sc_ctrl & sc->sc_base_mask) >> CHVPWM_CTRL_BASE_SHIFT;
+	sc->sc_period = chvpwm_base_period(sc, base);
+	sc->sc_duty = chvpwm_div_duty(sc->sc_period,
+		sc->sc_ctrl & CHVPWM_CTRL_DIV_MASK);
+	sc->sc_out_period = sc->sc_period;
+	sc->sc_level = (chvpwm_duty_level(sc) +
+		(1 << (CHVPWM_LEVEL_SHIFT - 1))) >> CHVPWM_LEVEL_SHIFT;
 
-#if 0
 	ctx = device_get_sysctl_ctx(sc->sc_dev);
 	tree = device_get_sysctl_tree(sc->sc_dev);
 
-	sc->sc_freq_oid = SYSCTL_ADD_PROC(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
-		"freq", CTLTYPE_INT | CTLFLAG_RW, sc, 0,
-		chvpwm_sysctl_freq, "I", "PWM frequency");
-#endif
-
-	return (0);
+	SYSCTL_ADD_PROC(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+		"freq", CTLTYPE_INT | CTLFLAG_RW, sc, CHVPWM_SYSCTL_FREQ,
+		chvpwm_sysctl, "I", "PWM frequency in Hz");
+	SYSCTL_ADD_PROC(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+		"period", CTLTYPE_INT | CTLFLAG_RW, sc, CHVPWM_SYSCTL_PERIOD,
+		chvpwm_sysctl, "I", "PWM period in ns");
+	SYSCTL_ADD_PROC(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+		"duty", CTLTYPE_INT | CTLFLAG_RW, sc, CHVPWM_SYSCTL_DUTY,
+		chvpwm_sysctl, "I", "Time the output is high each period, in ns");
+	SYSCTL_ADD_PROC(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+		"enable", CTLTYPE_INT | CTLFLAG_RW, sc, CHVPWM_SYSCTL_ENABLE,
+		chvpwm_sysctl, "I", "Output enabled");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+		"updates", CTLFLAG_RD, &sc->sc_updates, 0,
+		"Settings latched with UPDATE");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+		"updates_deferred", CTLFLAG_RD, &sc->sc_updates_deferred, 0,
+		"Settings held back until the last update latched");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+		"updates_merged", CTLFLAG_RD, &sc->sc_updates_merged, 0,
+		"Settings replaced by newer ones before they were written");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+		"update_timeouts", CTLFLAG_RD, &sc->sc_update_timeouts, 0,
+		"Updates the controller did not latch in time");
+	SYSCTL_ADD_PROC(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+		"brightness", CTLTYPE_INT | CTLFLAG_RW, sc,
+		CHVPWM_SYSCTL_BRIGHTNESS, chvpwm_sysctl, "I",
+		"Brightness 0 - 100, ramped to over ramp_ms");
+	SYSCTL_ADD_UINT(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+		"ramp_ms", CTLFLAG_RW, &sc->sc_ramp_ms, 0,
+		"Time a brightness change takes, in ms");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+		"ramp_steps", CTLFLAG_RD, &sc->sc_ramp_steps, 0,
+		"Duty changes written by brightness ramps");
+
+	if (bootverbose)
+		device_printf(dev, "CTRL %#x RESET %#x GENERAL %#x\n",
+			sc->sc_ctrl, sc->sc_reset, sc->sc_general);
+
+	sc->sc_busdev = device_add_child(dev, "pwmbus", -1);
+	if (sc->sc_busdev == NULL)
+		device_printf(dev, "failed to add pwmbus\n");
+
+	return (bus_generic_attach(dev));
 }
 
 static int
 chvpwm_detach(device_t dev)
 {
 	struct chvpwm_softc *sc;
-	sc = device_get_softc(dev);
+	int error;
 
-	if (sc->sc_mem_res != NULL)
-		bus_release_resource(dev, SYS_RES_MEMORY, sc->sc_mem_rid, sc->sc_mem_res);
+	sc = device_get_softc(dev);
 
-	CHVPWM_LOCK_DESTROY(sc);
+	error = bus_generic_detach(dev);
+	if (error)
+		return (error);
+	if (sc->sc_busdev != NULL)
+		device_delete_child(dev, sc->sc_busdev);
+	sc->sc_busdev = NULL;
+
+	if (sc->sc_mem_res != NULL) {
+		callout_drain(&sc->sc_ramp);
+		callout_drain(&sc->sc_flush);
+		bus_release_resource(dev, SYS_RES_MEMORY, sc->sc_mem_rid,
+			sc->sc_mem_res);
+		CHVPWM_LOCK_DESTROY(sc);
+	}
+	sc->sc_mem_res = NULL;
 
     return (0);
 }
 
+/*
+ * The block can lose power over suspend. The private registers are put
+ * back first, then CTRL is sent with whatever was last asked for, a ramp
+ * in progress skipping to its end.
+ */
+static int
+chvpwm_suspend(device_t dev)
+{
+	struct chvpwm_softc *sc;
+	uint32_t div;
+	int error;
+
+	sc = device_get_softc(dev);
+
+	error = bus_generic_suspend(dev);
+	if (error)
+		return (error);
+
+	CHVPWM_LOCK(sc);
+	if (callout_stop(&sc->sc_ramp)) {
+		div = chvpwm_level_div(sc->sc_ramp_to);
+		sc->sc_ctrl = (sc->sc_ctrl & ~CHVPWM_CTRL_DIV_MASK) | div;
+		sc->sc_duty = chvpwm_div_duty(sc->sc_period, div);
+	}
+	callout_stop(&sc->sc_flush);
+	sc->sc_pending = false;
+	sc->sc_inflight = false;
+	if (sc->sc_info->ci_priv != 0) {
+		sc->sc_reset = chvpwm_read_reset(sc);
+		sc->sc_general = chvpwm_read_general(sc);
+	}
+	sc->sc_suspended = true;
+	CHVPWM_UNLOCK(sc);
+
+	return (0);
+}
+
+static int
+chvpwm_resume(device_t dev)
+{
+	struct chvpwm_softc *sc;
+
+	sc = device_get_softc(dev);
+
+	CHVPWM_LOCK(sc);
+	sc->sc_suspended = false;
+	if (sc->sc_info->ci_priv != 0) {
+		chvpwm_write_reset(sc, sc->sc_reset | CHVPWM_RESET_RELEASE);
+		chvpwm_write_general(sc, sc->sc_general);
+	}
+	chvpwm_program(sc, sc->sc_ctrl);
+	CHVPWM_UNLOCK(sc);
+
+	return (bus_generic_resume(dev));
+}
+
 static device_method_t chvpwm_methods[] = {
 	DEVMETHOD(device_probe,     	chvpwm_probe),
 	DEVMETHOD(device_attach,    	chvpwm_attach),
 	DEVMETHOD(device_detach,    	chvpwm_detach),
+	DEVMETHOD(device_suspend,	chvpwm_suspend),
+	DEVMETHOD(device_resume,	chvpwm_resume),
+
+	/* pwmbus interface */
+	DEVMETHOD(pwmbus_channel_count,		chvpwm_channel_count),
+	DEVMETHOD(pwmbus_channel_config,	chvpwm_channel_config),
+	DEVMETHOD(pwmbus_channel_get_config,	chvpwm_channel_get_config),
+	DEVMETHOD(pwmbus_channel_enable,	chvpwm_channel_enable),
+	DEVMETHOD(pwmbus_channel_is_enabled,	chvpwm_channel_is_enabled),
 	DEVMETHOD_END
 };
 
@@ -233,6 +943,9 @@ static driver_t chvpwm_driver = {
 
 static devclass_t chvpwm_devclass;
 DRIVER_MODULE(chvpwm, acpi, chvpwm_driver, chvpwm_devclass, NULL , NULL);
+/* pwmbus only registers itself under "pwm" parents */
+DRIVER_MODULE(pwmbus, chvpwm, pwmbus_driver, pwmbus_devclass, NULL, NULL);
 MODULE_DEPEND(chvpwm, acpi, 1, 1, 1);
+MODULE_DEPEND(chvpwm, pwmbus, 1, 1, 1);
 
 MODULE_VERSION(chvpwm, 1);
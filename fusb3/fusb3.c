@@ -25,6 +25,26 @@
  *
  */
 
+/*
+ * Fairchild FUSB302 USB Type-C port controller on the GPD Pocket.
+ *
+ * The chip toggles between presenting Rp and Rd itself and interrupts once
+ * it finds a partner (TOGDONE). From there the driver runs the Type-C
+ * connection state machine: settle the pull for the role the partner asked
+ * for, measure the CC pin it turned up on to get the orientation, wait out
+ * tCCDebounce and declare the port attached, then watch VBUS or the
+ * comparator for the partner going away.
+ *
+ * Firmware leaves the device (\_SB.PCI0.I2C1.USTC) disabled, so we attach
+ * from hints on the iicbus and only borrow its _CRS for the interrupt,
+ * which is a GpioInt on the north community and reaches us through
+ * chvgpio_setup_intr. Without it the chip is polled.
+ *
+ * The status and interrupt registers sit together at 0x3C-0x42, every
+ * step of the state machine reads them in one burst. The interrupt
+ * registers clear on read, so the burst is also the acknowledgement.
+ */
+
 #include <sys/param.h>
 #include <sys/systm.h>
 #include <sys/bus.h>
@@ -33,77 +53,1741 @@
 #include <sys/module.h>
 #include <sys/endian.h>
 #include <sys/rman.h>
+#include <sys/lock.h>
+#include <sys/sx.h>
+#include <sys/malloc.h>
+#include <sys/sysctl.h>
+#include <sys/taskqueue.h>
+#include <sys/callout.h>
 
 #include <machine/bus.h>
 #include <machine/resource.h>
 
+#include <contrib/dev/acpica/include/acpi.h>
+#include <contrib/dev/acpica/include/accommon.h>
+
+#include <dev/acpica/acpivar.h>
+
 #include <dev/iicbus/iicbus.h>
 #include <dev/iicbus/iiconf.h>
 
-struct fusb3_softc {
-	device_t			sc_dev;
-	uint8_t				sc_addr;
+#include "chvgpio_var.h"
+#include "pi3usb_var.h"
+#include "bqreg_var.h"
+#include "fusb3_pd.h"
+#include "fusb3_trace.h"
+
+#define	FUSB3_SADDR		0x22	/* 7 bit, from _CRS */
+#define	FUSB3_ACPI_PATH		"\\_SB_.PCI0.I2C1.USTC"
+
+#define	FUSB3_DEVICE_ID		0x01
+#define	FUSB3_SWITCHES0		0x02
+#define	 FUSB3_SW0_PU_EN2	 (1 << 7)
+#define	 FUSB3_SW0_PU_EN1	 (1 << 6)
+#define	 FUSB3_SW0_VCONN_CC2	 (1 << 5)
+#define	 FUSB3_SW0_VCONN_CC1	 (1 << 4)
+#define	 FUSB3_SW0_MEAS_CC2	 (1 << 3)
+#define	 FUSB3_SW0_MEAS_CC1	 (1 << 2)
+#define	 FUSB3_SW0_PDWN2	 (1 << 1)
+#define	 FUSB3_SW0_PDWN1	 (1 << 0)
+#define	FUSB3_SWITCHES1		0x03
+#define	 FUSB3_SW1_POWERROLE	 (1 << 7)
+#define	 FUSB3_SW1_SPECREV_20	 (1 << 5)
+#define	 FUSB3_SW1_DATAROLE	 (1 << 4)
+#define	 FUSB3_SW1_AUTO_CRC	 (1 << 2)
+#define	 FUSB3_SW1_TXCC2	 (1 << 1)
+#define	 FUSB3_SW1_TXCC1	 (1 << 0)
+#define	FUSB3_MEASURE		0x04
+#define	 FUSB3_MEASURE_VBUS	 (1 << 6)
+#define	 FUSB3_MEASURE_MDAC	 0x3f		/* 42 mV steps, less one */
+#define	FUSB3_CONTROL0		0x06
+#define	 FUSB3_CTL0_TX_FLUSH	 (1 << 6)
+#define	 FUSB3_CTL0_INT_MASK	 (1 << 5)
+#define	 FUSB3_CTL0_HOST_CUR_DEF (1 << 2)	/* 80 uA, default USB power */
+#define	 FUSB3_CTL0_HOST_CUR_1A5 (2 << 2)
+#define	 FUSB3_CTL0_HOST_CUR_3A	 (3 << 2)
+#define	 FUSB3_CTL0_AUTO_PRE	 (1 << 1)
+#define	 FUSB3_CTL0_TX_START	 (1 << 0)
+#define	FUSB3_CONTROL1		0x07
+#define	 FUSB3_CTL1_RX_FLUSH	 (1 << 2)
+#define	FUSB3_CONTROL2		0x08
+#define	 FUSB3_CTL2_TOG_SAVE_40	 (1 << 6)	/* idle 40 ms between cycles */
+#define	 FUSB3_CTL2_MODE_DRP	 (1 << 1)
+#define	 FUSB3_CTL2_MODE_SNK	 (2 << 1)
+#define	 FUSB3_CTL2_MODE_SRC	 (3 << 1)
+#define	 FUSB3_CTL2_TOGGLE	 (1 << 0)
+#define	FUSB3_CONTROL3		0x09
+#define	 FUSB3_CTL3_SEND_HARDRESET (1 << 6)
+#define	 FUSB3_CTL3_N_RETRIES_3	 (3 << 1)
+#define	 FUSB3_CTL3_AUTO_RETRY	 (1 << 0)
+#define	FUSB3_MASK1		0x0a
+#define	 FUSB3_M_VBUSOK		 (1 << 7)
+#define	 FUSB3_M_ACTIVITY	 (1 << 6)
+#define	 FUSB3_M_COMP_CHNG	 (1 << 5)
+#define	 FUSB3_M_CRC_CHK	 (1 << 4)
+#define	 FUSB3_M_ALERT		 (1 << 3)
+#define	 FUSB3_M_WAKE		 (1 << 2)
+#define	 FUSB3_M_COLLISION	 (1 << 1)
+#define	 FUSB3_M_BC_LVL		 (1 << 0)
+#define	FUSB3_POWER		0x0b
+#define	 FUSB3_POWER_BANDGAP	 (1 << 0)	/* and the wake circuit */
+#define	 FUSB3_POWER_RECEIVER	 (1 << 1)	/* and measure references */
+#define	 FUSB3_POWER_MEASURE	 (1 << 2)
+#define	 FUSB3_POWER_OSC	 (1 << 3)
+#define	 FUSB3_POWER_ALL	 0x0f
+#define	FUSB3_RESET		0x0c
+#define	 FUSB3_RESET_PD		 (1 << 1)
+#define	 FUSB3_RESET_SW		 (1 << 0)
+#define	FUSB3_MASKA		0x0e
+#define	 FUSB3_MA_TOGDONE	 (1 << 6)
+#define	 FUSB3_MA_RETRYFAIL	 (1 << 4)
+#define	 FUSB3_MA_HARDSENT	 (1 << 3)
+#define	 FUSB3_MA_TXSENT	 (1 << 2)
+#define	 FUSB3_MA_SOFTRST	 (1 << 1)
+#define	 FUSB3_MA_HARDRST	 (1 << 0)
+#define	FUSB3_MASKB		0x0f
+#define	 FUSB3_MB_GCRCSENT	 (1 << 0)
+
+/*
+ * The control registers only change when we write them, so they are kept
+ * in the softc. Writing a value they already hold is dropped, the rest are
+ * staged and go out together, neighbours in one burst, before the next
+ * transfer which is not to one of them. Strobe bits, which clear
+ * themselves, are staged with their register but never cached; RESET
+ * holds nothing else. A software reset is written straight away. Rewriting
+ * CONTROL2 could restart toggling, so it never fills a gap between two
+ * staged registers.
+ */
+#define	FUSB3_CACHE_FIRST	FUSB3_DEVICE_ID
+#define	FUSB3_CACHE_LAST	FUSB3_MASKB
+#define	FUSB3_NCACHE		(FUSB3_CACHE_LAST - FUSB3_CACHE_FIRST + 1)
+#define	FUSB3_CACHE_BIT(reg)	(1 << ((reg) - FUSB3_CACHE_FIRST))
+#define	FUSB3_CACHE_FILL	(~(FUSB3_CACHE_BIT(FUSB3_DEVICE_ID) | \
+	FUSB3_CACHE_BIT(FUSB3_CONTROL2)))
+#define	FUSB3_CACHE_GAP		3	/* clean registers worth rewriting */
+
+/* Status and interrupts, read together */
+#define	FUSB3_STATUS0A		0x3c
+#define	FUSB3_STATUS1A		0x3d
+#define	 FUSB3_ST1A_TOGSS_SHIFT	 3
+#define	 FUSB3_ST1A_TOGSS_MASK	 (7 << 3)
+#define	 FUSB3_TOGSS_SRC_CC1	 1
+#define	 FUSB3_TOGSS_SRC_CC2	 2
+#define	 FUSB3_TOGSS_SNK_CC1	 5
+#define	 FUSB3_TOGSS_SNK_CC2	 6
+#define	 FUSB3_TOGSS_AUDIO	 7
+#define	FUSB3_INTERRUPTA	0x3e
+#define	 FUSB3_IA_TOGDONE	 (1 << 6)
+#define	 FUSB3_IA_RETRYFAIL	 (1 << 4)
+#define	 FUSB3_IA_HARDSENT	 (1 << 3)
+#define	 FUSB3_IA_TXSENT	 (1 << 2)
+#define	 FUSB3_IA_HARDRST	 (1 << 0)
+#define	FUSB3_INTERRUPTB	0x3f
+#define	 FUSB3_IB_GCRCSENT	 (1 << 0)
+#define	FUSB3_STATUS0		0x40
+#define	 FUSB3_ST0_VBUSOK	 (1 << 7)
+#define	 FUSB3_ST0_ACTIVITY	 (1 << 6)
+#define	 FUSB3_ST0_COMP		 (1 << 5)
+#define	 FUSB3_ST0_BC_LVL	 0x03
+#define	FUSB3_STATUS1		0x41
+#define	 FUSB3_ST1_RX_EMPTY	 (1 << 5)
+#define	 FUSB3_ST1_TX_EMPTY	 (1 << 3)
+#define	FUSB3_INTERRUPT		0x42
+#define	 FUSB3_I_VBUSOK		 (1 << 7)
+#define	 FUSB3_I_COMP_CHNG	 (1 << 5)
+#define	 FUSB3_I_BC_LVL		 (1 << 0)
+#define	FUSB3_NSTATUS		(FUSB3_INTERRUPT - FUSB3_STATUS0A + 1)
+
+/* Message FIFO, reads and writes do not advance the address */
+#define	FUSB3_FIFOS		0x43
+#define	 FUSB3_TX_SOP1		 0x12
+#define	 FUSB3_TX_SOP2		 0x13
+#define	 FUSB3_TX_PACKSYM	 0x80
+#define	 FUSB3_TX_JAM_CRC	 0xff
+#define	 FUSB3_TX_EOP		 0x14
+#define	 FUSB3_TX_TXOFF		 0xfe
+#define	 FUSB3_TX_TXON		 0xa1
+#define	 FUSB3_RX_TOKEN_MASK	 0xe0
+#define	 FUSB3_RX_SOP		 0xe0
+#define	FUSB3_CRC_LEN		4
+
+#define	FUSB3_ST(sc, reg)	((sc)->sc_status[(reg) - FUSB3_STATUS0A])
+
+/* BC_LVL, what a sink sees of the source's Rp */
+#define	FUSB3_RP_NONE		0
+#define	FUSB3_RP_DEF		1
+#define	FUSB3_RP_1A5		2
+#define	FUSB3_RP_3A		3
+
+/* Comparator threshold for an open CC with the default Rp, 1.6 V */
+#define	FUSB3_MDAC_OPEN		0x25
+
+#define	FUSB3_CC_DEBOUNCE_MS	120	/* tCCDebounce, 100-200 ms */
+#define	FUSB3_VBUS_WAIT_MS	500	/* Rp seen but no VBUS, give up */
+#define	FUSB3_POLL_MS		100
+
+/* Charger input limit, while its D+/D- detection runs */
+#define	FUSB3_ILIM_RETRY_MS	100
+#define	FUSB3_ILIM_WAIT_MS	2000
+
+/* Power Delivery timers and counters, as a sink */
+#define	FUSB3_PD_WAIT_CAP_MS	500	/* tTypeCSinkWaitCap, 310-620 ms */
+#define	FUSB3_PD_RESPONSE_MS	30	/* tSenderResponse, 24-30 ms */
+#define	FUSB3_PD_TRANSITION_MS	500	/* tPSTransition, 450-550 ms */
+#define	FUSB3_PD_HARD_RESET_MS	2000	/* VBUS off and back, worst case */
+#define	FUSB3_PD_HARD_RESETS	2	/* nHardResetCount */
+
+/* What the board takes, the charger's input limits */
+#define	FUSB3_PD_MAX_MV		12000
+#define	FUSB3_PD_MAX_MA		3000
+
+static const char *fusb3_pd_names[] = {
+	[FUSB3_PD_OFF] = "off",
+	[FUSB3_PD_WAIT_CAPS] = "wait_caps",
+	[FUSB3_PD_REQUEST] = "request",
+	[FUSB3_PD_TRANSITION] = "transition",
+	[FUSB3_PD_READY] = "ready",
+	[FUSB3_PD_HARD_RESET] = "hard_reset",
+	[FUSB3_PD_DISABLED] = "disabled",
 };
 
-#define FUSB3_SADDR	0x22	//I think I know this
+static const char *fusb3_tc_names[] = {
+	[FUSB3_TC_DISABLED] = "disabled",
+	[FUSB3_TC_UNATTACHED] = "unattached",
+	[FUSB3_TC_ATTACHWAIT_SNK] = "attachwait.snk",
+	[FUSB3_TC_ATTACHWAIT_SRC] = "attachwait.src",
+	[FUSB3_TC_ATTACHWAIT_ACC] = "attachwait.acc",
+	[FUSB3_TC_ATTACHED_SNK] = "attached.snk",
+	[FUSB3_TC_ATTACHED_SRC] = "attached.src",
+	[FUSB3_TC_AUDIO] = "audio",
+};
+
+struct fusb3_softc {
+	device_t		sc_dev;
+	uint8_t			sc_addr;
+	struct sx		sc_lock;	/* bus and state machine */
+
+	device_t		sc_gpio;	/* NULL when polling */
+	int			sc_int_pin;
+	int			sc_polling;
+	int			sc_lowpower;	/* toggle on the bandgap alone */
+	struct taskqueue	*sc_tq;
+	struct task		sc_task;
+	struct callout		sc_timer;	/* debounce and poll */
+	volatile u_int		sc_intr_pending;
+	sbintime_t		sc_intr_time;
+
+	uint8_t			sc_status[FUSB3_NSTATUS];
+
+	int			sc_regcache;
+	uint8_t			sc_regs[FUSB3_NCACHE];
+	uint8_t			sc_strobes[FUSB3_NCACHE];
+	uint16_t		sc_regs_valid;
+	uint16_t		sc_regs_dirty;	/* staged, not written yet */
+	uint64_t		sc_xfers;
+	uint64_t		sc_writes_dropped;
+
+	enum fusb3_tc_state	sc_state;
+	sbintime_t		sc_deadline;	/* debounce, 0 if none */
+	sbintime_t		sc_found;	/* TOGDONE for this partner */
+	int			sc_cc;		/* 1 or 2, 0 if detached */
+	int			sc_rp;		/* FUSB3_RP_* as a sink */
+	int			sc_mux;		/* PI3USB_CFG_*, -1 if unset */
+	int			sc_ilim_ma;	/* handed to bqreg, 0 if none */
+	sbintime_t		sc_ilim_deadline;	/* retry, 0 if none */
+	sbintime_t		sc_ilim_since;	/* first EAGAIN */
 
-#define	FUSB3_VERSION	0x01
+	uint64_t		sc_intr_count;
+	uint64_t		sc_steps;
+	uint64_t		sc_attaches;
+	uint64_t		sc_detaches;
+	u_int			sc_attach_ms;	/* TOGDONE to attached */
+	u_int			sc_attach_max_ms;
 
-#define	FUSB3_STAT0A	0x3C
-#define	FUSB3_STAT1B	0x3D
+	/* Power Delivery sink */
+	enum fusb3_pd_state	sc_pd_state;
+	sbintime_t		sc_pd_deadline;	/* 0 if none */
+	int			sc_pd_hard_resets;	/* since last contract */
+	int			sc_pd_vbus_lost;	/* during hard reset */
+	u_int			sc_pd_tx_id;	/* MessageIDCounter */
+	int			sc_pd_tx_busy;	/* waiting on GoodCRC */
+	int			sc_pd_rx_id;	/* last received, -1 if none */
+	uint32_t		sc_pd_caps[PD_MAX_DO];
+	int			sc_pd_ncaps;
+	uint32_t		sc_pd_rdo;	/* last request */
+	int			sc_pd_req_mv;
+	int			sc_pd_req_ma;
+	int			sc_pd_mv;	/* contract, 0 if none */
+	int			sc_pd_ma;
+	int			sc_pd_max_mv;	/* board limits */
+	int			sc_pd_max_ma;
 
-#define	FUSB3_STAT0	0x40
-#define	FUSB3_STAT1	0x41
+	uint64_t		sc_pd_rx;
+	uint64_t		sc_pd_rx_dups;
+	uint64_t		sc_pd_tx;
+	uint64_t		sc_pd_tx_failed;
+	uint64_t		sc_pd_hard_reset_count;
+	uint64_t		sc_pd_contracts;
+
+	/* Event trace, NULL when off */
+	struct fusb3_trace	*sc_trace;
+	u_int			sc_trace_head;	/* next record written */
+	u_int			sc_trace_count;
+	uint64_t		sc_trace_total;
+};
+
+/* _CRS of the USTC node, we only want the GpioInt */
+struct fusb3_crs {
+	char			fc_gpio[32];
+	int			fc_pin;
+	int			fc_triggering;
+	int			fc_polarity;
+};
 
 static int fusb3_probe(device_t);
 static int fusb3_attach(device_t);
 static int fusb3_detach(device_t);
 static int fusb3_read(device_t, uint8_t, uint8_t *);
+static int fusb3_read_burst(device_t, uint8_t, uint8_t *, uint16_t);
 static int fusb3_write(device_t, uint8_t, uint8_t );
+static int fusb3_write_burst(device_t, uint8_t, const uint8_t *, uint16_t);
+static int fusb3_write_raw(struct fusb3_softc *, uint8_t, const uint8_t *,
+    uint16_t);
+static int fusb3_flush(struct fusb3_softc *);
+static int fusb3_cache_fill(struct fusb3_softc *);
+static void fusb3_tc_unattached(struct fusb3_softc *);
+static void fusb3_tc_detached(struct fusb3_softc *);
+static void fusb3_pd_start(struct fusb3_softc *, sbintime_t);
+static void fusb3_pd_stop(struct fusb3_softc *);
+static int fusb3_pd_step(struct fusb3_softc *, sbintime_t);
+
+/*
+ * Next record in the trace ring, zeroed, or NULL when tracing is off.
+ * Called with the lock held, like everything else touching the state.
+ */
+static struct fusb3_trace *
+fusb3_trace(struct fusb3_softc *sc, uint8_t type, uint8_t arg)
+{
+	struct fusb3_trace *ft;
+	struct timeval tv;
+
+	if (sc->sc_trace == NULL)
+		return (NULL);
+	ft = &sc->sc_trace[sc->sc_trace_head];
+	memset(ft, 0, sizeof(*ft));
+	microuptime(&tv);
+	ft->ft_us = (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+	ft->ft_type = type;
+	ft->ft_arg = arg;
+	sc->sc_trace_head = (sc->sc_trace_head + 1) % FUSB3_TRACE_RECORDS;
+	if (sc->sc_trace_count < FUSB3_TRACE_RECORDS)
+		sc->sc_trace_count++;
+	sc->sc_trace_total++;
+	return (ft);
+}
+
+static void
+fusb3_trace_msg(struct fusb3_softc *sc, uint8_t type, uint16_t hdr,
+    const uint32_t *dos)
+{
+	struct fusb3_trace *ft;
+
+	ft = fusb3_trace(sc, type, 0);
+	if (ft == NULL)
+		return;
+	ft->ft_hdr = hdr;
+	if (PD_HDR_CNT(hdr) != 0)
+		memcpy(ft->ft_data, dos, PD_HDR_CNT(hdr) * sizeof(*dos));
+}
+
+/* The status burst, when it has an interrupt to show for it */
+static void
+fusb3_trace_status(struct fusb3_softc *sc)
+{
+	struct fusb3_trace *ft;
+
+	if (FUSB3_ST(sc, FUSB3_INTERRUPTA) == 0 &&
+	    FUSB3_ST(sc, FUSB3_INTERRUPTB) == 0 &&
+	    FUSB3_ST(sc, FUSB3_INTERRUPT) == 0)
+		return;
+	ft = fusb3_trace(sc, FUSB3_TR_INTR, 0);
+	if (ft == NULL)
+		return;
+	memcpy(ft->ft_data, sc->sc_status, FUSB3_NSTATUS);
+}
+
+static void
+fusb3_tc_set(struct fusb3_softc *sc, enum fusb3_tc_state state)
+{
+	struct fusb3_trace *ft;
+
+	if (sc->sc_state == state)
+		return;
+	sc->sc_state = state;
+	ft = fusb3_trace(sc, FUSB3_TR_TC, state);
+	if (ft != NULL)
+		ft->ft_data[0] = sc->sc_cc;
+}
+
+static void
+fusb3_pd_set(struct fusb3_softc *sc, enum fusb3_pd_state state)
+{
+	if (sc->sc_pd_state == state)
+		return;
+	sc->sc_pd_state = state;
+	fusb3_trace(sc, FUSB3_TR_PD, state);
+}
 
 static int
 fusb3_probe(device_t dev)
 {
-	device_printf(dev, "probe\n");
-	device_set_desc(dev, "fusb3 USB Type-C Controller with PD");
+	device_set_desc(dev, "FUSB302 USB Type-C Controller with PD");
+	return (0);
+}
+
+/*
+ * Stop toggling and settle on a role. As a sink we present Rd on both pins
+ * and measure the one the source's Rp turned up on, BC_LVL then gives its
+ * current. As a source we present Rp on both pins and the comparator tells
+ * us when the sink's Rd goes away.
+ */
+static void
+fusb3_tc_snk(struct fusb3_softc *sc, int cc, sbintime_t found)
+{
+	device_t dev = sc->sc_dev;
+
+	fusb3_write(dev, FUSB3_POWER, FUSB3_POWER_ALL);
+	fusb3_write(dev, FUSB3_CONTROL2, 0);
+	fusb3_write(dev, FUSB3_SWITCHES0, FUSB3_SW0_PDWN1 | FUSB3_SW0_PDWN2 |
+		(cc == 1 ? FUSB3_SW0_MEAS_CC1 : FUSB3_SW0_MEAS_CC2));
+	fusb3_write(dev, FUSB3_MASK1,
+		(uint8_t)~(FUSB3_M_VBUSOK | FUSB3_M_BC_LVL));
+	fusb3_write(dev, FUSB3_MASKA, 0xff);
+
+	sc->sc_cc = cc;
+	fusb3_tc_set(sc, FUSB3_TC_ATTACHWAIT_SNK);
+	sc->sc_found = found;
+	sc->sc_deadline = found + mstosbt(FUSB3_CC_DEBOUNCE_MS);
+}
+
+static void
+fusb3_tc_src(struct fusb3_softc *sc, int cc, sbintime_t found,
+    enum fusb3_tc_state state)
+{
+	device_t dev = sc->sc_dev;
+
+	fusb3_write(dev, FUSB3_POWER, FUSB3_POWER_ALL);
+	fusb3_write(dev, FUSB3_CONTROL2, 0);
+	fusb3_write(dev, FUSB3_MEASURE, FUSB3_MDAC_OPEN);
+	fusb3_write(dev, FUSB3_SWITCHES0, FUSB3_SW0_PU_EN1 | FUSB3_SW0_PU_EN2 |
+		(cc == 1 ? FUSB3_SW0_MEAS_CC1 : FUSB3_SW0_MEAS_CC2));
+	fusb3_write(dev, FUSB3_MASK1, (uint8_t)~FUSB3_M_COMP_CHNG);
+	fusb3_write(dev, FUSB3_MASKA, 0xff);
+
+	sc->sc_cc = cc;
+	fusb3_tc_set(sc, state);
+	sc->sc_found = found;
+	sc->sc_deadline = found + mstosbt(FUSB3_CC_DEBOUNCE_MS);
+}
+
+/*
+ * The pi3usb on our bus routes the SuperSpeed lanes, it has to follow the
+ * plug orientation. It may not have attached, we carry on without it.
+ */
+static void
+fusb3_mux(struct fusb3_softc *sc, uint8_t config)
+{
+	device_t mux;
+	int error;
+
+	mux = device_find_child(device_get_parent(sc->sc_dev), "pi3usb", -1);
+	if (mux == NULL || !device_is_attached(mux))
+		return;
+	error = pi3usb_set_config(mux, config);
+	if (error != 0) {
+		device_printf(sc->sc_dev, "mux config 0x%02x failed: %d\n",
+			config, error);
+		sc->sc_mux = -1;
+	} else
+		sc->sc_mux = config;
+}
+
+static void
+fusb3_tc_attached(struct fusb3_softc *sc, enum fusb3_tc_state state,
+    sbintime_t now)
+{
+	u_int ms;
+
+	fusb3_tc_set(sc, state);
+	sc->sc_deadline = 0;
+	sc->sc_attaches++;
+
+	ms = sbttoms(now - sc->sc_found);
+	sc->sc_attach_ms = ms;
+	if (ms > sc->sc_attach_max_ms)
+		sc->sc_attach_max_ms = ms;
+
+	if (bootverbose)
+		device_printf(sc->sc_dev, "%s on CC%d after %u ms\n",
+			fusb3_tc_names[state], sc->sc_cc, ms);
+
+	/* USB 3 either way round, DisplayPort would need alternate modes */
+	if (state == FUSB3_TC_ATTACHED_SNK || state == FUSB3_TC_ATTACHED_SRC)
+		fusb3_mux(sc, sc->sc_cc == 1 ? PI3USB_CFG_USB3 :
+			PI3USB_CFG_USB3S);
+
+	if (state == FUSB3_TC_ATTACHED_SNK)
+		fusb3_pd_start(sc, now);
+}
+
+static void
+fusb3_tc_detached(struct fusb3_softc *sc)
+{
+	if (bootverbose)
+		device_printf(sc->sc_dev, "detached from %s\n",
+			fusb3_tc_names[sc->sc_state]);
+	sc->sc_detaches++;
+	fusb3_mux(sc, PI3USB_CFG_OPEN);
+	fusb3_tc_unattached(sc);
+}
+
+/*
+ * Back to DRP toggling with only TOGDONE able to interrupt. The chip
+ * toggles by itself on the bandgap and wake circuit, so the receiver,
+ * measure block and oscillator are powered down until it finds something,
+ * and it rests 40 ms between toggle cycles. The datasheet puts that at
+ * 25 uA against 40 uA or more with the rest powered.
+ */
+static void
+fusb3_tc_unattached(struct fusb3_softc *sc)
+{
+	device_t dev = sc->sc_dev;
+	uint8_t ctl2;
+
+	if (sc->sc_pd_state != FUSB3_PD_OFF)
+		fusb3_pd_stop(sc);
+	fusb3_write(dev, FUSB3_SWITCHES0, 0);
+	fusb3_write(dev, FUSB3_MASK1, 0xff);
+	fusb3_write(dev, FUSB3_MASKA, (uint8_t)~FUSB3_MA_TOGDONE);
+	fusb3_write(dev, FUSB3_MASKB, FUSB3_MB_GCRCSENT);
+	ctl2 = FUSB3_CTL2_MODE_DRP | FUSB3_CTL2_TOGGLE;
+	if (sc->sc_lowpower)
+		ctl2 |= FUSB3_CTL2_TOG_SAVE_40;
+	fusb3_write(dev, FUSB3_CONTROL2, ctl2);
+	fusb3_write(dev, FUSB3_POWER, sc->sc_lowpower ? FUSB3_POWER_BANDGAP :
+		FUSB3_POWER_ALL);
+
+	sc->sc_cc = 0;
+	fusb3_tc_set(sc, FUSB3_TC_UNATTACHED);
+	sc->sc_deadline = 0;
+	sc->sc_rp = FUSB3_RP_NONE;
+}
+
+/*
+ * One step of the state machine on a fresh status burst. when is the
+ * interrupt that asked for it, now is after the read.
+ */
+static void
+fusb3_tc_step(struct fusb3_softc *sc, sbintime_t when, sbintime_t now)
+{
+	uint8_t status0, inta, intr;
+	int togss, rp;
+
+	status0 = FUSB3_ST(sc, FUSB3_STATUS0);
+	inta = FUSB3_ST(sc, FUSB3_INTERRUPTA);
+	intr = FUSB3_ST(sc, FUSB3_INTERRUPT);
+	rp = status0 & FUSB3_ST0_BC_LVL;
+
+	sc->sc_steps++;
+	switch (sc->sc_state) {
+	case FUSB3_TC_DISABLED:
+		break;
+	case FUSB3_TC_UNATTACHED:
+		if ((inta & FUSB3_IA_TOGDONE) == 0)
+			break;
+		togss = (FUSB3_ST(sc, FUSB3_STATUS1A) &
+			FUSB3_ST1A_TOGSS_MASK) >> FUSB3_ST1A_TOGSS_SHIFT;
+		switch (togss) {
+		case FUSB3_TOGSS_SNK_CC1:
+		case FUSB3_TOGSS_SNK_CC2:
+			fusb3_tc_snk(sc, togss == FUSB3_TOGSS_SNK_CC1 ? 1 : 2,
+				when);
+			break;
+		case FUSB3_TOGSS_SRC_CC1:
+		case FUSB3_TOGSS_SRC_CC2:
+			fusb3_tc_src(sc, togss == FUSB3_TOGSS_SRC_CC1 ? 1 : 2,
+				when, FUSB3_TC_ATTACHWAIT_SRC);
+			break;
+		case FUSB3_TOGSS_AUDIO:
+			fusb3_tc_src(sc, 1, when, FUSB3_TC_ATTACHWAIT_ACC);
+			break;
+		default:
+			/* Toggling stopped on something we do not handle */
+			fusb3_tc_unattached(sc);
+			break;
+		}
+		break;
+	case FUSB3_TC_ATTACHWAIT_SNK:
+		sc->sc_rp = rp;
+		if (now < sc->sc_deadline)
+			break;
+		if (rp != FUSB3_RP_NONE && (status0 & FUSB3_ST0_VBUSOK))
+			fusb3_tc_attached(sc, FUSB3_TC_ATTACHED_SNK, now);
+		else if (rp == FUSB3_RP_NONE || now >= sc->sc_found +
+		    mstosbt(FUSB3_CC_DEBOUNCE_MS + FUSB3_VBUS_WAIT_MS))
+			fusb3_tc_unattached(sc);
+		else
+			sc->sc_deadline = sc->sc_found +
+				mstosbt(FUSB3_CC_DEBOUNCE_MS +
+				FUSB3_VBUS_WAIT_MS);
+		break;
+	case FUSB3_TC_ATTACHED_SNK:
+		/* A PD hard reset takes VBUS away for a while */
+		if ((status0 & FUSB3_ST0_VBUSOK) == 0 &&
+		    sc->sc_pd_state != FUSB3_PD_HARD_RESET) {
+			fusb3_tc_detached(sc);
+			break;
+		}
+		if ((intr & FUSB3_I_BC_LVL) && rp != FUSB3_RP_NONE)
+			sc->sc_rp = rp;
+		break;
+	case FUSB3_TC_ATTACHWAIT_SRC:
+	case FUSB3_TC_ATTACHWAIT_ACC:
+		if (status0 & FUSB3_ST0_COMP)
+			fusb3_tc_unattached(sc);
+		else if (now >= sc->sc_deadline)
+			fusb3_tc_attached(sc,
+				sc->sc_state == FUSB3_TC_ATTACHWAIT_SRC ?
+				FUSB3_TC_ATTACHED_SRC : FUSB3_TC_AUDIO, now);
+		break;
+	case FUSB3_TC_ATTACHED_SRC:
+	case FUSB3_TC_AUDIO:
+		if (status0 & FUSB3_ST0_COMP)
+			fusb3_tc_detached(sc);
+		break;
+	}
+}
+
+/*
+ * USB Power Delivery, as a sink. The chip answers what it receives with
+ * GoodCRC itself and retries what we send until a GoodCRC comes back,
+ * both GoodCRCs land in the receive FIFO. A message goes into the FIFO
+ * with the tokens framing it in one burst, and comes out in one burst if
+ * it has no data objects, two if it has.
+ */
+static void
+fusb3_pd_contract(struct fusb3_softc *sc, int mv, int ma)
+{
+	sc->sc_pd_mv = mv;
+	sc->sc_pd_ma = ma;
+}
+
+static void
+fusb3_pd_reset_ids(struct fusb3_softc *sc)
+{
+	sc->sc_pd_tx_id = 0;
+	sc->sc_pd_tx_busy = 0;
+	sc->sc_pd_rx_id = -1;
+}
+
+static void
+fusb3_pd_wait_caps(struct fusb3_softc *sc, sbintime_t now)
+{
+	fusb3_pd_set(sc, FUSB3_PD_WAIT_CAPS);
+	sc->sc_pd_deadline = now + mstosbt(FUSB3_PD_WAIT_CAP_MS);
+}
+
+static void
+fusb3_pd_start(struct fusb3_softc *sc, sbintime_t now)
+{
+	device_t dev = sc->sc_dev;
+
+	fusb3_write(dev, FUSB3_SWITCHES1, FUSB3_SW1_SPECREV_20 |
+		FUSB3_SW1_AUTO_CRC |
+		(sc->sc_cc == 1 ? FUSB3_SW1_TXCC1 : FUSB3_SW1_TXCC2));
+	fusb3_write(dev, FUSB3_CONTROL3, FUSB3_CTL3_N_RETRIES_3 |
+		FUSB3_CTL3_AUTO_RETRY);
+	/* TXSENT to take the partner's GoodCRC before anything else */
+	fusb3_write(dev, FUSB3_MASKA, (uint8_t)~(FUSB3_MA_HARDRST |
+		FUSB3_MA_HARDSENT | FUSB3_MA_RETRYFAIL | FUSB3_MA_TXSENT));
+	fusb3_write(dev, FUSB3_MASKB, 0);
+	fusb3_write(dev, FUSB3_RESET, FUSB3_RESET_PD);
+	fusb3_write(dev, FUSB3_CONTROL0, FUSB3_CTL0_HOST_CUR_DEF |
+		FUSB3_CTL0_TX_FLUSH);
+	fusb3_write(dev, FUSB3_CONTROL1, FUSB3_CTL1_RX_FLUSH);
+
+	fusb3_pd_reset_ids(sc);
+	fusb3_pd_contract(sc, 0, 0);
+	sc->sc_pd_ncaps = 0;
+	sc->sc_pd_hard_resets = 0;
+	fusb3_pd_wait_caps(sc, now);
+}
+
+static void
+fusb3_pd_stop(struct fusb3_softc *sc)
+{
+	device_t dev = sc->sc_dev;
+
+	fusb3_write(dev, FUSB3_SWITCHES1, 0);
+	fusb3_write(dev, FUSB3_CONTROL3, 0);
+	fusb3_write(dev, FUSB3_RESET, FUSB3_RESET_PD);
+
+	fusb3_pd_reset_ids(sc);
+	fusb3_pd_contract(sc, 0, 0);
+	sc->sc_pd_ncaps = 0;
+	fusb3_pd_set(sc, FUSB3_PD_OFF);
+	sc->sc_pd_deadline = 0;
+}
+
+static int
+fusb3_pd_send(struct fusb3_softc *sc, int type, int cnt, const uint32_t *dos)
+{
+	uint8_t buf[4 + 1 + 2 + PD_MAX_DO * 4 + 4];
+	int i, len, error;
+
+	len = 0;
+	buf[len++] = FUSB3_TX_SOP1;
+	buf[len++] = FUSB3_TX_SOP1;
+	buf[len++] = FUSB3_TX_SOP1;
+	buf[len++] = FUSB3_TX_SOP2;
+	buf[len++] = FUSB3_TX_PACKSYM | (2 + cnt * 4);
+	le16enc(&buf[len], PD_HEADER(type, PD_REV20, sc->sc_pd_tx_id, cnt));
+	len += 2;
+	for (i = 0; i < cnt; i++, len += 4)
+		le32enc(&buf[len], dos[i]);
+	buf[len++] = FUSB3_TX_JAM_CRC;
+	buf[len++] = FUSB3_TX_EOP;
+	buf[len++] = FUSB3_TX_TXOFF;
+	buf[len++] = FUSB3_TX_TXON;
+
+	error = fusb3_write_burst(sc->sc_dev, FUSB3_FIFOS, buf, len);
+	if (error != 0) {
+		device_printf(sc->sc_dev, "PD transmit failed: %d\n",
+			iic2errno(error));
+		return (error);
+	}
+	sc->sc_pd_tx++;
+	sc->sc_pd_tx_busy = 1;
+	fusb3_trace_msg(sc, FUSB3_TR_TX,
+		PD_HEADER(type, PD_REV20, sc->sc_pd_tx_id, cnt), dos);
 	return (0);
 }
 
+static int
+fusb3_pd_ctrl(struct fusb3_softc *sc, int type)
+{
+	return (fusb3_pd_send(sc, type, 0, NULL));
+}
+
+/* Hard reset sent or received, the source takes VBUS away and back */
+static void
+fusb3_pd_to_default(struct fusb3_softc *sc, sbintime_t now)
+{
+	fusb3_write(sc->sc_dev, FUSB3_MASK1,
+		(uint8_t)~(FUSB3_M_VBUSOK | FUSB3_M_BC_LVL));
+
+	fusb3_pd_reset_ids(sc);
+	fusb3_pd_contract(sc, 0, 0);
+	fusb3_pd_set(sc, FUSB3_PD_HARD_RESET);
+	sc->sc_pd_vbus_lost = 0;
+	sc->sc_pd_deadline = now + mstosbt(FUSB3_PD_HARD_RESET_MS);
+}
+
+static void
+fusb3_pd_hard_reset(struct fusb3_softc *sc, sbintime_t now)
+{
+	if (sc->sc_pd_hard_resets >= FUSB3_PD_HARD_RESETS) {
+		device_printf(sc->sc_dev,
+			"no PD contract after %d hard resets, "
+			"staying at Type-C current\n", sc->sc_pd_hard_resets);
+		fusb3_pd_set(sc, FUSB3_PD_DISABLED);
+		sc->sc_pd_deadline = 0;
+		return;
+	}
+
+	sc->sc_pd_hard_resets++;
+	sc->sc_pd_hard_reset_count++;
+	fusb3_trace(sc, FUSB3_TR_HARD_RESET, 0);
+	fusb3_write(sc->sc_dev, FUSB3_CONTROL3, FUSB3_CTL3_N_RETRIES_3 |
+		FUSB3_CTL3_AUTO_RETRY | FUSB3_CTL3_SEND_HARDRESET);
+	fusb3_pd_to_default(sc, now);
+}
+
+/*
+ * Pick the source capability giving the most power the board can take,
+ * the lower voltage of two giving the same. The first is always vSafe5V,
+ * which we are running from anyway, so there is always one to ask for.
+ */
+static int
+fusb3_pd_select(struct fusb3_softc *sc, uint32_t *rdo)
+{
+	uint32_t pdo;
+	int i, best, mv, max_mv, ma, mw, best_mv, best_ma, best_mw;
+
+	best = -1;
+	best_mv = best_ma = best_mw = 0;
+	for (i = 0; i < sc->sc_pd_ncaps; i++) {
+		pdo = sc->sc_pd_caps[i];
+		switch (PD_PDO_TYPE(pdo)) {
+		case PD_PDO_FIXED:
+			mv = max_mv = PD_PDO_FIXED_MV(pdo);
+			ma = MIN(PD_PDO_FIXED_MA(pdo), sc->sc_pd_max_ma);
+			break;
+		case PD_PDO_VARIABLE:
+			max_mv = PD_PDO_MAX_MV(pdo);
+			mv = PD_PDO_MIN_MV(pdo);
+			ma = MIN(PD_PDO_VAR_MA(pdo), sc->sc_pd_max_ma);
+			break;
+		case PD_PDO_BATTERY:
+			max_mv = PD_PDO_MAX_MV(pdo);
+			mv = PD_PDO_MIN_MV(pdo);
+			if (mv == 0)
+				continue;
+			ma = MIN(PD_PDO_BATT_MW(pdo) * 1000 / mv,
+				sc->sc_pd_max_ma);
+			break;
+		default:
+			continue;	/* PPS is no use to a charger */
+		}
+		if (mv == 0 || (i > 0 && max_mv > sc->sc_pd_max_mv))
+			continue;
+		mw = mv * ma / 1000;
+		if (best < 0 || mw > best_mw || (mw == best_mw && mv < best_mv)) {
+			best = i;
+			best_mv = mv;
+			best_ma = ma;
+			best_mw = mw;
+		}
+	}
+	if (best < 0)
+		return (ENOENT);
+
+	if (PD_PDO_TYPE(sc->sc_pd_caps[best]) == PD_PDO_BATTERY)
+		*rdo = PD_RDO(best + 1, best_mw / 250, best_mw / 250);
+	else
+		*rdo = PD_RDO(best + 1, best_ma / 10, best_ma / 10);
+	*rdo |= PD_RDO_USB_COMM | PD_RDO_NO_SUSPEND;
+	sc->sc_pd_req_mv = best_mv;
+	sc->sc_pd_req_ma = best_ma;
+	return (0);
+}
+
+static void
+fusb3_pd_request(struct fusb3_softc *sc, sbintime_t now)
+{
+	uint32_t rdo;
+
+	if (fusb3_pd_select(sc, &rdo) != 0) {
+		device_printf(sc->sc_dev, "no usable source capability\n");
+		return;
+	}
+	sc->sc_pd_rdo = rdo;
+	if (fusb3_pd_send(sc, PD_DATA_REQUEST, 1, &rdo) != 0)
+		return;
+	fusb3_pd_set(sc, FUSB3_PD_REQUEST);
+	sc->sc_pd_deadline = now + mstosbt(FUSB3_PD_RESPONSE_MS);
+}
+
+static void
+fusb3_pd_ready(struct fusb3_softc *sc)
+{
+	/* BC_LVL means nothing once the source is talking PD */
+	fusb3_write(sc->sc_dev, FUSB3_MASK1, (uint8_t)~FUSB3_M_VBUSOK);
+
+	fusb3_pd_contract(sc, sc->sc_pd_req_mv, sc->sc_pd_req_ma);
+	fusb3_pd_set(sc, FUSB3_PD_READY);
+	sc->sc_pd_deadline = 0;
+	sc->sc_pd_hard_resets = 0;
+	sc->sc_pd_contracts++;
+
+	if (bootverbose)
+		device_printf(sc->sc_dev, "PD contract %d mV %d mA\n",
+			sc->sc_pd_mv, sc->sc_pd_ma);
+}
+
+static void
+fusb3_pd_sink_caps(struct fusb3_softc *sc)
+{
+	uint32_t pdo[2];
+	int n;
+
+	n = 0;
+	pdo[n++] = PD_FIXED_PDO(5000, sc->sc_pd_max_ma) | PD_PDO_USB_COMM;
+	if (sc->sc_pd_max_mv > 5000)
+		pdo[n++] = PD_FIXED_PDO(sc->sc_pd_max_mv, sc->sc_pd_max_ma);
+	fusb3_pd_send(sc, PD_DATA_SINK_CAP, n, pdo);
+}
+
+static void
+fusb3_pd_rx(struct fusb3_softc *sc, uint16_t hdr, const uint32_t *dos,
+    sbintime_t now)
+{
+	int type, cnt, id;
+
+	type = PD_HDR_TYPE(hdr);
+	cnt = PD_HDR_CNT(hdr);
+	id = PD_HDR_ID(hdr);
+
+	if (cnt == 0 && type == PD_CTRL_GOODCRC) {
+		if (sc->sc_pd_tx_busy && id == sc->sc_pd_tx_id) {
+			sc->sc_pd_tx_busy = 0;
+			sc->sc_pd_tx_id = (sc->sc_pd_tx_id + 1) & 7;
+		}
+		return;
+	}
+
+	/* A retry from a source which missed our GoodCRC */
+	if (id == sc->sc_pd_rx_id &&
+	    !(cnt == 0 && type == PD_CTRL_SOFT_RESET)) {
+		sc->sc_pd_rx_dups++;
+		return;
+	}
+	sc->sc_pd_rx_id = id;
+	sc->sc_pd_rx++;
+
+	if (hdr & PD_HDR_EXT)
+		return;
+
+	if (cnt != 0) {
+		/* BIST and VDMs are ignored */
+		if (type == PD_DATA_SOURCE_CAP) {
+			memcpy(sc->sc_pd_caps, dos, cnt * sizeof(*dos));
+			sc->sc_pd_ncaps = cnt;
+			fusb3_pd_request(sc, now);
+		}
+		return;
+	}
+
+	switch (type) {
+	case PD_CTRL_ACCEPT:
+		if (sc->sc_pd_state == FUSB3_PD_REQUEST) {
+			fusb3_pd_set(sc, FUSB3_PD_TRANSITION);
+			sc->sc_pd_deadline = now +
+				mstosbt(FUSB3_PD_TRANSITION_MS);
+		}
+		break;
+	case PD_CTRL_REJECT:
+	case PD_CTRL_WAIT:
+		if (sc->sc_pd_state != FUSB3_PD_REQUEST)
+			break;
+		if (sc->sc_pd_mv != 0) {
+			fusb3_pd_set(sc, FUSB3_PD_READY);
+			sc->sc_pd_deadline = 0;
+		} else
+			fusb3_pd_wait_caps(sc, now);
+		break;
+	case PD_CTRL_PS_RDY:
+		if (sc->sc_pd_state == FUSB3_PD_TRANSITION)
+			fusb3_pd_ready(sc);
+		break;
+	case PD_CTRL_SOFT_RESET:
+		fusb3_pd_reset_ids(sc);
+		fusb3_pd_ctrl(sc, PD_CTRL_ACCEPT);
+		fusb3_pd_wait_caps(sc, now);
+		break;
+	case PD_CTRL_GET_SINK_CAP:
+		fusb3_pd_sink_caps(sc);
+		break;
+	case PD_CTRL_PING:
+	case PD_CTRL_GOTOMIN:
+		break;
+	default:
+		/* Swaps and Get_Source_Cap, we are a sink and UFP only */
+		fusb3_pd_ctrl(sc, PD_CTRL_REJECT);
+		break;
+	}
+}
+
+static int
+fusb3_pd_read(struct fusb3_softc *sc, uint16_t *hdr, uint32_t *dos)
+{
+	uint8_t buf[3 + PD_MAX_DO * 4 + FUSB3_CRC_LEN];
+	int i, cnt, error;
+
+	/*
+	 * Token, header and four more bytes, the CRC of a control message
+	 * or the first data object, then the rest if there is any.
+	 */
+	error = fusb3_read_burst(sc->sc_dev, FUSB3_FIFOS, buf,
+		3 + FUSB3_CRC_LEN);
+	if (error != 0)
+		return (error);
+	*hdr = le16dec(&buf[1]);
+	cnt = PD_HDR_CNT(*hdr);
+	if (cnt != 0) {
+		error = fusb3_read_burst(sc->sc_dev, FUSB3_FIFOS, &buf[7],
+			cnt * 4);
+		if (error != 0)
+			return (error);
+	}
+
+	/* SOP' and SOP'' are for the cable */
+	if ((buf[0] & FUSB3_RX_TOKEN_MASK) != FUSB3_RX_SOP)
+		return (EAGAIN);
+	for (i = 0; i < cnt; i++)
+		dos[i] = le32dec(&buf[3 + i * 4]);
+	return (0);
+}
+
+/*
+ * The Power Delivery half of a step, on the same status burst. Returns
+ * true when a message was taken from the FIFO, there may be another
+ * behind it.
+ */
+static int
+fusb3_pd_step(struct fusb3_softc *sc, sbintime_t now)
+{
+	uint32_t dos[PD_MAX_DO];
+	uint16_t hdr;
+	uint8_t inta, status0, status1;
+	int got;
+
+	inta = FUSB3_ST(sc, FUSB3_INTERRUPTA);
+	status0 = FUSB3_ST(sc, FUSB3_STATUS0);
+	status1 = FUSB3_ST(sc, FUSB3_STATUS1);
+	got = 0;
+
+	if (inta & (FUSB3_IA_HARDRST | FUSB3_IA_HARDSENT)) {
+		fusb3_write(sc->sc_dev, FUSB3_RESET, FUSB3_RESET_PD);
+		/* We went to HARD_RESET when we sent ours */
+		if (inta & FUSB3_IA_HARDRST) {
+			sc->sc_pd_hard_reset_count++;
+			fusb3_trace(sc, FUSB3_TR_HARD_RESET, 1);
+			fusb3_pd_to_default(sc, now);
+		}
+		return (0);
+	}
+
+	if (inta & FUSB3_IA_RETRYFAIL) {
+		sc->sc_pd_tx_failed++;
+		sc->sc_pd_tx_busy = 0;
+		sc->sc_pd_tx_id = (sc->sc_pd_tx_id + 1) & 7;
+		if (sc->sc_pd_state == FUSB3_PD_REQUEST)
+			fusb3_pd_hard_reset(sc, now);
+	}
+
+	if (sc->sc_pd_state == FUSB3_PD_HARD_RESET) {
+		if ((status0 & FUSB3_ST0_VBUSOK) == 0)
+			sc->sc_pd_vbus_lost = 1;
+		else if (sc->sc_pd_vbus_lost)
+			fusb3_pd_wait_caps(sc, now);
+	}
+
+	if ((status1 & FUSB3_ST1_RX_EMPTY) == 0) {
+		if (fusb3_pd_read(sc, &hdr, dos) == 0) {
+			fusb3_trace_msg(sc, FUSB3_TR_RX, hdr, dos);
+			fusb3_pd_rx(sc, hdr, dos, now);
+		}
+		got = 1;
+	}
+
+	if (sc->sc_pd_deadline == 0 || now < sc->sc_pd_deadline)
+		return (got);
+	switch (sc->sc_pd_state) {
+	case FUSB3_PD_WAIT_CAPS:
+	case FUSB3_PD_REQUEST:
+	case FUSB3_PD_TRANSITION:
+		fusb3_pd_hard_reset(sc, now);
+		break;
+	case FUSB3_PD_HARD_RESET:
+		/* Some sources keep VBUS up through a hard reset */
+		if (status0 & FUSB3_ST0_VBUSOK)
+			fusb3_pd_wait_caps(sc, now);
+		else
+			fusb3_tc_detached(sc);
+		break;
+	default:
+		sc->sc_pd_deadline = 0;
+		break;
+	}
+	return (got);
+}
+
+/* Input current each Rp level is good for, default USB power as USB 2 */
+static const int fusb3_rp_ma[] = {
+	[FUSB3_RP_NONE] = 0,
+	[FUSB3_RP_DEF] = 500,
+	[FUSB3_RP_1A5] = 1500,
+	[FUSB3_RP_3A] = 3000,
+};
+
+/*
+ * Tell the charger what the source is good for, the PD contract if there
+ * is one, else what Rp advertises. VBUS going away, on detach or through
+ * a hard reset, sends the charger back to its own detection, so the limit
+ * is handed over again once VBUS is back. bqreg may be on another bus or
+ * not there at all.
+ */
+static void
+fusb3_ilim(struct fusb3_softc *sc, sbintime_t now)
+{
+	device_t bq;
+	int ma, error;
+
+	ma = 0;
+	if (sc->sc_state == FUSB3_TC_ATTACHED_SNK &&
+	    (FUSB3_ST(sc, FUSB3_STATUS0) & FUSB3_ST0_VBUSOK))
+		ma = sc->sc_pd_mv != 0 ? sc->sc_pd_ma : fusb3_rp_ma[sc->sc_rp];
+	if (ma == sc->sc_ilim_ma) {
+		sc->sc_ilim_deadline = 0;
+		sc->sc_ilim_since = 0;
+		return;
+	}
+	if (sc->sc_ilim_deadline != 0 && now < sc->sc_ilim_deadline)
+		return;
+
+	sc->sc_ilim_deadline = 0;
+	bq = devclass_get_device(devclass_find("bqreg"), 0);
+	if (bq == NULL || !device_is_attached(bq))
+		return;
+	error = bqreg_set_input_limit(bq, ma);
+	if (error == EAGAIN) {
+		if (sc->sc_ilim_since == 0)
+			sc->sc_ilim_since = now;
+		if (now - sc->sc_ilim_since < mstosbt(FUSB3_ILIM_WAIT_MS)) {
+			sc->sc_ilim_deadline = now +
+				mstosbt(FUSB3_ILIM_RETRY_MS);
+			return;
+		}
+	}
+	sc->sc_ilim_since = 0;
+	/* Not again until the source's offer changes */
+	sc->sc_ilim_ma = ma;
+	if (error != 0)
+		device_printf(sc->sc_dev, "input limit %d mA failed: %d\n",
+			ma, error);
+}
+
+static void
+fusb3_timer(void *arg)
+{
+	struct fusb3_softc *sc;
+
+	sc = (struct fusb3_softc *)arg;
+	taskqueue_enqueue(sc->sc_tq, &sc->sc_task);
+}
+
+/* Run again at the debounce or PD deadline, or the next poll */
+static void
+fusb3_schedule(struct fusb3_softc *sc, sbintime_t now)
+{
+	sbintime_t next;
+
+	next = 0;
+	if (sc->sc_polling)
+		next = now + mstosbt(FUSB3_POLL_MS);
+	if (sc->sc_deadline != 0 && (next == 0 || sc->sc_deadline < next))
+		next = sc->sc_deadline;
+	if (sc->sc_pd_deadline != 0 &&
+	    (next == 0 || sc->sc_pd_deadline < next))
+		next = sc->sc_pd_deadline;
+	if (sc->sc_ilim_deadline != 0 &&
+	    (next == 0 || sc->sc_ilim_deadline < next))
+		next = sc->sc_ilim_deadline;
+
+	if (next == 0)
+		callout_stop(&sc->sc_timer);
+	else
+		callout_reset_sbt(&sc->sc_timer, MAX(next - now, 0), 0,
+			fusb3_timer, sc, 0);
+}
+
+static void
+fusb3_task(void *arg, int pending)
+{
+	struct fusb3_softc *sc;
+	sbintime_t when, now;
+	int error;
+
+	sc = (struct fusb3_softc *)arg;
+
+	sx_xlock(&sc->sc_lock);
+	/* Detaching, leave the chip and the callout alone */
+	if (sc->sc_state == FUSB3_TC_DISABLED) {
+		sx_xunlock(&sc->sc_lock);
+		return;
+	}
+	when = 0;
+	if (atomic_load_acq_int(&sc->sc_intr_pending)) {
+		when = sc->sc_intr_time;
+		atomic_store_rel_int(&sc->sc_intr_pending, 0);
+	}
+
+	error = fusb3_read_burst(sc->sc_dev, FUSB3_STATUS0A, sc->sc_status,
+		FUSB3_NSTATUS);
+	now = sbinuptime();
+	if (when == 0)
+		when = now;
+	if (error != 0)
+		device_printf(sc->sc_dev, "status read failed: %d\n",
+			iic2errno(error));
+	else {
+		if (sc->sc_trace != NULL)
+			fusb3_trace_status(sc);
+		fusb3_tc_step(sc, when, now);
+		/* One message per step, the next burst tells if there is more */
+		if (sc->sc_pd_state != FUSB3_PD_OFF && fusb3_pd_step(sc, now))
+			taskqueue_enqueue(sc->sc_tq, &sc->sc_task);
+		fusb3_ilim(sc, now);
+	}
+	fusb3_flush(sc);
+	fusb3_schedule(sc, now);
+	sx_xunlock(&sc->sc_lock);
+}
+
+/* Called by chvgpio with its lock held, just queue the task */
+static void
+fusb3_intr(void *arg)
+{
+	struct fusb3_softc *sc;
+
+	sc = (struct fusb3_softc *)arg;
+
+	sc->sc_intr_count++;
+	if (atomic_cmpset_int(&sc->sc_intr_pending, 0, 1))
+		sc->sc_intr_time = sbinuptime();
+	taskqueue_enqueue(sc->sc_tq, &sc->sc_task);
+}
+
+static ACPI_STATUS
+fusb3_parse_crs(ACPI_RESOURCE *res, void *context)
+{
+	struct fusb3_crs *crs;
+	ACPI_RESOURCE_SOURCE *src;
+
+	crs = (struct fusb3_crs *)context;
+
+	if (res->Type != ACPI_RESOURCE_TYPE_GPIO ||
+	    res->Data.Gpio.ConnectionType != ACPI_RESOURCE_GPIO_TYPE_INT ||
+	    res->Data.Gpio.PinTableLength == 0 || crs->fc_pin >= 0)
+		return (AE_OK);
+
+	src = &res->Data.Gpio.ResourceSource;
+	if (src->StringPtr == NULL)
+		return (AE_OK);
+	crs->fc_pin = res->Data.Gpio.PinTable[0];
+	crs->fc_triggering = res->Data.Gpio.Triggering;
+	crs->fc_polarity = res->Data.Gpio.Polarity;
+	strlcpy(crs->fc_gpio, src->StringPtr, sizeof(crs->fc_gpio));
+
+	return (AE_OK);
+}
+
+/*
+ * Hook up the GpioInt from the USTC node's _CRS. AcpiGetHandle pads the
+ * short name segments of "\\_SB.GPO1".
+ */
+static int
+fusb3_setup_intr(struct fusb3_softc *sc)
+{
+	struct fusb3_crs crs;
+	ACPI_HANDLE h;
+	device_t gpio;
+	int error;
+
+	memset(&crs, 0, sizeof(crs));
+	crs.fc_pin = -1;
+	if (ACPI_FAILURE(AcpiGetHandle(NULL, FUSB3_ACPI_PATH, &h)))
+		return (ENXIO);
+	AcpiWalkResources(h, "_CRS", fusb3_parse_crs, &crs);
+	if (crs.fc_pin < 0 ||
+	    ACPI_FAILURE(AcpiGetHandle(NULL, crs.fc_gpio, &h)) ||
+	    (gpio = acpi_get_device(h)) == NULL)
+		return (ENXIO);
+
+	error = chvgpio_setup_intr(gpio, crs.fc_pin, crs.fc_triggering,
+		crs.fc_polarity, fusb3_intr, sc);
+	if (error != 0)
+		return (error);
+
+	sc->sc_gpio = gpio;
+	sc->sc_int_pin = crs.fc_pin;
+	return (0);
+}
+
+static int
+fusb3_sysctl_state(SYSCTL_HANDLER_ARGS)
+{
+	struct fusb3_softc *sc;
+	char buf[32];
+
+	sc = (struct fusb3_softc *)arg1;
+
+	sx_slock(&sc->sc_lock);
+	strlcpy(buf, fusb3_tc_names[sc->sc_state], sizeof(buf));
+	sx_sunlock(&sc->sc_lock);
+
+	return (sysctl_handle_string(oidp, buf, sizeof(buf), req));
+}
+
+static int
+fusb3_sysctl_pd_state(SYSCTL_HANDLER_ARGS)
+{
+	struct fusb3_softc *sc;
+	char buf[32];
+
+	sc = (struct fusb3_softc *)arg1;
+
+	sx_slock(&sc->sc_lock);
+	strlcpy(buf, fusb3_pd_names[sc->sc_pd_state], sizeof(buf));
+	sx_sunlock(&sc->sc_lock);
+
+	return (sysctl_handle_string(oidp, buf, sizeof(buf), req));
+}
+
+static int
+fusb3_sysctl_pd_caps(SYSCTL_HANDLER_ARGS)
+{
+	struct fusb3_softc *sc;
+	struct sbuf sb;
+	char buf[256];
+	uint32_t pdo;
+	int i;
+
+	sc = (struct fusb3_softc *)arg1;
+
+	sbuf_new(&sb, buf, sizeof(buf), SBUF_FIXEDLEN);
+	sx_slock(&sc->sc_lock);
+	for (i = 0; i < sc->sc_pd_ncaps; i++) {
+		pdo = sc->sc_pd_caps[i];
+		sbuf_printf(&sb, "%s", i ? ", " : "");
+		switch (PD_PDO_TYPE(pdo)) {
+		case PD_PDO_FIXED:
+			sbuf_printf(&sb, "%dmV %dmA", PD_PDO_FIXED_MV(pdo),
+				PD_PDO_FIXED_MA(pdo));
+			break;
+		case PD_PDO_VARIABLE:
+			sbuf_printf(&sb, "%d-%dmV %dmA", PD_PDO_MIN_MV(pdo),
+				PD_PDO_MAX_MV(pdo), PD_PDO_VAR_MA(pdo));
+			break;
+		case PD_PDO_BATTERY:
+			sbuf_printf(&sb, "%d-%dmV %dmW", PD_PDO_MIN_MV(pdo),
+				PD_PDO_MAX_MV(pdo), PD_PDO_BATT_MW(pdo));
+			break;
+		default:
+			sbuf_printf(&sb, "0x%08x", pdo);
+			break;
+		}
+	}
+	sx_sunlock(&sc->sc_lock);
+	sbuf_finish(&sb);
+	sbuf_delete(&sb);
+
+	return (sysctl_handle_string(oidp, buf, sizeof(buf), req));
+}
+
+/* Changing what the board takes asks the source for its offer again */
+static int
+fusb3_sysctl_pd_limit(SYSCTL_HANDLER_ARGS)
+{
+	struct fusb3_softc *sc;
+	int *limit, val, error;
+
+	sc = (struct fusb3_softc *)arg1;
+	limit = arg2 == 0 ? &sc->sc_pd_max_mv : &sc->sc_pd_max_ma;
+
+	val = *limit;
+	error = sysctl_handle_int(oidp, &val, 0, req);
+	if (error || req->newptr == NULL)
+		return (error);
+	if (arg2 == 0 && (val < 5000 || val > 20000))
+		return (EINVAL);
+	if (arg2 == 1 && (val < 500 || val > 5000))
+		return (EINVAL);
+
+	sx_xlock(&sc->sc_lock);
+	*limit = val;
+	if (sc->sc_pd_state == FUSB3_PD_READY && !sc->sc_pd_tx_busy)
+		fusb3_pd_ctrl(sc, PD_CTRL_GET_SOURCE_CAP);
+	sx_xunlock(&sc->sc_lock);
+
+	return (0);
+}
+
+static int
+fusb3_sysctl_trace(SYSCTL_HANDLER_ARGS)
+{
+	struct fusb3_softc *sc;
+	struct fusb3_trace *ring;
+	int error, val;
+
+	sc = (struct fusb3_softc *)arg1;
+	val = sc->sc_trace != NULL;
+	error = sysctl_handle_int(oidp, &val, 0, req);
+	if (error || req->newptr == NULL)
+		return (error);
+
+	/* Turning the trace on again keeps what is already in the ring */
+	ring = NULL;
+	if (val)
+		ring = malloc(sizeof(*ring) * FUSB3_TRACE_RECORDS, M_DEVBUF,
+			M_WAITOK | M_ZERO);
+
+	sx_xlock(&sc->sc_lock);
+	if (val && sc->sc_trace == NULL) {
+		sc->sc_trace = ring;
+		sc->sc_trace_head = 0;
+		sc->sc_trace_count = 0;
+		ring = NULL;
+	} else if (!val) {
+		ring = sc->sc_trace;
+		sc->sc_trace = NULL;
+	}
+	sx_xunlock(&sc->sc_lock);
+
+	if (ring != NULL)
+		free(ring, M_DEVBUF);
+	return (0);
+}
+
+static int
+fusb3_sysctl_trace_ring(SYSCTL_HANDLER_ARGS)
+{
+	struct fusb3_softc *sc;
+	struct fusb3_trace *out;
+	u_int i, first, n;
+	int error;
+
+	sc = (struct fusb3_softc *)arg1;
+	out = malloc(sizeof(*out) * FUSB3_TRACE_RECORDS, M_TEMP, M_WAITOK);
+
+	sx_slock(&sc->sc_lock);
+	n = 0;
+	if (sc->sc_trace != NULL) {
+		n = sc->sc_trace_count;
+		first = (sc->sc_trace_head + FUSB3_TRACE_RECORDS - n) %
+			FUSB3_TRACE_RECORDS;
+		for (i = 0; i < n; i++)
+			out[i] = sc->sc_trace[(first + i) %
+				FUSB3_TRACE_RECORDS];
+	}
+	sx_sunlock(&sc->sc_lock);
+
+	error = SYSCTL_OUT(req, out, sizeof(*out) * n);
+	free(out, M_TEMP);
+	return (error);
+}
+
+static void
+fusb3_sysctl_pd(struct fusb3_softc *sc, struct sysctl_ctx_list *ctx,
+    struct sysctl_oid *tree)
+{
+	struct sysctl_oid *pd;
+
+	pd = SYSCTL_ADD_NODE(ctx, SYSCTL_CHILDREN(tree), OID_AUTO, "pd",
+		CTLFLAG_RD, NULL, "USB Power Delivery sink");
+
+	SYSCTL_ADD_PROC(ctx, SYSCTL_CHILDREN(pd), OID_AUTO,
+		"state", CTLTYPE_STRING | CTLFLAG_RD, sc, 0,
+		fusb3_sysctl_pd_state, "A", "Policy engine state");
+	SYSCTL_ADD_PROC(ctx, SYSCTL_CHILDREN(pd), OID_AUTO,
+		"source_caps", CTLTYPE_STRING | CTLFLAG_RD, sc, 0,
+		fusb3_sysctl_pd_caps, "A", "Last Source_Capabilities");
+	SYSCTL_ADD_INT(ctx, SYSCTL_CHILDREN(pd), OID_AUTO,
+		"mv", CTLFLAG_RD, &sc->sc_pd_mv, 0,
+		"Contract voltage in mV, 0 without a contract");
+	SYSCTL_ADD_INT(ctx, SYSCTL_CHILDREN(pd), OID_AUTO,
+		"ma", CTLFLAG_RD, &sc->sc_pd_ma, 0,
+		"Contract current in mA");
+	SYSCTL_ADD_PROC(ctx, SYSCTL_CHILDREN(pd), OID_AUTO,
+		"max_mv", CTLTYPE_INT | CTLFLAG_RWTUN, sc, 0,
+		fusb3_sysctl_pd_limit, "I", "Highest voltage to ask for in mV");
+	SYSCTL_ADD_PROC(ctx, SYSCTL_CHILDREN(pd), OID_AUTO,
+		"max_ma", CTLTYPE_INT | CTLFLAG_RWTUN, sc, 1,
+		fusb3_sysctl_pd_limit, "I", "Most current to ask for in mA");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(pd), OID_AUTO,
+		"rx", CTLFLAG_RD, &sc->sc_pd_rx, 0,
+		"Messages received, less GoodCRC");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(pd), OID_AUTO,
+		"rx_dups", CTLFLAG_RD, &sc->sc_pd_rx_dups, 0,
+		"Retries of a message already received");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(pd), OID_AUTO,
+		"tx", CTLFLAG_RD, &sc->sc_pd_tx, 0,
+		"Messages sent");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(pd), OID_AUTO,
+		"tx_failed", CTLFLAG_RD, &sc->sc_pd_tx_failed, 0,
+		"Messages never acknowledged with GoodCRC");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(pd), OID_AUTO,
+		"hard_resets", CTLFLAG_RD, &sc->sc_pd_hard_reset_count, 0,
+		"Hard resets sent or received");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(pd), OID_AUTO,
+		"contracts", CTLFLAG_RD, &sc->sc_pd_contracts, 0,
+		"Explicit contracts made");
+}
+
 static int
 fusb3_attach(device_t dev)
 {
-	device_printf(dev, "attach\n");
-	struct fusb3_softc *sc = device_get_softc(dev);
+	struct fusb3_softc *sc;
+	struct sysctl_ctx_list *ctx;
+	struct sysctl_oid *tree;
+	uint8_t id;
 	int rv;
 
+	sc = device_get_softc(dev);
 	sc->sc_dev = dev;
-	sc->sc_addr = FUSB3_SADDR;
-
-	uint8_t version;
+	sc->sc_addr = iicbus_get_addr(dev);
+	if (sc->sc_addr == 0)
+		sc->sc_addr = FUSB3_SADDR << 1;
+	sc->sc_int_pin = -1;
+	sc->sc_mux = -1;
+	sc->sc_regcache = 1;
+	sc->sc_lowpower = 1;
+	sc->sc_pd_max_mv = FUSB3_PD_MAX_MV;
+	sc->sc_pd_max_ma = FUSB3_PD_MAX_MA;
 
-	rv = fusb3_read(dev, FUSB3_VERSION, &version);
-	if ( rv != 0) {
-		device_printf(dev, "failed to read version code: %d %d\n", 
+	rv = fusb3_read(dev, FUSB3_DEVICE_ID, &id);
+	if (rv != 0) {
+		device_printf(dev, "failed to read version code: %d %d\n",
 			rv, iic2errno(rv));
-		return ENXIO;
+		return (ENXIO);
+	}
+	if (bootverbose)
+		device_printf(dev, "device id 0x%02x\n", id);
+
+	/* Start from the reset state */
+	fusb3_write(dev, FUSB3_RESET, FUSB3_RESET_SW);
+
+	sx_init(&sc->sc_lock, "fusb3");
+	/* A few KB, on unless the trace tunable says otherwise */
+	sc->sc_trace = malloc(sizeof(*sc->sc_trace) * FUSB3_TRACE_RECORDS,
+		M_DEVBUF, M_WAITOK | M_ZERO);
+	callout_init(&sc->sc_timer, 1);
+	TASK_INIT(&sc->sc_task, 0, fusb3_task, sc);
+	sc->sc_tq = taskqueue_create_fast("fusb3", M_WAITOK,
+		taskqueue_thread_enqueue, &sc->sc_tq);
+	taskqueue_start_threads(&sc->sc_tq, 1, PI_SWI(SWI_TQ), "%s taskq",
+		device_get_nameunit(dev));
+
+	ctx = device_get_sysctl_ctx(dev);
+	tree = device_get_sysctl_tree(dev);
+
+	SYSCTL_ADD_INT(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+		"polling", CTLFLAG_RDTUN, &sc->sc_polling, 0,
+		"Poll the controller instead of waiting for the interrupt");
+	SYSCTL_ADD_INT(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+		"lowpower", CTLFLAG_RDTUN, &sc->sc_lowpower, 0,
+		"Power down all but the toggle logic while nothing is attached");
+	SYSCTL_ADD_INT(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+		"regcache", CTLFLAG_RDTUN, &sc->sc_regcache, 0,
+		"Cache the control registers and coalesce writes to them");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+		"xfers", CTLFLAG_RD, &sc->sc_xfers, 0,
+		"I2C transfers to the controller");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+		"writes_dropped", CTLFLAG_RD, &sc->sc_writes_dropped, 0,
+		"Register writes dropped as the cached value was the same");
+	SYSCTL_ADD_PROC(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+		"state", CTLTYPE_STRING | CTLFLAG_RD, sc, 0,
+		fusb3_sysctl_state, "A", "Type-C connection state");
+	SYSCTL_ADD_INT(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+		"cc", CTLFLAG_RD, &sc->sc_cc, 0,
+		"CC pin of the attached partner, the plug orientation");
+	SYSCTL_ADD_INT(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+		"rp", CTLFLAG_RD, &sc->sc_rp, 0,
+		"Source current as a sink, 0 none, 1 default, 2 1.5 A, 3 3 A");
+	SYSCTL_ADD_INT(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+		"mux", CTLFLAG_RD, &sc->sc_mux, 0,
+		"pi3usb config last set, -1 if none");
+	SYSCTL_ADD_INT(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+		"input_limit", CTLFLAG_RD, &sc->sc_ilim_ma, 0,
+		"Input current in mA the source offers, as handed to bqreg");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+		"intr_count", CTLFLAG_RD, &sc->sc_intr_count, 0,
+		"Controller interrupts");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+		"steps", CTLFLAG_RD, &sc->sc_steps, 0,
+		"Status bursts run through the state machine");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+		"attaches", CTLFLAG_RD, &sc->sc_attaches, 0,
+		"Partners attached");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+		"detaches", CTLFLAG_RD, &sc->sc_detaches, 0,
+		"Partners detached");
+	SYSCTL_ADD_UINT(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+		"attach_ms", CTLFLAG_RD, &sc->sc_attach_ms, 0,
+		"TOGDONE interrupt to attached for the last partner");
+	SYSCTL_ADD_UINT(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+		"attach_max_ms", CTLFLAG_RD, &sc->sc_attach_max_ms, 0,
+		"Longest TOGDONE interrupt to attached");
+	SYSCTL_ADD_PROC(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+		"trace", CTLTYPE_INT | CTLFLAG_RWTUN, sc, 0,
+		fusb3_sysctl_trace, "I",
+		"Record Type-C and PD events in trace_ring");
+	SYSCTL_ADD_PROC(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+		"trace_ring", CTLTYPE_OPAQUE | CTLFLAG_RD, sc, 0,
+		fusb3_sysctl_trace_ring, "S,fusb3_trace",
+		"Recent events oldest first, fusb3trace decodes them");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+		"trace_total", CTLFLAG_RD, &sc->sc_trace_total, 0,
+		"Events recorded since attach");
+	fusb3_sysctl_pd(sc, ctx, tree);
+
+	if (!sc->sc_polling && (rv = fusb3_setup_intr(sc)) != 0) {
+		device_printf(dev, "no interrupt (%d), polling\n", rv);
+		sc->sc_polling = 1;
 	}
 
+	sx_xlock(&sc->sc_lock);
+	if (sc->sc_regcache)
+		fusb3_cache_fill(sc);
+	fusb3_write(dev, FUSB3_CONTROL0, FUSB3_CTL0_HOST_CUR_DEF);
+	fusb3_tc_unattached(sc);
+	fusb3_flush(sc);
+	sx_xunlock(&sc->sc_lock);
+
+	/* Pick up a partner which was there before toggling started */
+	taskqueue_enqueue(sc->sc_tq, &sc->sc_task);
+
 	return (0);
 }
 
 static int
 fusb3_detach(device_t dev)
 {
+	struct fusb3_softc *sc;
+
+	sc = device_get_softc(dev);
+
+	if (sc->sc_gpio != NULL)
+		chvgpio_teardown_intr(sc->sc_gpio, sc->sc_int_pin);
+	if (sc->sc_tq != NULL) {
+		/*
+		 * With every deadline gone and the state disabled neither
+		 * the task nor the callout arms the other again. Drain the
+		 * task either side of the callout, one may be queued by it.
+		 */
+		sx_xlock(&sc->sc_lock);
+		sc->sc_polling = 0;
+		fusb3_tc_set(sc, FUSB3_TC_DISABLED);
+		sc->sc_deadline = 0;
+		sc->sc_pd_deadline = 0;
+		sc->sc_ilim_deadline = 0;
+		sx_xunlock(&sc->sc_lock);
+		taskqueue_drain(sc->sc_tq, &sc->sc_task);
+		callout_drain(&sc->sc_timer);
+		taskqueue_drain(sc->sc_tq, &sc->sc_task);
+		taskqueue_free(sc->sc_tq);
+		sx_destroy(&sc->sc_lock);
+	}
+	if (sc->sc_trace != NULL)
+		free(sc->sc_trace, M_DEVBUF);
+	sc->sc_trace = NULL;
+
+	/* Leave the pins and the lanes open and toggling off */
+	if (sc->sc_mux > 0)
+		fusb3_mux(sc, PI3USB_CFG_OPEN);
+	fusb3_write(dev, FUSB3_RESET, FUSB3_RESET_SW);
+
 	return (0);
 }
 
-static int 
+/* Self clearing bits, which do something each time they are written */
+static uint8_t
+fusb3_strobes(uint8_t reg)
+{
+	switch (reg) {
+	case FUSB3_CONTROL0:
+		return (FUSB3_CTL0_TX_FLUSH | FUSB3_CTL0_TX_START);
+	case FUSB3_CONTROL1:
+		return (FUSB3_CTL1_RX_FLUSH);
+	case FUSB3_CONTROL3:
+		return (FUSB3_CTL3_SEND_HARDRESET);
+	case FUSB3_RESET:
+		return (0xff);
+	default:
+		return (0);
+	}
+}
+
+static int
+fusb3_cached(struct fusb3_softc *sc, uint8_t reg)
+{
+	return (sc->sc_regcache && reg >= FUSB3_CACHE_FIRST &&
+	    reg <= FUSB3_CACHE_LAST);
+}
+
+/* One burst for all of the control registers, after a reset */
+static int
+fusb3_cache_fill(struct fusb3_softc *sc)
+{
+	int error;
+
+	sc->sc_regs_valid = 0;
+	sc->sc_regs_dirty = 0;
+	memset(sc->sc_strobes, 0, sizeof(sc->sc_strobes));
+	error = fusb3_read_burst(sc->sc_dev, FUSB3_CACHE_FIRST, sc->sc_regs,
+		FUSB3_NCACHE);
+	if (error == 0) {
+		sc->sc_regs[FUSB3_RESET - FUSB3_CACHE_FIRST] = 0;
+		sc->sc_regs_valid = (1 << FUSB3_NCACHE) - 1;
+	}
+	return (error);
+}
+
+/* Write what is staged, neighbours and short gaps in one burst */
+static int
+fusb3_flush(struct fusb3_softc *sc)
+{
+	uint8_t buf[FUSB3_NCACHE];
+	uint16_t bits;
+	int first, last, reg, error, rv;
+
+	rv = 0;
+	while (sc->sc_regs_dirty != 0) {
+		first = ffs(sc->sc_regs_dirty) - 1 + FUSB3_CACHE_FIRST;
+		last = first;
+		for (reg = first + 1; reg <= FUSB3_CACHE_LAST; reg++) {
+			if (sc->sc_regs_dirty & FUSB3_CACHE_BIT(reg))
+				last = reg;
+			else if (reg - last > FUSB3_CACHE_GAP ||
+			    (sc->sc_regs_valid & FUSB3_CACHE_FILL &
+			    FUSB3_CACHE_BIT(reg)) == 0)
+				break;
+		}
+		bits = (FUSB3_CACHE_BIT(last) << 1) - FUSB3_CACHE_BIT(first);
+		sc->sc_regs_dirty &= ~bits;
+
+		for (reg = first; reg <= last; reg++) {
+			buf[reg - first] = sc->sc_regs[reg - FUSB3_CACHE_FIRST] |
+				sc->sc_strobes[reg - FUSB3_CACHE_FIRST];
+			sc->sc_strobes[reg - FUSB3_CACHE_FIRST] = 0;
+		}
+		error = fusb3_write_raw(sc, first, buf, last - first + 1);
+		if (error != 0) {
+			/* No telling what the chip holds now */
+			sc->sc_regs_valid &= ~bits;
+			rv = error;
+		}
+	}
+	return (rv);
+}
+
+static int
 fusb3_read(device_t dev, uint8_t reg, uint8_t *val)
+{
+	struct fusb3_softc *sc;
+
+	sc = device_get_softc(dev);
+	if (fusb3_cached(sc, reg) &&
+	    (sc->sc_regs_valid & FUSB3_CACHE_BIT(reg))) {
+		*val = sc->sc_regs[reg - FUSB3_CACHE_FIRST];
+		return (0);
+	}
+	return (fusb3_read_burst(dev, reg, val, 1));
+}
+
+/* Reads auto-increment the register address, except on the FIFO */
+static int
+fusb3_read_burst(device_t dev, uint8_t reg, uint8_t *buf, uint16_t len)
 {
 	struct fusb3_softc *sc;
 	struct iic_msg msg[2];
 
 	sc = device_get_softc(dev);
+	if (sc->sc_regs_dirty != 0)
+		fusb3_flush(sc);
+	sc->sc_xfers++;
 
 	msg[0].slave = sc->sc_addr;
 	msg[0].flags = IIC_M_WR | IIC_M_NOSTOP;
@@ -112,32 +1796,74 @@ fusb3_read(device_t dev, uint8_t reg, uint8_t *val)
 
 	msg[1].slave = sc->sc_addr;
 	msg[1].flags = IIC_M_RD;
-	msg[1].len = sizeof(uint8_t);
-	msg[1].buf = val;
+	msg[1].len = len;
+	msg[1].buf = buf;
 
 	return (iicbus_transfer(dev, msg, 2));
 }
 
-static int 
+static int
 fusb3_write(device_t dev, uint8_t reg, uint8_t val)
 {
 	struct fusb3_softc *sc;
-	struct iic_msg msg[2];
+	uint8_t strobe;
+	int error;
 
 	sc = device_get_softc(dev);
-	reg = htobe16(reg);
+	if (!fusb3_cached(sc, reg) ||
+	    (reg == FUSB3_RESET && (val & FUSB3_RESET_SW))) {
+		error = fusb3_write_burst(dev, reg, &val, 1);
+		if (reg == FUSB3_RESET && (val & FUSB3_RESET_SW))
+			sc->sc_regs_valid = 0;
+		return (error);
+	}
 
-	msg[0].slave = sc->sc_addr;
-	msg[0].flags = IIC_M_WR | IIC_M_NOSTOP;
-	msg[0].len = 1;
-	msg[0].buf = &reg;
+	strobe = val & fusb3_strobes(reg);
+	val &= ~strobe;
+	if (strobe == 0 && (sc->sc_regs_valid & FUSB3_CACHE_BIT(reg)) &&
+	    sc->sc_regs[reg - FUSB3_CACHE_FIRST] == val) {
+		sc->sc_writes_dropped++;
+		return (0);
+	}
+	sc->sc_regs[reg - FUSB3_CACHE_FIRST] = val;
+	sc->sc_strobes[reg - FUSB3_CACHE_FIRST] |= strobe;
+	sc->sc_regs_valid |= FUSB3_CACHE_BIT(reg);
+	sc->sc_regs_dirty |= FUSB3_CACHE_BIT(reg);
+	return (0);
+}
 
-	msg[1].slave = sc->sc_addr;		
-	msg[1].flags = IIC_M_WR;
-	msg[1].len = sizeof(uint8_t);
-	msg[1].buf = &val;
+static int
+fusb3_write_burst(device_t dev, uint8_t reg, const uint8_t *data,
+    uint16_t len)
+{
+	struct fusb3_softc *sc;
 
-	return (iicbus_transfer(dev, msg, 2));
+	sc = device_get_softc(dev);
+	if (sc->sc_regs_dirty != 0)
+		fusb3_flush(sc);
+	return (fusb3_write_raw(sc, reg, data, len));
+}
+
+/* Register and data go out in one message, the chip wants no restart */
+static int
+fusb3_write_raw(struct fusb3_softc *sc, uint8_t reg, const uint8_t *data,
+    uint16_t len)
+{
+	struct iic_msg msg;
+	uint8_t buf[1 + 48];
+
+	if (len >= sizeof(buf))
+		return (IIC_EOVERFLOW);
+	buf[0] = reg;
+	memcpy(&buf[1], data, len);
+
+	msg.slave = sc->sc_addr;
+	msg.flags = IIC_M_WR;
+	msg.len = len + 1;
+	msg.buf = buf;
+
+	sc->sc_xfers++;
+	return (iicbus_transfer(sc->sc_dev, &msg, 1));
 }
 
 static int
@@ -176,4 +1902,8 @@ static devclass_t fusb3_devclass;
 DRIVER_MODULE(fusb3, iicbus, fusb3_driver, fusb3_devclass, fusb3_driver_loaded, NULL);
 
 MODULE_DEPEND(fusb3, iicbus, IICBUS_MINVER, IICBUS_PREFVER, IICBUS_MAXVER);
+MODULE_DEPEND(fusb3, acpi, 1, 1, 1);
+MODULE_DEPEND(fusb3, chvgpio, 1, 1, 1);
+MODULE_DEPEND(fusb3, pi3usb, 1, 1, 1);
+MODULE_DEPEND(fusb3, bqreg, 1, 1, 1);
 MODULE_VERSION(fusb3, 1);
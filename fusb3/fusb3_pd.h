@@ -0,0 +1,107 @@
+/*-
+ * Copyright (c) 2018 Tom Jones <tj@enoti.me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+/*
+ * USB Power Delivery message layout, as far as a sink needs it. Plain
+ * defines so userland tools can decode what fusb3 saw.
+ */
+
+#ifndef FUSB3_PD_H
+#define FUSB3_PD_H
+
+/* Message header */
+#define	PD_HDR_TYPE(h)		((h) & 0x1f)
+#define	PD_HDR_DATA_ROLE	(1 << 5)	/* DFP */
+#define	PD_HDR_REV_SHIFT	6
+#define	PD_HDR_REV_MASK		(3 << 6)
+#define	 PD_REV20		 1
+#define	 PD_REV30		 2
+#define	PD_HDR_POWER_ROLE	(1 << 8)	/* source */
+#define	PD_HDR_ID_SHIFT		9
+#define	PD_HDR_ID(h)		(((h) >> 9) & 7)
+#define	PD_HDR_CNT_SHIFT	12
+#define	PD_HDR_CNT(h)		(((h) >> 12) & 7)
+#define	PD_HDR_EXT		(1 << 15)
+
+#define	PD_HEADER(type, rev, id, cnt)					\
+	((type) | ((rev) << PD_HDR_REV_SHIFT) | ((id) << PD_HDR_ID_SHIFT) | \
+	((cnt) << PD_HDR_CNT_SHIFT))
+
+#define	PD_MAX_DO		7	/* data objects in a message */
+
+/* Control messages, no data objects */
+#define	PD_CTRL_GOODCRC		1
+#define	PD_CTRL_GOTOMIN		2
+#define	PD_CTRL_ACCEPT		3
+#define	PD_CTRL_REJECT		4
+#define	PD_CTRL_PING		5
+#define	PD_CTRL_PS_RDY		6
+#define	PD_CTRL_GET_SOURCE_CAP	7
+#define	PD_CTRL_GET_SINK_CAP	8
+#define	PD_CTRL_DR_SWAP		9
+#define	PD_CTRL_PR_SWAP		10
+#define	PD_CTRL_VCONN_SWAP	11
+#define	PD_CTRL_WAIT		12
+#define	PD_CTRL_SOFT_RESET	13
+
+/* Data messages */
+#define	PD_DATA_SOURCE_CAP	1
+#define	PD_DATA_REQUEST		2
+#define	PD_DATA_BIST		3
+#define	PD_DATA_SINK_CAP	4
+#define	PD_DATA_VENDOR		15
+
+/* Power data objects */
+#define	PD_PDO_TYPE(p)		((p) >> 30)
+#define	 PD_PDO_FIXED		 0
+#define	 PD_PDO_BATTERY		 1
+#define	 PD_PDO_VARIABLE	 2
+#define	 PD_PDO_AUGMENTED	 3
+#define	PD_PDO_USB_COMM		(1 << 26)
+#define	PD_PDO_FIXED_MV(p)	((((p) >> 10) & 0x3ff) * 50)
+#define	PD_PDO_FIXED_MA(p)	(((p) & 0x3ff) * 10)
+#define	PD_PDO_MAX_MV(p)	((((p) >> 20) & 0x3ff) * 50)
+#define	PD_PDO_MIN_MV(p)	((((p) >> 10) & 0x3ff) * 50)
+#define	PD_PDO_VAR_MA(p)	(((p) & 0x3ff) * 10)
+#define	PD_PDO_BATT_MW(p)	(((p) & 0x3ff) * 250)
+
+#define	PD_FIXED_PDO(mv, ma)						\
+	((((mv) / 50) << 10) | ((ma) / 10))
+
+/* Request data objects */
+#define	PD_RDO_POS_SHIFT	28
+#define	PD_RDO_POS(r)		(((r) >> 28) & 7)
+#define	PD_RDO_MISMATCH		(1 << 26)
+#define	PD_RDO_USB_COMM		(1 << 25)
+#define	PD_RDO_NO_SUSPEND	(1 << 24)
+#define	PD_RDO_OP(r)		(((r) >> 10) & 0x3ff)	/* 10 mA or 250 mW */
+#define	PD_RDO_MAX(r)		((r) & 0x3ff)
+
+#define	PD_RDO(pos, op, max)						\
+	(((pos) << PD_RDO_POS_SHIFT) | ((op) << 10) | (max))
+
+#endif	/* FUSB3_PD_H */
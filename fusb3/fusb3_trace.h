@@ -0,0 +1,77 @@
+/*-
+ * Copyright (c) 2018 Tom Jones <tj@enoti.me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Event trace kept by fusb3, dev.fusb3.N.trace_ring exports the records
+ * oldest first in this layout. fusb3trace decodes it.
+ */
+
+#ifndef FUSB3_TRACE_H
+#define FUSB3_TRACE_H
+
+enum fusb3_tc_state {
+	FUSB3_TC_DISABLED,
+	FUSB3_TC_UNATTACHED,		/* DRP toggling */
+	FUSB3_TC_ATTACHWAIT_SNK,
+	FUSB3_TC_ATTACHWAIT_SRC,
+	FUSB3_TC_ATTACHWAIT_ACC,
+	FUSB3_TC_ATTACHED_SNK,
+	FUSB3_TC_ATTACHED_SRC,
+	FUSB3_TC_AUDIO,
+};
+
+enum fusb3_pd_state {
+	FUSB3_PD_OFF,			/* not attached as a sink */
+	FUSB3_PD_WAIT_CAPS,		/* for Source_Capabilities */
+	FUSB3_PD_REQUEST,		/* Request sent, for Accept */
+	FUSB3_PD_TRANSITION,		/* Accepted, for PS_RDY */
+	FUSB3_PD_READY,			/* explicit contract */
+	FUSB3_PD_HARD_RESET,		/* for VBUS to come back */
+	FUSB3_PD_DISABLED,		/* source does not speak PD */
+};
+
+#define	FUSB3_TRACE_RECORDS	256
+
+/* Record types */
+#define	FUSB3_TR_TC		1	/* arg state, data[0] CC pin */
+#define	FUSB3_TR_PD		2	/* arg state */
+#define	FUSB3_TR_INTR		3	/* data the status block 0x3C-0x42 */
+#define	FUSB3_TR_RX		4	/* hdr and data objects */
+#define	FUSB3_TR_TX		5
+#define	FUSB3_TR_HARD_RESET	6	/* arg 1 if the source sent it */
+
+#define	FUSB3_TR_DATA		7
+
+struct fusb3_trace {
+	uint64_t	ft_us;		/* uptime */
+	uint8_t		ft_type;
+	uint8_t		ft_arg;
+	uint16_t	ft_hdr;
+	uint32_t	ft_data[FUSB3_TR_DATA];
+};
+
+#endif	/* FUSB3_TRACE_H */
@@ -0,0 +1,349 @@
+/*-
+ * Copyright (c) 2018 Tom Jones <tj@enoti.me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+
+/*
+ * Decode the event trace fusb3 keeps, from the running driver or from a
+ * dump of it taken with
+ *
+ *	# sysctl -b dev.fusb3.0.trace_ring > trace.bin
+ */
+
+#include <sys/param.h>
+#ifdef __FreeBSD__
+#include <sys/sysctl.h>
+#endif
+
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fusb3_pd.h"
+#include "fusb3_trace.h"
+
+static const char *tc_names[] = {
+	[FUSB3_TC_DISABLED] = "disabled",
+	[FUSB3_TC_UNATTACHED] = "unattached",
+	[FUSB3_TC_ATTACHWAIT_SNK] = "attachwait.snk",
+	[FUSB3_TC_ATTACHWAIT_SRC] = "attachwait.src",
+	[FUSB3_TC_ATTACHWAIT_ACC] = "attachwait.acc",
+	[FUSB3_TC_ATTACHED_SNK] = "attached.snk",
+	[FUSB3_TC_ATTACHED_SRC] = "attached.src",
+	[FUSB3_TC_AUDIO] = "audio",
+};
+
+static const char *pd_names[] = {
+	[FUSB3_PD_OFF] = "off",
+	[FUSB3_PD_WAIT_CAPS] = "wait_caps",
+	[FUSB3_PD_REQUEST] = "request",
+	[FUSB3_PD_TRANSITION] = "transition",
+	[FUSB3_PD_READY] = "ready",
+	[FUSB3_PD_HARD_RESET] = "hard_reset",
+	[FUSB3_PD_DISABLED] = "disabled",
+};
+
+static const char *ctrl_names[] = {
+	[PD_CTRL_GOODCRC] = "GoodCRC",
+	[PD_CTRL_GOTOMIN] = "GotoMin",
+	[PD_CTRL_ACCEPT] = "Accept",
+	[PD_CTRL_REJECT] = "Reject",
+	[PD_CTRL_PING] = "Ping",
+	[PD_CTRL_PS_RDY] = "PS_RDY",
+	[PD_CTRL_GET_SOURCE_CAP] = "Get_Source_Cap",
+	[PD_CTRL_GET_SINK_CAP] = "Get_Sink_Cap",
+	[PD_CTRL_DR_SWAP] = "DR_Swap",
+	[PD_CTRL_PR_SWAP] = "PR_Swap",
+	[PD_CTRL_VCONN_SWAP] = "VCONN_Swap",
+	[PD_CTRL_WAIT] = "Wait",
+	[PD_CTRL_SOFT_RESET] = "Soft_Reset",
+};
+
+static const char *data_names[] = {
+	[PD_DATA_SOURCE_CAP] = "Source_Capabilities",
+	[PD_DATA_REQUEST] = "Request",
+	[PD_DATA_BIST] = "BIST",
+	[PD_DATA_SINK_CAP] = "Sink_Capabilities",
+	[PD_DATA_VENDOR] = "Vendor_Defined",
+};
+
+/* Status burst 0x3C-0x42 as the driver read it */
+static const char *status_names[] = {
+	"status0a", "status1a", "interrupta", "interruptb", "status0",
+	"status1", "interrupt",
+};
+
+#ifndef nitems
+#define	nitems(x)	(sizeof((x)) / sizeof((x)[0]))
+#endif
+
+#define	NAME(tab, i)							\
+	((size_t)(i) < nitems(tab) && (tab)[i] != NULL ? (tab)[i] : NULL)
+
+/* The last offer, a Request is read against it */
+static uint32_t caps[PD_MAX_DO];
+static int ncaps;
+
+static void
+print_pdo(int pos, uint32_t pdo)
+{
+	printf("\t\t%d: ", pos);
+	switch (PD_PDO_TYPE(pdo)) {
+	case PD_PDO_FIXED:
+		printf("fixed %d mV %d mA%s", PD_PDO_FIXED_MV(pdo),
+			PD_PDO_FIXED_MA(pdo),
+			pdo & PD_PDO_USB_COMM ? " usb_comm" : "");
+		break;
+	case PD_PDO_VARIABLE:
+		printf("variable %d-%d mV %d mA", PD_PDO_MIN_MV(pdo),
+			PD_PDO_MAX_MV(pdo), PD_PDO_VAR_MA(pdo));
+		break;
+	case PD_PDO_BATTERY:
+		printf("battery %d-%d mV %d mW", PD_PDO_MIN_MV(pdo),
+			PD_PDO_MAX_MV(pdo), PD_PDO_BATT_MW(pdo));
+		break;
+	default:
+		/* Programmable power supply, 100 mV and 50 mA units */
+		printf("pps %d-%d mV %d mA", ((pdo >> 8) & 0xff) * 100,
+			((pdo >> 17) & 0xff) * 100, (pdo & 0x7f) * 50);
+		break;
+	}
+	printf("\n");
+}
+
+static void
+print_rdo(uint32_t rdo)
+{
+	uint32_t pdo;
+	int pos;
+
+	pos = PD_RDO_POS(rdo);
+	pdo = pos >= 1 && pos <= ncaps ? caps[pos - 1] : 0;
+	printf("\t\tposition %d ", pos);
+	if (pos >= 1 && pos <= ncaps && PD_PDO_TYPE(pdo) == PD_PDO_BATTERY)
+		printf("op %d mW max %d mW", PD_RDO_OP(rdo) * 250,
+			PD_RDO_MAX(rdo) * 250);
+	else if (pos >= 1 && pos <= ncaps &&
+	    PD_PDO_TYPE(pdo) == PD_PDO_AUGMENTED)
+		printf("%d mV %d mA", ((rdo >> 9) & 0x7ff) * 20,
+			(rdo & 0x7f) * 50);
+	else
+		printf("op %d mA max %d mA", PD_RDO_OP(rdo) * 10,
+			PD_RDO_MAX(rdo) * 10);
+	printf("%s%s%s\n", rdo & PD_RDO_MISMATCH ? " mismatch" : "",
+		rdo & PD_RDO_USB_COMM ? " usb_comm" : "",
+		rdo & PD_RDO_NO_SUSPEND ? " no_suspend" : "");
+}
+
+static void
+print_msg(const struct fusb3_trace *ft)
+{
+	const char *name;
+	uint16_t hdr;
+	int i, type, cnt, rev;
+
+	hdr = ft->ft_hdr;
+	type = PD_HDR_TYPE(hdr);
+	cnt = PD_HDR_CNT(hdr);
+	rev = (hdr & PD_HDR_REV_MASK) >> PD_HDR_REV_SHIFT;
+
+	if (hdr & PD_HDR_EXT)
+		name = "extended";
+	else if (cnt == 0)
+		name = NAME(ctrl_names, type);
+	else
+		name = NAME(data_names, type);
+	if (name != NULL)
+		printf("%s", name);
+	else
+		printf("%s %d", cnt == 0 ? "control" : "data", type);
+	printf(" id %d rev %d.0 %s/%s\n", PD_HDR_ID(hdr), rev + 1,
+		hdr & PD_HDR_POWER_ROLE ? "source" : "sink",
+		hdr & PD_HDR_DATA_ROLE ? "dfp" : "ufp");
+
+	if (hdr & PD_HDR_EXT)
+		return;
+	if (cnt != 0 && type == PD_DATA_SOURCE_CAP) {
+		memcpy(caps, ft->ft_data, cnt * sizeof(caps[0]));
+		ncaps = cnt;
+	}
+	for (i = 0; i < cnt; i++) {
+		switch (type) {
+		case PD_DATA_SOURCE_CAP:
+		case PD_DATA_SINK_CAP:
+			print_pdo(i + 1, ft->ft_data[i]);
+			break;
+		case PD_DATA_REQUEST:
+			print_rdo(ft->ft_data[i]);
+			break;
+		default:
+			printf("\t\t0x%08x\n", ft->ft_data[i]);
+			break;
+		}
+	}
+}
+
+static void
+print_record(const struct fusb3_trace *ft, uint64_t prev)
+{
+	const uint8_t *st;
+	const char *name;
+	size_t i;
+
+	printf("%6ju.%06ju %+9.3f ", (uintmax_t)(ft->ft_us / 1000000),
+		(uintmax_t)(ft->ft_us % 1000000),
+		prev == 0 ? 0.0 : (double)(int64_t)(ft->ft_us - prev) / 1000);
+
+	switch (ft->ft_type) {
+	case FUSB3_TR_TC:
+		name = NAME(tc_names, ft->ft_arg);
+		printf("tc   %s", name != NULL ? name : "?");
+		if (ft->ft_data[0] != 0)
+			printf(" cc%u", ft->ft_data[0]);
+		printf("\n");
+		break;
+	case FUSB3_TR_PD:
+		name = NAME(pd_names, ft->ft_arg);
+		printf("pd   %s\n", name != NULL ? name : "?");
+		break;
+	case FUSB3_TR_INTR:
+		st = (const uint8_t *)ft->ft_data;
+		printf("intr");
+		for (i = 0; i < nitems(status_names); i++)
+			printf(" %s %02x", status_names[i], st[i]);
+		printf("\n");
+		break;
+	case FUSB3_TR_RX:
+	case FUSB3_TR_TX:
+		printf("%s   ", ft->ft_type == FUSB3_TR_RX ? "rx" : "tx");
+		print_msg(ft);
+		break;
+	case FUSB3_TR_HARD_RESET:
+		printf("hard reset %s\n", ft->ft_arg ? "received" : "sent");
+		break;
+	default:
+		printf("type %u\n", ft->ft_type);
+		break;
+	}
+}
+
+static struct fusb3_trace *
+load_file(const char *path, size_t *n)
+{
+	struct fusb3_trace *ring;
+	FILE *fp;
+	long len;
+
+	fp = fopen(path, "r");
+	if (fp == NULL)
+		err(1, "%s", path);
+	if (fseek(fp, 0, SEEK_END) != 0 || (len = ftell(fp)) < 0)
+		err(1, "%s", path);
+	rewind(fp);
+	if (len % sizeof(*ring) != 0)
+		errx(1, "%s: not a trace_ring dump", path);
+
+	*n = len / sizeof(*ring);
+	ring = calloc(*n + 1, sizeof(*ring));
+	if (ring == NULL)
+		err(1, "calloc");
+	if (fread(ring, sizeof(*ring), *n, fp) != *n)
+		err(1, "%s", path);
+	fclose(fp);
+	return (ring);
+}
+
+#ifdef __FreeBSD__
+static struct fusb3_trace *
+load_sysctl(int unit, size_t *n)
+{
+	struct fusb3_trace *ring;
+	char name[64];
+	size_t len;
+
+	snprintf(name, sizeof(name), "dev.fusb3.%d.trace_ring", unit);
+	len = sizeof(*ring) * FUSB3_TRACE_RECORDS;
+	ring = malloc(len);
+	if (ring == NULL)
+		err(1, "malloc");
+	if (sysctlbyname(name, ring, &len, NULL, 0) != 0)
+		err(1, "%s", name);
+	*n = len / sizeof(*ring);
+	return (ring);
+}
+#endif
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: fusb3trace [-u unit] [dump]\n");
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct fusb3_trace *ring;
+	uint64_t prev;
+	size_t i, n;
+	int ch, unit;
+
+	unit = 0;
+	while ((ch = getopt(argc, argv, "u:")) != -1) {
+		switch (ch) {
+		case 'u':
+			unit = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc > 1 || unit < 0)
+		usage();
+
+	if (argc == 1)
+		ring = load_file(argv[0], &n);
+	else {
+#ifdef __FreeBSD__
+		ring = load_sysctl(unit, &n);
+#else
+		usage();
+#endif
+	}
+
+	prev = 0;
+	for (i = 0; i < n; i++) {
+		print_record(&ring[i], prev);
+		prev = ring[i].ft_us;
+	}
+	free(ring);
+	return (0);
+}
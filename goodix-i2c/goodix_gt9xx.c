@@ -28,11 +28,22 @@
 #include <sys/param.h>
 #include <sys/systm.h>
 #include <sys/bus.h>
+#include <sys/callout.h>
 #include <sys/clock.h>
+#include <sys/ctype.h>
 #include <sys/kernel.h>
+#include <sys/malloc.h>
 #include <sys/module.h>
 #include <sys/endian.h>
 #include <sys/rman.h>
+#include <sys/lock.h>
+#include <sys/mutex.h>
+#include <sys/sbuf.h>
+#include <sys/sx.h>
+#include <sys/sysctl.h>
+#include <sys/taskqueue.h>
+
+#include <machine/atomic.h>
 
 #include <machine/bus.h>
 #include <machine/resource.h>
@@ -42,30 +53,272 @@
 
 #include <dev/acpica/acpivar.h>
 
+#include <dev/gpio/gpiobusvar.h>
+
 #include <dev/iicbus/iicbus.h>
 #include <dev/iicbus/iiconf.h>
 
 #include <dev/evdev/input.h>
 #include <dev/evdev/evdev.h>
 
+#include "gpio_if.h"
+
 /* goodix GT9xx registers */
 
 #define GOODIX_CMD	0x8040
+#define GOODIX_CMD_CHECK	0x8046
+#define GOODIX_CONFIG	0x8047
 #define GOODIX_ID	0x8140
+#define GOODIX_COORD	0x814E
+
+/*
+ * Commands written to 0x8040. Screen off stops scanning until the host
+ * pulses INT, gesture mode keeps scanning slowly and raises INT on a touch.
+ * The controller needs 58 ms after a command before it takes another.
+ */
+#define GOODIX_CMD_SCREEN_OFF	0x05
+#define GOODIX_CMD_GESTURE	0x08
+#define GOODIX_CMD_SETTLE_MS	58
+
+/*
+ * INT doubles as the wake line. The host drives it through the INTO and
+ * INTI methods firmware provides, high for 2 to 5 ms then low for 50 ms
+ * before handing it back as an input.
+ */
+#define GOODIX_INT_SLEEP_MS	5
+#define GOODIX_INT_WAKE_MS	5
+#define GOODIX_INT_SYNC_MS	50
+
+/*
+ * The GT9xx answers at 0x14 or 0x5d, picked by the level of INT when reset
+ * is released. Reset is held low for T2, INT set up for T3 before reset
+ * goes high and then left for T4 before the INT sync.
+ */
+#define GOODIX_ADDR_ALT		(0x14 << 1)
+#define GOODIX_ADDR_DEFAULT	(0x5d << 1)
+#define GOODIX_RESET_LOW_MS	20
+#define GOODIX_RESET_SELECT_MS	1
+#define GOODIX_RESET_HIGH_MS	6
+
+#define GOODIX_ACPI_PATH	32
+
+#define GOODIX_AWAKE		0
+#define GOODIX_SLEEP		1	/* screen off, woken by the host */
+#define GOODIX_GESTURE		2	/* woken by a touch */
+
+/*
+ * The config block at 0x8047, its length depends on the part. The last two
+ * bytes are a checksum making the block sum to zero and a refresh flag the
+ * controller clears once it has taken a new config.
+ */
+#define GOODIX_CONFIG_VERSION	0
+#define GOODIX_CONFIG_MAX_X	1	/* le16 */
+#define GOODIX_CONFIG_MAX_Y	3	/* le16 */
+#define GOODIX_CONFIG_TOUCHES	5	/* low nibble */
+#define GOODIX_CONFIG_TRIGGER	6	/* INT mode, low two bits */
+#define GOODIX_CONFIG_THRESHOLD	12	/* screen touch level */
+#define GOODIX_CONFIG_RATE	15	/* report every 5 + n ms, low nibble */
+
+#define GOODIX_CONFIG_911_LEN	186
+#define GOODIX_CONFIG_967_LEN	228
+#define GOODIX_CONFIG_MAX_LEN	240
+
+#define GOODIX_RATE_MIN_MS	5
+
+#define GOODIX_TRIGGER_RISING	0
+#define GOODIX_TRIGGER_FALLING	1
+#define GOODIX_TRIGGER_LOW	2
+#define GOODIX_TRIGGER_HIGH	3
+#define GOODIX_TRIGGER_MASK	0x03
+
+/* Config fields behind goodix_sysctl_config */
+#define GOODIX_SYSCTL_RATE	0
+#define GOODIX_SYSCTL_THRESHOLD	1
+#define GOODIX_SYSCTL_CONTACTS	2
+
+/*
+ * A frame is the status byte at 0x814E followed by one record per contact.
+ * Records are the track id, x, y and size (le16) and a reserved byte.
+ */
+#define GOODIX_STATUS_READY	0x80
+#define GOODIX_STATUS_TOUCHES	0x0f
+#define GOODIX_CONTACT_LEN	8
+#define GOODIX_MAX_CONTACTS	10
+#define GOODIX_FRAME_LEN	(1 + GOODIX_CONTACT_LEN * GOODIX_MAX_CONTACTS)
+
+/*
+ * Each frame is stamped when the interrupt arrives, when the I2C read
+ * completes and after evdev_sync. Stage latencies go into histograms where
+ * bucket n counts latencies below 2^n us, halved every GOODIX_LAT_WINDOW
+ * frames so they follow recent behaviour.
+ */
+#define GOODIX_STAMP_IRQ	0
+#define GOODIX_STAMP_I2C	1
+#define GOODIX_STAMP_SYNC	2
+#define GOODIX_NSTAMPS		3
+
+#define GOODIX_LAT_READ		0	/* interrupt to I2C done */
+#define GOODIX_LAT_REPORT	1	/* I2C done to evdev_sync */
+#define GOODIX_LAT_TOTAL	2	/* interrupt to evdev_sync */
+#define GOODIX_NLAT		3
+#define GOODIX_LAT_BUCKETS	20
+#define GOODIX_LAT_WINDOW	1024
+
+/*
+ * Raw frames as read from the controller, kept for replay while capture is
+ * on. capture_ring exports the records oldest first in this layout, so
+ * sysctl -b output can be fed straight back to the replay harness.
+ */
+#define GOODIX_CAPTURE_FRAMES	256
+
+struct goodix_capture {
+	uint64_t	gc_us;				/* uptime of the interrupt */
+	uint8_t		gc_len;				/* bytes of gc_frame read */
+	uint8_t		gc_frame[GOODIX_FRAME_LEN];
+};
+
+/*
+ * Without an interrupt the coordinate status is polled, at the report rate
+ * while fingers are down, doubling the interval once the panel is released
+ * until it reaches the idle interval.
+ */
+#define GOODIX_POLL_IDLE_MS	100
+#define GOODIX_POLL_IDLE_MAX_MS	1000
+#define GOODIX_DEFAULT_PERIOD_MS	10
+
+#define GOODIX_DEFAULT_MAX_X	1920
+#define GOODIX_DEFAULT_MAX_Y	1200
+
+#define GOODIX_LOCK(_sc)		mtx_lock(&(_sc)->sc_mtx)
+#define GOODIX_UNLOCK(_sc)		mtx_unlock(&(_sc)->sc_mtx)
+#define GOODIX_LOCK_INIT(_sc) \
+	mtx_init(&_sc->sc_mtx, device_get_nameunit((_sc)->sc_dev), \
+		"goodix", MTX_DEF)
+#define GOODIX_LOCK_DESTROY(_sc)	mtx_destroy(&(_sc)->sc_mtx)
+#define GOODIX_ASSERT_LOCKED(_sc)	mtx_assert(&(_sc)->sc_mtx, MA_OWNED)
+
+/*
+ * Contacts are mapped from controller to panel coordinates by an affine
+ * transform in 16.16 fixed point,
+ *	x' = (m[0] * x + m[1] * y + m[2]) >> 16
+ *	y' = (m[3] * x + m[4] * y + m[5]) >> 16
+ * built at attach from the orientation tunables and the calibration matrix.
+ */
+#define GOODIX_FIX_SHIFT	16
+#define GOODIX_FIX_ONE		(1 << GOODIX_FIX_SHIFT)
+
+/* Calibration bounds, keeping the products of the transform in 64 bits */
+#define GOODIX_CAL_SCALE_MAX	((int64_t)16 << GOODIX_FIX_SHIFT)
+#define GOODIX_CAL_OFFSET_MAX	((int64_t)65535 << GOODIX_FIX_SHIFT)
+
+struct goodix_xform {
+	int64_t		m[6];
+};
+
+/* How _CRS says the controller is wired, pins are -1 when absent */
+struct goodix_crs {
+	uint16_t	gc_addr;		/* 7 bit */
+	u_int		gc_speed;		/* Hz */
+	char		gc_bus[GOODIX_ACPI_PATH];
+	int		gc_int_pin;
+	uint8_t		gc_int_triggering;
+	uint8_t		gc_int_polarity;
+	int		gc_reset_pin;
+	char		gc_reset_gpio[GOODIX_ACPI_PATH];
+};
+
+/*
+ * The ACPI device only carries _CRS, it finds the I2C controller named
+ * there and adds goodix as a child of its iicbus.
+ */
+struct goodix_acpi_softc {
+	device_t	sc_dev;
+	ACPI_HANDLE	sc_handle;
+	struct goodix_crs sc_crs;
+	device_t	sc_iicbus;
+	device_t	sc_child;
+};
 
 struct goodix_softc {
 	device_t			sc_dev;
 	uint8_t				sc_addr;
+	struct mtx			sc_mtx;
 	
 	ACPI_HANDLE			sc_handle;
+	struct goodix_crs	sc_crs;
+	device_t			sc_reset_gpio;	/* GpioIo controller */
 
 
 	struct resource 	*sc_irq_res;
 	void				*sc_intrhand;
 
-	int					sc_pen_down;
-	int					sc_x;
-	int					sc_y;
+	/*
+	 * The filter only notes the interrupt, frames are read from a
+	 * software interrupt priority taskqueue so I2C never runs in an
+	 * interrupt thread.
+	 */
+	struct taskqueue	*sc_tq;
+	struct task			sc_task;
+	u_int				sc_intr_pending;	/* frame read queued */
+	sbintime_t			sc_intr_time;		/* first interrupt of it */
+
+	uint64_t			sc_intr_count;
+	uint64_t			sc_coalesced;		/* merged into a queued read */
+	uint64_t			sc_frames;
+	uint64_t			sc_latency_us;		/* interrupt to evdev_sync */
+	uint64_t			sc_latency_max_us;
+	sbintime_t			sc_stamp[GOODIX_NSTAMPS];	/* last frame */
+	uint64_t			sc_lat_hist[GOODIX_NLAT][GOODIX_LAT_BUCKETS];
+
+	/* Polling when there is no interrupt, the callout holds sc_mtx */
+	struct callout		sc_poll;
+	int					sc_polling;
+	int					sc_poll_idle_ms;
+	int					sc_poll_down;		/* contacts in the last frame */
+	sbintime_t			sc_poll_interval;
+	sbintime_t			sc_report_period;	/* from the config rate */
+	uint64_t			sc_polls;
+
+	/*
+	 * Power state, changed with sc_config_lock held. sc_quiet stops the
+	 * filter and the poll queueing reads while INT is driven or the
+	 * controller sleeps.
+	 */
+	int					sc_power;
+	u_int				sc_quiet;
+	int					sc_int_acpi;	/* INTO/INTI present */
+	uint64_t			sc_sleeps;
+	uint64_t			sc_wakes;
+
+	struct goodix_capture	*sc_capture;	/* ring, NULL when off */
+	u_int				sc_capture_head;	/* next record written */
+	u_int				sc_capture_count;
+
+	char				sc_id[5];		/* product id, "911" */
+
+	/* Cached config block, sc_config_lock is held across writes */
+	struct sx			sc_config_lock;
+	uint8_t				sc_config[GOODIX_CONFIG_MAX_LEN];
+	int					sc_config_len;
+	uint64_t			sc_config_writes;
+
+	int					sc_max_x;
+	int					sc_max_y;
+	int					sc_max_contacts;
+	int					sc_nslots;		/* registered with evdev */
+	int					sc_frame_len;	/* bytes read per interrupt */
+
+	/* Orientation, fixed once the evdev ranges are registered */
+	int					sc_swap_xy;
+	int					sc_invert_x;
+	int					sc_invert_y;
+	int					sc_rotate;	/* degrees clockwise */
+	int					sc_out_x;	/* reported size */
+	int					sc_out_y;
+	int64_t				sc_calib[6];	/* 16.16, after orientation */
+	struct goodix_xform	sc_orient;
+	struct goodix_xform	sc_xform;	/* calibration * orientation */
+
 	struct evdev_dev 	*sc_evdev;
 };
 
@@ -77,48 +330,663 @@ static char *goodix_hids[] = {
 static int goodix_detach(device_t);
 static int goodix_read(device_t, uint16_t, uint8_t *, uint8_t);
 static int goodix_write(device_t, uint16_t, uint8_t *, uint8_t);
-static void goodix_intr(void *);
-static void goodix_ev_report(struct goodix_softc *);
+static int goodix_intr(void *);
+static void goodix_task(void *, int);
+static int goodix_frame(struct goodix_softc *);
+static int goodix_power(struct goodix_softc *, int);
+static int goodix_reset(struct goodix_softc *);
+static void goodix_poll(void *);
+static int goodix_ev_report(struct goodix_softc *, uint8_t *, sbintime_t);
+
+static ACPI_STATUS parse_resources(ACPI_RESOURCE *, void *);
+
+/* sbttous() overflows on absolute times after about 35 minutes of uptime */
+static uint64_t
+goodix_sbt_us(sbintime_t sbt)
+{
+	return ((sbt >> 32) * 1000000 + sbttous(sbt & 0xffffffff));
+}
 
-static ACPI_STATUS parse_resources(ACPI_RESOURCE *, void *); 
+/*
+ * Record the timeline of a reported frame, a lock round trip and a few
+ * increments so it can stay on all the time.
+ */
+static void
+goodix_latency(struct goodix_softc *sc, sbintime_t irq, sbintime_t i2c,
+    sbintime_t sync)
+{
+	uint64_t us[GOODIX_NLAT];
+	int i, j;
+
+	us[GOODIX_LAT_READ] = sbttous(i2c - irq);
+	us[GOODIX_LAT_REPORT] = sbttous(sync - i2c);
+	us[GOODIX_LAT_TOTAL] = sbttous(sync - irq);
+
+	GOODIX_LOCK(sc);
+	sc->sc_stamp[GOODIX_STAMP_IRQ] = irq;
+	sc->sc_stamp[GOODIX_STAMP_I2C] = i2c;
+	sc->sc_stamp[GOODIX_STAMP_SYNC] = sync;
+
+	sc->sc_frames++;
+	sc->sc_latency_us = us[GOODIX_LAT_TOTAL];
+	if (us[GOODIX_LAT_TOTAL] > sc->sc_latency_max_us)
+		sc->sc_latency_max_us = us[GOODIX_LAT_TOTAL];
+
+	if (sc->sc_frames % GOODIX_LAT_WINDOW == 0)
+		for (i = 0; i < GOODIX_NLAT; i++)
+			for (j = 0; j < GOODIX_LAT_BUCKETS; j++)
+				sc->sc_lat_hist[i][j] /= 2;
+	for (i = 0; i < GOODIX_NLAT; i++)
+		sc->sc_lat_hist[i][MIN(flsll(us[i]), GOODIX_LAT_BUCKETS - 1)]++;
+	GOODIX_UNLOCK(sc);
+}
 
 static int
-goodix_attach(device_t dev)
+goodix_sysctl_latency(SYSCTL_HANDLER_ARGS)
 {
-	int res, rid, err;
-	uint8_t buf[5];
 	struct goodix_softc *sc;
-	ACPI_STATUS status;
+	struct sbuf *sb;
+	uint64_t hist[GOODIX_LAT_BUCKETS];
+	int error;
+	int i;
 
-	sc = device_get_softc(dev);
-	sc->sc_dev = dev;
+	sc = arg1;
 
-	sc->sc_handle = acpi_get_handle(dev);
-	status = AcpiWalkResources(sc->sc_handle, "_CRS", parse_resources, dev);
+	GOODIX_LOCK(sc);
+	memcpy(hist, sc->sc_lat_hist[arg2], sizeof(hist));
+	GOODIX_UNLOCK(sc);
 
-	return (ENXIO);
+	sb = sbuf_new_for_sysctl(NULL, NULL, 128, req);
+	for (i = 0; i < GOODIX_LAT_BUCKETS; i++) {
+		if (hist[i] == 0)
+			continue;
+		sbuf_printf(sb, "\n<%juus: %ju", (uintmax_t)1 << i,
+			(uintmax_t)hist[i]);
+	}
+	error = sbuf_finish(sb);
+	sbuf_delete(sb);
+
+	return (error);
+}
 
-	res = goodix_read(dev, GOODIX_CMD, buf, 4);
-	if (res)
-		device_printf(dev, "error I guess\n");
+static int
+goodix_sysctl_poll_idle(SYSCTL_HANDLER_ARGS)
+{
+	struct goodix_softc *sc;
+	int error, val;
+
+	sc = arg1;
+	val = sc->sc_poll_idle_ms;
+	error = sysctl_handle_int(oidp, &val, 0, req);
+	if (error || req->newptr == NULL)
+		return (error);
+	if (val < GOODIX_RATE_MIN_MS || val > GOODIX_POLL_IDLE_MAX_MS)
+		return (EINVAL);
+
+	GOODIX_LOCK(sc);
+	sc->sc_poll_idle_ms = val;
+	GOODIX_UNLOCK(sc);
+	return (0);
+}
 
-	buf[4] = '\0';	
-	device_printf(dev, "goodix touch screen addr: %d, id %s\n", sc->sc_addr, buf);
+static int
+goodix_sysctl_power(SYSCTL_HANDLER_ARGS)
+{
+	struct goodix_softc *sc;
+	int error, val;
+
+	sc = arg1;
+	val = sc->sc_power;
+	error = sysctl_handle_int(oidp, &val, 0, req);
+	if (error || req->newptr == NULL)
+		return (error);
+	if (val != GOODIX_AWAKE && val != GOODIX_SLEEP && val != GOODIX_GESTURE)
+		return (EINVAL);
+
+	sx_xlock(&sc->sc_config_lock);
+	error = goodix_power(sc, val);
+	sx_xunlock(&sc->sc_config_lock);
+	return (error);
+}
 
-	rid = 0;
-	sc->sc_irq_res = bus_alloc_resource_any(dev, SYS_RES_IRQ, &rid, RF_ACTIVE);
-	if (!sc->sc_irq_res) {
-		device_printf(dev, "cannot allocate interrupt\n");
-		return (ENXIO);
+static void
+goodix_capture_frame(struct goodix_softc *sc, uint8_t *frame, int len,
+    sbintime_t irq)
+{
+	struct goodix_capture *gc;
+
+	GOODIX_LOCK(sc);
+	if (sc->sc_capture != NULL) {
+		gc = &sc->sc_capture[sc->sc_capture_head];
+		gc->gc_us = goodix_sbt_us(irq);
+		gc->gc_len = len;
+		memcpy(gc->gc_frame, frame, len);
+		memset(&gc->gc_frame[len], 0, GOODIX_FRAME_LEN - len);
+		sc->sc_capture_head = (sc->sc_capture_head + 1) %
+			GOODIX_CAPTURE_FRAMES;
+		if (sc->sc_capture_count < GOODIX_CAPTURE_FRAMES)
+			sc->sc_capture_count++;
 	}
+	GOODIX_UNLOCK(sc);
+}
 
-	if (bus_setup_intr(dev, sc->sc_irq_res, INTR_TYPE_MISC | INTR_MPSAFE,
-		NULL, goodix_intr, sc, &sc->sc_intrhand) != 0) {
-		bus_release_resource(dev, SYS_RES_IRQ, 0, sc->sc_irq_res);
-		device_printf(dev, "Unable to setup the irq handler.\n");
+static int
+goodix_sysctl_capture(SYSCTL_HANDLER_ARGS)
+{
+	struct goodix_softc *sc;
+	struct goodix_capture *ring;
+	int error, val;
+
+	sc = arg1;
+	val = sc->sc_capture != NULL;
+	error = sysctl_handle_int(oidp, &val, 0, req);
+	if (error || req->newptr == NULL)
+		return (error);
+
+	/* Turning capture on again keeps what is already in the ring */
+	ring = NULL;
+	if (val)
+		ring = malloc(sizeof(*ring) * GOODIX_CAPTURE_FRAMES, M_DEVBUF,
+			M_WAITOK | M_ZERO);
+
+	GOODIX_LOCK(sc);
+	if (val && sc->sc_capture == NULL) {
+		sc->sc_capture = ring;
+		sc->sc_capture_head = 0;
+		sc->sc_capture_count = 0;
+		ring = NULL;
+	} else if (!val) {
+		ring = sc->sc_capture;
+		sc->sc_capture = NULL;
+	}
+	GOODIX_UNLOCK(sc);
+
+	if (ring != NULL)
+		free(ring, M_DEVBUF);
+	return (0);
+}
+
+static int
+goodix_sysctl_capture_ring(SYSCTL_HANDLER_ARGS)
+{
+	struct goodix_softc *sc;
+	struct goodix_capture *out;
+	u_int i, first, n;
+	int error;
+
+	sc = arg1;
+	out = malloc(sizeof(*out) * GOODIX_CAPTURE_FRAMES, M_TEMP, M_WAITOK);
+
+	GOODIX_LOCK(sc);
+	n = 0;
+	if (sc->sc_capture != NULL) {
+		n = sc->sc_capture_count;
+		first = (sc->sc_capture_head + GOODIX_CAPTURE_FRAMES - n) %
+			GOODIX_CAPTURE_FRAMES;
+		for (i = 0; i < n; i++)
+			out[i] = sc->sc_capture[(first + i) %
+				GOODIX_CAPTURE_FRAMES];
+	}
+	GOODIX_UNLOCK(sc);
+
+	error = SYSCTL_OUT(req, out, sizeof(*out) * n);
+	free(out, M_TEMP);
+	return (error);
+}
+
+static int
+goodix_sysctl_stamps(SYSCTL_HANDLER_ARGS)
+{
+	struct goodix_softc *sc;
+	struct sbuf *sb;
+	sbintime_t stamp[GOODIX_NSTAMPS];
+	int error;
+
+	sc = arg1;
+
+	GOODIX_LOCK(sc);
+	memcpy(stamp, sc->sc_stamp, sizeof(stamp));
+	GOODIX_UNLOCK(sc);
+
+	sb = sbuf_new_for_sysctl(NULL, NULL, 64, req);
+	sbuf_printf(sb, "irq %ju i2c %ju sync %ju",
+		(uintmax_t)goodix_sbt_us(stamp[GOODIX_STAMP_IRQ]),
+		(uintmax_t)goodix_sbt_us(stamp[GOODIX_STAMP_I2C]),
+		(uintmax_t)goodix_sbt_us(stamp[GOODIX_STAMP_SYNC]));
+	error = sbuf_finish(sb);
+	sbuf_delete(sb);
+
+	return (error);
+}
+
+static int
+goodix_config_len(const char *id)
+{
+	if (strcmp(id, "911") == 0 || strcmp(id, "9110") == 0 ||
+	    strcmp(id, "927") == 0 || strcmp(id, "928") == 0 ||
+	    strcmp(id, "9271") == 0)
+		return (GOODIX_CONFIG_911_LEN);
+	if (strcmp(id, "912") == 0 || strcmp(id, "967") == 0)
+		return (GOODIX_CONFIG_967_LEN);
+	return (GOODIX_CONFIG_MAX_LEN);
+}
+
+static uint8_t
+goodix_config_checksum(const uint8_t *cfg, int len)
+{
+	uint8_t sum;
+	int i;
+
+	sum = 0;
+	for (i = 0; i < len - 2; i++)
+		sum += cfg[i];
+	return (~sum + 1);
+}
+
+/*
+ * Send the cached config back to the controller, checksum and refresh flag
+ * included, as a single transfer.
+ */
+static int
+goodix_config_write(struct goodix_softc *sc)
+{
+	uint8_t cfg[GOODIX_CONFIG_MAX_LEN];
+	int len, error;
+
+	sx_assert(&sc->sc_config_lock, SA_XLOCKED);
+
+	len = sc->sc_config_len;
+	memcpy(cfg, sc->sc_config, len);
+	cfg[len - 2] = goodix_config_checksum(cfg, len);
+	cfg[len - 1] = 1;
+
+	error = goodix_write(sc->sc_dev, GOODIX_CONFIG, cfg, len);
+	if (error == 0) {
+		sc->sc_config[len - 2] = cfg[len - 2];
+		sc->sc_config_writes++;
+	}
+	return (error);
+}
+
+/*
+ * Report rate in Hz, touch threshold and contact count from the config
+ * block. A change is written to the controller straight away and the cache
+ * left alone if that fails.
+ */
+static int
+goodix_sysctl_config(SYSCTL_HANDLER_ARGS)
+{
+	struct goodix_softc *sc;
+	uint8_t *cfg, old[GOODIX_CONFIG_MAX_LEN];
+	int error, val;
+
+	sc = arg1;
+	cfg = sc->sc_config;
+
+	sx_xlock(&sc->sc_config_lock);
+	switch (arg2) {
+	case GOODIX_SYSCTL_RATE:
+		val = 1000 / (GOODIX_RATE_MIN_MS +
+			(cfg[GOODIX_CONFIG_RATE] & 0x0f));
+		break;
+	case GOODIX_SYSCTL_THRESHOLD:
+		val = cfg[GOODIX_CONFIG_THRESHOLD];
+		break;
+	case GOODIX_SYSCTL_CONTACTS:
+		val = cfg[GOODIX_CONFIG_TOUCHES] & GOODIX_STATUS_TOUCHES;
+		break;
+	default:
+		sx_xunlock(&sc->sc_config_lock);
+		return (EINVAL);
+	}
+
+	error = sysctl_handle_int(oidp, &val, 0, req);
+	if (error || req->newptr == NULL)
+		goto out;
+
+	memcpy(old, cfg, sc->sc_config_len);
+	switch (arg2) {
+	case GOODIX_SYSCTL_RATE:
+		if (val < 1000 / (GOODIX_RATE_MIN_MS + 0x0f) ||
+		    val > 1000 / GOODIX_RATE_MIN_MS) {
+			error = EINVAL;
+			goto out;
+		}
+		cfg[GOODIX_CONFIG_RATE] = (cfg[GOODIX_CONFIG_RATE] & ~0x0f) |
+			(1000 / val - GOODIX_RATE_MIN_MS);
+		break;
+	case GOODIX_SYSCTL_THRESHOLD:
+		if (val < 1 || val > UINT8_MAX) {
+			error = EINVAL;
+			goto out;
+		}
+		cfg[GOODIX_CONFIG_THRESHOLD] = val;
+		break;
+	case GOODIX_SYSCTL_CONTACTS:
+		/* Slots can't be added once evdev is registered */
+		if (val < 1 || val > sc->sc_nslots) {
+			error = EINVAL;
+			goto out;
+		}
+		cfg[GOODIX_CONFIG_TOUCHES] =
+			(cfg[GOODIX_CONFIG_TOUCHES] & ~GOODIX_STATUS_TOUCHES) | val;
+		break;
+	}
+
+	if (memcmp(old, cfg, sc->sc_config_len) == 0)
+		goto out;
+
+	error = goodix_config_write(sc);
+	if (error) {
+		device_printf(sc->sc_dev, "config write failed: error %d\n",
+			error);
+		memcpy(cfg, old, sc->sc_config_len);
+		error = EIO;
+		goto out;
+	}
+
+	GOODIX_LOCK(sc);
+	if (arg2 == GOODIX_SYSCTL_RATE)
+		sc->sc_report_period = SBT_1MS * (GOODIX_RATE_MIN_MS +
+			(cfg[GOODIX_CONFIG_RATE] & 0x0f));
+	if (arg2 == GOODIX_SYSCTL_CONTACTS) {
+		sc->sc_max_contacts = val;
+		sc->sc_frame_len = 1 + GOODIX_CONTACT_LEN * val;
+	}
+	GOODIX_UNLOCK(sc);
+out:
+	sx_xunlock(&sc->sc_config_lock);
+	return (error);
+}
+
+/* r = a * b, both maps of homogeneous coordinates with a 0 0 1 last row */
+static void
+goodix_xform_mul(struct goodix_xform *r, const struct goodix_xform *a,
+    const struct goodix_xform *b)
+{
+	const int64_t *am, *bm;
+	int i;
+
+	am = a->m;
+	bm = b->m;
+	for (i = 0; i < 6; i += 3) {
+		r->m[i + 0] = (am[i] * bm[0] + am[i + 1] * bm[3]) >>
+			GOODIX_FIX_SHIFT;
+		r->m[i + 1] = (am[i] * bm[1] + am[i + 1] * bm[4]) >>
+			GOODIX_FIX_SHIFT;
+		r->m[i + 2] = ((am[i] * bm[2] + am[i + 1] * bm[5]) >>
+			GOODIX_FIX_SHIFT) + am[i + 2];
+	}
+}
+
+/* Follow the map in r by the integer map m */
+static void
+goodix_xform_then(struct goodix_xform *r, int64_t m0, int64_t m1, int64_t m2,
+    int64_t m3, int64_t m4, int64_t m5)
+{
+	struct goodix_xform t, o;
+
+	t.m[0] = m0 * GOODIX_FIX_ONE;
+	t.m[1] = m1 * GOODIX_FIX_ONE;
+	t.m[2] = m2 * GOODIX_FIX_ONE;
+	t.m[3] = m3 * GOODIX_FIX_ONE;
+	t.m[4] = m4 * GOODIX_FIX_ONE;
+	t.m[5] = m5 * GOODIX_FIX_ONE;
+	o = *r;
+	goodix_xform_mul(r, &t, &o);
+}
+
+/*
+ * Build the orientation part of the transform, the raw axes are swapped
+ * and inverted first and the result rotated. Leaves the reported size in
+ * sc_out_x and sc_out_y.
+ */
+static void
+goodix_orient(struct goodix_softc *sc)
+{
+	struct goodix_xform *o;
+	int w, h, t;
+
+	o = &sc->sc_orient;
+	memset(o, 0, sizeof(*o));
+	o->m[0] = o->m[4] = GOODIX_FIX_ONE;
+	w = sc->sc_max_x;
+	h = sc->sc_max_y;
+
+	if (sc->sc_swap_xy) {
+		goodix_xform_then(o, 0, 1, 0, 1, 0, 0);
+		t = w; w = h; h = t;
+	}
+	if (sc->sc_invert_x)
+		goodix_xform_then(o, -1, 0, w - 1, 0, 1, 0);
+	if (sc->sc_invert_y)
+		goodix_xform_then(o, 1, 0, 0, 0, -1, h - 1);
+
+	switch (sc->sc_rotate) {
+	case 0:
+		break;
+	case 90:
+		goodix_xform_then(o, 0, -1, h - 1, 1, 0, 0);
+		t = w; w = h; h = t;
+		break;
+	case 180:
+		goodix_xform_then(o, -1, 0, w - 1, 0, -1, h - 1);
+		break;
+	case 270:
+		goodix_xform_then(o, 0, 1, 0, -1, 0, w - 1);
+		t = w; w = h; h = t;
+		break;
+	default:
+		device_printf(sc->sc_dev, "invalid rotation %d, ignored\n",
+			sc->sc_rotate);
+		sc->sc_rotate = 0;
+		break;
+	}
+
+	sc->sc_out_x = w;
+	sc->sc_out_y = h;
+}
+
+static void
+goodix_calibrate(struct goodix_softc *sc)
+{
+	struct goodix_xform cal;
+
+	GOODIX_LOCK(sc);
+	memcpy(cal.m, sc->sc_calib, sizeof(cal.m));
+	goodix_xform_mul(&sc->sc_xform, &cal, &sc->sc_orient);
+	GOODIX_UNLOCK(sc);
+}
+
+/*
+ * The calibration matrix as six 16.16 integers "a b c d e f", applied after
+ * the orientation with c and f in reported units. 65536 0 0 0 65536 0 is
+ * the identity. Scale terms are limited to 16 and offsets to 65535 units,
+ * which also refuses the saturated value strtoq() returns on overflow.
+ */
+static int
+goodix_sysctl_calibration(SYSCTL_HANDLER_ARGS)
+{
+	struct goodix_softc *sc;
+	struct sbuf sb;
+	char buf[128];
+	int64_t m[6], lim;
+	char *p, *end;
+	int error, i;
+
+	sc = arg1;
+
+	GOODIX_LOCK(sc);
+	memcpy(m, sc->sc_calib, sizeof(m));
+	GOODIX_UNLOCK(sc);
+
+	sbuf_new(&sb, buf, sizeof(buf), SBUF_FIXEDLEN);
+	for (i = 0; i < 6; i++)
+		sbuf_printf(&sb, "%s%jd", i ? " " : "", (intmax_t)m[i]);
+	sbuf_finish(&sb);
+	sbuf_delete(&sb);
+
+	error = sysctl_handle_string(oidp, buf, sizeof(buf), req);
+	if (error || req->newptr == NULL)
+		return (error);
+
+	p = buf;
+	for (i = 0; i < 6; i++) {
+		m[i] = strtoq(p, &end, 0);
+		if (end == p)
+			return (EINVAL);
+		lim = (i == 2 || i == 5) ? GOODIX_CAL_OFFSET_MAX :
+			GOODIX_CAL_SCALE_MAX;
+		if (m[i] > lim || m[i] < -lim)
+			return (EINVAL);
+		p = end;
+	}
+	while (isspace(*p))
+		p++;
+	if (*p != '\0')
+		return (EINVAL);
+
+	GOODIX_LOCK(sc);
+	memcpy(sc->sc_calib, m, sizeof(m));
+	GOODIX_UNLOCK(sc);
+	goodix_calibrate(sc);
+
+	return (0);
+}
+
+/* The config's INT mode matching the GpioInt, or -1 for both edges */
+static int
+goodix_crs_trigger(const struct goodix_crs *crs)
+{
+	if (crs->gc_int_polarity == ACPI_ACTIVE_BOTH)
+		return (-1);
+	if (crs->gc_int_triggering == ACPI_EDGE_SENSITIVE)
+		return (crs->gc_int_polarity == ACPI_ACTIVE_LOW ?
+			GOODIX_TRIGGER_FALLING : GOODIX_TRIGGER_RISING);
+	return (crs->gc_int_polarity == ACPI_ACTIVE_LOW ?
+		GOODIX_TRIGGER_LOW : GOODIX_TRIGGER_HIGH);
+}
+
+static int
+goodix_attach(device_t dev)
+{
+	int res, rid, err, badsum;
+	uint8_t *cfg;
+	struct goodix_softc *sc;
+	struct sysctl_ctx_list *ctx;
+	struct sysctl_oid *tree;
+	ACPI_HANDLE h;
+
+	sc = device_get_softc(dev);
+	sc->sc_dev = dev;
+
+	/* Sleep and reset need firmware's methods for driving INT */
+	sc->sc_int_acpi = ACPI_SUCCESS(AcpiGetHandle(sc->sc_handle, "INTO",
+		&h)) && ACPI_SUCCESS(AcpiGetHandle(sc->sc_handle, "INTI", &h));
+	if (sc->sc_int_acpi && sc->sc_reset_gpio != NULL) {
+		res = goodix_reset(sc);
+		if (res)
+			device_printf(dev, "reset failed: error %d\n", res);
+	}
+
+	res = goodix_read(dev, GOODIX_ID, (uint8_t *)sc->sc_id, 4);
+	if (res) {
+		device_printf(dev, "unable to read product id: error %d\n", res);
 		return (ENXIO);
 	}
 
+	sc->sc_id[4] = '\0';	
+	device_printf(dev, "goodix touch screen addr: 0x%x, id %s\n",
+		sc->sc_addr >> 1, sc->sc_id);
+
+	GOODIX_LOCK_INIT(sc);
+	sx_init(&sc->sc_config_lock, "goodix config");
+	callout_init_mtx(&sc->sc_poll, &sc->sc_mtx, 0);
+
+	/* The panel size and contact count firmware configured */
+	sc->sc_max_x = GOODIX_DEFAULT_MAX_X;
+	sc->sc_max_y = GOODIX_DEFAULT_MAX_Y;
+	sc->sc_max_contacts = GOODIX_MAX_CONTACTS;
+	sc->sc_report_period = SBT_1MS * GOODIX_DEFAULT_PERIOD_MS;
+	cfg = sc->sc_config;
+	sc->sc_config_len = goodix_config_len(sc->sc_id);
+	res = goodix_read(dev, GOODIX_CONFIG, cfg, sc->sc_config_len);
+	badsum = 0;
+	if (res == 0) {
+		if (cfg[sc->sc_config_len - 2] !=
+		    goodix_config_checksum(cfg, sc->sc_config_len)) {
+			device_printf(dev, "config checksum mismatch, "
+				"not tuning it\n");
+			badsum = 1;
+		}
+		if (sc->sc_crs.gc_int_pin >= 0 &&
+		    (cfg[GOODIX_CONFIG_TRIGGER] & GOODIX_TRIGGER_MASK) !=
+		    goodix_crs_trigger(&sc->sc_crs))
+			device_printf(dev, "config INT trigger %d does not "
+				"match the GpioInt\n",
+				cfg[GOODIX_CONFIG_TRIGGER] & GOODIX_TRIGGER_MASK);
+		if (le16dec(&cfg[GOODIX_CONFIG_MAX_X]) != 0)
+			sc->sc_max_x = le16dec(&cfg[GOODIX_CONFIG_MAX_X]);
+		if (le16dec(&cfg[GOODIX_CONFIG_MAX_Y]) != 0)
+			sc->sc_max_y = le16dec(&cfg[GOODIX_CONFIG_MAX_Y]);
+		if ((cfg[GOODIX_CONFIG_TOUCHES] & GOODIX_STATUS_TOUCHES) != 0)
+			sc->sc_max_contacts = MIN(GOODIX_MAX_CONTACTS,
+				cfg[GOODIX_CONFIG_TOUCHES] & GOODIX_STATUS_TOUCHES);
+		sc->sc_report_period = SBT_1MS * (GOODIX_RATE_MIN_MS +
+			(cfg[GOODIX_CONFIG_RATE] & 0x0f));
+	} else {
+		device_printf(dev, "unable to read config, using defaults\n");
+		sc->sc_config_len = 0;
+	}
+	sc->sc_nslots = sc->sc_max_contacts;
+	sc->sc_frame_len = 1 + GOODIX_CONTACT_LEN * sc->sc_max_contacts;
+
+	ctx = device_get_sysctl_ctx(dev);
+	tree = device_get_sysctl_tree(dev);
+	SYSCTL_ADD_INT(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+		"swap_xy", CTLFLAG_RDTUN, &sc->sc_swap_xy, 0,
+		"Swap the controller axes");
+	SYSCTL_ADD_INT(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+		"invert_x", CTLFLAG_RDTUN, &sc->sc_invert_x, 0,
+		"Invert the x axis, after any swap");
+	SYSCTL_ADD_INT(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+		"invert_y", CTLFLAG_RDTUN, &sc->sc_invert_y, 0,
+		"Invert the y axis, after any swap");
+	SYSCTL_ADD_INT(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+		"rotate", CTLFLAG_RDTUN, &sc->sc_rotate, 0,
+		"Rotate clockwise by 0, 90, 180 or 270 degrees");
+	goodix_orient(sc);
+
+	sc->sc_calib[0] = sc->sc_calib[4] = GOODIX_FIX_ONE;
+	SYSCTL_ADD_PROC(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+		"calibration", CTLTYPE_STRING | CTLFLAG_RWTUN, sc, 0,
+		goodix_sysctl_calibration, "A",
+		"Calibration matrix, six 16.16 values");
+	goodix_calibrate(sc);
+
+	/*
+	 * Without a config there is nothing to tune. A bad checksum means
+	 * the length is wrong for this part, a write would land the checksum
+	 * and refresh flag in the middle of the block.
+	 */
+	if (sc->sc_config_len != 0 && !badsum) {
+		SYSCTL_ADD_PROC(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+			"report_rate", CTLTYPE_INT | CTLFLAG_RW, sc,
+			GOODIX_SYSCTL_RATE, goodix_sysctl_config, "I",
+			"Coordinate report rate in Hz, 50 to 200");
+		SYSCTL_ADD_PROC(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+			"touch_threshold", CTLTYPE_INT | CTLFLAG_RW, sc,
+			GOODIX_SYSCTL_THRESHOLD, goodix_sysctl_config, "I",
+			"Signal level a touch has to reach");
+		SYSCTL_ADD_PROC(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+			"max_contacts", CTLTYPE_INT | CTLFLAG_RW, sc,
+			GOODIX_SYSCTL_CONTACTS, goodix_sysctl_config, "I",
+			"Contacts reported per frame");
+		SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+			"config_writes", CTLFLAG_RD, &sc->sc_config_writes, 0,
+			"Config blocks written to the controller");
+	}
+
 	sc->sc_evdev = evdev_alloc();
 	evdev_set_name(sc->sc_evdev, device_get_desc(dev));
 	evdev_set_phys(sc->sc_evdev, device_get_nameunit(dev));
@@ -127,12 +995,25 @@ goodix_attach(device_t dev)
 	evdev_support_event(sc->sc_evdev, EV_SYN);
 	evdev_support_event(sc->sc_evdev, EV_ABS);
 	evdev_support_event(sc->sc_evdev, EV_KEY);
-
-	//TODO fix these
-	//evdev_support_abs(sc->sc_evdev, ABS_X, 0, 0,
-		//ADC_MAX_VALUE, 0, 0, 0);
-	//evdev_support_abs(sc->sc_evdev, ABS_Y, 0, 0,
-		//ADC_MAX_VALUE, 0, 0, 0);
+	evdev_support_event(sc->sc_evdev, EV_MSC);
+	evdev_support_msc(sc->sc_evdev, MSC_TIMESTAMP);
+
+	/*
+	 * Contacts are reported in protocol B slots, evdev releases the
+	 * slots missing from a frame and emulates single touch for us.
+	 */
+	evdev_support_abs(sc->sc_evdev, ABS_MT_SLOT, 0, 0,
+		sc->sc_nslots - 1, 0, 0, 0);
+	evdev_support_abs(sc->sc_evdev, ABS_MT_TRACKING_ID, 0, -1,
+		GOODIX_STATUS_TOUCHES, 0, 0, 0);
+	evdev_support_abs(sc->sc_evdev, ABS_MT_POSITION_X, 0, 0,
+		sc->sc_out_x - 1, 0, 0, 0);
+	evdev_support_abs(sc->sc_evdev, ABS_MT_POSITION_Y, 0, 0,
+		sc->sc_out_y - 1, 0, 0, 0);
+	evdev_support_abs(sc->sc_evdev, ABS_MT_TOUCH_MAJOR, 0, 0,
+		255, 0, 0, 0);
+	evdev_set_flag(sc->sc_evdev, EVDEV_FLAG_MT_STCOMPAT);
+	evdev_set_flag(sc->sc_evdev, EVDEV_FLAG_MT_AUTOREL);
 
 	evdev_support_key(sc->sc_evdev, BTN_TOUCH);
 
@@ -144,9 +1025,117 @@ goodix_attach(device_t dev)
 		return (err);
 	}
 
-	sc->sc_pen_down = 0;
-	sc->sc_x = -1;
-	sc->sc_y = -1;
+	TASK_INIT(&sc->sc_task, 0, goodix_task, sc);
+	sc->sc_tq = taskqueue_create_fast("goodix", M_WAITOK,
+		taskqueue_thread_enqueue, &sc->sc_tq);
+	taskqueue_start_threads(&sc->sc_tq, 1, PI_SWI(SWI_TQ), "%s taskq",
+		device_get_nameunit(dev));
+
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+		"intr_count", CTLFLAG_RD, &sc->sc_intr_count, 0,
+		"Touch interrupts");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+		"coalesced", CTLFLAG_RD, &sc->sc_coalesced, 0,
+		"Interrupts merged into an already queued frame read");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+		"frames", CTLFLAG_RD, &sc->sc_frames, 0,
+		"Frames reported");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+		"latency_us", CTLFLAG_RD, &sc->sc_latency_us, 0,
+		"Interrupt to evdev_sync of the last frame");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+		"latency_max_us", CTLFLAG_RD, &sc->sc_latency_max_us, 0,
+		"Longest interrupt to evdev_sync");
+	SYSCTL_ADD_PROC(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+		"latency_read", CTLTYPE_STRING | CTLFLAG_RD, sc,
+		GOODIX_LAT_READ, goodix_sysctl_latency, "A",
+		"Histogram of interrupt to I2C read done");
+	SYSCTL_ADD_PROC(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+		"latency_report", CTLTYPE_STRING | CTLFLAG_RD, sc,
+		GOODIX_LAT_REPORT, goodix_sysctl_latency, "A",
+		"Histogram of I2C read done to evdev_sync");
+	SYSCTL_ADD_PROC(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+		"latency_total", CTLTYPE_STRING | CTLFLAG_RD, sc,
+		GOODIX_LAT_TOTAL, goodix_sysctl_latency, "A",
+		"Histogram of interrupt to evdev_sync");
+	SYSCTL_ADD_PROC(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+		"last_frame", CTLTYPE_STRING | CTLFLAG_RD, sc, 0,
+		goodix_sysctl_stamps, "A",
+		"Uptime in us of the last frame's interrupt, read and sync");
+
+	sc->sc_poll_idle_ms = GOODIX_POLL_IDLE_MS;
+	SYSCTL_ADD_INT(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+		"polling", CTLFLAG_RDTUN, &sc->sc_polling, 0,
+		"Poll the controller instead of waiting for the interrupt");
+	SYSCTL_ADD_PROC(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+		"poll_idle_ms", CTLTYPE_INT | CTLFLAG_RWTUN, sc, 0,
+		goodix_sysctl_poll_idle, "I",
+		"Longest poll interval with nothing touching the panel");
+	SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+		"polls", CTLFLAG_RD, &sc->sc_polls, 0,
+		"Frame reads started by the poll callout");
+
+	SYSCTL_ADD_UINT(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+		"bus_speed", CTLFLAG_RD, &sc->sc_crs.gc_speed, 0,
+		"I2C connection speed _CRS declares, in Hz");
+	SYSCTL_ADD_INT(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+		"int_pin", CTLFLAG_RD, &sc->sc_crs.gc_int_pin, 0,
+		"GpioInt pin, -1 without one");
+	SYSCTL_ADD_INT(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+		"reset_pin", CTLFLAG_RD, &sc->sc_crs.gc_reset_pin, 0,
+		"GpioIo reset pin, -1 without one");
+
+	if (sc->sc_int_acpi) {
+		SYSCTL_ADD_PROC(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+			"sleep", CTLTYPE_INT | CTLFLAG_RW, sc, 0,
+			goodix_sysctl_power, "I",
+			"0 awake, 1 screen off, 2 gesture mode waking on touch");
+		SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+			"sleeps", CTLFLAG_RD, &sc->sc_sleeps, 0,
+			"Times the controller was put to sleep");
+		SYSCTL_ADD_U64(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+			"wakes", CTLFLAG_RD, &sc->sc_wakes, 0,
+			"Times the controller was woken");
+	}
+
+	SYSCTL_ADD_PROC(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+		"capture", CTLTYPE_INT | CTLFLAG_RW, sc, 0,
+		goodix_sysctl_capture, "I",
+		"Keep the last raw frames read from the controller");
+	SYSCTL_ADD_PROC(ctx, SYSCTL_CHILDREN(tree), OID_AUTO,
+		"capture_ring", CTLTYPE_OPAQUE | CTLFLAG_RD, sc, 0,
+		goodix_sysctl_capture_ring, "S,goodix_capture",
+		"Captured frames, oldest first");
+
+	/*
+	 * Frames are only read once there is somewhere to report them. Fall
+	 * back to polling when the GpioInt can't be delivered.
+	 */
+	if (!sc->sc_polling) {
+		rid = 0;
+		sc->sc_irq_res = bus_alloc_resource_any(dev, SYS_RES_IRQ, &rid,
+			RF_ACTIVE);
+		if (!sc->sc_irq_res) {
+			device_printf(dev, "cannot allocate interrupt, polling\n");
+			sc->sc_polling = 1;
+		} else if (bus_setup_intr(dev, sc->sc_irq_res,
+		    INTR_TYPE_MISC | INTR_MPSAFE, goodix_intr, NULL, sc,
+		    &sc->sc_intrhand) != 0) {
+			device_printf(dev,
+				"Unable to setup the irq handler, polling\n");
+			bus_release_resource(dev, SYS_RES_IRQ, rid, sc->sc_irq_res);
+			sc->sc_irq_res = NULL;
+			sc->sc_polling = 1;
+		}
+	}
+
+	if (sc->sc_polling) {
+		GOODIX_LOCK(sc);
+		sc->sc_poll_interval = sc->sc_report_period;
+		callout_reset_sbt(&sc->sc_poll, sc->sc_poll_interval, 0,
+			goodix_poll, sc, C_PREL(2));
+		GOODIX_UNLOCK(sc);
+	}
 
 	return (0);
 }
@@ -154,6 +1143,40 @@ goodix_attach(device_t dev)
 static int
 goodix_detach(device_t dev)
 {
+	struct goodix_softc *sc;
+
+	sc = device_get_softc(dev);
+
+	/* The frame task rearms the poll unless polling is off */
+	if (mtx_initialized(&sc->sc_mtx)) {
+		GOODIX_LOCK(sc);
+		sc->sc_polling = 0;
+		callout_stop(&sc->sc_poll);
+		GOODIX_UNLOCK(sc);
+		callout_drain(&sc->sc_poll);
+	}
+	if (sc->sc_intrhand != NULL)
+		bus_teardown_intr(dev, sc->sc_irq_res, sc->sc_intrhand);
+	sc->sc_intrhand = NULL;
+	if (sc->sc_tq != NULL) {
+		taskqueue_drain(sc->sc_tq, &sc->sc_task);
+		taskqueue_free(sc->sc_tq);
+	}
+	sc->sc_tq = NULL;
+	if (sc->sc_irq_res != NULL)
+		bus_release_resource(dev, SYS_RES_IRQ, 0, sc->sc_irq_res);
+	sc->sc_irq_res = NULL;
+	if (sc->sc_evdev != NULL)
+		evdev_free(sc->sc_evdev);
+	sc->sc_evdev = NULL;
+	if (sc->sc_capture != NULL)
+		free(sc->sc_capture, M_DEVBUF);
+	sc->sc_capture = NULL;
+	if (mtx_initialized(&sc->sc_mtx)) {
+		sx_destroy(&sc->sc_config_lock);
+		GOODIX_LOCK_DESTROY(sc);
+	}
+
 	return (0);
 }
 
@@ -179,123 +1202,445 @@ goodix_read(device_t dev, uint16_t reg, uint8_t *data, uint8_t size)
 	return (iicbus_transfer(dev, msg, 2));
 }
 
+/*
+ * The register address and the data have to go out as one message, the
+ * controller takes a repeated start as the beginning of a new command.
+ */
 static int 
 goodix_write(device_t dev, uint16_t reg, uint8_t *data, uint8_t size)
 {
 	struct goodix_softc *sc;
-	struct iic_msg msg[2];
+	struct iic_msg msg;
+	uint8_t buf[2 + UINT8_MAX];
 
 	sc = device_get_softc(dev);
-	reg = htobe16(reg);
 
-	msg[0].slave = sc->sc_addr;
-	msg[0].flags = IIC_M_WR | IIC_M_NOSTOP;
-	msg[0].len = 2;
-	msg[0].buf = (uint8_t *)&reg; /* what is the byte order */
+	be16enc(buf, reg);
+	memcpy(&buf[2], data, size);
 
-	/* this might not work as a transfer group */
-	msg[1].slave = sc->sc_addr;		
-	msg[1].flags = IIC_M_WR;
-	msg[1].len = size;
-	msg[1].buf = data;
+	msg.slave = sc->sc_addr;
+	msg.flags = IIC_M_WR;
+	msg.len = 2 + size;
+	msg.buf = buf;
 
-	return (iicbus_transfer(dev, msg, 2));
+	return (iicbus_transfer(dev, &msg, 1));
 }
 
-static void
+/*
+ * INT is edge triggered, so rather than masking the line the filter latches
+ * that a frame read is pending. Interrupts that arrive before the read
+ * starts are folded into it.
+ */
+static int
 goodix_intr(void *arg)
 {
 	struct goodix_softc *sc;
-	//uint32_t status, rawstatus;
 
 	sc = (struct goodix_softc *)arg;
 
-	//status = ADC_READ4(sc, ADC_IRQSTATUS);
-	goodix_ev_report(sc);
+	sc->sc_intr_count++;
+	if (atomic_load_acq_int(&sc->sc_quiet))
+		return (FILTER_HANDLED);
+	if (atomic_cmpset_int(&sc->sc_intr_pending, 0, 1))
+		sc->sc_intr_time = sbinuptime();
+	else
+		sc->sc_coalesced++;
+	taskqueue_enqueue(sc->sc_tq, &sc->sc_task);
+
+	return (FILTER_HANDLED);
+}
+
+/*
+ * The poll stands in for the interrupt, the callout runs with sc_mtx held
+ * so the read itself is left to the taskqueue.
+ */
+static void
+goodix_poll(void *arg)
+{
+	struct goodix_softc *sc;
+
+	sc = (struct goodix_softc *)arg;
+	GOODIX_ASSERT_LOCKED(sc);
+
+	sc->sc_polls++;
+	if (atomic_cmpset_int(&sc->sc_intr_pending, 0, 1))
+		sc->sc_intr_time = sbinuptime();
+	taskqueue_enqueue(sc->sc_tq, &sc->sc_task);
+}
+
+/*
+ * Poll at the report rate while fingers are down or a frame is due, back
+ * off once the controller reports the panel released.
+ */
+static void
+goodix_poll_next(struct goodix_softc *sc, int touches)
+{
+	sbintime_t idle;
+
+	GOODIX_LOCK(sc);
+	if (!sc->sc_polling || sc->sc_quiet) {
+		GOODIX_UNLOCK(sc);
+		return;
+	}
+
+	idle = MAX(SBT_1MS * sc->sc_poll_idle_ms, sc->sc_report_period);
+	if (touches > 0 || (touches < 0 && sc->sc_poll_down))
+		sc->sc_poll_interval = sc->sc_report_period;
+	else
+		sc->sc_poll_interval = MIN(sc->sc_poll_interval * 2, idle);
+	if (touches >= 0)
+		sc->sc_poll_down = touches > 0;
+
+	callout_reset_sbt(&sc->sc_poll, sc->sc_poll_interval, 0, goodix_poll,
+		sc, C_PREL(2));
+	GOODIX_UNLOCK(sc);
 }
 
 static void
-goodix_ev_report(struct goodix_softc *sc)
+goodix_task(void *arg, int pending)
+{
+	struct goodix_softc *sc;
+	int touches;
+
+	sc = (struct goodix_softc *)arg;
+
+	/*
+	 * In gesture mode the interrupt is the touch that should wake the
+	 * controller. Leave it if a power change is already under way, that
+	 * drains this task.
+	 */
+	if (sc->sc_power == GOODIX_GESTURE) {
+		if (!sx_try_xlock(&sc->sc_config_lock))
+			return;
+		goodix_power(sc, GOODIX_AWAKE);
+		sx_xunlock(&sc->sc_config_lock);
+	}
+
+	touches = goodix_frame(sc);
+	goodix_poll_next(sc, touches);
+}
+
+static int
+goodix_int_output(struct goodix_softc *sc, int level)
+{
+	if (ACPI_FAILURE(acpi_SetInteger(sc->sc_handle, "INTO", level)))
+		return (ENXIO);
+	return (0);
+}
+
+/*
+ * Stop reads being queued and wait out the one in flight, INT is about to
+ * become an output or the controller to stop answering.
+ */
+static void
+goodix_quiesce(struct goodix_softc *sc)
+{
+	GOODIX_LOCK(sc);
+	atomic_store_rel_int(&sc->sc_quiet, 1);
+	callout_stop(&sc->sc_poll);
+	GOODIX_UNLOCK(sc);
+	taskqueue_drain(sc->sc_tq, &sc->sc_task);
+	atomic_store_rel_int(&sc->sc_intr_pending, 0);
+}
+
+static void
+goodix_unquiesce(struct goodix_softc *sc)
+{
+	GOODIX_LOCK(sc);
+	atomic_store_rel_int(&sc->sc_quiet, 0);
+	if (sc->sc_polling) {
+		sc->sc_poll_interval = sc->sc_report_period;
+		callout_reset_sbt(&sc->sc_poll, sc->sc_poll_interval, 0,
+			goodix_poll, sc, C_PREL(2));
+	}
+	GOODIX_UNLOCK(sc);
+}
+
+/*
+ * Pulse INT high then hold it low before releasing it, the controller
+ * leaves either sleep mode and resumes scanning.
+ */
+static int
+goodix_wake(struct goodix_softc *sc)
+{
+	int error;
+
+	atomic_store_rel_int(&sc->sc_quiet, 1);
+	error = goodix_int_output(sc, 1);
+	if (error == 0) {
+		pause_sbt("gdxwak", SBT_1MS * GOODIX_INT_WAKE_MS, 0, 0);
+		error = goodix_int_output(sc, 0);
+	}
+	if (error == 0) {
+		pause_sbt("gdxwak", SBT_1MS * GOODIX_INT_SYNC_MS, 0, 0);
+		if (ACPI_FAILURE(AcpiEvaluateObject(sc->sc_handle, "INTI",
+		    NULL, NULL)))
+			error = ENXIO;
+	}
+	return (error);
+}
+
+/*
+ * Reset the controller through the GpioIo line, holding INT at the level
+ * that selects the address _CRS gave while reset is released. INT is then
+ * held low for the sync and handed back as on wake.
+ */
+static int
+goodix_reset(struct goodix_softc *sc)
+{
+	device_t gpio;
+	uint32_t pin;
+	int error;
+
+	gpio = sc->sc_reset_gpio;
+	pin = sc->sc_crs.gc_reset_pin;
+
+	error = GPIO_PIN_SETFLAGS(gpio, pin, GPIO_PIN_OUTPUT);
+	if (error == 0)
+		error = GPIO_PIN_SET(gpio, pin, GPIO_PIN_LOW);
+	if (error)
+		return (error);
+	pause_sbt("gdxrst", SBT_1MS * GOODIX_RESET_LOW_MS, 0, 0);
+
+	error = goodix_int_output(sc, sc->sc_addr == GOODIX_ADDR_ALT);
+	if (error == 0) {
+		pause_sbt("gdxrst", SBT_1MS * GOODIX_RESET_SELECT_MS, 0, 0);
+		error = GPIO_PIN_SET(gpio, pin, GPIO_PIN_HIGH);
+	}
+	if (error == 0) {
+		pause_sbt("gdxrst", SBT_1MS * GOODIX_RESET_HIGH_MS, 0, 0);
+		error = GPIO_PIN_SETFLAGS(gpio, pin, GPIO_PIN_INPUT);
+	}
+	if (error == 0)
+		error = goodix_int_output(sc, 0);
+	if (error == 0) {
+		pause_sbt("gdxrst", SBT_1MS * GOODIX_INT_SYNC_MS, 0, 0);
+		if (ACPI_FAILURE(AcpiEvaluateObject(sc->sc_handle, "INTI",
+		    NULL, NULL)))
+			error = ENXIO;
+	}
+	return (error);
+}
+
+/*
+ * Move the controller between awake, screen off and gesture mode. Asleep
+ * it takes no interrupts and no reads, in gesture mode the first interrupt
+ * wakes it from the frame task.
+ */
+static int
+goodix_power(struct goodix_softc *sc, int state)
 {
+	uint8_t cmd;
+	int error;
+
+	sx_assert(&sc->sc_config_lock, SA_XLOCKED);
 
-	evdev_push_event(sc->sc_evdev, EV_ABS, ABS_X, sc->sc_x);
-	evdev_push_event(sc->sc_evdev, EV_ABS, ABS_Y, sc->sc_y);
-	evdev_push_event(sc->sc_evdev, EV_KEY, BTN_TOUCH, sc->sc_pen_down);
+	if (state == sc->sc_power)
+		return (0);
+	if (!sc->sc_int_acpi)
+		return (ENXIO);
+	if (state == GOODIX_GESTURE && sc->sc_polling)
+		return (EOPNOTSUPP);
+
+	if (sc->sc_power != GOODIX_AWAKE) {
+		error = goodix_wake(sc);
+		if (error) {
+			device_printf(sc->sc_dev, "wake failed: error %d\n",
+				error);
+			return (error);
+		}
+		sc->sc_power = GOODIX_AWAKE;
+		sc->sc_wakes++;
+		if (state == GOODIX_AWAKE) {
+			goodix_unquiesce(sc);
+			return (0);
+		}
+	}
+
+	goodix_quiesce(sc);
+	if (state == GOODIX_SLEEP) {
+		error = goodix_int_output(sc, 0);
+		if (error == 0) {
+			pause_sbt("gdxslp", SBT_1MS * GOODIX_INT_SLEEP_MS, 0, 0);
+			cmd = GOODIX_CMD_SCREEN_OFF;
+			error = goodix_write(sc->sc_dev, GOODIX_CMD, &cmd, 1);
+		}
+	} else {
+		cmd = GOODIX_CMD_GESTURE;
+		error = goodix_write(sc->sc_dev, GOODIX_CMD_CHECK, &cmd, 1);
+		if (error == 0)
+			error = goodix_write(sc->sc_dev, GOODIX_CMD, &cmd, 1);
+	}
+	if (error) {
+		device_printf(sc->sc_dev, "sleep failed: error %d\n", error);
+		if (state == GOODIX_SLEEP)
+			AcpiEvaluateObject(sc->sc_handle, "INTI", NULL, NULL);
+		goodix_unquiesce(sc);
+		return (error);
+	}
+	pause_sbt("gdxslp", SBT_1MS * GOODIX_CMD_SETTLE_MS, 0, 0);
+
+	sc->sc_power = state;
+	sc->sc_sleeps++;
+	if (state == GOODIX_GESTURE)
+		atomic_store_rel_int(&sc->sc_quiet, 0);
+	return (0);
+}
+
+/*
+ * Read the status byte and every contact record the controller may report
+ * in one transfer, then hand the buffer back to the controller. Each frame
+ * costs one read and one write no matter how many fingers are down.
+ *
+ * Returns the contacts reported, or -1 if there was no new frame.
+ */
+static int
+goodix_frame(struct goodix_softc *sc)
+{
+	uint8_t frame[GOODIX_FRAME_LEN];
+	uint8_t status;
+	sbintime_t irq, i2c;
+	int len, touches;
+
+	/* An interrupt from here on queues another read */
+	irq = sc->sc_intr_time;
+	atomic_store_rel_int(&sc->sc_intr_pending, 0);
+
+	GOODIX_LOCK(sc);
+	len = sc->sc_frame_len;
+	GOODIX_UNLOCK(sc);
+
+	if (goodix_read(sc->sc_dev, GOODIX_COORD, frame, len) != 0)
+		return (-1);
+	i2c = sbinuptime();
+
+	/* Nothing new since the last frame was read */
+	if ((frame[0] & GOODIX_STATUS_READY) == 0)
+		return (-1);
+
+	if (sc->sc_capture != NULL)
+		goodix_capture_frame(sc, frame, len, irq);
+	touches = goodix_ev_report(sc, frame, irq);
+	goodix_latency(sc, irq, i2c, sbinuptime());
+
+	status = 0;
+	goodix_write(sc->sc_dev, GOODIX_COORD, &status, 1);
+
+	return (touches);
+}
+
+/*
+ * MSC_TIMESTAMP carries the interrupt time in us, wrapping at 32 bits as
+ * userland expects, so consumers can measure latency end to end.
+ */
+static int
+goodix_ev_report(struct goodix_softc *sc, uint8_t *frame, sbintime_t irq)
+{
+	struct goodix_xform xf;
+	uint8_t *contact;
+	int64_t rx, ry;
+	int x, y;
+	int i, id, slot, touches;
+
+	GOODIX_LOCK(sc);
+	xf = sc->sc_xform;
+	touches = MIN(frame[0] & GOODIX_STATUS_TOUCHES, sc->sc_max_contacts);
+	GOODIX_UNLOCK(sc);
+
+	for (i = 0; i < touches; i++) {
+		contact = &frame[1 + i * GOODIX_CONTACT_LEN];
+		id = contact[0] & GOODIX_STATUS_TOUCHES;
+		slot = evdev_get_mt_slot_by_tracking_id(sc->sc_evdev, id);
+		if (slot == -1)
+			continue;
+
+		/* Rounded to the nearest unit and kept inside the panel */
+		rx = le16dec(&contact[1]);
+		ry = le16dec(&contact[3]);
+		x = (xf.m[0] * rx + xf.m[1] * ry + xf.m[2] +
+			GOODIX_FIX_ONE / 2) >> GOODIX_FIX_SHIFT;
+		y = (xf.m[3] * rx + xf.m[4] * ry + xf.m[5] +
+			GOODIX_FIX_ONE / 2) >> GOODIX_FIX_SHIFT;
+		x = MAX(0, MIN(x, sc->sc_out_x - 1));
+		y = MAX(0, MIN(y, sc->sc_out_y - 1));
+
+		evdev_push_event(sc->sc_evdev, EV_ABS, ABS_MT_SLOT, slot);
+		evdev_push_event(sc->sc_evdev, EV_ABS, ABS_MT_TRACKING_ID, id);
+		evdev_push_event(sc->sc_evdev, EV_ABS, ABS_MT_POSITION_X, x);
+		evdev_push_event(sc->sc_evdev, EV_ABS, ABS_MT_POSITION_Y, y);
+		evdev_push_event(sc->sc_evdev, EV_ABS, ABS_MT_TOUCH_MAJOR,
+			MIN(le16dec(&contact[5]), 255));
+	}
+	evdev_push_event(sc->sc_evdev, EV_MSC, MSC_TIMESTAMP,
+		(uint32_t)goodix_sbt_us(irq));
 	evdev_sync(sc->sc_evdev);
+
+	return (touches);
 }
 
+/*
+ * Collect the wiring from _CRS: the I2cSerialBus, the GpioInt and the
+ * GpioIo driving reset. Only the first of each is used.
+ */
 static ACPI_STATUS
 parse_resources(ACPI_RESOURCE *res, void *context)
 {
-	int type;          
-	struct link_count_request *req;               
-	device_t dev = (device_t)context;             
-	struct chvpower_softc *sc;
-	sc = device_get_softc(dev);
+	struct goodix_crs *crs;
+	ACPI_RESOURCE_SOURCE *src;
 
-	req = (struct link_count_request *)context;   
-	device_printf(dev, "resource of number: %d\n", res->Type);
+	crs = context;
 
-	switch(res->Type) {
+	switch (res->Type) {
 	case ACPI_RESOURCE_TYPE_SERIAL_BUS:
-		device_printf(dev, "serial resource number: %x\n"
-			"rev id: %x type: %x producer consumer: %x slave mode: %x "
-			"connection sharing: %x type rev id: %x type data len: %x "
-			"vendor len: %x\n",
-			res->Type,
-			res->Data.CommonSerialBus.RevisionId,
-			res->Data.CommonSerialBus.Type,
-			res->Data.CommonSerialBus.ProducerConsumer,
-			res->Data.CommonSerialBus.SlaveMode,
-			res->Data.CommonSerialBus.ConnectionSharing,
-			res->Data.CommonSerialBus.TypeRevisionId,
-			res->Data.CommonSerialBus.TypeDataLength,
-			res->Data.CommonSerialBus.VendorLength);
-
-		device_printf(dev,
-			"resource source, index: %x, str len: %x, str:\n\t%s\n",
-			res->Data.CommonSerialBus.ResourceSource.Index,
-			res->Data.CommonSerialBus.ResourceSource.StringLength,
-			res->Data.CommonSerialBus.ResourceSource.StringPtr);
-		type = res->Data.CommonSerialBus.Type;
-		switch (type) {
-		case ACPI_RESOURCE_SERIAL_TYPE_I2C:
-			device_printf(dev, "i2c device,"
-				"access mode: %x addr: %x, connection speed %x\n",
-				res->Data.I2cSerialBus.AccessMode,
-				res->Data.I2cSerialBus.SlaveAddress,
-				res->Data.I2cSerialBus.ConnectionSpeed);
-				break;
-		}
+		if (res->Data.CommonSerialBus.Type !=
+		    ACPI_RESOURCE_SERIAL_TYPE_I2C || crs->gc_addr != 0)
+			break;
+		src = &res->Data.CommonSerialBus.ResourceSource;
+		if (src->StringPtr == NULL)
+			break;
+		crs->gc_addr = res->Data.I2cSerialBus.SlaveAddress;
+		crs->gc_speed = res->Data.I2cSerialBus.ConnectionSpeed;
+		strlcpy(crs->gc_bus, src->StringPtr, sizeof(crs->gc_bus));
+		break;
 	case ACPI_RESOURCE_TYPE_GPIO:
-
-		device_printf(dev,"serial resource number: %x\n"
-			"rev id: %x type: %x producer consumer: %x "
-			"pin config: %x, sharable: %x, wake capable: %x "
-			"io restrict: %x, triggering: %x, polarity: %x "
-			"drive strengh: %x, debounce timeout: %x "
-			"pin table len %x, vendor table len: %x\n",
-			res->Type,
-			res->Data.Gpio.RevisionId,      
-			res->Data.Gpio.ConnectionType,  
-			res->Data.Gpio.ProducerConsumer,
-			res->Data.Gpio.PinConfig,       
-			res->Data.Gpio.Sharable,        
-			res->Data.Gpio.WakeCapable,     
-			res->Data.Gpio.IoRestriction,   
-			res->Data.Gpio.Triggering,      
-			res->Data.Gpio.Polarity,        
-			res->Data.Gpio.DriveStrength,   
-			res->Data.Gpio.DebounceTimeout, 
-			res->Data.Gpio.PinTableLength,  
-			res->Data.Gpio.VendorLength);
+		if (res->Data.Gpio.PinTableLength == 0)
+			break;
+		src = &res->Data.Gpio.ResourceSource;
+		switch (res->Data.Gpio.ConnectionType) {
+		case ACPI_RESOURCE_GPIO_TYPE_INT:
+			if (crs->gc_int_pin >= 0)
+				break;
+			crs->gc_int_pin = res->Data.Gpio.PinTable[0];
+			crs->gc_int_triggering = res->Data.Gpio.Triggering;
+			crs->gc_int_polarity = res->Data.Gpio.Polarity;
+			break;
+		case ACPI_RESOURCE_GPIO_TYPE_IO:
+			if (crs->gc_reset_pin >= 0 || src->StringPtr == NULL)
+				break;
+			crs->gc_reset_pin = res->Data.Gpio.PinTable[0];
+			strlcpy(crs->gc_reset_gpio, src->StringPtr,
+				sizeof(crs->gc_reset_gpio));
 			break;
 		}
-//ResourceSource;  
-//*PinTable;       
-//*VendorData;     
+		break;
+	default:
+		break;
+	}
 	return (AE_OK);
+}
 
+/*
+ * The device behind an absolute ACPI path. AcpiGetHandle pads short name
+ * segments, so the "\\_SB.PCI0.I2C6" firmware gives finds \\_SB_.
+ */
+static device_t
+goodix_acpi_device(char *path)
+{
+	ACPI_HANDLE h;
+
+	if (path[0] == '\0' || ACPI_FAILURE(AcpiGetHandle(NULL, path, &h)))
+		return (NULL);
+	return (acpi_get_device(h));
 }
 
 static int
@@ -324,38 +1669,243 @@ goodix_acpi_probe(device_t dev)
 		ACPI_ID_PROBE(device_get_parent(dev), dev, goodix_hids) == NULL)
 		return (ENXIO);
 
-	device_set_desc(dev, "Goodix GT9xx Capacitive TouchScreen");
+	device_set_desc(dev, "Goodix GT9xx TouchScreen ACPI");
+	return (0);
+}
+
+static int
+goodix_acpi_attach(device_t dev)
+{
+	struct goodix_acpi_softc *sc;
+	struct goodix_crs *crs;
+	device_t i2c;
+	rman_res_t start, count;
+
+	sc = device_get_softc(dev);
+	sc->sc_dev = dev;
+	sc->sc_handle = acpi_get_handle(dev);
+
+	crs = &sc->sc_crs;
+	crs->gc_int_pin = -1;
+	crs->gc_reset_pin = -1;
+	AcpiWalkResources(sc->sc_handle, "_CRS", parse_resources, crs);
+	if (crs->gc_addr == 0) {
+		device_printf(dev, "no I2cSerialBus in _CRS\n");
+		return (ENXIO);
+	}
+
+	i2c = goodix_acpi_device(crs->gc_bus);
+	if (i2c != NULL)
+		sc->sc_iicbus = device_find_child(i2c, "iicbus", -1);
+	if (sc->sc_iicbus == NULL) {
+		device_printf(dev, "no iicbus for %s\n", crs->gc_bus);
+		return (ENXIO);
+	}
+
+	sc->sc_child = BUS_ADD_CHILD(sc->sc_iicbus, 0, "goodix", -1);
+	if (sc->sc_child == NULL) {
+		device_printf(dev, "failed to add goodix child\n");
+		return (ENXIO);
+	}
+	iicbus_set_addr(sc->sc_child, crs->gc_addr << 1);
+
+	/* Hand over the GpioInt, if the bus turned it into an interrupt */
+	if (bus_get_resource(dev, SYS_RES_IRQ, 0, &start, &count) == 0)
+		bus_set_resource(sc->sc_child, SYS_RES_IRQ, 0, start, count);
+
+	bus_generic_attach(sc->sc_iicbus);
+	if (!device_is_attached(sc->sc_child)) {
+		device_delete_child(sc->sc_iicbus, sc->sc_child);
+		sc->sc_child = NULL;
+		return (ENXIO);
+	}
 	return (0);
 }
 
 static int
 goodix_acpi_detach(device_t dev)
 {
+	struct goodix_acpi_softc *sc;
+	int error;
+
+	sc = device_get_softc(dev);
+
+	if (sc->sc_child != NULL) {
+		error = device_delete_child(sc->sc_iicbus, sc->sc_child);
+		if (error)
+			return (error);
+	}
+	sc->sc_child = NULL;
+
+	return (0);
+}
+
+/* The ACPI device that added dev to its iicbus */
+static struct goodix_acpi_softc *
+goodix_acpi_glue(device_t dev)
+{
+	struct goodix_acpi_softc *asc;
+	devclass_t dc;
+	device_t acpidev;
+	int unit;
+
+	dc = devclass_find("goodix_acpi");
+	if (dc == NULL)
+		return (NULL);
+
+	for (unit = 0; unit < devclass_get_maxunit(dc); unit++) {
+		acpidev = devclass_get_device(dc, unit);
+		if (acpidev == NULL)
+			continue;
+		asc = device_get_softc(acpidev);
+		if (asc->sc_child == dev)
+			return (asc);
+	}
+	return (NULL);
+}
+
+/*
+ * Run the bus at the speed _CRS declares, otherwise the I2C controller is
+ * left in standard mode.
+ */
+static void
+goodix_bus_speed(struct goodix_softc *sc)
+{
+	device_t bus;
+	u_char speed;
+	int error;
+
+	if (sc->sc_crs.gc_speed == 0)
+		return;
+	if (sc->sc_crs.gc_speed >= 1000000)
+		speed = IIC_FASTEST;
+	else if (sc->sc_crs.gc_speed >= 400000)
+		speed = IIC_FAST;
+	else
+		speed = IIC_SLOW;
+
+	bus = device_get_parent(sc->sc_dev);
+	error = iicbus_request_bus(bus, sc->sc_dev, IIC_WAIT);
+	if (error == 0) {
+		error = iicbus_reset(bus, speed, 0, NULL);
+		iicbus_release_bus(bus, sc->sc_dev);
+	}
+	if (error)
+		device_printf(sc->sc_dev, "unable to set bus speed: error %d\n",
+			error);
+}
+
+static int
+goodix_probe(device_t dev)
+{
+	if (goodix_acpi_glue(dev) == NULL)
+		return (ENXIO);
+
+	device_set_desc(dev, "Goodix GT9xx Capacitive TouchScreen");
 	return (0);
 }
 
 static int
-goodix_acpi_attach(device_t dev)
+goodix_iic_attach(device_t dev)
 {
+	struct goodix_acpi_softc *asc;
 	struct goodix_softc *sc;
 	int error;
 
 	sc = device_get_softc(dev);
+	asc = goodix_acpi_glue(dev);
 
 	sc->sc_dev = dev;
-	sc->sc_addr = 0xBA;
+	sc->sc_addr = iicbus_get_addr(dev);
+	sc->sc_handle = asc->sc_handle;
+	sc->sc_crs = asc->sc_crs;
+	if (sc->sc_crs.gc_reset_pin >= 0) {
+		sc->sc_reset_gpio = goodix_acpi_device(sc->sc_crs.gc_reset_gpio);
+		if (sc->sc_reset_gpio == NULL)
+			device_printf(dev, "no GPIO controller for %s\n",
+				sc->sc_crs.gc_reset_gpio);
+	}
+	goodix_bus_speed(sc);
 
 	error = goodix_attach(sc->sc_dev);
 	if (error)
-		goodix_acpi_detach(sc->sc_dev);
+		goodix_detach(sc->sc_dev);
 
-	return (0);
+	return (error);
 }
 
-static device_method_t goodix_methods[] = {
+static int
+goodix_suspend(device_t dev)
+{
+	struct goodix_softc *sc;
+	int error;
+
+	sc = device_get_softc(dev);
+
+	sx_xlock(&sc->sc_config_lock);
+	error = 0;
+	if (sc->sc_int_acpi && sc->sc_power == GOODIX_AWAKE)
+		error = goodix_power(sc, GOODIX_SLEEP);
+	sx_xunlock(&sc->sc_config_lock);
+
+	return (error);
+}
+
+static int
+goodix_resume(device_t dev)
+{
+	struct goodix_softc *sc;
+	int error;
+
+	sc = device_get_softc(dev);
+
+	sx_xlock(&sc->sc_config_lock);
+	error = 0;
+	if (sc->sc_int_acpi)
+		error = goodix_power(sc, GOODIX_AWAKE);
+	if (error && sc->sc_reset_gpio != NULL) {
+		/* A reset leaves the controller awake as well */
+		device_printf(dev, "unable to wake on resume: error %d, "
+			"resetting\n", error);
+		error = goodix_reset(sc);
+		if (error == 0) {
+			sc->sc_power = GOODIX_AWAKE;
+			goodix_unquiesce(sc);
+		} else
+			device_printf(dev, "reset failed: error %d\n", error);
+	} else if (error)
+		device_printf(dev, "unable to wake on resume: error %d\n",
+			error);
+	sx_xunlock(&sc->sc_config_lock);
+
+	return (error);
+}
+
+static device_method_t goodix_acpi_methods[] = {
 	DEVMETHOD(device_probe,		goodix_acpi_probe),
 	DEVMETHOD(device_attach,	goodix_acpi_attach),
 	DEVMETHOD(device_detach,	goodix_acpi_detach),
+	DEVMETHOD(device_suspend,	bus_generic_suspend),
+	DEVMETHOD(device_resume,	bus_generic_resume),
+	DEVMETHOD_END
+};
+
+static driver_t goodix_acpi_driver = {
+	.name = "goodix_acpi",
+	.methods = goodix_acpi_methods,
+	.size = sizeof(struct goodix_acpi_softc)
+};
+
+static devclass_t goodix_acpi_devclass;
+DRIVER_MODULE(goodix_acpi, acpi, goodix_acpi_driver, goodix_acpi_devclass,
+	goodix_driver_loaded, NULL);
+
+static device_method_t goodix_methods[] = {
+	DEVMETHOD(device_probe,		goodix_probe),
+	DEVMETHOD(device_attach,	goodix_iic_attach),
+	DEVMETHOD(device_detach,	goodix_detach),
+	DEVMETHOD(device_suspend,	goodix_suspend),
+	DEVMETHOD(device_resume,	goodix_resume),
 	DEVMETHOD_END
 };
 
@@ -366,7 +1916,7 @@ static driver_t goodix_driver = {
 };
 
 static devclass_t goodix_devclass;
-DRIVER_MODULE(goodix, acpi, goodix_driver, goodix_devclass, goodix_driver_loaded, NULL);
+DRIVER_MODULE(goodix, iicbus, goodix_driver, goodix_devclass, NULL, NULL);
 
 MODULE_DEPEND(goodix, acpi, 1, 1, 1);
 MODULE_DEPEND(goodix, iicbus, IICBUS_MINVER, IICBUS_PREFVER, IICBUS_MAXVER);
@@ -34,6 +34,8 @@
 #include <sys/module.h>
 #include <sys/endian.h>
 #include <sys/rman.h>
+#include <sys/lock.h>
+#include <sys/sx.h>
 #include <sys/sysctl.h>
 
 #include <machine/bus.h>
@@ -42,22 +44,18 @@
 #include <dev/iicbus/iicbus.h>
 #include <dev/iicbus/iiconf.h>
 
+#include "pi3usb_var.h"
+
 struct pi3usb_softc {
 	device_t			sc_dev;
+	struct sx			sc_lock;
 	uint8_t				sc_config;
+	uint64_t			sc_changes;
 };
 
 #define PI3USB_SADDR	0x54 // datasheet disagrees with acpi
 
-#define PI3USB_CFG_OPEN	0x00
-#define PI3USB_CFG_4DPI	0x02
-#define PI3USB_CFG_4DPIS	0x03
-#define PI3USB_CFG_USB3	0x04
-#define PI3USB_CFG_USB3S	0x05
-#define PI3USB_CFG_USB32DPI	0x06
-#define PI3USB_CFG_USB32DPIS	0x07
-
-#define	CAST_PTR_INT(X) (*((int*)(X)))
+#define	PI3USB_CFG_UNKNOWN	0xff
 
 static int pi3usb_probe(device_t);
 static int pi3usb_attach(device_t);
@@ -74,37 +72,31 @@ pi3usb_probe(device_t dev)
 	return (0);
 }
 
-#define PI3USB_CONF_4LANEDPI		3
-#define PI3USB_CONF_4LANEDPI_SWAP	4
-#define PI3USB_CONF_USB3		5
-#define PI3USB_CONF_USB3_SWAP		6
-#define PI3USB_CONF_2LANEDPIUSB3	7
-#define PI3USB_CONF_2LANEDPIUSB3_SWAP	8
-
+/* config is the register value, as the mux sysctl reads and writes it */
 static void
 pi3usb_print_config(device_t dev, uint8_t config)
 {
-	if (config > 8) {
+	if (config > PI3USB_CFG_USB32DPIS) {
 		device_printf(dev, "invalid config\n");
 		return;
 	}
 	switch (config) {
-	case PI3USB_CONF_4LANEDPI:
+	case PI3USB_CFG_4DPI:
 		device_printf(dev, "PI3USB_CONF_4LANEDPI\n");
 		break;
-	case PI3USB_CONF_4LANEDPI_SWAP:
+	case PI3USB_CFG_4DPIS:
 		device_printf(dev, "PI3USB_CONF_4LANEDPI_SWAP\n");
 		break;
-	case PI3USB_CONF_USB3:
+	case PI3USB_CFG_USB3:
 		device_printf(dev, "PI3USB_CONF_USB3\n");
 		break;
-	case PI3USB_CONF_USB3_SWAP:
+	case PI3USB_CFG_USB3S:
 		device_printf(dev, "PI3USB_CONF_USB3_SWAP\n");
 		break;
-	case PI3USB_CONF_2LANEDPIUSB3:
+	case PI3USB_CFG_USB32DPI:
 		device_printf(dev, "PI3USB_CONF_2LANEDPIUSB3\n");
 		break;
-	case PI3USB_CONF_2LANEDPIUSB3_SWAP:
+	case PI3USB_CFG_USB32DPIS:
 		device_printf(dev, "PI3USB_CONF_2LANEDPIUSB3_SWAP\n");
 		break;
 	default:
@@ -123,8 +115,10 @@ pi3usb_attach(device_t dev)
 	uint8_t config = 0;
 
 	sc->sc_dev = dev;
+	sx_init(&sc->sc_lock, "pi3usb");
 	device_printf(dev, "attach\n");
 
+	sc->sc_config = PI3USB_CFG_UNKNOWN;
 	if ((rv = pi3usb_read(dev, &config)) != 0)	
 		device_printf(dev, "read config failed rv: %d errno: %d\n", rv, iic2errno(rv));
 	else {
@@ -141,7 +135,9 @@ pi3usb_attach(device_t dev)
 		    "mux", CTLTYPE_INT | CTLFLAG_RW,
 		    sc, 0, pi3usb_sysctl, "I",
 		    "USB-C MUX config");
-
+	SYSCTL_ADD_U64(sysctl_ctx, SYSCTL_CHILDREN(sysctl_tree), OID_AUTO,
+		"changes", CTLFLAG_RD, &sc->sc_changes, 0,
+		"Times the mux config was changed");
 
 	return (0);
 }
@@ -149,48 +145,74 @@ pi3usb_attach(device_t dev)
 static int
 pi3usb_detach(device_t dev)
 {
+	struct pi3usb_softc *sc = device_get_softc(dev);
+
+	sx_destroy(&sc->sc_lock);
 	return (0);
 }
 
+/*
+ * Set the mux, skipping the write when it is already there. fusb3 calls
+ * this from its state machine on attach and detach.
+ */
+int
+pi3usb_set_config(device_t dev, uint8_t config)
+{
+	struct pi3usb_softc *sc = device_get_softc(dev);
+	int rv = 0;
+
+	if (config > PI3USB_CFG_USB32DPIS || config == PI3USB_CFG_SWAP)
+		return (EINVAL);
+
+	sx_xlock(&sc->sc_lock);
+	if (config != sc->sc_config) {
+		if ((rv = pi3usb_write(dev, config)) != 0) {
+			sc->sc_config = PI3USB_CFG_UNKNOWN;
+			device_printf(dev, "write config failed rv: %d errno: %d\n",
+			    rv, iic2errno(rv));
+		} else {
+			sc->sc_config = config;
+			sc->sc_changes++;
+		}
+	}
+	sx_xunlock(&sc->sc_lock);
+
+	return (iic2errno(rv));
+}
+
 static int
 pi3usb_sysctl(SYSCTL_HANDLER_ARGS)
 {
 	struct pi3usb_softc *sc;
 	uint8_t value;
-	int rv = 0;
+	int rv, val;
+
+	sc = (struct pi3usb_softc *)arg1;
 
-	sc = (struct pi3usb_softc *)oidp->oid_arg1;
-
-	if (req->newptr != NULL ) {
-		value = CAST_PTR_INT(req->newptr);
-		if (value < 0 || value > 8)
-			return (EINVAL);
-		device_printf(sc->sc_dev, "value %d\n", value);
-		if ((rv = pi3usb_write(sc->sc_dev, value)) != 0)
-			device_printf(sc->sc_dev, "write config failed rv: %d errno: %d\n",
-		    	rv, iic2errno(rv));
-	} else {
-		if ((rv = pi3usb_read(sc->sc_dev, &value)) != 0)	
-			device_printf(sc->sc_dev, "read config failed rv: %d errno: %d\n",
-				rv, iic2errno(rv));
-		device_printf(sc->sc_dev, "value %d\n", value);
-		SYSCTL_OUT(req, &value, sizeof(value));
+	if ((rv = pi3usb_read(sc->sc_dev, &value)) != 0) {
+		device_printf(sc->sc_dev, "read config failed rv: %d errno: %d\n",
+			rv, iic2errno(rv));
+		return (iic2errno(rv));
 	}
+	val = value;
 
-	return (iic2errno(rv));
+	rv = sysctl_handle_int(oidp, &val, 0, req);
+	if (rv != 0 || req->newptr == NULL)
+		return (rv);
+	if (val < PI3USB_CFG_OPEN || val > PI3USB_CFG_USB32DPIS)
+		return (EINVAL);
+
+	return (pi3usb_set_config(sc->sc_dev, val));
 }
 
 static int 
 pi3usb_read(device_t dev, uint8_t *val)
 {
-	struct pi3usb_softc *sc;
 	struct iic_msg msg[1];
 	uint8_t buf[2];
 	int rv;
 	uint16_t addr = iicbus_get_addr(dev); 
 
-	sc = device_get_softc(dev);
-
 	msg[0].slave = addr;
 	msg[0].flags = IIC_M_RD;
 	msg[0].len = 2;
@@ -205,7 +227,6 @@ pi3usb_read(device_t dev, uint8_t *val)
 static int 
 pi3usb_write(device_t dev, uint8_t val)
 {
-	struct pi3usb_softc *sc;
 	struct iic_msg msg[2];
 	uint8_t buf[2];
 	uint16_t addr = iicbus_get_addr(dev); 
@@ -213,8 +234,6 @@ pi3usb_write(device_t dev, uint8_t val)
 	buf[0] = 0;
 	buf[1] = val;
 
-	sc = device_get_softc(dev);
-
 	msg[0].slave = addr;
 	msg[0].flags = IIC_M_WR;
 	msg[0].len = 2;
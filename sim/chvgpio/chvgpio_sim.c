@@ -0,0 +1,709 @@
+/*-
+ * Copyright (c) 2018 Tom Jones <tj@enoti.me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+
+/*
+ * Cherry View GPIO register model for chvgpio(4).
+ *
+ * The driver is built unmodified on top of a simulated pad register file.
+ * Each community is seeded from the pad registers Linux dumped in
+ * linuxdebugpinctrl/INT33FF_0x/pins, INTERRUPT_STATUS is write-1-to-clear
+ * and is raised from the INTWAKECFG trigger of each pad as the harness moves
+ * the input levels, and the community interrupt is delivered whenever a
+ * status bit is set for an unmasked line.
+ */
+
+#include "../../chvgpio/chvgpio.c"
+
+#include "sim.h"
+
+
+#define	CHV_NCOMMUNITIES	4
+#define	CHV_MAXGROUPS		8
+#define	CHV_MAXPADS		(CHV_MAXGROUPS * 15)
+#define	CHV_WINDOW		(CHVGPIO_PAD_CFG0 + CHV_MAXGROUPS * 1024)
+
+struct chv_counters {
+	uint64_t	reads;
+	uint64_t	writes;
+	uint64_t	status_reads;
+	uint64_t	status_writes;
+	uint64_t	mask_writes;
+	uint64_t	pad_reads;
+	uint64_t	pad_writes;
+	uint64_t	locked_writes;	/* dropped, pad has CFGLOCK set */
+	uint64_t	interrupts;
+};
+
+struct chv_community {
+	const char	*name;
+	int		uid;
+	device_t	dev;
+	struct sim_acpi_node *acpi;
+
+	uint32_t	status;
+	uint32_t	mask;
+	uint32_t	cfg0[CHV_MAXPADS];
+	uint32_t	cfg1[CHV_MAXPADS];
+	int		input[CHV_MAXPADS];	/* level driven onto the pad */
+	int		npads;			/* seeded from the dump */
+
+	struct chv_counters c;
+};
+
+static struct chv_community chv[CHV_NCOMMUNITIES] = {
+	{ .name = "INT33FF_00", .uid = 1 },	/* southwest */
+	{ .name = "INT33FF_01", .uid = 2 },	/* north */
+	{ .name = "INT33FF_02", .uid = 3 },	/* east */
+	{ .name = "INT33FF_03", .uid = 4 },	/* southeast */
+};
+
+static int
+chv_pad(bus_size_t off, int *cfg1)
+{
+	int pad;
+
+	off -= CHVGPIO_PAD_CFG0;
+	pad = (off / 1024) * 15 + (off % 1024) / 8;
+	*cfg1 = (off & 4) != 0;
+	if ((off % 1024) / 8 >= 15 || pad >= CHV_MAXPADS)
+		return (-1);
+	return (pad);
+}
+
+/* Level seen by the pad logic, after the RX inversion */
+static int
+chv_rx(struct chv_community *cc, int pad)
+{
+	uint32_t cfg0;
+	int level, gpiocfg;
+
+	cfg0 = cc->cfg0[pad];
+	gpiocfg = (cfg0 & CHVGPIO_PAD_CFG0_GPIOCFG_MASK) >>
+		CHVGPIO_PAD_CFG0_GPIOCFG_SHIFT;
+	if (gpiocfg == CHVGPIO_PAD_CFG0_GPIOCFG_GPO)
+		level = (cfg0 & CHVGPIO_PAD_CFG0_GPIOTXSTATE) != 0;
+	else
+		level = cc->input[pad];
+	if (cc->cfg1[pad] & CHVGPIO_PAD_CFG1_INVRXTX_RXDATA)
+		level = !level;
+	return (level);
+}
+
+static void
+chv_trigger(struct chv_community *cc, int pad, int old, int new)
+{
+	int fire;
+
+	switch (cc->cfg1[pad] & CHVGPIO_PAD_CFG1_INTWAKECFG_MASK) {
+	case CHVGPIO_PAD_CFG1_INTWAKECFG_FALLING:
+		fire = old && !new;
+		break;
+	case CHVGPIO_PAD_CFG1_INTWAKECFG_RISING:
+		fire = !old && new;
+		break;
+	case CHVGPIO_PAD_CFG1_INTWAKECFG_BOTH:
+		fire = old != new;
+		break;
+	case CHVGPIO_PAD_CFG1_INTWAKECFG_LEVEL:
+		fire = new;
+		break;
+	default:
+		fire = 0;
+	}
+	if (fire)
+		cc->status |= 1 << (cc->cfg0[pad] >> CHVGPIO_PAD_CFG0_INTSEL_SHIFT);
+}
+
+/* Level triggered pads keep their line asserted while they are active */
+static void
+chv_reassert(struct chv_community *cc)
+{
+	int pad;
+
+	for (pad = 0; pad < CHV_MAXPADS; pad++)
+		if ((cc->cfg1[pad] & CHVGPIO_PAD_CFG1_INTWAKECFG_MASK) ==
+		    CHVGPIO_PAD_CFG1_INTWAKECFG_LEVEL && chv_rx(cc, pad))
+			chv_trigger(cc, pad, 0, 1);
+}
+
+static uint32_t
+chv_read4(void *ctx, bus_size_t off)
+{
+	struct chv_community *cc = ctx;
+	int pad, cfg1;
+
+	cc->c.reads++;
+	switch (off) {
+	case CHVGPIO_INTERRUPT_STATUS:
+		cc->c.status_reads++;
+		return (cc->status);
+	case CHVGPIO_INTERRUPT_MASK:
+		return (cc->mask);
+	}
+
+	if (off < CHVGPIO_PAD_CFG0 || (pad = chv_pad(off, &cfg1)) < 0)
+		return (0xffffffff);
+	cc->c.pad_reads++;
+	if (cfg1)
+		return (cc->cfg1[pad]);
+	return ((cc->cfg0[pad] & ~CHVGPIO_PAD_CFG0_GPIORXSTATE) |
+		(cc->input[pad] ? CHVGPIO_PAD_CFG0_GPIORXSTATE : 0));
+}
+
+static void
+chv_write4(void *ctx, bus_size_t off, uint32_t val)
+{
+	struct chv_community *cc = ctx;
+	int pad, cfg1, old;
+
+	cc->c.writes++;
+	switch (off) {
+	case CHVGPIO_INTERRUPT_STATUS:
+		cc->c.status_writes++;
+		cc->status &= ~(val & 0xffff);
+		chv_reassert(cc);
+		return;
+	case CHVGPIO_INTERRUPT_MASK:
+		cc->c.mask_writes++;
+		cc->mask = val & 0xffff;
+		return;
+	}
+
+	if (off < CHVGPIO_PAD_CFG0 || (pad = chv_pad(off, &cfg1)) < 0)
+		return;
+	cc->c.pad_writes++;
+	if (cc->cfg1[pad] & CHVGPIO_PAD_CFG1_CFGLOCK) {
+		cc->c.locked_writes++;
+		return;
+	}
+
+	old = chv_rx(cc, pad);
+	if (cfg1)
+		cc->cfg1[pad] = val & ~CHVGPIO_PAD_CFG1_CFGLOCK;
+	else
+		cc->cfg0[pad] = val & ~CHVGPIO_PAD_CFG0_GPIORXSTATE;
+	chv_trigger(cc, pad, old, chv_rx(cc, pad));
+}
+
+/*
+ * Deliver the community interrupt until every unmasked line has been
+ * serviced, then run whatever the handler queued.
+ */
+static void
+chv_service(struct chv_community *cc)
+{
+	int n;
+
+	for (n = 0; (cc->status & cc->mask) != 0 && n < 64; n++) {
+		cc->c.interrupts++;
+		sim_intr(cc->dev);
+	}
+	sim_taskqueue_run();
+}
+
+static void
+chv_set_input(struct chv_community *cc, int pad, int level)
+{
+	int old;
+
+	old = chv_rx(cc, pad);
+	cc->input[pad] = level;
+	chv_trigger(cc, pad, old, chv_rx(cc, pad));
+	chv_service(cc);
+}
+
+/*
+ * Seed a community from a pinctrl-cherryview "pins" dump, one line per pad:
+ *	pin 35 (MF_HDA_SYNC) GPIO 0x00008201 0x04c00003
+ * with the pad number spaced 15 per group just like chvgpio's.
+ */
+static int
+chv_load(struct chv_community *cc, const char *dir)
+{
+	char path[1024], line[256];
+	const char *p;
+	uint32_t cfg0, cfg1;
+	FILE *f;
+	int pad;
+
+	snprintf(path, sizeof(path), "%s/%s/pins", dir, cc->name);
+	f = fopen(path, "r");
+	if (f == NULL) {
+		perror(path);
+		return (-1);
+	}
+
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (sscanf(line, "pin %d", &pad) != 1 || pad < 0 ||
+		    pad >= CHV_MAXPADS)
+			continue;
+		if ((p = strchr(line, ')')) == NULL ||
+		    (p = strstr(p, "0x")) == NULL ||
+		    sscanf(p, "%x %x", &cfg0, &cfg1) != 2)
+			continue;
+		cc->cfg0[pad] = cfg0 & ~CHVGPIO_PAD_CFG0_GPIORXSTATE;
+		cc->cfg1[pad] = cfg1;
+		cc->input[pad] = (cfg0 & CHVGPIO_PAD_CFG0_GPIORXSTATE) != 0;
+		cc->npads++;
+	}
+	fclose(f);
+
+	return (0);
+}
+
+static void
+chv_reset_counters(void)
+{
+	int i;
+
+	for (i = 0; i < CHV_NCOMMUNITIES; i++)
+		memset(&chv[i].c, 0, sizeof(chv[i].c));
+}
+
+/*
+ * The southwest community carries the lid switch event, _E23 in the DSDT,
+ * which may also wake the machine
+ */
+static uint16_t chv_lid_pin = 0x23;
+static ACPI_RESOURCE chv_sw_aei = {
+	.Type = ACPI_RESOURCE_TYPE_GPIO,
+	.Data.Gpio = {
+		.ConnectionType = ACPI_RESOURCE_GPIO_TYPE_INT,
+		.Triggering = ACPI_EDGE_SENSITIVE,
+		.Polarity = ACPI_ACTIVE_BOTH,
+		.WakeCapable = ACPI_WAKE_CAPABLE,
+		.PinTableLength = 1,
+		.PinTable = &chv_lid_pin,
+	},
+};
+
+static struct sim_acpi_node *chv_lid_method;
+
+static int
+chv_attach_all(const char *dir)
+{
+	struct chv_community *cc;
+	char name[16];
+	int i, error;
+
+	for (i = 0; i < CHV_NCOMMUNITIES; i++) {
+		cc = &chv[i];
+		if (chv_load(cc, dir) != 0)
+			return (-1);
+
+		snprintf(name, sizeof(name), "GPO%d", cc->uid - 1);
+		cc->acpi = sim_acpi_node(name, cc->uid);
+		if (cc->uid == SW_UID) {
+			chv_lid_method = sim_acpi_method(cc->acpi, "_E23");
+			sim_acpi_resources(cc->acpi, "_AEI", &chv_sw_aei, 1);
+		}
+
+		cc->dev = sim_device_create("gpio", i,
+			sizeof(struct chvgpio_softc));
+		sim_device_set_acpi(cc->dev, cc->acpi);
+		sim_device_set_mem(cc->dev, chv_read4, chv_write4, cc);
+
+		error = chvgpio_probe(cc->dev);
+		if (error == 0)
+			error = chvgpio_attach(cc->dev);
+		if (!sim_check(error == 0, "%s: attach, %d pads seeded",
+		    cc->name, cc->npads))
+			return (-1);
+	}
+
+	return (0);
+}
+
+static void
+chv_detach_all(void)
+{
+	int i;
+
+	for (i = 0; i < CHV_NCOMMUNITIES; i++) {
+		sim_check(chvgpio_detach(chv[i].dev) == 0, "%s: detach",
+			chv[i].name);
+		sim_device_destroy(chv[i].dev);
+	}
+}
+
+static void
+test_attach(void)
+{
+	struct chv_community *cc;
+
+	cc = &chv[SW_UID - 1];
+	sim_check(cc->mask == 1, "southwest: lid line unmasked (mask 0x%04x)",
+		cc->mask);
+	sim_check(cc->status == 0, "southwest: status acked at attach");
+
+	cc = &chv[SE_UID - 1];
+	sim_check(cc->mask == 0x0020,
+		"southeast: fusb302 line unmasked (mask 0x%04x)", cc->mask);
+}
+
+static void
+test_pins(void)
+{
+	struct chv_community *cc;
+	unsigned int val;
+	uint32_t flags;
+	int pin;
+
+	cc = &chv[N_UID - 1];
+
+	/* Find an unlocked pad firmware left as a plain GPIO */
+	for (pin = 0; pin < CHV_MAXPADS; pin++)
+		if (chvgpio_valid_pin(device_get_softc(cc->dev), pin) == 0 &&
+		    (cc->cfg1[pin] & CHVGPIO_PAD_CFG1_CFGLOCK) == 0 &&
+		    ((cc->cfg0[pin] & CHVGPIO_PAD_CFG0_GPIOCFG_MASK) >>
+		    CHVGPIO_PAD_CFG0_GPIOCFG_SHIFT) !=
+		    CHVGPIO_PAD_CFG0_GPIOCFG_HIZ && (cc->cfg0[pin] & 0x8000))
+			break;
+	if (!sim_check(pin < CHV_MAXPADS, "north: found unlocked gpio pad"))
+		return;
+
+	chvgpio_pin_setflags(cc->dev, pin, GPIO_PIN_OUTPUT);
+	chvgpio_pin_getflags(cc->dev, pin, &flags);
+	sim_check(flags == GPIO_PIN_OUTPUT, "north: pin %d output (0x%x)",
+		pin, flags);
+
+	chvgpio_pin_set(cc->dev, pin, GPIO_PIN_HIGH);
+	sim_check(cc->cfg0[pin] & CHVGPIO_PAD_CFG0_GPIOTXSTATE,
+		"north: pin %d driven high", pin);
+	chvgpio_pin_toggle(cc->dev, pin);
+	sim_check((cc->cfg0[pin] & CHVGPIO_PAD_CFG0_GPIOTXSTATE) == 0,
+		"north: pin %d toggled low", pin);
+
+	chvgpio_pin_setflags(cc->dev, pin, GPIO_PIN_INPUT);
+	cc->input[pin] = 1;
+	chvgpio_pin_get(cc->dev, pin, &val);
+	sim_check(val == GPIO_PIN_HIGH, "north: pin %d reads input high", pin);
+	cc->input[pin] = 0;
+	chvgpio_pin_get(cc->dev, pin, &val);
+	sim_check(val == GPIO_PIN_LOW, "north: pin %d reads input low", pin);
+}
+
+static void
+test_aei(void)
+{
+	struct chv_community *cc;
+	u_int calls;
+
+	cc = &chv[SW_UID - 1];
+	calls = sim_acpi_calls(chv_lid_method);
+
+	chv_set_input(cc, chv_lid_pin, !cc->input[chv_lid_pin]);
+	sim_check(sim_acpi_calls(chv_lid_method) == calls + 1,
+		"southwest: lid edge ran _E23");
+	sim_check(cc->status == 0, "southwest: lid line acked");
+
+	chv_set_input(cc, chv_lid_pin, !cc->input[chv_lid_pin]);
+	sim_check(sim_acpi_calls(chv_lid_method) == calls + 2,
+		"southwest: lid edge back ran _E23 again");
+	sim_check(sim_sysctl_u64(cc->dev, "line.0.count") == 2,
+		"southwest: line 0 counted both edges");
+
+	/* Status set on a masked line is left for whoever owns it */
+	cc->status |= 0x8000;
+	sim_intr(cc->dev);
+	sim_check(cc->status == 0 && sim_sysctl_u64(cc->dev,
+	    "line.15.stray") == 1, "southwest: stray line 15 acked");
+}
+
+/*
+ * The FUSB302 interrupt, north pin 5, is not in any _AEI and goes to
+ * fusb3(4) through chvgpio_setup_intr. Firmware leaves it level
+ * triggered, the driver asks for falling edges.
+ */
+static u_int chv_consumer_calls;
+
+static void
+chv_consumer(void *arg)
+{
+	chv_consumer_calls++;
+}
+
+static void
+test_consumer(void)
+{
+	struct chv_community *cc;
+	int pin, line, error;
+
+	cc = &chv[N_UID - 1];
+	pin = 5;
+	line = cc->cfg0[pin] >> CHVGPIO_PAD_CFG0_INTSEL_SHIFT;
+
+	error = chvgpio_setup_intr(cc->dev, pin, ACPI_LEVEL_SENSITIVE,
+		ACPI_ACTIVE_LOW, chv_consumer, NULL);
+	sim_check(error == EOPNOTSUPP, "north: level consumer refused, %d",
+		error);
+
+	cc->input[pin] = 1;
+	error = chvgpio_setup_intr(cc->dev, pin, ACPI_EDGE_SENSITIVE,
+		ACPI_ACTIVE_LOW, chv_consumer, NULL);
+	sim_check(error == 0 && (cc->mask & (1 << line)) != 0,
+		"north: pin %d handed out on line %d", pin, line);
+	sim_check(chvgpio_setup_intr(cc->dev, pin, ACPI_EDGE_SENSITIVE,
+	    ACPI_ACTIVE_LOW, chv_consumer, NULL) == EBUSY,
+		"north: pin %d cannot be handed out twice", pin);
+
+	chv_set_input(cc, pin, 0);
+	chv_set_input(cc, pin, 1);
+	sim_check(chv_consumer_calls == 1 && cc->status == 0,
+		"north: falling edge called the handler once");
+
+	chvgpio_teardown_intr(cc->dev, pin);
+	chv_set_input(cc, pin, 0);
+	chv_set_input(cc, pin, 1);
+	sim_check(chv_consumer_calls == 1 && (cc->mask & (1 << line)) == 0,
+		"north: line %d masked after teardown", line);
+}
+
+static void
+test_suspend(void)
+{
+	struct chv_community *cc;
+	uint32_t cfg0[CHV_MAXPADS], cfg1[CHV_MAXPADS];
+	uint64_t writes;
+	int pad, clobbered, same;
+
+	cc = &chv[N_UID - 1];
+	memcpy(cfg0, cc->cfg0, sizeof(cfg0));
+	memcpy(cfg1, cc->cfg1, sizeof(cfg1));
+
+	sim_check(chvgpio_suspend(cc->dev) == 0, "north: suspend");
+
+	/* Firmware resets the unlocked pads of the community */
+	clobbered = 0;
+	for (pad = 0; pad < CHV_MAXPADS; pad++)
+		if ((cc->cfg1[pad] & CHVGPIO_PAD_CFG1_CFGLOCK) == 0 &&
+		    cc->cfg0[pad] != 0) {
+			cc->cfg0[pad] = 0;
+			cc->cfg1[pad] = 0;
+			clobbered++;
+		}
+	cc->mask = 0;
+
+	writes = cc->c.pad_writes;
+	sim_check(chvgpio_resume(cc->dev) == 0, "north: resume");
+
+	same = memcmp(cfg0, cc->cfg0, sizeof(cfg0)) == 0 &&
+		memcmp(cfg1, cc->cfg1, sizeof(cfg1)) == 0;
+	sim_check(same, "north: pads restored");
+	sim_check(sim_sysctl_u64(cc->dev, "resume_pads") == (uint64_t)clobbered,
+		"north: %d clobbered pads rewritten, %ju pad writes", clobbered,
+		(uintmax_t)(cc->c.pad_writes - writes));
+}
+
+/*
+ * Pin flags set on the lid pad leave its _AEI wake alone, and a pad whose
+ * line is taken is refused before its configuration is touched.
+ */
+static void
+test_wake(void)
+{
+	struct chv_community *cc;
+	uint32_t flags, cfg0;
+	int pin, error;
+
+	cc = &chv[SW_UID - 1];
+
+	chvgpio_pin_getflags(cc->dev, chv_lid_pin, &flags);
+	sim_check(flags & CHVGPIO_PIN_WAKE, "southwest: lid armed from _AEI");
+	error = chvgpio_pin_setflags(cc->dev, chv_lid_pin, GPIO_PIN_INPUT);
+	chvgpio_pin_getflags(cc->dev, chv_lid_pin, &flags);
+	sim_check(error == 0 && (flags & CHVGPIO_PIN_WAKE),
+		"southwest: lid still armed after setflags, %d", error);
+
+	for (pin = 0; pin < CHV_MAXPADS; pin++)
+		if (pin != chv_lid_pin &&
+		    chvgpio_valid_pin(device_get_softc(cc->dev), pin) == 0 &&
+		    (cc->cfg1[pin] & CHVGPIO_PAD_CFG1_CFGLOCK) == 0)
+			break;
+	if (sim_check(pin < CHV_MAXPADS, "southwest: found unlocked pad")) {
+		cfg0 = cc->cfg0[pin];
+		cc->cfg0[pin] &= ~CHVGPIO_PAD_CFG0_INTSEL_MASK;
+		error = chvgpio_pin_setflags(cc->dev, pin,
+			GPIO_PIN_OUTPUT | CHVGPIO_PIN_WAKE);
+		sim_check(error == EBUSY && cc->cfg0[pin] ==
+		    (cfg0 & ~CHVGPIO_PAD_CFG0_INTSEL_MASK),
+			"southwest: pin %d on the lid line refused untouched, %d",
+			pin, error);
+		cc->cfg0[pin] = cfg0;
+	}
+
+	sim_check(chvgpio_suspend(cc->dev) == 0 && (cc->mask & 1) != 0,
+		"southwest: lid line unmasked while suspended");
+	sim_check(chvgpio_resume(cc->dev) == 0, "southwest: resume");
+}
+
+static void
+test_storm(void)
+{
+	struct chv_community *cc;
+	u_int threshold, calls;
+	int i;
+
+	cc = &chv[SW_UID - 1];
+	threshold = 50;
+	sim_sysctl_set(cc->dev, "storm_threshold", &threshold,
+		sizeof(threshold));
+
+	calls = sim_acpi_calls(chv_lid_method);
+	sim_quiet = 1;
+	for (i = 0; i < (int)threshold * 2; i++)
+		chv_set_input(cc, chv_lid_pin, !cc->input[chv_lid_pin]);
+	sim_quiet = 0;
+
+	sim_check(sim_sysctl_u64(cc->dev, "line.0.throttled") == 1 &&
+	    (cc->mask & 1) == 0, "southwest: storming lid line masked");
+	sim_check(sim_acpi_calls(chv_lid_method) - calls <= threshold + 1,
+		"southwest: %u events ran for %u edges",
+		sim_acpi_calls(chv_lid_method) - calls, threshold * 2);
+
+	sim_clock_advance(SBT_1S);
+	sim_check(sim_sysctl_u64(cc->dev, "line.0.throttled") == 0 &&
+	    (cc->mask & 1) != 0, "southwest: lid line rearmed after backoff");
+
+	threshold = CHVGPIO_STORM_THRESHOLD;
+	sim_sysctl_set(cc->dev, "storm_threshold", &threshold,
+		sizeof(threshold));
+}
+
+/*
+ * Cost of the pin accessors, in time and in register accesses per call.
+ */
+static void
+bench(const char *what, struct chv_community *cc,
+    void (*op)(device_t, uint32_t), uint32_t pin, int iterations)
+{
+	uint64_t start, ns;
+	int i;
+
+	chv_reset_counters();
+	start = sim_nsec();
+	for (i = 0; i < iterations; i++)
+		op(cc->dev, pin);
+	ns = sim_nsec() - start;
+
+	printf("bench %-16s %8.1f ns/op %6.2f reads/op %6.2f writes/op\n",
+		what, (double)ns / iterations,
+		(double)cc->c.reads / iterations,
+		(double)cc->c.writes / iterations);
+}
+
+static void
+bench_get(device_t dev, uint32_t pin)
+{
+	unsigned int val;
+
+	chvgpio_pin_get(dev, pin, &val);
+}
+
+static void
+bench_set(device_t dev, uint32_t pin)
+{
+	chvgpio_pin_set(dev, pin, GPIO_PIN_HIGH);
+}
+
+static void
+bench_toggle(device_t dev, uint32_t pin)
+{
+	chvgpio_pin_toggle(dev, pin);
+}
+
+static void
+bench_getflags(device_t dev, uint32_t pin)
+{
+	uint32_t flags;
+
+	chvgpio_pin_getflags(dev, pin, &flags);
+}
+
+static void
+bench_intr(device_t dev, uint32_t pin)
+{
+	struct chv_community *cc = &chv[SW_UID - 1];
+
+	chv_set_input(cc, pin, !cc->input[pin]);
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: chvgpio_sim [-n iterations] [dumpdir]\n");
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *dir;
+	int ch, iterations;
+
+	iterations = 1000000;
+	while ((ch = getopt(argc, argv, "n:")) != -1) {
+		switch (ch) {
+		case 'n':
+			iterations = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc > 1 || iterations <= 0)
+		usage();
+	dir = argc == 1 ? argv[0] : "../linuxdebugpinctrl";
+
+	if (chv_attach_all(dir) != 0)
+		return (1);
+
+	test_attach();
+	test_pins();
+	test_aei();
+	test_consumer();
+	test_suspend();
+	test_wake();
+	test_storm();
+
+	bench("pin_get", &chv[N_UID - 1], bench_get, 0, iterations);
+	bench("pin_set", &chv[N_UID - 1], bench_set, 0, iterations);
+	bench("pin_toggle", &chv[N_UID - 1], bench_toggle, 0, iterations);
+	bench("pin_getflags", &chv[N_UID - 1], bench_getflags, 0, iterations);
+	sim_quiet = 1;
+	bench("lid_event", &chv[SW_UID - 1], bench_intr, chv_lid_pin,
+		MIN(iterations, 1000));
+	sim_quiet = 0;
+
+	chv_detach_all();
+
+	printf("%d failures\n", sim_failures());
+	return (sim_failures() != 0);
+}
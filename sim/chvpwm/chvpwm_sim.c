@@ -0,0 +1,720 @@
+/*-
+ * Copyright (c) 2018 Tom Jones <tj@enoti.me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Cherry View LPSS PWM register model for chvpwm(4).
+ *
+ * CTRL holds the enable bit, the base unit and the on time divisor. New
+ * values only reach the output once UPDATE is written, the model latches
+ * them at the end of the running period and clears UPDATE then, as the
+ * controller does. Every register access is counted.
+ */
+
+#include "../../chvpwm/chvpwm.c"
+
+#include "sim.h"
+
+struct pwm_counters {
+	uint64_t	reads;
+	uint64_t	writes;
+	uint64_t	updates;	/* UPDATE written */
+	uint64_t	latches;
+	uint64_t	restarts;	/* UPDATE written while one was pending */
+	uint64_t	stray;		/* past CTRL on a block without RESET */
+};
+
+struct pwm_model {
+	device_t	dev;
+	u_int		clk_hz;
+	u_int		base_bits;
+	uint32_t	base_mask;
+	uint32_t	ctrl;		/* as written, less UPDATE */
+	uint32_t	active;		/* base unit and divisor latched */
+	int		priv;	/* LPSS private block, RESET and GENERAL */
+	uint32_t	reset;
+	uint32_t	general;
+	int		pending;
+	int		stall;		/* hold UPDATE set */
+	sbintime_t	latch_at;
+	struct pwm_counters c;
+};
+
+/* Cherry View's 16 bit base unit */
+#define	PWM_BASE_MASK	(0xffffU << CHVPWM_CTRL_BASE_SHIFT)
+#define	PWM_FREQ(x)	((x) << CHVPWM_CTRL_BASE_SHIFT)
+
+static struct pwm_model pwm, pwm2;
+
+/* One output period at the latched base unit */
+static sbintime_t
+pwm_period_sbt(struct pwm_model *m, uint32_t ctrl)
+{
+	uint32_t base;
+
+	base = (ctrl & m->base_mask) >> CHVPWM_CTRL_BASE_SHIFT;
+	if (base == 0)
+		return (0);
+	return ((SBT_1S << m->base_bits) / ((sbintime_t)base * m->clk_hz));
+}
+
+/* Latch once the running period ends, only while the output runs */
+static void
+pwm_tick(struct pwm_model *m)
+{
+	if (m->pending && !m->stall && (m->ctrl & CHVPWM_CTRL_ENABLE) &&
+	    sbinuptime() >= m->latch_at) {
+		m->active = m->ctrl & (m->base_mask | CHVPWM_CTRL_DIV_MASK);
+		m->pending = 0;
+		m->c.latches++;
+	}
+}
+
+static uint32_t
+pwm_read4(void *ctx, bus_size_t off)
+{
+	struct pwm_model *m = ctx;
+
+	m->c.reads++;
+	if (off == CHVPWM_CTRL) {
+		pwm_tick(m);
+		return (m->ctrl | (m->pending ? CHVPWM_CTRL_UPDATE : 0));
+	}
+	if (!m->priv) {
+		m->c.stray++;
+		return (0);
+	}
+	switch (off) {
+	case CHVPWM_PRIV + CHVPWM_RESET:
+		return (m->reset);
+	case CHVPWM_PRIV + CHVPWM_GENERAL:
+		return (m->general);
+	}
+	return (0);
+}
+
+/*
+ * CTRL ignores writes while the block is held in reset. Without a private
+ * block the next output's registers are where RESET would be.
+ */
+static void
+pwm_write4(void *ctx, bus_size_t off, uint32_t val)
+{
+	struct pwm_model *m = ctx;
+
+	m->c.writes++;
+	if (off != CHVPWM_CTRL && !m->priv) {
+		m->c.stray++;
+		return;
+	}
+	switch (off) {
+	case CHVPWM_PRIV + CHVPWM_RESET:
+		m->reset = val;
+		return;
+	case CHVPWM_PRIV + CHVPWM_GENERAL:
+		m->general = val;
+		return;
+	case CHVPWM_CTRL:
+		break;
+	default:
+		return;
+	}
+	if (m->priv &&
+	    (m->reset & CHVPWM_RESET_RELEASE) != CHVPWM_RESET_RELEASE)
+		return;
+	pwm_tick(m);
+	m->ctrl = val & ~CHVPWM_CTRL_UPDATE;
+	if (val & CHVPWM_CTRL_UPDATE) {
+		m->c.updates++;
+		if (m->pending)
+			m->c.restarts++;
+		m->pending = 1;
+		m->latch_at = sbinuptime() + pwm_period_sbt(m, m->active);
+	}
+}
+
+/* Power lost over suspend, everything back to reset values */
+static void
+pwm_power_cycle(struct pwm_model *m)
+{
+	m->ctrl = 0;
+	m->active = 0;
+	m->reset = 0;
+	m->general = 0;
+	m->pending = 0;
+}
+
+/* What the pin does, in ns */
+static void
+pwm_output(struct pwm_model *m, u_int *period, u_int *duty)
+{
+	uint32_t base, div;
+
+	pwm_tick(m);
+	base = (m->active & m->base_mask) >> CHVPWM_CTRL_BASE_SHIFT;
+	div = m->active & CHVPWM_CTRL_DIV_MASK;
+	*period = chvpwm_base_period(device_get_softc(m->dev), base);
+	*duty = chvpwm_div_duty(*period, div);
+}
+
+static void
+pwm_reset_counters(struct pwm_model *m)
+{
+	memset(&m->c, 0, sizeof(m->c));
+}
+
+/* A controller with the CTRL and RESET firmware left */
+static int
+pwm_model_attach(struct pwm_model *m, const char *hid, int unit,
+    u_int clk_hz, u_int base_bits, uint32_t ctrl, uint32_t reset)
+{
+	struct sim_acpi_node *node;
+	int error;
+
+	memset(m, 0, sizeof(*m));
+	m->clk_hz = clk_hz;
+	m->base_bits = base_bits;
+	m->base_mask = ((1U << base_bits) - 1) << CHVPWM_CTRL_BASE_SHIFT;
+	/* Only Broxton's has no private block */
+	m->priv = strcmp(hid, "80865AC8") != 0;
+	m->reset = reset;
+	m->ctrl = ctrl;
+	m->active = ctrl & (m->base_mask | CHVPWM_CTRL_DIV_MASK);
+	m->dev = sim_device_create("chvpwm", unit, 0);
+	node = sim_acpi_node(unit == 0 ? "PWM1" : "PWM2", unit + 1);
+	sim_acpi_set_hid(node, hid);
+	sim_device_set_acpi(m->dev, node);
+	sim_device_set_mem(m->dev, pwm_read4, pwm_write4, m);
+
+	error = chvpwm_probe(m->dev);
+	if (error == 0)
+		error = chvpwm_attach(m->dev);
+	return (error);
+}
+
+static int
+pwm_attach(uint32_t ctrl)
+{
+	return (pwm_model_attach(&pwm, "80862288", 0, CHVPWM_CLK_HZ, 16,
+		ctrl, CHVPWM_RESET_RELEASE));
+}
+
+static void
+pwm_detach(struct pwm_model *m)
+{
+	chvpwm_detach(m->dev);
+	sim_device_destroy(m->dev);
+	m->dev = NULL;
+}
+
+static int
+pwm_sysctl_int(const char *name)
+{
+	size_t len;
+	int val;
+
+	len = sizeof(val);
+	if (sim_sysctl_get(pwm.dev, name, &val, &len) != 0)
+		return (-1);
+	return (val);
+}
+
+static int
+pwm_sysctl_set(const char *name, int val)
+{
+	return (sim_sysctl_set(pwm.dev, name, &val, sizeof(val)));
+}
+
+/*
+ * Firmware's settings are picked up at attach and the pwmbus child is
+ * added.
+ */
+static void
+test_attach(void)
+{
+	u_int period, duty, n;
+	bool enabled;
+
+	/* 25% at 20 kHz, running */
+	if (!sim_check(pwm_attach(CHVPWM_CTRL_ENABLE | PWM_FREQ(68) |
+	    191) == 0, "chvpwm: attach"))
+		return;
+	sim_check(device_find_child(pwm.dev, "pwmbus", -1) != NULL &&
+	    device_is_attached(device_find_child(pwm.dev, "pwmbus", -1)),
+		"chvpwm: pwmbus attached");
+	chvpwm_channel_count(pwm.dev, &n);
+	chvpwm_channel_get_config(pwm.dev, 0, &period, &duty);
+	chvpwm_channel_is_enabled(pwm.dev, 0, &enabled);
+	sim_check(n == 1 && period == 50196 && duty == 12598 && enabled,
+		"chvpwm: firmware's %u/%u ns picked up", duty, period);
+	sim_check(chvpwm_channel_config(pwm.dev, 1, 50000, 0) == EINVAL,
+		"chvpwm: only channel 0");
+}
+
+/*
+ * Base unit and divisor in fixed point, checked against what the output
+ * then does.
+ */
+static void
+test_config(void)
+{
+	static const struct {
+		u_int	period;
+		u_int	duty;
+		uint32_t base;
+		uint32_t div;
+	} cases[] = {
+		{ 50000, 25000, 68, 127 },	/* 20 kHz, 50% */
+		{ 5000000 / 1000, 0, 683, 255 },	/* 200 kHz, off */
+		{ 1000000, 1000000, 3, 0 },	/* nearest 1 kHz is 879 Hz */
+		{ 3413333, 341333, 1, 230 },	/* slowest */
+		{ 100, 50, 34133, 127 },	/* 10 MHz */
+	};
+	u_int period, duty, i;
+	uint32_t base, div;
+	int error;
+
+	for (i = 0; i < nitems(cases); i++) {
+		pwm_reset_counters(&pwm);
+		error = chvpwm_channel_config(pwm.dev, 0, cases[i].period,
+			cases[i].duty);
+		/* Long enough for the slowest period to end twice */
+		sim_clock_advance(mstosbt(8));
+		pwm_tick(&pwm);
+		base = (pwm.active & PWM_BASE_MASK) >>
+			CHVPWM_CTRL_BASE_SHIFT;
+		div = pwm.active & CHVPWM_CTRL_DIV_MASK;
+		pwm_output(&pwm, &period, &duty);
+		sim_check(error == 0 && base == cases[i].base &&
+		    div == cases[i].div && pwm.c.updates == 1 &&
+		    pwm.c.latches == 1,
+			"chvpwm: %u/%u ns is base %u div %u, out %u/%u ns",
+			cases[i].duty, cases[i].period, base, div, duty,
+			period);
+	}
+
+	error = chvpwm_channel_config(pwm.dev, 0, 3500000, 0);
+	sim_check(error == EINVAL, "chvpwm: period past the slowest refused");
+	error = chvpwm_channel_config(pwm.dev, 0, 40, 0);
+	sim_check(error == EINVAL, "chvpwm: period past the fastest refused");
+	error = chvpwm_channel_config(pwm.dev, 0, 50000, 50001);
+	sim_check(error == EINVAL, "chvpwm: duty over the period refused");
+}
+
+/* Disabled, settings are stored and only latched when enabled */
+static void
+test_enable(void)
+{
+	u_int period, duty;
+	sbintime_t now;
+	bool enabled;
+	int error;
+
+	sim_check(chvpwm_channel_enable(pwm.dev, 0, false) == 0 &&
+	    (pwm.ctrl & CHVPWM_CTRL_ENABLE) == 0, "chvpwm: disabled");
+	pwm_reset_counters(&pwm);
+	sim_check(chvpwm_channel_config(pwm.dev, 0, 40000, 10000) == 0 &&
+	    pwm.c.updates == 0, "chvpwm: stored while disabled");
+	/* Enabling sends UPDATE and returns, even with the latch held off */
+	pwm.stall = 1;
+	now = sbinuptime();
+	error = chvpwm_channel_enable(pwm.dev, 0, true);
+	sim_check(error == 0 && pwm.c.updates == 1 &&
+	    sbinuptime() - now < ustosbt(CHVPWM_UPDATE_US),
+		"chvpwm: UPDATE sent on enable without waiting");
+	pwm.stall = 0;
+	sim_clock_advance(SBT_1MS);
+	pwm_tick(&pwm);
+	sim_check(pwm.c.latches == 1, "chvpwm: latched after enable");
+	pwm_output(&pwm, &period, &duty);
+	chvpwm_channel_is_enabled(pwm.dev, 0, &enabled);
+	sim_check(enabled && period == 40157 && duty == 10079,
+		"chvpwm: output %u/%u ns", duty, period);
+}
+
+/* The sysctls take continuous values, the period keeps the duty ratio */
+static void
+test_sysctl(void)
+{
+	int error;
+
+	error = pwm_sysctl_set("period", 50000) ||
+		pwm_sysctl_set("duty", 12500);
+	sim_check(error == 0 && pwm_sysctl_int("period") == 50196 &&
+	    pwm_sysctl_int("duty") == 12598,
+		"chvpwm: period and duty, %d/%d ns",
+		pwm_sysctl_int("duty"), pwm_sysctl_int("period"));
+	error = pwm_sysctl_set("freq", 25000);
+	sim_check(error == 0 && pwm_sysctl_int("freq") == 24902 &&
+	    pwm_sysctl_int("period") == 40157 &&
+	    pwm_sysctl_int("duty") == 10079,
+		"chvpwm: 25 kHz keeps 25%%, %d/%d ns",
+		pwm_sysctl_int("duty"), pwm_sysctl_int("period"));
+	sim_check(pwm_sysctl_set("freq", 0) == EINVAL &&
+	    pwm_sysctl_set("duty", 2000000) == EINVAL,
+		"chvpwm: bad values refused");
+	sim_check(pwm_sysctl_set("enable", 0) == 0 &&
+	    pwm_sysctl_int("enable") == 0 && pwm_sysctl_set("enable", 1) == 0 &&
+	    pwm_sysctl_int("enable") == 1, "chvpwm: enable");
+	sim_check(sim_sysctl_u64(pwm.dev, "update_timeouts") == 0,
+		"chvpwm: every update latched");
+}
+
+/*
+ * Settings made while an update is latching wait for it, only the last of
+ * them is written.
+ */
+static void
+test_coalesce(void)
+{
+	uint64_t merged, deferred, timeouts;
+	u_int period, duty;
+	int i;
+
+	chvpwm_channel_config(pwm.dev, 0, 50000, 0);
+	sim_clock_advance(SBT_1MS);
+	sim_clock_advance(SBT_1MS);
+	pwm_tick(&pwm);
+	merged = sim_sysctl_u64(pwm.dev, "updates_merged");
+	deferred = sim_sysctl_u64(pwm.dev, "updates_deferred");
+	pwm_reset_counters(&pwm);
+	for (i = 1; i <= 10; i++)
+		chvpwm_channel_config(pwm.dev, 0, 50000, i * 2500);
+	sim_check(pwm.c.writes == 1 &&
+	    sim_sysctl_u64(pwm.dev, "updates_deferred") - deferred == 1 &&
+	    sim_sysctl_u64(pwm.dev, "updates_merged") - merged == 8,
+		"chvpwm: burst of 10 is one write, one deferred, 8 merged");
+	/* One period for the flush to go out, another for it to latch */
+	sim_clock_advance(SBT_1MS);
+	sim_clock_advance(SBT_1MS);
+	pwm_output(&pwm, &period, &duty);
+	sim_check(pwm.c.writes == 2 && pwm.c.latches == 2 &&
+	    pwm.c.restarts == 0 && duty == 25196,
+		"chvpwm: last writer wins, %u/%u ns", duty, period);
+
+	/* A controller that never clears UPDATE gets the settings again */
+	timeouts = sim_sysctl_u64(pwm.dev, "update_timeouts");
+	pwm.stall = 1;
+	chvpwm_channel_config(pwm.dev, 0, 50000, 0);
+	chvpwm_channel_config(pwm.dev, 0, 50000, 10000);
+	sim_quiet = 1;
+	sim_clock_advance(mstosbt(CHVPWM_UPDATE_US / 1000 + 1));
+	sim_quiet = 0;
+	pwm.stall = 0;
+	sim_clock_advance(SBT_1MS);
+	pwm_output(&pwm, &period, &duty);
+	sim_check(sim_sysctl_u64(pwm.dev, "update_timeouts") == timeouts + 1 &&
+	    duty == 10039, "chvpwm: stuck UPDATE reported and rewritten, "
+	    "%u/%u ns", duty, period);
+}
+
+static uint32_t
+pwm_div(struct pwm_model *m)
+{
+	pwm_tick(m);
+	return (m->active & CHVPWM_CTRL_DIV_MASK);
+}
+
+/* Advance ms one at a time, checking the output only ever moves one way */
+static int
+pwm_ramp_run(int ms, int up)
+{
+	uint32_t div, last;
+	int i, ok;
+
+	ok = 1;
+	last = pwm_div(&pwm);
+	for (i = 0; i < ms; i++) {
+		sim_clock_advance(SBT_1MS);
+		div = pwm_div(&pwm);
+		if (up ? div > last : div < last)
+			ok = 0;
+		last = div;
+	}
+	return (ok);
+}
+
+/*
+ * A brightness write ramps over ramp_ms through the gamma table from a
+ * callout, one step per latch at most.
+ */
+static void
+test_ramp(void)
+{
+	uint64_t steps, merged;
+	u_int period, duty;
+	int error, ok;
+
+	chvpwm_channel_config(pwm.dev, 0, 50000, 0);
+	sim_clock_advance(SBT_1MS);
+	sim_check(pwm_sysctl_int("brightness") == 0 &&
+	    pwm_sysctl_set("ramp_ms", 100) == 0, "chvpwm: ramp from dark");
+
+	pwm_reset_counters(&pwm);
+	sim_check(pwm_sysctl_set("brightness", 100) == 0 &&
+	    pwm.c.writes <= 1 && pwm_sysctl_int("brightness") == 100,
+		"chvpwm: one call starts the ramp");
+	ok = pwm_ramp_run(50, 1);
+	pwm_output(&pwm, &period, &duty);
+	sim_check(duty > period / 8 && duty < period / 3,
+		"chvpwm: halfway is %u/%u ns, along the gamma curve", duty,
+		period);
+	ok &= pwm_ramp_run(100, 1);
+	pwm_output(&pwm, &period, &duty);
+	steps = sim_sysctl_u64(pwm.dev, "ramp_steps");
+	sim_check(ok && duty == period && steps > 50 &&
+	    steps <= CHVPWM_DIV_MAX && pwm.c.updates <= steps &&
+	    pwm.c.restarts == 0 && !callout_pending(&((struct chvpwm_softc *)
+	    device_get_softc(pwm.dev))->sc_ramp),
+		"chvpwm: ramp done in %ju steps, never ahead of the latch",
+		(uintmax_t)steps);
+
+	/* A new target part way down carries on from where the output is */
+	pwm_sysctl_set("brightness", 50);
+	ok = pwm_ramp_run(20, 0);
+	pwm_sysctl_set("brightness", 20);
+	ok &= pwm_ramp_run(150, 0);
+	sim_check(ok && pwm_div(&pwm) == chvpwm_level_div(20 <<
+	    CHVPWM_LEVEL_SHIFT) && pwm_sysctl_int("brightness") == 20,
+		"chvpwm: retargeted ramp ends at 20");
+
+	/* The controller holding UPDATE folds steps together */
+	pwm_reset_counters(&pwm);
+	merged = sim_sysctl_u64(pwm.dev, "updates_merged");
+	pwm.stall = 1;
+	pwm_sysctl_set("brightness", 100);
+	pwm_ramp_run(8, 1);
+	merged = sim_sysctl_u64(pwm.dev, "updates_merged") - merged;
+	sim_check(merged > 0 && pwm.c.updates == 1 && pwm.c.restarts == 0,
+		"chvpwm: steps held while UPDATE is set, %ju merged",
+		(uintmax_t)merged);
+	pwm.stall = 0;
+	pwm_ramp_run(150, 1);
+	sim_check(pwm_div(&pwm) == 0, "chvpwm: ramp finishes after a stall");
+
+	/* Setting the duty directly stops a ramp */
+	pwm_sysctl_set("brightness", 0);
+	pwm_ramp_run(10, 0);
+	chvpwm_channel_config(pwm.dev, 0, 50000, 25000);
+	pwm_ramp_run(150, 0);
+	sim_check(pwm_div(&pwm) == 127, "chvpwm: duty write wins over a ramp");
+
+	/* Disabled or with no ramp time the level is set at once */
+	chvpwm_channel_enable(pwm.dev, 0, false);
+	pwm_reset_counters(&pwm);
+	sim_check(pwm_sysctl_set("brightness", 50) == 0 &&
+	    (pwm.ctrl & CHVPWM_CTRL_DIV_MASK) ==
+	    chvpwm_level_div(50 << CHVPWM_LEVEL_SHIFT) && pwm.c.updates == 0,
+		"chvpwm: set at once while disabled");
+	chvpwm_channel_enable(pwm.dev, 0, true);
+	pwm_sysctl_set("ramp_ms", 0);
+	error = pwm_sysctl_set("brightness", 80);
+	/* Behind the enable's latch, one period to go out, one to latch */
+	sim_clock_advance(SBT_1MS);
+	sim_clock_advance(SBT_1MS);
+	sim_check(error == 0 && pwm_div(&pwm) == chvpwm_level_div(80 << CHVPWM_LEVEL_SHIFT),
+		"chvpwm: set at once with no ramp time");
+	sim_check(pwm_sysctl_set("brightness", 101) == EINVAL,
+		"chvpwm: brightness over 100 refused");
+}
+
+/*
+ * Back to back duty changes, every so many PWM periods of virtual time
+ * apart. 0 is a burst, as a fan loop or ramp would make them.
+ */
+/*
+ * A second controller, Bay Trail's with its 25 MHz clock, held in reset
+ * by firmware. It gets its own pwmbus and leaves the first alone.
+ */
+static void
+test_instances(void)
+{
+	struct pwm_model other;
+	u_int period, duty, period2, duty2;
+	device_t bus, bus2;
+	size_t len;
+	int error, val;
+
+	pwm_output(&pwm, &period, &duty);
+	error = pwm_model_attach(&pwm2, "80860F09", 1, 25000000, 16, 0, 0);
+	sim_check(error == 0 && strcmp(device_get_desc(pwm2.dev),
+	    "Intel Bay Trail PWM") == 0 && pwm2.reset == CHVPWM_RESET_RELEASE,
+		"chvpwm: Bay Trail attaches and is taken out of reset");
+	bus = device_find_child(pwm.dev, "pwmbus", -1);
+	bus2 = device_find_child(pwm2.dev, "pwmbus", -1);
+	sim_check(bus != NULL && bus2 != NULL && bus != bus2 &&
+	    device_is_attached(bus) && device_is_attached(bus2),
+		"chvpwm: a pwmbus for each controller");
+
+	chvpwm_channel_config(pwm2.dev, 0, 50000, 25000);
+	chvpwm_channel_enable(pwm2.dev, 0, true);
+	pwm_output(&pwm2, &period2, &duty2);
+	len = sizeof(val);
+	sim_check(period2 == 50412 && duty2 == 25305 &&
+	    sim_sysctl_get(pwm2.dev, "period", &val, &len) == 0 &&
+	    val == 50412, "chvpwm: 25 MHz base unit, %u/%u ns", duty2,
+	    period2);
+	pwm_output(&pwm, &period2, &duty2);
+	sim_check(period == period2 && duty == duty2,
+		"chvpwm: first controller untouched, %u/%u ns", duty2, period2);
+	pwm_detach(&pwm2);
+
+	/* Broxton, whose next output sits where RESET and GENERAL would */
+	error = pwm_model_attach(&pwm2, "80865AC8", 1, CHVPWM_CLK_HZ, 22, 0,
+		0);
+	chvpwm_channel_config(pwm2.dev, 0, 50000, 25000);
+	chvpwm_channel_enable(pwm2.dev, 0, true);
+	chvpwm_suspend(pwm2.dev);
+	chvpwm_resume(pwm2.dev);
+	pwm_output(&pwm2, &period2, &duty2);
+	sim_check(error == 0 && pwm2.c.stray == 0 &&
+	    (pwm2.ctrl & CHVPWM_CTRL_ENABLE) && period2 > 49000 &&
+	    period2 < 51000, "chvpwm: Broxton runs without touching output "
+	    "2, %u/%u ns", duty2, period2);
+	pwm_detach(&pwm2);
+
+	error = pwm_model_attach(&other, "INT33FF", 1, CHVPWM_CLK_HZ, 16, 0,
+		CHVPWM_RESET_RELEASE);
+	sim_check(error == ENXIO, "chvpwm: other HIDs not probed");
+	sim_device_destroy(other.dev);
+}
+
+/*
+ * Over suspend the block loses its registers. Resume puts RESET and
+ * GENERAL back and sends CTRL with UPDATE, settings made while suspended
+ * included.
+ */
+static void
+test_suspend(void)
+{
+	struct chvpwm_softc *sc;
+	u_int period, duty;
+	int error;
+
+	sc = device_get_softc(pwm.dev);
+	chvpwm_channel_config(pwm.dev, 0, 40000, 10000);
+	sim_clock_advance(SBT_1MS);
+	pwm.general = 0x4;
+
+	error = chvpwm_suspend(pwm.dev);
+	pwm_power_cycle(&pwm);
+	pwm_reset_counters(&pwm);
+	chvpwm_channel_config(pwm.dev, 0, 50000, 20000);
+	sim_check(error == 0 && pwm.c.reads == 0 && pwm.c.writes == 0,
+		"chvpwm: suspended, settings held");
+
+	error = chvpwm_resume(pwm.dev);
+	pwm_output(&pwm, &period, &duty);
+	sim_check(error == 0 && pwm.reset == CHVPWM_RESET_RELEASE &&
+	    pwm.general == 0x4 && (pwm.ctrl & CHVPWM_CTRL_ENABLE) &&
+	    period == 50196 && duty == 20078 && pwm.c.latches == 1,
+		"chvpwm: restored on resume, %u/%u ns", duty, period);
+
+	/* A ramp in progress comes back at its end */
+	pwm_sysctl_set("ramp_ms", 100);
+	pwm_sysctl_set("brightness", 100);
+	sim_clock_advance(mstosbt(10));
+	chvpwm_suspend(pwm.dev);
+	pwm_power_cycle(&pwm);
+	chvpwm_resume(pwm.dev);
+	sim_check(pwm_div(&pwm) == 0 && !callout_pending(&sc->sc_ramp) &&
+	    pwm_sysctl_int("brightness") == 100,
+		"chvpwm: ramp skips to its end over suspend");
+}
+
+static void
+bench(const char *what, int iterations, int periods)
+{
+	uint64_t start, ns;
+	sbintime_t gap;
+	int i;
+
+	sim_quiet = 1;
+	chvpwm_channel_config(pwm.dev, 0, 50000, 0);
+	sim_clock_advance(SBT_1MS);
+	gap = periods * nstosbt(50196);
+	pwm_reset_counters(&pwm);
+	start = sim_nsec();
+	for (i = 0; i < iterations; i++) {
+		chvpwm_channel_config(pwm.dev, 0, 50000, i % 50000);
+		if (gap != 0)
+			sim_clock_advance(gap);
+	}
+	ns = sim_nsec() - start;
+	sim_clock_advance(SBT_1MS);
+	sim_quiet = 0;
+
+	printf("bench %-16s %8.1f ns/op %6.2f reads/op %6.4f writes/op "
+		"%6.4f latches/op\n", what, (double)ns / iterations,
+		(double)pwm.c.reads / iterations,
+		(double)pwm.c.writes / iterations,
+		(double)pwm.c.latches / iterations);
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: chvpwm_sim [-n iterations]\n");
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	int ch, iterations;
+
+	iterations = 100000;
+	while ((ch = getopt(argc, argv, "n:")) != -1) {
+		switch (ch) {
+		case 'n':
+			iterations = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (argc != optind || iterations <= 0)
+		usage();
+
+	test_attach();
+	if (pwm.dev == NULL)
+		return (1);
+	test_config();
+	test_enable();
+	test_sysctl();
+	test_coalesce();
+	test_ramp();
+	test_instances();
+	test_suspend();
+
+	bench("duty burst", iterations, 0);
+	bench("duty per period", iterations, 1);
+
+	pwm_detach(&pwm);
+
+	printf("%d failures\n", sim_failures());
+	return (sim_failures() != 0);
+}
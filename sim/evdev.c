@@ -0,0 +1,263 @@
+/*-
+ * Copyright (c) 2018 Tom Jones <tj@enoti.me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+
+/*
+ * evdev(4) stand-in. Nothing reads the events, each device keeps counters
+ * and the multitouch slot state as of the last sync so the simulators can
+ * check what a driver reported.
+ */
+
+#define SIM_KERN_IMPL
+#include "sim_kern.h"
+#include "sim.h"
+
+#define	SIM_EVDEV_SLOTS		16
+
+struct evdev_dev {
+	int		ev_registered;
+	uint16_t	ev_flags;
+	int32_t		ev_abs_max[ABS_CNT];
+
+	int		ev_slot;		/* current ABS_MT_SLOT */
+	uint32_t	ev_touched;		/* slots reported this frame */
+	struct sim_evdev_slot ev_slots[SIM_EVDEV_SLOTS];
+	int32_t		ev_msc[MSC_CNT];	/* last value of each */
+
+	uint64_t	ev_events;
+	uint64_t	ev_syncs;
+	uint64_t	ev_releases;
+};
+
+static struct evdev_dev *sim_evdev_last_dev;
+
+struct evdev_dev *
+evdev_alloc(void)
+{
+	struct evdev_dev *evdev;
+	int i;
+
+	evdev = calloc(1, sizeof(*evdev));
+	for (i = 0; i < SIM_EVDEV_SLOTS; i++)
+		evdev->ev_slots[i].id = -1;
+	sim_evdev_last_dev = evdev;
+	return (evdev);
+}
+
+void
+evdev_free(struct evdev_dev *evdev)
+{
+	if (sim_evdev_last_dev == evdev)
+		sim_evdev_last_dev = NULL;
+	free(evdev);
+}
+
+void
+evdev_set_name(struct evdev_dev *evdev, const char *name)
+{
+}
+
+void
+evdev_set_phys(struct evdev_dev *evdev, const char *name)
+{
+}
+
+void
+evdev_set_id(struct evdev_dev *evdev, uint16_t bustype, uint16_t vendor,
+    uint16_t product, uint16_t version)
+{
+}
+
+void
+evdev_set_flag(struct evdev_dev *evdev, uint16_t flag)
+{
+	evdev->ev_flags |= flag;
+}
+
+void
+evdev_support_prop(struct evdev_dev *evdev, uint16_t prop)
+{
+}
+
+void
+evdev_support_event(struct evdev_dev *evdev, uint16_t type)
+{
+}
+
+void
+evdev_support_key(struct evdev_dev *evdev, uint16_t code)
+{
+}
+
+void
+evdev_support_msc(struct evdev_dev *evdev, uint16_t code)
+{
+}
+
+void
+evdev_support_abs(struct evdev_dev *evdev, uint16_t code, int32_t value,
+    int32_t minimum, int32_t maximum, int32_t fuzz, int32_t flat,
+    int32_t resolution)
+{
+	if (code < ABS_CNT)
+		evdev->ev_abs_max[code] = maximum;
+}
+
+int
+evdev_register(struct evdev_dev *evdev)
+{
+	evdev->ev_registered = 1;
+	return (0);
+}
+
+static struct sim_evdev_slot *
+sim_evdev_cur(struct evdev_dev *evdev)
+{
+	return (&evdev->ev_slots[evdev->ev_slot]);
+}
+
+int
+evdev_push_event(struct evdev_dev *evdev, uint16_t type, uint16_t code,
+    int32_t value)
+{
+	if (!evdev->ev_registered)
+		abort();
+
+	evdev->ev_events++;
+	if (type == EV_MSC && code < MSC_CNT)
+		evdev->ev_msc[code] = value;
+	if (type != EV_ABS)
+		return (0);
+
+	switch (code) {
+	case ABS_MT_SLOT:
+		if (value < 0 || value >= SIM_EVDEV_SLOTS ||
+		    value > evdev->ev_abs_max[ABS_MT_SLOT])
+			return (EINVAL);
+		evdev->ev_slot = value;
+		break;
+	case ABS_MT_TRACKING_ID:
+		if (value == -1 && sim_evdev_cur(evdev)->id != -1)
+			evdev->ev_releases++;
+		sim_evdev_cur(evdev)->id = value;
+		evdev->ev_touched |= 1 << evdev->ev_slot;
+		break;
+	case ABS_MT_POSITION_X:
+		sim_evdev_cur(evdev)->x = value;
+		break;
+	case ABS_MT_POSITION_Y:
+		sim_evdev_cur(evdev)->y = value;
+		break;
+	case ABS_MT_TOUCH_MAJOR:
+		sim_evdev_cur(evdev)->major = value;
+		break;
+	}
+	return (0);
+}
+
+void
+evdev_sync(struct evdev_dev *evdev)
+{
+	int i;
+
+	/* Slots a driver did not mention in the frame are lifted */
+	if (evdev->ev_flags & EVDEV_FLAG_MT_AUTOREL)
+		for (i = 0; i < SIM_EVDEV_SLOTS; i++)
+			if ((evdev->ev_touched & (1 << i)) == 0 &&
+			    evdev->ev_slots[i].id != -1) {
+				evdev->ev_slots[i].id = -1;
+				evdev->ev_releases++;
+			}
+	evdev->ev_touched = 0;
+	evdev->ev_events++;
+	evdev->ev_syncs++;
+}
+
+int
+evdev_get_mt_slot_by_tracking_id(struct evdev_dev *evdev, int32_t id)
+{
+	int i, nslots;
+
+	nslots = MIN(SIM_EVDEV_SLOTS, evdev->ev_abs_max[ABS_MT_SLOT] + 1);
+	for (i = 0; i < nslots; i++)
+		if (evdev->ev_slots[i].id == id)
+			return (i);
+	for (i = 0; i < nslots; i++)
+		if (evdev->ev_slots[i].id == -1 &&
+		    (evdev->ev_touched & (1 << i)) == 0)
+			return (i);
+	return (-1);
+}
+
+struct evdev_dev *
+sim_evdev_last(void)
+{
+	return (sim_evdev_last_dev);
+}
+
+int
+sim_evdev_slot(struct evdev_dev *evdev, int slot, struct sim_evdev_slot *s)
+{
+	*s = evdev->ev_slots[slot];
+	return (s->id != -1);
+}
+
+int32_t
+sim_evdev_msc(struct evdev_dev *evdev, uint16_t code)
+{
+	return (evdev->ev_msc[code]);
+}
+
+uint64_t
+sim_evdev_events(struct evdev_dev *evdev)
+{
+	return (evdev->ev_events);
+}
+
+uint64_t
+sim_evdev_syncs(struct evdev_dev *evdev)
+{
+	return (evdev->ev_syncs);
+}
+
+uint64_t
+sim_evdev_releases(struct evdev_dev *evdev)
+{
+	return (evdev->ev_releases);
+}
+
+int
+sim_evdev_abs_max(struct evdev_dev *evdev, uint16_t code)
+{
+	return (evdev->ev_abs_max[code]);
+}
+
+int
+sim_evdev_registered(struct evdev_dev *evdev)
+{
+	return (evdev->ev_registered);
+}
@@ -0,0 +1,1666 @@
+/*-
+ * Copyright (c) 2018 Tom Jones <tj@enoti.me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+/*
+ * FUSB302 register model for fusb3(4).
+ *
+ * The register file sits behind the I2C transfer handler with the chip's
+ * auto-increment, interrupt registers clear when read. A partner plugged
+ * into the port stops DRP toggling with TOGDONE and the TOGSS the chip
+ * would report, the measured CC pin drives BC_LVL and the comparator, and
+ * INT_N is delivered through a stand-in for chvgpio_setup_intr on each
+ * falling edge. Every transfer is counted.
+ *
+ * A source partner also speaks Power Delivery. It offers its capabilities
+ * until one is acknowledged, answers Request with Accept and PS_RDY, and
+ * takes VBUS away and back on a hard reset. Messages go through the
+ * chip's FIFOs as the real one frames them, GoodCRC both ways is left to
+ * the chip as with AUTO_CRC.
+ *
+ * The PI3USB30532 mux sits on the same bus, driven by the real pi3usb(4),
+ * its one register is all there is to it.
+ *
+ * The BQ24296 charger is on I2C3 with the real bqreg(4) in front of it. It
+ * runs its D+/D- detection a while after VBUS comes up, then reports the
+ * port it found and sets its input current limit to match, as the chip
+ * does, before fusb3(4) gets a say.
+ */
+
+#include "../../fusb3/fusb3.c"
+#include "../../pi3usb/pi3usb.c"
+#include "../../bqreg/bqreg.c"
+
+#include "sim.h"
+
+#define	FX_ADDR			0x22
+#define	FX_MUX_ADDR		PI3USB_SADDR
+#define	FX_GPIO_PIN		5
+#define	FX_BQ_ADDR		0x6b
+#define	FX_BQ_DETECT_MS		300	/* D+/D- detection after VBUS */
+
+enum fx_partner {
+	FX_NONE,
+	FX_SOURCE,		/* Rp on one pin, VBUS on */
+	FX_SINK,		/* Rd on one pin */
+	FX_AUDIO,		/* Ra on both pins */
+};
+
+struct fx_counters {
+	uint64_t	xfers;
+	uint64_t	writes;
+	uint64_t	status_bursts;	/* all of 0x3C-0x42 in one read */
+	uint64_t	status_reads;	/* anything else touching them */
+	uint64_t	control_reads;	/* anything in 0x01-0x0F */
+	uint64_t	fifo_xfers;
+	uint64_t	fifo_single;	/* FIFO transfers moving one byte */
+	uint64_t	interrupts;
+};
+
+/* Things the source does later */
+enum fx_event {
+	FX_EV_CAPS,		/* offer Source_Capabilities */
+	FX_EV_CTRL,		/* send a control message */
+	FX_EV_VBUS_OFF,
+	FX_EV_VBUS_ON,
+};
+
+#define	FX_NEVENTS		16
+#define	FX_CAPS_MS		150	/* tTypeCSendSourceCap */
+#define	FX_CAPS_COUNT		50	/* nCapsCount */
+#define	FX_PS_RDY_MS		50
+#define	FX_VBUS_OFF_MS		30	/* tPSHardReset */
+#define	FX_VBUS_ON_MS		700	/* tSrcRecover and tSrcTurnOn */
+
+struct fx_source {
+	uint32_t	caps[PD_MAX_DO];
+	int		ncaps;
+	int		no_ps_rdy;	/* accepts but never switches */
+	int		lose_goodcrc;	/* our GoodCRC for its next message */
+	u_int		tx_id;
+	int		caps_sent;
+	int		contract_pos;	/* object position, 0 if none */
+	uint32_t	rdo;
+	uint32_t	sink_caps[PD_MAX_DO];
+	int		nsink_caps;
+	u_int		rx[32];		/* messages by type, data at 16+ */
+	u_int		hard_resets;
+
+	struct {
+		sbintime_t	at;
+		enum fx_event	ev;
+		int		arg;
+	}		events[FX_NEVENTS];
+	int		nevents;
+};
+
+struct fx_chip {
+	device_t	dev;
+	uint8_t		regs[0x44];
+	int		int_n;		/* 1 while asserted */
+
+	enum fx_partner	partner;
+	int		partner_cc;
+	int		partner_rp;	/* FUSB3_RP_* a source presents */
+	int		vbus;
+
+	uint8_t		rxf[512];	/* receive FIFO */
+	int		rx_len;
+	uint8_t		txf[64];	/* transmit FIFO */
+	int		tx_len;
+	struct fx_source src;
+
+	driver_intr_t	*handler;
+	void		*arg;
+	int		handler_pin;
+	struct fx_counters c;
+
+	device_t	mux;
+	uint8_t		mux_cfg;
+	uint64_t	mux_writes;
+	sbintime_t	mux_time;	/* of the last write */
+};
+
+static struct fx_chip fx;
+
+static void
+fx_reset(struct fx_chip *chip)
+{
+	memset(chip->regs, 0, sizeof(chip->regs));
+	chip->regs[FUSB3_DEVICE_ID] = 0x81;	/* as Linux saw it */
+	chip->regs[FUSB3_SWITCHES0] = FUSB3_SW0_PDWN1 | FUSB3_SW0_PDWN2;
+	chip->regs[FUSB3_CONTROL0] = FUSB3_CTL0_INT_MASK |
+		FUSB3_CTL0_HOST_CUR_DEF;
+	chip->regs[FUSB3_CONTROL2] = FUSB3_CTL2_MODE_DRP;
+	chip->regs[FUSB3_POWER] = 0x01;
+	chip->rx_len = 0;
+	chip->tx_len = 0;
+}
+
+static void fx_src_rx(struct fx_chip *, uint16_t, const uint32_t *);
+
+/*
+ * Supply current from the datasheet typicals: Itog, toggling on the
+ * bandgap alone resting between cycles, and Ipd_stby with the receiver
+ * and measure block powered. The oscillator adds to that, unspecified.
+ */
+static int
+fx_supply_ua(struct fx_chip *chip)
+{
+	uint8_t *r = chip->regs;
+
+	if (r[FUSB3_POWER] & ~FUSB3_POWER_BANDGAP)
+		return (40);
+	return ((r[FUSB3_CONTROL2] & FUSB3_CTL2_TOGGLE) ? 25 : 1);
+}
+
+static int
+fx_meas_cc(struct fx_chip *chip)
+{
+	uint8_t sw0 = chip->regs[FUSB3_SWITCHES0];
+
+	if (sw0 & FUSB3_SW0_MEAS_CC1)
+		return (1);
+	if (sw0 & FUSB3_SW0_MEAS_CC2)
+		return (2);
+	return (0);
+}
+
+/* Recompute status from the switches and the partner, raise interrupts */
+static void
+fx_update(struct fx_chip *chip)
+{
+	uint8_t *r = chip->regs;
+	uint8_t st0, pending;
+	int cc, togss, pu, pd;
+
+	/* Toggling runs on the bandgap and wake circuit */
+	if ((r[FUSB3_CONTROL2] & FUSB3_CTL2_TOGGLE) == 0)
+		r[FUSB3_STATUS1A] &= ~FUSB3_ST1A_TOGSS_MASK;
+	else if ((r[FUSB3_STATUS1A] & FUSB3_ST1A_TOGSS_MASK) == 0 &&
+	    (r[FUSB3_POWER] & FUSB3_POWER_BANDGAP) &&
+	    chip->partner != FX_NONE) {
+		switch (chip->partner) {
+		case FX_SOURCE:
+			togss = chip->partner_cc == 1 ? FUSB3_TOGSS_SNK_CC1 :
+				FUSB3_TOGSS_SNK_CC2;
+			break;
+		case FX_SINK:
+			togss = chip->partner_cc == 1 ? FUSB3_TOGSS_SRC_CC1 :
+				FUSB3_TOGSS_SRC_CC2;
+			break;
+		default:
+			togss = FUSB3_TOGSS_AUDIO;
+			break;
+		}
+		r[FUSB3_STATUS1A] |= togss << FUSB3_ST1A_TOGSS_SHIFT;
+		r[FUSB3_INTERRUPTA] |= FUSB3_IA_TOGDONE;
+	}
+
+	/* VBUSOK, BC_LVL and the comparator need the measure block */
+	st0 = chip->vbus ? FUSB3_ST0_VBUSOK : 0;
+	cc = fx_meas_cc(chip);
+	if ((r[FUSB3_POWER] & FUSB3_POWER_MEASURE) == 0) {
+		st0 = 0;
+		cc = 0;
+	}
+	if (cc != 0) {
+		pu = r[FUSB3_SWITCHES0] &
+			(cc == 1 ? FUSB3_SW0_PU_EN1 : FUSB3_SW0_PU_EN2);
+		pd = r[FUSB3_SWITCHES0] &
+			(cc == 1 ? FUSB3_SW0_PDWN1 : FUSB3_SW0_PDWN2);
+		if (pd && chip->partner == FX_SOURCE &&
+		    chip->partner_cc == cc)
+			st0 |= chip->partner_rp;
+		/* The comparator trips with nothing pulling CC down */
+		if (pu && !(chip->partner == FX_AUDIO ||
+		    (chip->partner == FX_SINK && chip->partner_cc == cc)))
+			st0 |= FUSB3_ST0_COMP;
+	}
+	if ((st0 ^ r[FUSB3_STATUS0]) & FUSB3_ST0_VBUSOK)
+		r[FUSB3_INTERRUPT] |= FUSB3_I_VBUSOK;
+	if ((st0 ^ r[FUSB3_STATUS0]) & FUSB3_ST0_BC_LVL)
+		r[FUSB3_INTERRUPT] |= FUSB3_I_BC_LVL;
+	if ((st0 ^ r[FUSB3_STATUS0]) & FUSB3_ST0_COMP)
+		r[FUSB3_INTERRUPT] |= FUSB3_I_COMP_CHNG;
+	r[FUSB3_STATUS0] = st0;
+	r[FUSB3_STATUS1] = (chip->rx_len == 0 ? FUSB3_ST1_RX_EMPTY : 0) |
+		(chip->tx_len == 0 ? FUSB3_ST1_TX_EMPTY : 0);
+
+	pending = (r[FUSB3_INTERRUPT] & ~r[FUSB3_MASK1]) |
+		(r[FUSB3_INTERRUPTA] & ~r[FUSB3_MASKA]) |
+		(r[FUSB3_INTERRUPTB] & ~r[FUSB3_MASKB] & 0x01);
+	if (r[FUSB3_CONTROL0] & FUSB3_CTL0_INT_MASK)
+		pending = 0;
+	if (pending && !chip->int_n) {
+		chip->int_n = 1;
+		chip->c.interrupts++;
+		if (chip->handler != NULL)
+			chip->handler(chip->arg);
+	} else if (!pending)
+		chip->int_n = 0;
+}
+
+/*
+ * PD is only on the wire with AUTO_CRC and the partner's pin selected, and
+ * a source with no capabilities is a Type-C only one.
+ */
+static int
+fx_pd_on(struct fx_chip *chip)
+{
+	uint8_t sw1 = chip->regs[FUSB3_SWITCHES1];
+
+	return (chip->partner == FX_SOURCE && chip->src.ncaps != 0 &&
+	    (sw1 & FUSB3_SW1_AUTO_CRC) &&
+	    (sw1 & (chip->partner_cc == 1 ? FUSB3_SW1_TXCC1 :
+	    FUSB3_SW1_TXCC2)));
+}
+
+/* A message arriving from the wire, as the receive FIFO holds it */
+static void
+fx_rx_push(struct fx_chip *chip, uint16_t hdr, const uint32_t *dos)
+{
+	uint8_t *p;
+	int i, cnt;
+
+	cnt = PD_HDR_CNT(hdr);
+	if (chip->rx_len + 3 + cnt * 4 + FUSB3_CRC_LEN > (int)sizeof(chip->rxf))
+		return;
+	p = &chip->rxf[chip->rx_len];
+	*p++ = FUSB3_RX_SOP;
+	le16enc(p, hdr);
+	p += 2;
+	for (i = 0; i < cnt; i++, p += 4)
+		le32enc(p, dos[i]);
+	memset(p, 0, FUSB3_CRC_LEN);
+	chip->rx_len += 3 + cnt * 4 + FUSB3_CRC_LEN;
+}
+
+/* TXON ends a message, the tokens in front of it frame it */
+static void
+fx_transmit(struct fx_chip *chip)
+{
+	uint32_t dos[PD_MAX_DO];
+	uint16_t hdr;
+	uint8_t *p;
+	int i, cnt;
+
+	p = memchr(chip->txf, FUSB3_TX_PACKSYM | 2, chip->tx_len);
+	for (i = 0; p == NULL && i < PD_MAX_DO; i++)
+		p = memchr(chip->txf, FUSB3_TX_PACKSYM | (2 + (i + 1) * 4),
+			chip->tx_len);
+	chip->tx_len = 0;
+	if (p == NULL)
+		return;
+	hdr = le16dec(p + 1);
+	cnt = PD_HDR_CNT(hdr);
+	for (i = 0; i < cnt; i++)
+		dos[i] = le32dec(p + 3 + i * 4);
+
+	if (!fx_pd_on(chip)) {
+		chip->regs[FUSB3_INTERRUPTA] |= FUSB3_IA_RETRYFAIL;
+		return;
+	}
+	/* The source's GoodCRC, which the chip files like any message */
+	fx_rx_push(chip, PD_HEADER(PD_CTRL_GOODCRC, PD_REV20, PD_HDR_ID(hdr),
+		0) | PD_HDR_POWER_ROLE | PD_HDR_DATA_ROLE, NULL);
+	chip->regs[FUSB3_INTERRUPTA] |= FUSB3_IA_TXSENT;
+	fx_src_rx(chip, hdr, dos);
+}
+
+static void fx_src_hard_reset(struct fx_chip *);
+
+static void
+fx_write_reg(struct fx_chip *chip, uint8_t reg, uint8_t val)
+{
+	if (reg == FUSB3_FIFOS) {
+		if (chip->tx_len < (int)sizeof(chip->txf))
+			chip->txf[chip->tx_len++] = val;
+		if (val == FUSB3_TX_TXON)
+			fx_transmit(chip);
+		return;
+	}
+	if (reg >= sizeof(chip->regs) || reg >= FUSB3_STATUS0A)
+		return;
+	switch (reg) {
+	case FUSB3_RESET:
+		if (val & FUSB3_RESET_SW)
+			fx_reset(chip);
+		if (val & FUSB3_RESET_PD)
+			chip->rx_len = chip->tx_len = 0;
+		return;
+	case FUSB3_CONTROL0:
+		if (val & FUSB3_CTL0_TX_FLUSH)
+			chip->tx_len = 0;
+		val &= ~FUSB3_CTL0_TX_FLUSH;
+		break;
+	case FUSB3_CONTROL1:
+		if (val & FUSB3_CTL1_RX_FLUSH)
+			chip->rx_len = 0;
+		val &= ~FUSB3_CTL1_RX_FLUSH;
+		break;
+	case FUSB3_CONTROL3:
+		if (val & FUSB3_CTL3_SEND_HARDRESET) {
+			chip->regs[FUSB3_INTERRUPTA] |= FUSB3_IA_HARDSENT;
+			if (fx_pd_on(chip))
+				fx_src_hard_reset(chip);
+		}
+		val &= ~FUSB3_CTL3_SEND_HARDRESET;
+		break;
+	}
+	chip->regs[reg] = val;
+}
+
+static uint8_t
+fx_read_reg(struct fx_chip *chip, uint8_t reg)
+{
+	uint8_t val;
+
+	if (reg == FUSB3_FIFOS) {
+		if (chip->rx_len == 0)
+			return (0);
+		val = chip->rxf[0];
+		memmove(chip->rxf, chip->rxf + 1, --chip->rx_len);
+		return (val);
+	}
+	if (reg >= sizeof(chip->regs))
+		return (0);
+	val = chip->regs[reg];
+	if (reg == FUSB3_INTERRUPTA || reg == FUSB3_INTERRUPTB ||
+	    reg == FUSB3_INTERRUPT)
+		chip->regs[reg] = 0;
+	return (val);
+}
+
+/* Writes are the register index then the config, reads echo the index */
+static int
+fx_mux_xfer(struct fx_chip *chip, struct iic_msg *msgs, uint32_t nmsgs)
+{
+	if (nmsgs != 1)
+		return (IIC_ENOACK);
+	if (msgs[0].flags & IIC_M_RD) {
+		memset(msgs[0].buf, 0, msgs[0].len);
+		if (msgs[0].len > 1)
+			msgs[0].buf[1] = chip->mux_cfg;
+		return (0);
+	}
+	if (msgs[0].len != 2 || msgs[0].buf[0] != 0)
+		return (IIC_ENOACK);
+	chip->mux_cfg = msgs[0].buf[1];
+	chip->mux_writes++;
+	chip->mux_time = sbinuptime();
+	return (0);
+}
+
+static int
+fx_xfer(void *ctx, struct iic_msg *msgs, uint32_t nmsgs)
+{
+	struct fx_chip *chip = ctx;
+	uint8_t reg;
+	int i;
+
+	if (msgs[0].slave == FX_MUX_ADDR << 1)
+		return (fx_mux_xfer(chip, msgs, nmsgs));
+	if (msgs[0].slave != FX_ADDR << 1 || (msgs[0].flags & IIC_M_RD) ||
+	    msgs[0].len < 1)
+		return (IIC_ENOACK);
+	chip->c.xfers++;
+	reg = msgs[0].buf[0];
+	if (reg == FUSB3_FIFOS) {
+		chip->c.fifo_xfers++;
+		if ((nmsgs == 2 ? msgs[1].len : msgs[0].len - 1) == 1)
+			chip->c.fifo_single++;
+	}
+	/* The FIFO address does not advance */
+	if (nmsgs == 2) {
+		if (reg == FUSB3_STATUS0A && msgs[1].len == FUSB3_NSTATUS)
+			chip->c.status_bursts++;
+		else if (reg + msgs[1].len > FUSB3_STATUS0A &&
+		    reg <= FUSB3_INTERRUPT)
+			chip->c.status_reads++;
+		if (reg <= FUSB3_MASKB)
+			chip->c.control_reads++;
+		for (i = 0; i < msgs[1].len; i++)
+			msgs[1].buf[i] = fx_read_reg(chip,
+				reg == FUSB3_FIFOS ? reg : reg + i);
+	} else {
+		for (i = 1; i < msgs[0].len; i++) {
+			chip->c.writes++;
+			fx_write_reg(chip, reg == FUSB3_FIFOS ? reg :
+				reg + i - 1, msgs[0].buf[i]);
+		}
+	}
+	fx_update(chip);
+	return (0);
+}
+
+/* The source's side of the wire */
+static void
+fx_src_event(struct fx_chip *chip, int ms, enum fx_event ev, int arg)
+{
+	struct fx_source *src = &chip->src;
+
+	if (src->nevents == FX_NEVENTS)
+		return;
+	src->events[src->nevents].at = sbinuptime() + mstosbt(ms);
+	src->events[src->nevents].ev = ev;
+	src->events[src->nevents].arg = arg;
+	src->nevents++;
+}
+
+/* Delivered if the sink is listening, the chip answers with GoodCRC */
+static int
+fx_src_send(struct fx_chip *chip, int type, int cnt, const uint32_t *dos)
+{
+	struct fx_source *src = &chip->src;
+	uint16_t hdr;
+
+	if (!fx_pd_on(chip))
+		return (0);
+	hdr = PD_HEADER(type, PD_REV20, src->tx_id, cnt) |
+		PD_HDR_POWER_ROLE | PD_HDR_DATA_ROLE;
+	fx_rx_push(chip, hdr, dos);
+	/* Our GoodCRC lost on the way back, the retry has the same ID */
+	if (src->lose_goodcrc) {
+		src->lose_goodcrc--;
+		fx_rx_push(chip, hdr, dos);
+	}
+	src->tx_id = (src->tx_id + 1) & 7;
+	chip->regs[FUSB3_INTERRUPTB] |= FUSB3_IB_GCRCSENT;
+	fx_update(chip);
+	return (1);
+}
+
+static void
+fx_src_caps(struct fx_chip *chip)
+{
+	struct fx_source *src = &chip->src;
+
+	if (chip->partner != FX_SOURCE || !chip->vbus)
+		return;
+	if (fx_src_send(chip, PD_DATA_SOURCE_CAP, src->ncaps, src->caps))
+		src->caps_sent++;
+	else if (src->caps_sent < FX_CAPS_COUNT)
+		fx_src_event(chip, FX_CAPS_MS, FX_EV_CAPS, 0);
+}
+
+static int
+fx_src_valid(struct fx_source *src, uint32_t rdo)
+{
+	uint32_t pdo;
+	int pos;
+
+	pos = PD_RDO_POS(rdo);
+	if (pos < 1 || pos > src->ncaps)
+		return (0);
+	pdo = src->caps[pos - 1];
+	return (PD_PDO_TYPE(pdo) != PD_PDO_FIXED ||
+	    PD_RDO_OP(rdo) * 10 <= PD_PDO_FIXED_MA(pdo));
+}
+
+static void
+fx_src_rx(struct fx_chip *chip, uint16_t hdr, const uint32_t *dos)
+{
+	struct fx_source *src = &chip->src;
+	int type, cnt;
+
+	type = PD_HDR_TYPE(hdr);
+	cnt = PD_HDR_CNT(hdr);
+	src->rx[type + (cnt != 0 ? 16 : 0)]++;
+
+	if (cnt != 0) {
+		switch (type) {
+		case PD_DATA_REQUEST:
+			if (!fx_src_valid(src, dos[0])) {
+				fx_src_event(chip, 3, FX_EV_CTRL,
+					PD_CTRL_REJECT);
+				break;
+			}
+			src->rdo = dos[0];
+			fx_src_event(chip, 3, FX_EV_CTRL, PD_CTRL_ACCEPT);
+			if (!src->no_ps_rdy)
+				fx_src_event(chip, FX_PS_RDY_MS, FX_EV_CTRL,
+					PD_CTRL_PS_RDY);
+			break;
+		case PD_DATA_SINK_CAP:
+			memcpy(src->sink_caps, dos, cnt * sizeof(*dos));
+			src->nsink_caps = cnt;
+			break;
+		}
+		return;
+	}
+
+	switch (type) {
+	case PD_CTRL_GET_SOURCE_CAP:
+	case PD_CTRL_ACCEPT:		/* to our Soft_Reset */
+		fx_src_event(chip, 3, FX_EV_CAPS, 0);
+		break;
+	}
+}
+
+/* Hard reset either way, VBUS goes to vSafe0V and comes back */
+static void
+fx_src_hard_reset(struct fx_chip *chip)
+{
+	struct fx_source *src = &chip->src;
+
+	src->hard_resets++;
+	src->tx_id = 0;
+	src->caps_sent = 0;
+	src->contract_pos = 0;
+	src->nevents = 0;
+	fx_src_event(chip, FX_VBUS_OFF_MS, FX_EV_VBUS_OFF, 0);
+	fx_src_event(chip, FX_VBUS_OFF_MS + FX_VBUS_ON_MS, FX_EV_VBUS_ON, 0);
+}
+
+static void
+fx_src_run(struct fx_chip *chip)
+{
+	struct fx_source *src = &chip->src;
+	enum fx_event ev;
+	sbintime_t now;
+	int i, arg;
+
+	now = sbinuptime();
+	for (i = 0; i < src->nevents;) {
+		if (src->events[i].at > now) {
+			i++;
+			continue;
+		}
+		ev = src->events[i].ev;
+		arg = src->events[i].arg;
+		memmove(&src->events[i], &src->events[i + 1],
+		    (src->nevents - i - 1) * sizeof(src->events[0]));
+		src->nevents--;
+
+		switch (ev) {
+		case FX_EV_CAPS:
+			fx_src_caps(chip);
+			break;
+		case FX_EV_CTRL:
+			if (arg == PD_CTRL_PS_RDY)
+				src->contract_pos = PD_RDO_POS(src->rdo);
+			fx_src_send(chip, arg, 0, NULL);
+			break;
+		case FX_EV_VBUS_OFF:
+			chip->vbus = 0;
+			fx_update(chip);
+			break;
+		case FX_EV_VBUS_ON:
+			chip->vbus = 1;
+			fx_update(chip);
+			fx_src_event(chip, FX_CAPS_MS, FX_EV_CAPS, 0);
+			break;
+		}
+		/* Anything above may have queued more, start again */
+		i = 0;
+	}
+}
+
+/*
+ * chvgpio(4) is not built in, the north community is a driver without
+ * methods under the name the real one registers, "gpio".
+ */
+static device_method_t fx_gpio_methods[] = {
+	DEVMETHOD_END
+};
+
+static driver_t fx_gpio_driver = {
+	.name = "gpio",
+	.methods = fx_gpio_methods,
+};
+static devclass_t fx_gpio_devclass;
+DRIVER_MODULE(chvgpio, acpi, fx_gpio_driver, fx_gpio_devclass, NULL, NULL);
+
+int
+chvgpio_setup_intr(device_t dev, int pin, int triggering, int polarity,
+    driver_intr_t *handler, void *arg)
+{
+	if (device_get_driver(dev) != &fx_gpio_driver)
+		return (ENXIO);
+	if (triggering != ACPI_EDGE_SENSITIVE || polarity != ACPI_ACTIVE_LOW)
+		return (EOPNOTSUPP);
+	if (fx.handler != NULL)
+		return (EBUSY);
+	fx.handler = handler;
+	fx.arg = arg;
+	fx.handler_pin = pin;
+	return (0);
+}
+
+void
+chvgpio_teardown_intr(device_t dev, int pin)
+{
+	if (pin == fx.handler_pin) {
+		fx.handler = NULL;
+		fx.arg = NULL;
+	}
+}
+
+/* The charger, VBUS comes from the Type-C partner */
+static struct fx_bq {
+	device_t	dev;
+	uint8_t		regs[BQREG_VENDER + 1];
+	int		vbus;
+	int		source;		/* BQREG_VBUS_* detection finds */
+	sbintime_t	detect;		/* when detection finishes, 0 if done */
+	uint64_t	writes;
+} fx_bq;
+
+static int
+fx_bq_xfer(void *ctx, struct iic_msg *msgs, uint32_t nmsgs)
+{
+	struct fx_bq *bq = ctx;
+	uint8_t reg;
+
+	if (msgs[0].slave != FX_BQ_ADDR << 1 || (msgs[0].flags & IIC_M_RD) ||
+	    msgs[0].len < 1)
+		return (IIC_ENOACK);
+	reg = msgs[0].buf[0];
+	if (reg >= sizeof(bq->regs))
+		return (IIC_ENOACK);
+	if (nmsgs == 2 && msgs[1].len == 1) {
+		msgs[1].buf[0] = bq->regs[reg];
+		return (0);
+	}
+	if (nmsgs != 1 || msgs[0].len != 2 || reg >= BQREG_STATUS)
+		return (IIC_ENOACK);
+	bq->regs[reg] = msgs[0].buf[1];
+	bq->writes++;
+	return (0);
+}
+
+/* Detection starts over from 500 mA on every VBUS rising edge */
+static void
+fx_bq_run(struct fx_bq *bq, int vbus)
+{
+	uint8_t code;
+
+	if (vbus && !bq->vbus) {
+		bq->detect = sbinuptime() + FX_BQ_DETECT_MS * SBT_1MS;
+		bq->regs[BQREG_INPUT] = (bq->regs[BQREG_INPUT] &
+			~BQREG_INPUT_IINLIM) | 2;
+	}
+	bq->vbus = vbus;
+	if (!vbus) {
+		bq->regs[BQREG_STATUS] = 0;
+		bq->detect = 0;
+		return;
+	}
+	if (bq->detect == 0 || sbinuptime() < bq->detect)
+		return;
+	bq->detect = 0;
+	bq->regs[BQREG_STATUS] = bq->source << BQREG_STAT_VBUS |
+		1 << BQREG_STAT_PG;
+	code = bq->source == BQREG_VBUS_ADAPTER ? 5 : 2;
+	bq->regs[BQREG_INPUT] = (bq->regs[BQREG_INPUT] &
+		~BQREG_INPUT_IINLIM) | code;
+}
+
+static int
+fx_bq_ma(void)
+{
+	return (bqreg_iinlim_ma[fx_bq.regs[BQREG_INPUT] & BQREG_INPUT_IINLIM]);
+}
+
+/* USTC on I2C1, with its GpioInt on the north community */
+static uint16_t fx_int_pin = FX_GPIO_PIN;
+static ACPI_RESOURCE fx_crs[] = {
+	{
+		.Type = ACPI_RESOURCE_TYPE_SERIAL_BUS,
+		.Data.I2cSerialBus = {
+			.Type = ACPI_RESOURCE_SERIAL_TYPE_I2C,
+			.SlaveAddress = FX_ADDR,
+			.ConnectionSpeed = 400000,
+			.ResourceSource.StringPtr = "\\_SB.PCI0.I2C1",
+		},
+	},
+	{
+		.Type = ACPI_RESOURCE_TYPE_GPIO,
+		.Data.Gpio = {
+			.ConnectionType = ACPI_RESOURCE_GPIO_TYPE_INT,
+			.Triggering = ACPI_EDGE_SENSITIVE,
+			.Polarity = ACPI_ACTIVE_LOW,
+			.WakeCapable = ACPI_WAKE_CAPABLE,
+			.PinTableLength = 1,
+			.PinTable = &fx_int_pin,
+			.ResourceSource.StringPtr = "\\_SB.GPO1",
+		},
+	},
+};
+
+static device_t fx_iicbus;
+
+static void
+fx_platform(void)
+{
+	device_t i2c, iicbus, gpio;
+
+	i2c = sim_device_create("ig4iic_acpi", 0, 0);
+	sim_device_set_acpi(i2c, sim_acpi_node("\\_SB_.PCI0.I2C1", -1));
+	fx_iicbus = BUS_ADD_CHILD(i2c, 0, "iicbus", -1);
+	sim_device_set_iic(fx_iicbus, fx_xfer, &fx);
+
+	/* Left in 4 lane DisplayPort, as if firmware had been at it */
+	fx.mux_cfg = PI3USB_CFG_4DPI;
+	fx.mux = BUS_ADD_CHILD(fx_iicbus, 0, "pi3usb", 0);
+	sim_device_set_addr(fx.mux, FX_MUX_ADDR << 1);
+	bus_generic_attach(fx_iicbus);
+
+	gpio = sim_device_create("gpio", 1, 1);
+	sim_device_set_acpi(gpio, sim_acpi_node("\\_SB_.GPO1", 2));
+
+	/* Power on defaults, 500 mA on the bq24296, and its vendor bits */
+	fx_bq.regs[BQREG_INPUT] = 0x32;
+	fx_bq.regs[BQREG_VENDER] = 0x20;
+	fx_bq.source = BQREG_VBUS_USB;
+	i2c = sim_device_create("ig4iic_acpi", 1, 0);
+	sim_device_set_acpi(i2c, sim_acpi_node("\\_SB_.PCI0.I2C3", -1));
+	iicbus = BUS_ADD_CHILD(i2c, 0, "iicbus", -1);
+	sim_device_set_iic(iicbus, fx_bq_xfer, &fx_bq);
+	fx_bq.dev = BUS_ADD_CHILD(iicbus, 0, "bqreg", 0);
+	sim_device_set_addr(fx_bq.dev, FX_BQ_ADDR << 1);
+	bus_generic_attach(iicbus);
+
+	sim_acpi_resources(sim_acpi_node(FUSB3_ACPI_PATH, -1), "_CRS",
+		fx_crs, nitems(fx_crs));
+}
+
+static int
+fx_attach(void)
+{
+	int error;
+
+	fx_reset(&fx);
+	fx.int_n = 0;
+	fx.dev = BUS_ADD_CHILD(fx_iicbus, 0, "fusb3", 0);
+	sim_device_set_addr(fx.dev, FX_ADDR << 1);
+	error = fusb3_probe(fx.dev);
+	if (error == 0)
+		error = fusb3_attach(fx.dev);
+	sim_taskqueue_run();
+	return (error);
+}
+
+static void
+fx_detach(void)
+{
+	fusb3_detach(fx.dev);
+	sim_device_destroy(fx.dev);
+	fx.dev = NULL;
+}
+
+static struct fusb3_softc *
+fx_softc(void)
+{
+	return (device_get_softc(fx.dev));
+}
+
+/* Let time pass, running whatever the callouts queued */
+static void
+fx_wait_ms(int ms)
+{
+	int i;
+
+	for (i = 0; i < ms; i++) {
+		sim_clock_advance(SBT_1MS);
+		fx_src_run(&fx);
+		fx_bq_run(&fx_bq, fx.vbus);
+		sim_taskqueue_run();
+	}
+}
+
+static void
+fx_plug(enum fx_partner partner, int cc, int rp)
+{
+	fx.partner = partner;
+	fx.partner_cc = cc;
+	fx.partner_rp = rp;
+	fx.vbus = partner == FX_SOURCE;
+	fx.src.tx_id = 0;
+	fx.src.caps_sent = 0;
+	fx.src.contract_pos = 0;
+	fx.src.nevents = 0;
+	if (partner == FX_SOURCE)
+		fx_src_event(&fx, FX_CAPS_MS, FX_EV_CAPS, 0);
+	fx_update(&fx);
+	sim_taskqueue_run();
+}
+
+static void
+fx_unplug(void)
+{
+	fx_plug(FX_NONE, 0, 0);
+}
+
+static const char *
+fx_state(void)
+{
+	static char buf[32];
+	size_t len;
+
+	len = sizeof(buf);
+	if (sim_sysctl_get(fx.dev, "state", buf, &len) != 0)
+		return ("?");
+	return (buf);
+}
+
+static const char *
+fx_pd_state(void)
+{
+	static char buf[32];
+	size_t len;
+
+	len = sizeof(buf);
+	if (sim_sysctl_get(fx.dev, "pd.state", buf, &len) != 0)
+		return ("?");
+	return (buf);
+}
+
+static int
+fx_pd_limit(const char *name, int val)
+{
+	return (sim_sysctl_set(fx.dev, name, &val, sizeof(val)));
+}
+
+static void
+test_attach(void)
+{
+	struct fusb3_softc *sc;
+
+	sim_check(fx_attach() == 0, "attach");
+	sc = fx_softc();
+	sim_check(fx.handler != NULL && fx.handler_pin == FX_GPIO_PIN &&
+	    !sc->sc_polling, "interrupt from _CRS, north pin %d",
+	    fx.handler_pin);
+	sim_check(strcmp(fx_state(), "unattached") == 0 &&
+	    fx.regs[FUSB3_CONTROL2] ==
+	    (FUSB3_CTL2_MODE_DRP | FUSB3_CTL2_TOGGLE | FUSB3_CTL2_TOG_SAVE_40),
+		"DRP toggling, state %s", fx_state());
+	sim_check(fx.regs[FUSB3_MASKA] == (uint8_t)~FUSB3_MA_TOGDONE &&
+	    fx.regs[FUSB3_MASK1] == 0xff &&
+	    (fx.regs[FUSB3_CONTROL0] & FUSB3_CTL0_INT_MASK) == 0,
+		"only TOGDONE unmasked while toggling");
+	sim_check(device_is_attached(fx.mux) &&
+	    fx.mux_cfg == PI3USB_CFG_4DPI && sc->sc_mux == -1,
+		"mux left alone until a partner attaches");
+}
+
+static void
+test_sink(void)
+{
+	struct fusb3_softc *sc;
+	uint64_t steps, bursts;
+
+	sc = fx_softc();
+	steps = sc->sc_steps;
+	bursts = fx.c.status_bursts;
+	fx.c.status_reads = 0;
+
+	fx_plug(FX_SOURCE, 2, FUSB3_RP_1A5);
+	sim_check(strcmp(fx_state(), "attachwait.snk") == 0 && sc->sc_cc == 2,
+		"source on CC2 seen, state %s", fx_state());
+	sim_check(fx.regs[FUSB3_CONTROL2] == 0 &&
+	    (fx.regs[FUSB3_SWITCHES0] & FUSB3_SW0_MEAS_CC2),
+		"toggling stopped, measuring CC2");
+
+	fx_wait_ms(FUSB3_CC_DEBOUNCE_MS - 20);
+	sim_check(strcmp(fx_state(), "attachwait.snk") == 0,
+		"still debouncing after %d ms", FUSB3_CC_DEBOUNCE_MS - 20);
+	fx_wait_ms(30);
+	sim_check(strcmp(fx_state(), "attached.snk") == 0 &&
+	    sc->sc_rp == FUSB3_RP_1A5, "attached.snk, rp %d", sc->sc_rp);
+	sim_check(sc->sc_attach_ms >= FUSB3_CC_DEBOUNCE_MS &&
+	    sc->sc_attach_ms <= FUSB3_CC_DEBOUNCE_MS + 5,
+		"attach took %u ms", sc->sc_attach_ms);
+	sim_check(fx.c.status_bursts - bursts == sc->sc_steps - steps &&
+	    fx.c.status_reads == 0, "%ju steps, one status burst each",
+	    (uintmax_t)(sc->sc_steps - steps));
+
+	fx.partner_rp = FUSB3_RP_3A;
+	fx_update(&fx);
+	sim_taskqueue_run();
+	sim_check(sc->sc_rp == FUSB3_RP_3A, "Rp change to 3 A followed");
+
+	fx_unplug();
+	sim_check(strcmp(fx_state(), "unattached") == 0 &&
+	    sc->sc_detaches == 1 && sc->sc_cc == 0,
+		"VBUS gone, back to toggling");
+}
+
+static void
+test_source(void)
+{
+	struct fusb3_softc *sc;
+
+	sc = fx_softc();
+	fx_plug(FX_SINK, 1, 0);
+	sim_check(strcmp(fx_state(), "attachwait.src") == 0 && sc->sc_cc == 1,
+		"sink on CC1 seen, state %s", fx_state());
+	fx_wait_ms(FUSB3_CC_DEBOUNCE_MS + 5);
+	sim_check(strcmp(fx_state(), "attached.src") == 0,
+		"attached.src after %u ms", sc->sc_attach_ms);
+
+	fx_unplug();
+	sim_check(strcmp(fx_state(), "unattached") == 0 &&
+	    sc->sc_detaches == 2, "Rd gone, back to toggling");
+
+	fx_plug(FX_AUDIO, 0, 0);
+	fx_wait_ms(FUSB3_CC_DEBOUNCE_MS + 5);
+	sim_check(strcmp(fx_state(), "audio") == 0, "audio accessory, %s",
+		fx_state());
+	fx_unplug();
+	sim_check(strcmp(fx_state(), "unattached") == 0,
+		"accessory removed");
+}
+
+static void
+test_bounce(void)
+{
+	struct fusb3_softc *sc;
+	sbintime_t found;
+	uint64_t attaches;
+
+	sc = fx_softc();
+	attaches = sc->sc_attaches;
+
+	/* Pulled out again before tCCDebounce */
+	fx_plug(FX_SOURCE, 1, FUSB3_RP_DEF);
+	fx_wait_ms(40);
+	fx_unplug();
+	fx_wait_ms(FUSB3_CC_DEBOUNCE_MS);
+	sim_check(strcmp(fx_state(), "unattached") == 0 &&
+	    sc->sc_attaches == attaches, "short plug not attached, %s",
+	    fx_state());
+
+	/* A source which never turns VBUS on */
+	fx_plug(FX_SOURCE, 1, FUSB3_RP_DEF);
+	fx.vbus = 0;
+	fx_update(&fx);
+	sim_taskqueue_run();
+	fx_wait_ms(FUSB3_CC_DEBOUNCE_MS + 20);
+	found = sc->sc_found;
+	sim_check(strcmp(fx_state(), "attachwait.snk") == 0,
+		"waiting on VBUS after tCCDebounce");
+	fx_wait_ms(FUSB3_VBUS_WAIT_MS);
+	/* Toggling again finds the same source straight away */
+	sim_check(sc->sc_found - found >=
+	    mstosbt(FUSB3_CC_DEBOUNCE_MS + FUSB3_VBUS_WAIT_MS) &&
+	    sc->sc_attaches == attaches, "gave up without VBUS, after %ju ms",
+	    (uintmax_t)sbttoms(sc->sc_found - found));
+	fx_unplug();
+}
+
+/* A 45 W charger, the most the board takes at 12 V is 27 W at 9 V */
+static const uint32_t fx_charger[] = {
+	PD_FIXED_PDO(5000, 3000) | PD_PDO_USB_COMM,
+	PD_FIXED_PDO(9000, 3000),
+	PD_FIXED_PDO(12000, 2250),
+	PD_FIXED_PDO(15000, 3000),
+	PD_FIXED_PDO(20000, 2250),
+};
+
+static void
+test_pd_contract(void)
+{
+	struct fusb3_softc *sc;
+
+	sc = fx_softc();
+	memcpy(fx.src.caps, fx_charger, sizeof(fx_charger));
+	fx.src.ncaps = nitems(fx_charger);
+	fx.c.fifo_xfers = fx.c.fifo_single = 0;
+
+	fx_plug(FX_SOURCE, 1, FUSB3_RP_3A);
+	fx_wait_ms(FUSB3_CC_DEBOUNCE_MS + 5);
+	sim_check(strcmp(fx_state(), "attached.snk") == 0 &&
+	    strcmp(fx_pd_state(), "wait_caps") == 0,
+		"attached, PD waiting for capabilities, %s", fx_pd_state());
+	sim_check((fx.regs[FUSB3_SWITCHES1] & (FUSB3_SW1_AUTO_CRC |
+	    FUSB3_SW1_TXCC1)) == (FUSB3_SW1_AUTO_CRC | FUSB3_SW1_TXCC1),
+		"AUTO_CRC on CC1");
+
+	fx_wait_ms(FX_CAPS_MS + FX_PS_RDY_MS + 10);
+	sim_check(strcmp(fx_pd_state(), "ready") == 0 &&
+	    sc->sc_pd_mv == 9000 && sc->sc_pd_ma == 3000 &&
+	    fx.src.contract_pos == 2, "contract %d mV %d mA, %s",
+	    sc->sc_pd_mv, sc->sc_pd_ma, fx_pd_state());
+	sim_check(fx.src.caps_sent == 1 &&
+	    fx.src.rx[16 + PD_DATA_REQUEST] == 1 && sc->sc_pd_contracts == 1 &&
+	    sc->sc_pd_tx_failed == 0, "one offer, one request");
+	sim_check(fx.c.fifo_xfers > 0 && fx.c.fifo_single == 0,
+		"%ju FIFO transfers, all bursts", (uintmax_t)fx.c.fifo_xfers);
+	sim_check(fx.regs[FUSB3_MASK1] & FUSB3_M_BC_LVL,
+		"BC_LVL masked under a contract");
+}
+
+static void
+test_pd_limits(void)
+{
+	struct fusb3_softc *sc;
+
+	sc = fx_softc();
+	sim_check(fx_pd_limit("pd.max_mv", 25000) == EINVAL &&
+	    fx_pd_limit("pd.max_ma", 100) == EINVAL, "limits out of range");
+
+	sim_check(fx_pd_limit("pd.max_mv", 5000) == 0, "max_mv 5000");
+	fx_wait_ms(FX_PS_RDY_MS + 10);
+	sim_check(sc->sc_pd_mv == 5000 && sc->sc_pd_ma == 3000 &&
+	    fx.src.contract_pos == 1 &&
+	    fx.src.rx[PD_CTRL_GET_SOURCE_CAP] == 1,
+		"renegotiated to %d mV %d mA", sc->sc_pd_mv, sc->sc_pd_ma);
+
+	fx_pd_limit("pd.max_ma", 2000);
+	fx_pd_limit("pd.max_mv", 20000);
+	fx_wait_ms(2 * (FX_PS_RDY_MS + 10));
+	sim_check(sc->sc_pd_mv == 20000 && sc->sc_pd_ma == 2000 &&
+	    PD_RDO_OP(fx.src.rdo) == 200, "renegotiated to %d mV %d mA",
+	    sc->sc_pd_mv, sc->sc_pd_ma);
+
+	fx_pd_limit("pd.max_ma", FUSB3_PD_MAX_MA);
+	fx_pd_limit("pd.max_mv", FUSB3_PD_MAX_MV);
+	fx_wait_ms(2 * (FX_PS_RDY_MS + 10));
+	sim_check(sc->sc_pd_mv == 9000 && sc->sc_pd_ma == 3000 &&
+	    strcmp(fx_pd_state(), "ready") == 0, "back to %d mV %d mA",
+	    sc->sc_pd_mv, sc->sc_pd_ma);
+}
+
+static void
+test_pd_messages(void)
+{
+	struct fusb3_softc *sc;
+	uint64_t dups, contracts;
+	u_int sink_caps;
+
+	sc = fx_softc();
+
+	/* Our GoodCRC lost, the source sends Get_Sink_Cap twice */
+	dups = sc->sc_pd_rx_dups;
+	sink_caps = fx.src.rx[16 + PD_DATA_SINK_CAP];
+	fx.src.lose_goodcrc = 1;
+	fx_src_send(&fx, PD_CTRL_GET_SINK_CAP, 0, NULL);
+	fx_wait_ms(5);
+	sim_check(sc->sc_pd_rx_dups == dups + 1 &&
+	    fx.src.rx[16 + PD_DATA_SINK_CAP] == sink_caps + 1,
+		"retry dropped, answered once");
+	sim_check(fx.src.nsink_caps == 2 &&
+	    PD_PDO_FIXED_MV(fx.src.sink_caps[1]) == FUSB3_PD_MAX_MV &&
+	    PD_PDO_FIXED_MA(fx.src.sink_caps[1]) == FUSB3_PD_MAX_MA,
+		"sink capabilities up to %d mV",
+		PD_PDO_FIXED_MV(fx.src.sink_caps[1]));
+
+	/* Soft_Reset, accepted and a new contract */
+	contracts = sc->sc_pd_contracts;
+	fx_src_send(&fx, PD_CTRL_SOFT_RESET, 0, NULL);
+	fx_wait_ms(FX_PS_RDY_MS + 10);
+	sim_check(fx.src.rx[PD_CTRL_ACCEPT] == 1 &&
+	    sc->sc_pd_contracts == contracts + 1 &&
+	    strcmp(fx_pd_state(), "ready") == 0, "soft reset, %s",
+	    fx_pd_state());
+
+	/* Swaps are refused */
+	fx_src_send(&fx, PD_CTRL_DR_SWAP, 0, NULL);
+	fx_wait_ms(5);
+	sim_check(fx.src.rx[PD_CTRL_REJECT] == 1, "DR_Swap rejected");
+}
+
+static void
+test_pd_hard_reset(void)
+{
+	struct fusb3_softc *sc;
+	uint64_t detaches, resets;
+
+	sc = fx_softc();
+	detaches = sc->sc_detaches;
+	resets = sc->sc_pd_hard_reset_count;
+
+	/* From the source */
+	fx.regs[FUSB3_INTERRUPTA] |= FUSB3_IA_HARDRST;
+	fx_src_hard_reset(&fx);
+	fx_update(&fx);
+	sim_taskqueue_run();
+	sim_check(strcmp(fx_pd_state(), "hard_reset") == 0 &&
+	    sc->sc_pd_mv == 0, "hard reset received, %s", fx_pd_state());
+	fx_wait_ms(FX_VBUS_OFF_MS + FX_VBUS_ON_MS + FX_CAPS_MS +
+	    FX_PS_RDY_MS + 10);
+	sim_check(strcmp(fx_pd_state(), "ready") == 0 &&
+	    sc->sc_pd_mv == 9000 && strcmp(fx_state(), "attached.snk") == 0 &&
+	    sc->sc_detaches == detaches && fx.src.hard_resets == 1,
+		"recovered through VBUS off, %s", fx_pd_state());
+
+	/* PS_RDY never comes, we send one */
+	fx.src.no_ps_rdy = 1;
+	fx_pd_limit("pd.max_mv", 15000);
+	fx_wait_ms(10);
+	sim_check(strcmp(fx_pd_state(), "transition") == 0,
+		"accepted 15 V, %s", fx_pd_state());
+	fx_wait_ms(FUSB3_PD_TRANSITION_MS);
+	sim_check(fx.src.hard_resets == 2 &&
+	    sc->sc_pd_hard_reset_count == resets + 2 &&
+	    strcmp(fx_pd_state(), "hard_reset") == 0,
+		"hard reset after tPSTransition, %s", fx_pd_state());
+	fx.src.no_ps_rdy = 0;
+	fx_wait_ms(FX_VBUS_OFF_MS + FX_VBUS_ON_MS + FX_CAPS_MS +
+	    FX_PS_RDY_MS + 10);
+	sim_check(strcmp(fx_pd_state(), "ready") == 0 &&
+	    sc->sc_pd_mv == 15000 && sc->sc_pd_ma == 3000 &&
+	    sc->sc_detaches == detaches, "recovered at %d mV",
+	    sc->sc_pd_mv);
+
+	fx_pd_limit("pd.max_mv", FUSB3_PD_MAX_MV);
+	fx_wait_ms(FX_PS_RDY_MS + 10);
+	fx_unplug();
+	sim_check(strcmp(fx_pd_state(), "off") == 0 && sc->sc_pd_mv == 0,
+		"PD off at detach");
+}
+
+/* A Type-C only source never answers, give up and keep Rp current */
+static void
+test_pd_legacy(void)
+{
+	struct fusb3_softc *sc;
+	uint64_t attaches, detaches;
+
+	sc = fx_softc();
+	fx.src.ncaps = 0;
+	fx.src.hard_resets = 0;
+	fx_plug(FX_SOURCE, 2, FUSB3_RP_1A5);
+	fx_wait_ms(FUSB3_CC_DEBOUNCE_MS + 5);
+	attaches = sc->sc_attaches;
+	detaches = sc->sc_detaches;
+
+	fx_wait_ms(3 * FUSB3_PD_WAIT_CAP_MS + 2 * FUSB3_PD_HARD_RESET_MS + 10);
+	sim_check(strcmp(fx_pd_state(), "disabled") == 0 &&
+	    sc->sc_pd_hard_resets == FUSB3_PD_HARD_RESETS,
+		"gave up after %d hard resets, %s", sc->sc_pd_hard_resets,
+		fx_pd_state());
+	sim_check(strcmp(fx_state(), "attached.snk") == 0 &&
+	    sc->sc_attaches == attaches && sc->sc_detaches == detaches &&
+	    sc->sc_rp == FUSB3_RP_1A5, "still attached at Rp 1.5 A");
+	fx_unplug();
+}
+
+/* Transfers from attach to PS_RDY, and the PD messages they carried */
+static uint64_t
+fx_pd_cost(uint64_t *msgs)
+{
+	struct fusb3_softc *sc;
+	uint64_t xfers, rx, tx;
+
+	sc = fx_softc();
+	memcpy(fx.src.caps, fx_charger, sizeof(fx_charger));
+	fx.src.ncaps = nitems(fx_charger);
+	fx_plug(FX_SOURCE, 1, FUSB3_RP_3A);
+	fx_wait_ms(FUSB3_CC_DEBOUNCE_MS - 5);
+
+	xfers = fx.c.xfers;
+	rx = sc->sc_pd_rx;
+	tx = sc->sc_pd_tx;
+	fx_wait_ms(10 + FX_CAPS_MS + FX_PS_RDY_MS);
+	sim_check(strcmp(fx_pd_state(), "ready") == 0 &&
+	    sc->sc_pd_mv == 9000, "contract with regcache %d",
+	    sc->sc_regcache);
+	xfers = fx.c.xfers - xfers;
+	*msgs = sc->sc_pd_rx - rx + sc->sc_pd_tx - tx;
+	return (xfers);
+}
+
+static void
+test_regcache(void)
+{
+	struct fusb3_softc *sc;
+	uint64_t cached, uncached, msgs, umsgs;
+	int reg, same;
+
+	sc = fx_softc();
+	fx.c.control_reads = 0;
+	cached = fx_pd_cost(&msgs);
+	sim_check(fx.c.control_reads == 0 && sc->sc_writes_dropped > 0,
+		"no control register reads, %ju writes dropped",
+		(uintmax_t)sc->sc_writes_dropped);
+	sim_check(sc->sc_regs_dirty == 0, "nothing left staged");
+	same = 1;
+	for (reg = FUSB3_CACHE_FIRST; reg <= FUSB3_CACHE_LAST; reg++)
+		if ((sc->sc_regs_valid & FUSB3_CACHE_BIT(reg)) &&
+		    sc->sc_regs[reg - FUSB3_CACHE_FIRST] != fx.regs[reg]) {
+			printf("  0x%02x cached 0x%02x chip 0x%02x\n", reg,
+				sc->sc_regs[reg - FUSB3_CACHE_FIRST],
+				fx.regs[reg]);
+			same = 0;
+		}
+	sim_check(same, "cache matches the chip");
+	fx_unplug();
+
+	fx_detach();
+	sim_setenv("dev.fusb3.0.regcache", "0");
+	fx_attach();
+	sim_setenv("dev.fusb3.0.regcache", "1");
+	uncached = fx_pd_cost(&umsgs);
+	fx_unplug();
+	fx_detach();
+	fx_attach();
+
+	sim_check(msgs == umsgs && cached < uncached,
+	    "%ju transfers for %ju PD messages, %.1f each, %ju uncached",
+	    (uintmax_t)cached, (uintmax_t)msgs, (double)cached / msgs,
+	    (uintmax_t)uncached);
+}
+
+static int
+fx_fusb3_mux(void)
+{
+	int mux;
+	size_t len;
+
+	len = sizeof(mux);
+	if (sim_sysctl_get(fx.dev, "mux", &mux, &len) != 0)
+		return (-2);
+	return (mux);
+}
+
+static void
+test_mux(void)
+{
+	struct fusb3_softc *sc;
+	sbintime_t found;
+	uint64_t writes;
+	size_t len;
+	int val, error;
+
+	sc = fx_softc();
+	writes = fx.mux_writes;
+
+	/* Plug upside down */
+	fx_plug(FX_SOURCE, 2, FUSB3_RP_DEF);
+	found = sc->sc_found;
+	fx_wait_ms(FUSB3_CC_DEBOUNCE_MS + 5);
+	sim_check(strcmp(fx_state(), "attached.snk") == 0 &&
+	    fx.mux_cfg == PI3USB_CFG_USB3S && fx_fusb3_mux() == fx.mux_cfg,
+		"CC2 sink, mux 0x%02x", fx.mux_cfg);
+	sim_check(fx.mux_time - found <= mstosbt(sc->sc_attach_ms + 1),
+		"mux set %ju ms after TOGDONE, attached after %u ms",
+		(uintmax_t)sbttoms(fx.mux_time - found), sc->sc_attach_ms);
+	fx_unplug();
+	sim_check(fx.mux_cfg == PI3USB_CFG_OPEN, "open after detach");
+
+	fx_plug(FX_SINK, 1, 0);
+	fx_wait_ms(FUSB3_CC_DEBOUNCE_MS + 5);
+	sim_check(strcmp(fx_state(), "attached.src") == 0 &&
+	    fx.mux_cfg == PI3USB_CFG_USB3, "CC1 source, mux 0x%02x",
+	    fx.mux_cfg);
+	fx_unplug();
+
+	fx_plug(FX_AUDIO, 0, 0);
+	fx_wait_ms(FUSB3_CC_DEBOUNCE_MS + 5);
+	sim_check(strcmp(fx_state(), "audio") == 0 &&
+	    fx.mux_cfg == PI3USB_CFG_OPEN, "audio accessory, mux open");
+	fx_unplug();
+
+	sim_check(fx.mux_writes - writes == 4, "%ju mux writes, none repeated",
+		(uintmax_t)(fx.mux_writes - writes));
+	sim_check(pi3usb_set_config(fx.mux, PI3USB_CFG_SWAP) == EINVAL &&
+	    pi3usb_set_config(fx.mux, 8) == EINVAL, "bad configs refused");
+
+	/* 260 would be 4 if narrowed to the register */
+	val = 260;
+	error = sim_sysctl_set(fx.mux, "mux", &val, sizeof(val));
+	sim_check(error == EINVAL && fx.mux_cfg == PI3USB_CFG_OPEN,
+		"mux sysctl refuses 260, error %d", error);
+	val = PI3USB_CFG_4DPI;
+	error = sim_sysctl_set(fx.mux, "mux", &val, sizeof(val));
+	len = sizeof(val);
+	val = -1;
+	sim_check(error == 0 && fx.mux_cfg == PI3USB_CFG_4DPI &&
+	    sim_sysctl_get(fx.mux, "mux", &val, &len) == 0 &&
+	    val == PI3USB_CFG_4DPI, "mux sysctl set and read back");
+	val = PI3USB_CFG_OPEN;
+	sim_sysctl_set(fx.mux, "mux", &val, sizeof(val));
+}
+
+static int
+fx_trace(int on)
+{
+	return (sim_sysctl_set(fx.dev, "trace", &on, sizeof(on)));
+}
+
+/* Contract with the charger, the ring goes to path for fusb3trace */
+static void
+test_trace(const char *path)
+{
+	struct fusb3_trace ring[FUSB3_TRACE_RECORDS], *ft;
+	struct fusb3_softc *sc;
+	size_t len, i, n;
+	int tc, caps, req, ready, intr, order;
+	FILE *fp;
+
+	sc = fx_softc();
+	len = sizeof(ring);
+	sim_check(sim_sysctl_get(fx.dev, "trace_ring", ring, &len) == 0 &&
+	    len > 0 && len / sizeof(ring[0]) == MIN(sc->sc_trace_total,
+	    FUSB3_TRACE_RECORDS), "trace on from attach, %ju records",
+	    (uintmax_t)sc->sc_trace_total);
+
+	/* Off and on again starts an empty ring */
+	fx_trace(0);
+	fx_trace(1);
+	memcpy(fx.src.caps, fx_charger, sizeof(fx_charger));
+	fx.src.ncaps = nitems(fx_charger);
+	fx_plug(FX_SOURCE, 1, FUSB3_RP_3A);
+	fx_wait_ms(FUSB3_CC_DEBOUNCE_MS + FX_CAPS_MS + FX_PS_RDY_MS + 20);
+	sim_check(strcmp(fx_pd_state(), "ready") == 0, "contract, %s",
+		fx_pd_state());
+
+	len = sizeof(ring);
+	sim_sysctl_get(fx.dev, "trace_ring", ring, &len);
+	n = len / sizeof(ring[0]);
+	tc = caps = req = ready = intr = 0;
+	order = 1;
+	for (i = 0; i < n; i++) {
+		ft = &ring[i];
+		if (i > 0 && ft->ft_us < ring[i - 1].ft_us)
+			order = 0;
+		switch (ft->ft_type) {
+		case FUSB3_TR_TC:
+			if (ft->ft_arg == FUSB3_TC_ATTACHED_SNK &&
+			    ft->ft_data[0] == 1)
+				tc++;
+			break;
+		case FUSB3_TR_PD:
+			if (ft->ft_arg == FUSB3_PD_READY)
+				ready++;
+			break;
+		case FUSB3_TR_INTR:
+			intr++;
+			break;
+		case FUSB3_TR_RX:
+			if (PD_HDR_TYPE(ft->ft_hdr) == PD_DATA_SOURCE_CAP &&
+			    PD_HDR_CNT(ft->ft_hdr) == nitems(fx_charger) &&
+			    memcmp(ft->ft_data, fx_charger,
+			    sizeof(fx_charger)) == 0)
+				caps++;
+			break;
+		case FUSB3_TR_TX:
+			if (PD_HDR_TYPE(ft->ft_hdr) == PD_DATA_REQUEST &&
+			    PD_HDR_CNT(ft->ft_hdr) == 1 &&
+			    ft->ft_data[0] == sc->sc_pd_rdo)
+				req++;
+			break;
+		}
+	}
+	sim_check(n > 0 && order && intr > 0,
+		"%zu records in order, %d interrupts", n, intr);
+	sim_check(tc == 1 && caps == 1 && req == 1 && ready == 1,
+		"attached on CC1, offer, request and contract traced");
+
+	if (path != NULL) {
+		fp = fopen(path, "w");
+		sim_check(fp != NULL && fwrite(ring, sizeof(ring[0]), n, fp) == n &&
+		    fclose(fp) == 0, "trace written to %s", path);
+	}
+	fx_unplug();
+
+	fx_trace(0);
+	len = sizeof(ring);
+	sim_check(sim_sysctl_get(fx.dev, "trace_ring", ring, &len) == 0 &&
+	    len == 0 && sc->sc_trace == NULL, "trace off");
+	fx_plug(FX_SINK, 1, 0);
+	fx_wait_ms(FUSB3_CC_DEBOUNCE_MS + 5);
+	fx_unplug();
+	fx_trace(1);
+}
+
+/* Nothing plugged in, the chip looks after itself until TOGDONE */
+static void
+test_lowpower(void)
+{
+	struct fusb3_softc *sc;
+	struct fx_counters c;
+	int ua;
+
+	sc = fx_softc();
+	fx_unplug();
+	fx_wait_ms(10);
+	c = fx.c;
+	fx_wait_ms(10000);
+	sim_check(fx.regs[FUSB3_POWER] == FUSB3_POWER_BANDGAP &&
+	    (fx.regs[FUSB3_CONTROL2] & 0xc0) == FUSB3_CTL2_TOG_SAVE_40,
+		"idle on the bandgap, 40 ms between toggle cycles");
+	sim_check(fx.c.xfers == c.xfers && fx.c.interrupts == c.interrupts,
+		"idle 10 s, %ju transfers %ju interrupts",
+		(uintmax_t)(fx.c.xfers - c.xfers),
+		(uintmax_t)(fx.c.interrupts - c.interrupts));
+	ua = fx_supply_ua(&fx);
+
+	fx_plug(FX_SOURCE, 2, FUSB3_RP_1A5);
+	sim_check(fx.c.interrupts > c.interrupts &&
+	    fx.regs[FUSB3_POWER] == FUSB3_POWER_ALL,
+		"TOGDONE wakes it, measure block back on");
+	fx_wait_ms(FUSB3_CC_DEBOUNCE_MS + 5);
+	sim_check(strcmp(fx_state(), "attached.snk") == 0 && sc->sc_cc == 2 &&
+	    sc->sc_rp == FUSB3_RP_1A5, "attached from low power, %s rp %d",
+	    fx_state(), sc->sc_rp);
+	fx_unplug();
+
+	fx_detach();
+	sim_setenv("dev.fusb3.0.lowpower", "0");
+	fx_attach();
+	sim_setenv("dev.fusb3.0.lowpower", "1");
+	sim_check(fx.regs[FUSB3_POWER] == FUSB3_POWER_ALL &&
+	    (fx.regs[FUSB3_CONTROL2] & 0xc0) == 0 &&
+	    fx_supply_ua(&fx) > ua, "idle %d uA, %d uA fully powered", ua,
+	    fx_supply_ua(&fx));
+	fx_detach();
+	fx_attach();
+}
+
+static int
+fx_bq_sysctl(const char *name)
+{
+	size_t len;
+	int val;
+
+	len = sizeof(val);
+	if (sim_sysctl_get(fx_bq.dev, name, &val, &len) != 0)
+		return (-1);
+	return (val);
+}
+
+static void
+test_ilim(void)
+{
+	struct fusb3_softc *sc;
+	uint64_t writes;
+
+	sc = fx_softc();
+
+	/* Type-C only, Rp has the last word once detection is done */
+	fx.src.ncaps = 0;
+	fx_bq.source = BQREG_VBUS_USB;
+	fx_plug(FX_SOURCE, 1, FUSB3_RP_3A);
+	fx_wait_ms(FUSB3_CC_DEBOUNCE_MS + 5);
+	sim_check(strcmp(fx_state(), "attached.snk") == 0 &&
+	    sc->sc_ilim_ma == 0 && sc->sc_ilim_deadline != 0 &&
+	    fx_bq_ma() == 500, "charger still detecting, %d mA",
+	    fx_bq_ma());
+	fx_wait_ms(FX_BQ_DETECT_MS + FUSB3_ILIM_RETRY_MS);
+	sim_check(sc->sc_ilim_ma == 3000 && fx_bq_ma() == 3000 &&
+	    fx_bq_sysctl("limit_ma") == 3000 &&
+	    fx_bq_sysctl("input_ma") == 3000, "Rp 3 A, limit %d mA",
+	    fx_bq_ma());
+	writes = fx_bq.writes;
+	fx_wait_ms(3 * FUSB3_PD_WAIT_CAP_MS + 2 * FUSB3_PD_HARD_RESET_MS + 10);
+	sim_check(strcmp(fx_pd_state(), "disabled") == 0 &&
+	    fx_bq.writes == writes && sc->sc_ilim_deadline == 0,
+		"left alone while PD gives up, %s", fx_pd_state());
+	fx_unplug();
+	fx_wait_ms(10);
+	sim_check(strcmp(fx_state(), "unattached") == 0 &&
+	    sc->sc_ilim_ma == 0 && fx_bq_sysctl("limit_ma") == 0 &&
+	    fx_bq_sysctl("input_ma") == 0, "cleared at detach");
+
+	/* A dedicated charging port is good for more than Rp says */
+	fx_bq.source = BQREG_VBUS_ADAPTER;
+	fx_plug(FX_SOURCE, 2, FUSB3_RP_DEF);
+	fx_wait_ms(FUSB3_CC_DEBOUNCE_MS + FX_BQ_DETECT_MS +
+	    FUSB3_ILIM_RETRY_MS + 5);
+	sim_check(sc->sc_ilim_ma == 500 && fx_bq_ma() == 1500,
+		"adapter at default Rp, %d mA", fx_bq_ma());
+	/* PD may be in a hard reset still, where VBUS loss is not detach */
+	fx_unplug();
+	fx_wait_ms(FUSB3_PD_HARD_RESET_MS + 10);
+	sim_check(strcmp(fx_state(), "unattached") == 0 &&
+	    sc->sc_ilim_ma == 0, "detached, %s", fx_state());
+	fx_bq.source = BQREG_VBUS_USB;
+	fx_plug(FX_SOURCE, 2, FUSB3_RP_DEF);
+	fx_wait_ms(FUSB3_CC_DEBOUNCE_MS + FX_BQ_DETECT_MS +
+	    FUSB3_ILIM_RETRY_MS + 5);
+	sim_check(sc->sc_ilim_ma == 500 && fx_bq_ma() == 500,
+		"USB host at default Rp, %d mA", fx_bq_ma());
+	fx_unplug();
+
+	/* The PD contract takes over from Rp, across a hard reset too */
+	memcpy(fx.src.caps, fx_charger, sizeof(fx_charger));
+	fx.src.ncaps = nitems(fx_charger);
+	fx.src.hard_resets = 0;
+	fx_plug(FX_SOURCE, 1, FUSB3_RP_1A5);
+	fx_wait_ms(FUSB3_CC_DEBOUNCE_MS + FX_CAPS_MS + FX_PS_RDY_MS +
+	    FX_BQ_DETECT_MS + FUSB3_ILIM_RETRY_MS + 10);
+	sim_check(sc->sc_pd_mv == 9000 && sc->sc_ilim_ma == 3000 &&
+	    fx_bq_ma() == 3000, "contract 9 V 3 A, limit %d mA", fx_bq_ma());
+	fx.regs[FUSB3_INTERRUPTA] |= FUSB3_IA_HARDRST;
+	fx_src_hard_reset(&fx);
+	fx_update(&fx);
+	sim_taskqueue_run();
+	fx_wait_ms(FX_VBUS_OFF_MS + 5);
+	sim_check(sc->sc_ilim_ma == 0, "no limit while VBUS is off");
+	fx_wait_ms(FX_VBUS_ON_MS + FX_CAPS_MS + FX_PS_RDY_MS +
+	    FX_BQ_DETECT_MS + FUSB3_ILIM_RETRY_MS);
+	sim_check(strcmp(fx_pd_state(), "ready") == 0 &&
+	    sc->sc_ilim_ma == 3000 && fx_bq_ma() == 3000,
+		"set again after the hard reset, %d mA", fx_bq_ma());
+	fx_unplug();
+	fx_wait_ms(10);
+}
+
+static void
+test_poll(void)
+{
+	struct fusb3_softc *sc;
+
+	fx_detach();
+	sim_check(fx.handler == NULL, "interrupt torn down at detach");
+
+	sim_setenv("dev.fusb3.0.polling", "1");
+	sim_check(fx_attach() == 0, "attach polling");
+	sim_setenv("dev.fusb3.0.polling", "0");
+	sc = fx_softc();
+	sim_check(sc->sc_polling && fx.handler == NULL,
+		"no interrupt asked for");
+
+	fx_plug(FX_SOURCE, 1, FUSB3_RP_3A);
+	fx_wait_ms(FUSB3_POLL_MS + FUSB3_CC_DEBOUNCE_MS + 5);
+	sim_check(strcmp(fx_state(), "attached.snk") == 0 &&
+	    sc->sc_cc == 1 && sc->sc_rp == FUSB3_RP_3A,
+		"polled attach, %s", fx_state());
+	fx_unplug();
+	fx_wait_ms(FUSB3_POLL_MS);
+	sim_check(strcmp(fx_state(), "unattached") == 0,
+		"polled detach");
+
+	fx_detach();
+	fx_attach();
+}
+
+/*
+ * Detach with a PD deadline or a charger retry armed and a status read
+ * queued, nothing may be left to fire on the freed softc.
+ */
+static void
+test_detach(void)
+{
+	struct fusb3_softc *sc;
+
+	sc = fx_softc();
+	memcpy(fx.src.caps, fx_charger, sizeof(fx_charger));
+	fx.src.ncaps = nitems(fx_charger);
+	fx_plug(FX_SOURCE, 1, FUSB3_RP_3A);
+	fx_wait_ms(FUSB3_CC_DEBOUNCE_MS + 5);
+	sim_check(strcmp(fx_pd_state(), "wait_caps") == 0 &&
+	    sc->sc_pd_deadline != 0, "PD waiting, %s", fx_pd_state());
+
+	taskqueue_enqueue(sc->sc_tq, &sc->sc_task);
+	fusb3_detach(fx.dev);
+	sim_check(!callout_pending(&sc->sc_timer),
+		"no callout left armed at detach");
+	sim_device_destroy(fx.dev);
+	fx.dev = NULL;
+	fx_unplug();
+	fx_wait_ms(10);
+	fx_attach();
+
+	/* Type-C only, with the charger still detecting */
+	sc = fx_softc();
+	fx.src.ncaps = 0;
+	fx_plug(FX_SOURCE, 1, FUSB3_RP_3A);
+	fx_wait_ms(FUSB3_CC_DEBOUNCE_MS + 5);
+	sim_check(sc->sc_ilim_deadline != 0, "charger retry armed");
+	taskqueue_enqueue(sc->sc_tq, &sc->sc_task);
+	fusb3_detach(fx.dev);
+	sim_check(!callout_pending(&sc->sc_timer),
+		"no callout left armed for the charger");
+	sim_device_destroy(fx.dev);
+	fx.dev = NULL;
+	fx_unplug();
+	fx_wait_ms(10);
+	fx_attach();
+}
+
+int
+main(int argc, char **argv)
+{
+	fx_platform();
+
+	test_attach();
+	test_sink();
+	test_source();
+	test_bounce();
+	test_pd_contract();
+	test_pd_limits();
+	test_pd_messages();
+	test_pd_hard_reset();
+	test_pd_legacy();
+	test_regcache();
+	test_mux();
+	test_trace(argc > 1 ? argv[1] : NULL);
+	test_lowpower();
+	test_ilim();
+	test_poll();
+	test_detach();
+
+	fx_detach();
+
+	printf("%d failures\n", sim_failures());
+	return (sim_failures() != 0);
+}
@@ -0,0 +1,279 @@
+/*-
+ * Copyright (c) 2018 Tom Jones <tj@enoti.me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+
+/*
+ * Replay raw GT9xx frames through goodix(4)'s frame parser, transform and
+ * multitouch slot tracking.
+ *
+ * Frames come from a capture_ring dump (sysctl -b dev.goodix.0.capture_ring)
+ * or are synthesised, fingers moving across the panel and lifting now and
+ * then. The bus is left out, only the per frame hot path is timed.
+ */
+
+#include <err.h>
+
+#include "../../goodix-i2c/goodix_gt9xx.c"
+
+#include "sim.h"
+
+#define	RP_ADDR			0x14
+#define	RP_SYNTH_FRAMES		1024
+#define	RP_SYNTH_LIFT		64	/* every so many frames */
+
+static uint8_t rp_regs[0x10000];
+
+/* Just enough of the controller for attach to find the panel */
+static int
+rp_xfer(void *ctx, struct iic_msg *msgs, uint32_t nmsgs)
+{
+	uint16_t reg;
+
+	if (msgs[0].slave != RP_ADDR << 1 || (msgs[0].flags & IIC_M_RD) ||
+	    msgs[0].len < 2)
+		return (IIC_ENOACK);
+	reg = be16dec(msgs[0].buf);
+	if (nmsgs == 2)
+		memcpy(msgs[1].buf, &rp_regs[reg], msgs[1].len);
+	else
+		memcpy(&rp_regs[reg], &msgs[0].buf[2], msgs[0].len - 2);
+	return (0);
+}
+
+/* TCSE on I2C6, only the I2cSerialBus matters here */
+static device_t
+rp_attach(int rotate)
+{
+	static ACPI_RESOURCE crs;
+	struct sim_acpi_node *node;
+	device_t i2c, iicbus, dev;
+	uint8_t *cfg;
+	char val[8];
+
+	memcpy(&rp_regs[GOODIX_ID], "911", 4);
+	cfg = &rp_regs[GOODIX_CONFIG];
+	le16enc(&cfg[GOODIX_CONFIG_MAX_X], 1200);
+	le16enc(&cfg[GOODIX_CONFIG_MAX_Y], 1920);
+	cfg[GOODIX_CONFIG_TOUCHES] = GOODIX_MAX_CONTACTS;
+	cfg[GOODIX_CONFIG_911_LEN - 2] =
+		goodix_config_checksum(cfg, GOODIX_CONFIG_911_LEN);
+
+	snprintf(val, sizeof(val), "%d", rotate);
+	sim_setenv("dev.goodix.0.rotate", val);
+
+	i2c = sim_device_create("ig4iic_acpi", 0, 0);
+	sim_device_set_acpi(i2c, sim_acpi_node("\\_SB_.PCI0.I2C6", -1));
+	iicbus = BUS_ADD_CHILD(i2c, 0, "iicbus", -1);
+	sim_device_set_iic(iicbus, rp_xfer, NULL);
+
+	crs.Type = ACPI_RESOURCE_TYPE_SERIAL_BUS;
+	crs.Data.I2cSerialBus.Type = ACPI_RESOURCE_SERIAL_TYPE_I2C;
+	crs.Data.I2cSerialBus.SlaveAddress = RP_ADDR;
+	crs.Data.I2cSerialBus.ConnectionSpeed = 400000;
+	crs.Data.I2cSerialBus.ResourceSource.StringPtr = "\\_SB.PCI0.I2C6";
+	node = sim_acpi_node("TCSE", -1);
+	sim_acpi_resources(node, "_CRS", &crs, 1);
+
+	dev = sim_device_create("goodix_acpi", 0, 0);
+	sim_device_set_acpi(dev, node);
+	if (goodix_acpi_probe(dev) != 0 || goodix_acpi_attach(dev) != 0)
+		errx(1, "goodix attach failed");
+	return (dev);
+}
+
+static struct goodix_capture *
+rp_load(const char *path, size_t *n)
+{
+	struct goodix_capture *frames;
+	FILE *fp;
+	long len;
+
+	fp = fopen(path, "r");
+	if (fp == NULL)
+		err(1, "%s", path);
+	if (fseek(fp, 0, SEEK_END) != 0 || (len = ftell(fp)) < 0)
+		err(1, "%s", path);
+	rewind(fp);
+	if (len == 0 || len % sizeof(*frames) != 0)
+		errx(1, "%s: not a capture_ring dump", path);
+
+	*n = len / sizeof(*frames);
+	frames = calloc(*n, sizeof(*frames));
+	if (frames == NULL || fread(frames, sizeof(*frames), *n, fp) != *n)
+		err(1, "%s", path);
+	fclose(fp);
+	return (frames);
+}
+
+/*
+ * Fingers walking diagonally across the panel, 5 ms apart, with every
+ * finger lifted for one frame now and then.
+ */
+static struct goodix_capture *
+rp_synth(int fingers, size_t *n)
+{
+	struct goodix_capture *frames, *gc;
+	uint8_t *p;
+	size_t i;
+	int j, down;
+
+	*n = RP_SYNTH_FRAMES;
+	frames = calloc(*n, sizeof(*frames));
+	if (frames == NULL)
+		err(1, "calloc");
+
+	for (i = 0; i < *n; i++) {
+		gc = &frames[i];
+		down = (i % RP_SYNTH_LIFT) == RP_SYNTH_LIFT - 1 ? 0 : fingers;
+		gc->gc_us = i * 5000;
+		gc->gc_len = 1 + GOODIX_CONTACT_LEN * GOODIX_MAX_CONTACTS;
+		gc->gc_frame[0] = GOODIX_STATUS_READY | down;
+		for (j = 0; j < down; j++) {
+			p = &gc->gc_frame[1 + j * GOODIX_CONTACT_LEN];
+			p[0] = j;
+			le16enc(&p[1], (i * 7 + j * 110) % 1200);
+			le16enc(&p[3], (i * 11 + j * 170) % 1920);
+			le16enc(&p[5], 20 + j);
+		}
+	}
+	return (frames);
+}
+
+static void
+rp_write(const char *path, struct goodix_capture *frames, size_t n)
+{
+	FILE *fp;
+
+	fp = fopen(path, "w");
+	if (fp == NULL || fwrite(frames, sizeof(*frames), n, fp) != n ||
+	    fclose(fp) != 0)
+		err(1, "%s", path);
+}
+
+static uint64_t
+rp_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return (__builtin_ia32_rdtsc());
+#else
+	return (0);
+#endif
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: goodix_replay [-f fingers] [-n iterations] "
+		"[-r rotate] [-w out] [capture]\n");
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct goodix_capture *frames;
+	struct goodix_softc *sc;
+	struct evdev_dev *evdev;
+	device_t dev;
+	uint64_t start, ns, cycles, contacts;
+	size_t n, i;
+	long iterations;
+	int ch, fingers, rotate;
+	const char *out;
+
+	fingers = 2;
+	iterations = 1000000;
+	rotate = 0;
+	out = NULL;
+	while ((ch = getopt(argc, argv, "f:n:r:w:")) != -1) {
+		switch (ch) {
+		case 'f':
+			fingers = atoi(optarg);
+			break;
+		case 'n':
+			iterations = atol(optarg);
+			break;
+		case 'r':
+			rotate = atoi(optarg);
+			break;
+		case 'w':
+			out = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc > 1 || iterations <= 0 || fingers < 0 ||
+	    fingers > GOODIX_MAX_CONTACTS)
+		usage();
+
+	if (argc == 1)
+		frames = rp_load(argv[0], &n);
+	else
+		frames = rp_synth(fingers, &n);
+	if (out != NULL) {
+		rp_write(out, frames, n);
+		return (0);
+	}
+
+	sim_quiet = 1;
+	dev = rp_attach(rotate);
+	sc = device_get_softc(
+		((struct goodix_acpi_softc *)device_get_softc(dev))->sc_child);
+	evdev = sc->sc_evdev;
+
+	contacts = 0;
+	for (i = 0; i < n; i++)
+		contacts += frames[i].gc_frame[0] & GOODIX_STATUS_TOUCHES;
+
+	start = sim_nsec();
+	cycles = rp_cycles();
+	for (i = 0; i < (size_t)iterations; i++)
+		goodix_ev_report(sc, frames[i % n].gc_frame,
+			ustosbt(frames[i % n].gc_us));
+	cycles = rp_cycles() - cycles;
+	ns = sim_nsec() - start;
+
+	printf("replay %zu frames, %.2f contacts/frame, rotate %d\n", n,
+		(double)contacts / n, rotate);
+	printf("%ld frames %.0f frames/s %.1f ns/frame", iterations,
+		iterations / (ns / 1e9), (double)ns / iterations);
+	if (cycles != 0)
+		printf(" %.0f cycles/frame", (double)cycles / iterations);
+	printf("\n%ju syncs %ju releases %ju events\n",
+		(uintmax_t)sim_evdev_syncs(evdev),
+		(uintmax_t)sim_evdev_releases(evdev),
+		(uintmax_t)sim_evdev_events(evdev));
+
+	goodix_acpi_detach(dev);
+	sim_device_destroy(dev);
+	/* free() is the kernel's two argument one here */
+	(free)(frames);
+	return (0);
+}
@@ -0,0 +1,1179 @@
+/*-
+ * Copyright (c) 2018 Tom Jones <tj@enoti.me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+
+/*
+ * Goodix GT9xx touch controller model for goodix(4).
+ *
+ * The controller is a 16 bit addressed register file behind I2C. The
+ * harness queues touch frames into the coordinate registers and raises the
+ * interrupt, the model counts every transfer so the per frame bus cost can
+ * be checked and benchmarked.
+ */
+
+#include "../../goodix-i2c/goodix_gt9xx.c"
+
+#include "sim.h"
+
+#define	GT_ADDR_ALT		(0x14 << 1)
+#define	GT_ADDR_DEFAULT		(0x5d << 1)	/* at power on */
+#define	GT_REGS			0x10000
+#define	GT_INT_PIN		0x4d
+#define	GT_RESET_PIN		0x14
+
+struct gt_counters {
+	uint64_t	xfers;
+	uint64_t	reads;
+	uint64_t	writes;
+	uint64_t	read_bytes;
+	uint64_t	write_bytes;
+	uint64_t	clears;		/* coordinate status handed back */
+	uint64_t	naks;
+	uint64_t	config_writes;
+	uint64_t	config_bad;	/* checksum or refresh flag wrong */
+	uint64_t	cmd_writes;
+	uint64_t	cmd_bad;	/* sleep without the INT handshake */
+	uint64_t	wakes;
+	uint64_t	irqs;		/* interrupts raised to the host */
+	uint64_t	dropped;	/* touches while the screen was off */
+};
+
+#define	GT_AWAKE	0
+#define	GT_SLEEP	1
+#define	GT_GESTURE	2
+
+struct gt_contact {
+	int		id;
+	int		x;
+	int		y;
+	int		size;
+};
+
+struct gt_model {
+	uint8_t		regs[GT_REGS];
+	device_t	acpi;		/* goodix_acpi */
+	device_t	dev;		/* goodix, on the iicbus */
+	struct gt_counters c;
+
+	uint16_t	addr;
+	int		reset_out;	/* host is driving reset */
+	int		in_reset;
+	sbintime_t	reset_low;
+	uint64_t	resets;
+
+	int		mode;
+	int		int_out;	/* host is driving INT */
+	int		int_level;
+	sbintime_t	int_high;	/* when the host drove it high */
+};
+
+static struct gt_model gt;
+static struct sim_acpi_node *gt_inti_node;
+static int gt_irq = 1;		/* GpioInt wired up */
+
+/* The part gt_init lays out, with its config block length */
+static struct {
+	const char	*id;
+	int		config_len;
+	int		bad_sum;	/* firmware left a broken checksum */
+} gt_part = { "911", GOODIX_CONFIG_911_LEN, 0 };
+
+/* The TCSE _CRS, as the GPD Pocket's DSDT has it by default */
+static struct {
+	uint16_t	addr;
+	uint32_t	speed;
+	char		*bus;
+	int		reset;		/* GpioIo listed */
+} gt_wiring = { 0x14, 400000, "\\_SB.PCI0.I2C6", 1 };
+
+static device_t gt_iicbus;
+
+static int
+gt_config_valid(const uint8_t *cfg)
+{
+	uint8_t sum;
+	int i;
+
+	sum = 0;
+	for (i = 0; i < gt_part.config_len - 1; i++)
+		sum += cfg[i];
+	return (sum == 0 && cfg[gt_part.config_len - 1] == 1);
+}
+
+static int
+gt_xfer(void *ctx, struct iic_msg *msgs, uint32_t nmsgs)
+{
+	struct gt_model *m = ctx;
+	uint16_t reg;
+	uint32_t i;
+
+	m->c.xfers++;
+	if (m->mode == GT_SLEEP || m->in_reset) {
+		m->c.naks++;
+		return (IIC_ENOACK);
+	}
+	for (i = 0; i < nmsgs; i++)
+		if (msgs[i].slave != m->addr) {
+			m->c.naks++;
+			return (IIC_ENOACK);
+		}
+
+	/* Every transfer starts by writing the register address */
+	if ((msgs[0].flags & IIC_M_RD) || msgs[0].len < 2)
+		return (IIC_EBUSERR);
+	reg = be16dec(msgs[0].buf);
+
+	if (nmsgs == 2 && (msgs[1].flags & IIC_M_RD)) {
+		if (msgs[0].len != 2 || reg + msgs[1].len > GT_REGS)
+			return (IIC_EBUSERR);
+		memcpy(msgs[1].buf, &m->regs[reg], msgs[1].len);
+		m->c.reads++;
+		m->c.read_bytes += msgs[1].len;
+		return (0);
+	}
+
+	if (nmsgs != 1 || reg + msgs[0].len - 2 > GT_REGS)
+		return (IIC_EBUSERR);
+	memcpy(&m->regs[reg], &msgs[0].buf[2], msgs[0].len - 2);
+	m->c.writes++;
+	m->c.write_bytes += msgs[0].len - 2;
+	if (reg == GOODIX_COORD && msgs[0].len > 2 && msgs[0].buf[2] == 0)
+		m->c.clears++;
+	if (reg == GOODIX_CMD && msgs[0].len > 2) {
+		m->c.cmd_writes++;
+		switch (msgs[0].buf[2]) {
+		case GOODIX_CMD_SCREEN_OFF:
+			if (m->int_out && m->int_level == 0)
+				m->mode = GT_SLEEP;
+			else
+				m->c.cmd_bad++;
+			break;
+		case GOODIX_CMD_GESTURE:
+			if (m->regs[GOODIX_CMD_CHECK] == GOODIX_CMD_GESTURE)
+				m->mode = GT_GESTURE;
+			else
+				m->c.cmd_bad++;
+			break;
+		}
+	}
+	if (reg == GOODIX_CONFIG) {
+		m->c.config_writes++;
+		if (msgs[0].len - 2 != gt_part.config_len ||
+		    !gt_config_valid(&m->regs[GOODIX_CONFIG]))
+			m->c.config_bad++;
+		/* The controller acks the refresh by clearing the flag */
+		m->regs[GOODIX_CONFIG + gt_part.config_len - 1] = 0;
+	}
+	return (0);
+}
+
+/*
+ * Post a frame in the coordinate registers and raise the interrupt, the
+ * frame read runs from the driver's taskqueue.
+ */
+static void
+gt_post(struct gt_model *m, const struct gt_contact *contacts, int n)
+{
+	uint8_t *p;
+	int i;
+
+	m->regs[GOODIX_COORD] = GOODIX_STATUS_READY | n;
+	for (i = 0; i < n; i++) {
+		p = &m->regs[GOODIX_COORD + 1 + i * GOODIX_CONTACT_LEN];
+		p[0] = contacts[i].id;
+		le16enc(&p[1], contacts[i].x);
+		le16enc(&p[3], contacts[i].y);
+		le16enc(&p[5], contacts[i].size);
+		p[7] = 0;
+	}
+}
+
+/*
+ * INTO drives INT, the controller leaves sleep when it sees INT held high
+ * for at least 2 ms and then dropped. INTI hands the line back.
+ */
+static void
+gt_into(void *ctx, uint64_t level)
+{
+	struct gt_model *m = ctx;
+
+	m->int_out = 1;
+	if (level && !m->int_level)
+		m->int_high = sbinuptime();
+	if (!level && m->int_level && m->mode != GT_AWAKE &&
+	    sbinuptime() - m->int_high >= SBT_1MS * 2) {
+		m->mode = GT_AWAKE;
+		m->c.wakes++;
+	}
+	m->int_level = level != 0;
+}
+
+static void
+gt_inti(void *ctx, uint64_t arg)
+{
+	struct gt_model *m = ctx;
+
+	m->int_out = 0;
+}
+
+/*
+ * GPO1, only the reset line goes anywhere. Held low for at least 10 ms
+ * reset restarts the controller, which takes its address from INT as
+ * reset is released.
+ */
+static int
+gt_gpio_pin_setflags(device_t dev, uint32_t pin, uint32_t flags)
+{
+	if (pin != GT_RESET_PIN)
+		return (EINVAL);
+	gt.reset_out = (flags & GPIO_PIN_OUTPUT) != 0;
+	return (0);
+}
+
+static int
+gt_gpio_pin_set(device_t dev, uint32_t pin, unsigned int value)
+{
+	struct gt_model *m = &gt;
+
+	if (pin != GT_RESET_PIN || !m->reset_out)
+		return (EINVAL);
+	if (!value && !m->in_reset) {
+		m->in_reset = 1;
+		m->reset_low = sbinuptime();
+	} else if (value && m->in_reset) {
+		m->in_reset = 0;
+		if (sbinuptime() - m->reset_low < SBT_1MS * 10)
+			return (0);
+		m->addr = m->int_out && m->int_level ? GT_ADDR_ALT :
+			GT_ADDR_DEFAULT;
+		m->mode = GT_AWAKE;
+		m->resets++;
+	}
+	return (0);
+}
+
+static device_method_t gt_gpio_methods[] = {
+	DEVMETHOD(gpio_pin_setflags,	gt_gpio_pin_setflags),
+	DEVMETHOD(gpio_pin_set,		gt_gpio_pin_set),
+	DEVMETHOD_END
+};
+
+static driver_t gt_gpio_driver = {
+	.name = "gtgpio",
+	.methods = gt_gpio_methods,
+};
+
+static devclass_t gt_gpio_devclass;
+DRIVER_MODULE(gtgpio, acpi, gt_gpio_driver, gt_gpio_devclass, NULL, NULL);
+
+/*
+ * A touch. With the screen off nothing is scanned, in gesture mode the
+ * controller only raises INT.
+ */
+static void
+gt_frame(struct gt_model *m, const struct gt_contact *contacts, int n)
+{
+	if (m->mode == GT_SLEEP) {
+		m->c.dropped++;
+		return;
+	}
+	if (m->mode == GT_AWAKE)
+		gt_post(m, contacts, n);
+	m->c.irqs++;
+	sim_intr(m->dev);
+	sim_taskqueue_run();
+}
+
+static void
+gt_init(struct gt_model *m)
+{
+	uint8_t *cfg;
+
+	memset(m, 0, sizeof(*m));
+	m->addr = GT_ADDR_DEFAULT;
+	strncpy((char *)&m->regs[GOODIX_ID], gt_part.id, 4);
+
+	/* GPD Pocket panel, portrait as the controller sees it */
+	cfg = &m->regs[GOODIX_CONFIG];
+	cfg[GOODIX_CONFIG_VERSION] = 0x41;
+	le16enc(&cfg[GOODIX_CONFIG_MAX_X], 1200);
+	le16enc(&cfg[GOODIX_CONFIG_MAX_Y], 1920);
+	cfg[GOODIX_CONFIG_TOUCHES] = 10;
+	cfg[GOODIX_CONFIG_TRIGGER] = GOODIX_TRIGGER_FALLING;
+	cfg[GOODIX_CONFIG_THRESHOLD] = 80;
+	cfg[GOODIX_CONFIG_RATE] = 0x05;	/* 10 ms */
+	cfg[gt_part.config_len - 2] =
+		goodix_config_checksum(cfg, gt_part.config_len);
+	if (gt_part.bad_sum)
+		cfg[gt_part.config_len - 2]++;
+}
+
+static void
+gt_reset_counters(struct gt_model *m)
+{
+	memset(&m->c, 0, sizeof(m->c));
+}
+
+static struct evdev_dev *
+gt_evdev(void)
+{
+	return (((struct goodix_softc *)device_get_softc(gt.dev))->sc_evdev);
+}
+
+static int
+gt_active(struct evdev_dev *evdev)
+{
+	struct sim_evdev_slot s;
+	int i, n;
+
+	for (i = n = 0; i < GOODIX_MAX_CONTACTS; i++)
+		n += sim_evdev_slot(evdev, i, &s);
+	return (n);
+}
+
+/* I2C6 with its iicbus and the GPIO controller reset hangs off */
+static void
+gt_platform(void)
+{
+	device_t i2c, gpio;
+
+	if (gt_iicbus != NULL)
+		return;
+	i2c = sim_device_create("ig4iic_acpi", 0, 0);
+	sim_device_set_acpi(i2c, sim_acpi_node("\\_SB_.PCI0.I2C6", -1));
+	gt_iicbus = BUS_ADD_CHILD(i2c, 0, "iicbus", -1);
+	sim_device_set_iic(gt_iicbus, gt_xfer, &gt);
+	gpio = sim_device_create("gtgpio", 0, 0);
+	sim_device_set_acpi(gpio, sim_acpi_node("\\_SB_.GPO1", -1));
+}
+
+static void
+gt_crs(struct sim_acpi_node *node)
+{
+	static ACPI_RESOURCE res[3];
+	static uint16_t int_pin = GT_INT_PIN, reset_pin = GT_RESET_PIN;
+	ACPI_RESOURCE *r;
+
+	memset(res, 0, sizeof(res));
+	r = &res[0];
+	r->Type = ACPI_RESOURCE_TYPE_SERIAL_BUS;
+	r->Data.I2cSerialBus.Type = ACPI_RESOURCE_SERIAL_TYPE_I2C;
+	r->Data.I2cSerialBus.SlaveAddress = gt_wiring.addr;
+	r->Data.I2cSerialBus.ConnectionSpeed = gt_wiring.speed;
+	r->Data.I2cSerialBus.ResourceSource.StringPtr = gt_wiring.bus;
+	r->Data.I2cSerialBus.ResourceSource.StringLength =
+		strlen(gt_wiring.bus) + 1;
+
+	r = &res[1];
+	r->Type = ACPI_RESOURCE_TYPE_GPIO;
+	r->Data.Gpio.ConnectionType = ACPI_RESOURCE_GPIO_TYPE_INT;
+	r->Data.Gpio.Triggering = ACPI_EDGE_SENSITIVE;
+	r->Data.Gpio.Polarity = ACPI_ACTIVE_LOW;
+	r->Data.Gpio.PinTableLength = 1;
+	r->Data.Gpio.PinTable = &int_pin;
+	r->Data.Gpio.ResourceSource.StringPtr = "\\_SB.GPO3";
+
+	r = &res[2];
+	r->Type = ACPI_RESOURCE_TYPE_GPIO;
+	r->Data.Gpio.ConnectionType = ACPI_RESOURCE_GPIO_TYPE_IO;
+	r->Data.Gpio.IoRestriction = ACPI_IO_RESTRICT_OUTPUT;
+	r->Data.Gpio.PinTableLength = 1;
+	r->Data.Gpio.PinTable = &reset_pin;
+	r->Data.Gpio.ResourceSource.StringPtr = "\\_SB.GPO1";
+
+	sim_acpi_resources(node, "_CRS", res, gt_wiring.reset ? 3 : 2);
+}
+
+static int
+gt_attach(void)
+{
+	struct sim_acpi_node *node;
+	int error;
+
+	gt_init(&gt);
+	gt_platform();
+	node = sim_acpi_node("TCSE", -1);
+	sim_acpi_hook(sim_acpi_method(node, "INTO"), gt_into, &gt);
+	gt_inti_node = sim_acpi_method(node, "INTI");
+	sim_acpi_hook(gt_inti_node, gt_inti, &gt);
+	gt_crs(node);
+	gt.acpi = sim_device_create("goodix_acpi", 0, 0);
+	sim_device_set_acpi(gt.acpi, node);
+	sim_device_set_irq(gt.acpi, gt_irq);
+
+	error = goodix_acpi_probe(gt.acpi);
+	if (error == 0)
+		error = goodix_acpi_attach(gt.acpi);
+	gt.dev = device_find_child(gt_iicbus, "goodix", -1);
+	return (error);
+}
+
+static void
+gt_detach(void)
+{
+	goodix_acpi_detach(gt.acpi);
+	sim_device_destroy(gt.acpi);
+	gt.acpi = NULL;
+	gt.dev = NULL;
+}
+
+static int
+test_attach(void)
+{
+	struct evdev_dev *evdev;
+
+	if (!sim_check(gt_attach() == 0, "goodix: attach"))
+		return (-1);
+
+	evdev = gt_evdev();
+	sim_check(evdev != NULL && sim_evdev_registered(evdev),
+		"goodix: evdev registered");
+	sim_check(sim_evdev_abs_max(evdev, ABS_MT_POSITION_X) == 1199 &&
+	    sim_evdev_abs_max(evdev, ABS_MT_POSITION_Y) == 1919,
+		"goodix: position range from config (%d x %d)",
+		sim_evdev_abs_max(evdev, ABS_MT_POSITION_X) + 1,
+		sim_evdev_abs_max(evdev, ABS_MT_POSITION_Y) + 1);
+	sim_check(sim_evdev_abs_max(evdev, ABS_MT_SLOT) == 9,
+		"goodix: 10 slots");
+	return (0);
+}
+
+static void
+test_frames(void)
+{
+	static const struct gt_contact five[] = {
+		{ 0, 100, 200, 30 }, { 1, 300, 400, 30 }, { 2, 500, 600, 30 },
+		{ 3, 700, 800, 30 }, { 4, 900, 1000, 30 },
+	};
+	struct evdev_dev *evdev;
+	struct sim_evdev_slot s;
+	uint64_t syncs;
+	int active;
+
+	evdev = gt_evdev();
+
+	gt_reset_counters(&gt);
+	syncs = sim_evdev_syncs(evdev);
+	gt_frame(&gt, five, 1);
+	active = sim_evdev_slot(evdev, 0, &s);
+	sim_check(active && s.x == 100 && s.y == 200,
+		"goodix: one finger in slot 0 at %d,%d", s.x, s.y);
+	sim_check(sim_evdev_syncs(evdev) == syncs + 1, "goodix: one sync");
+	sim_check(gt.c.reads == 1 && gt.c.writes == 1 && gt.c.clears == 1,
+		"goodix: one finger costs %ju reads %ju writes",
+		(uintmax_t)gt.c.reads, (uintmax_t)gt.c.writes);
+
+	gt_reset_counters(&gt);
+	syncs = sim_evdev_syncs(evdev);
+	gt_frame(&gt, five, 5);
+	sim_check(gt_active(evdev) == 5, "goodix: five fingers in five slots");
+	active = sim_evdev_slot(evdev, 4, &s);
+	sim_check(active && s.x == 900 && s.y == 1000,
+		"goodix: fifth finger at %d,%d", s.x, s.y);
+	sim_check(sim_evdev_syncs(evdev) == syncs + 1, "goodix: one sync");
+	sim_check(gt.c.reads == 1 && gt.c.writes == 1,
+		"goodix: five fingers cost %ju reads %ju writes, %ju bytes",
+		(uintmax_t)gt.c.reads, (uintmax_t)gt.c.writes,
+		(uintmax_t)gt.c.read_bytes);
+
+	/* Lift all but the third finger */
+	gt_frame(&gt, &five[2], 1);
+	sim_check(gt_active(evdev) == 1 && sim_evdev_slot(evdev, 2, &s) &&
+	    s.x == 500, "goodix: lifted fingers released");
+
+	gt_frame(&gt, five, 0);
+	sim_check(gt_active(evdev) == 0, "goodix: all fingers released");
+
+	/* An interrupt with no new frame reports nothing */
+	gt_reset_counters(&gt);
+	syncs = sim_evdev_syncs(evdev);
+	sim_intr(gt.dev);
+	sim_taskqueue_run();
+	sim_check(sim_evdev_syncs(evdev) == syncs && gt.c.writes == 0,
+		"goodix: stale frame ignored");
+}
+
+/*
+ * Interrupts raised before the queued read gets to run are folded into it,
+ * the filter itself never touches the bus.
+ */
+static void
+test_coalesce(void)
+{
+	static const struct gt_contact one = { 0, 10, 20, 30 };
+	struct evdev_dev *evdev;
+	uint64_t coalesced, syncs;
+	int i;
+
+	evdev = gt_evdev();
+	gt_reset_counters(&gt);
+	syncs = sim_evdev_syncs(evdev);
+	coalesced = sim_sysctl_u64(gt.dev, "coalesced");
+
+	gt_post(&gt, &one, 1);
+	for (i = 0; i < 3; i++)
+		sim_intr(gt.dev);
+	sim_check(gt.c.xfers == 0, "goodix: filter does no I2C");
+	sim_taskqueue_run();
+
+	sim_check(gt.c.reads == 1 && sim_evdev_syncs(evdev) == syncs + 1,
+		"goodix: three interrupts, %ju frame reads",
+		(uintmax_t)gt.c.reads);
+	sim_check(sim_sysctl_u64(gt.dev, "coalesced") == coalesced + 2,
+		"goodix: two interrupts coalesced");
+
+	sim_clock_advance(SBT_1MS);
+	gt_post(&gt, &one, 1);
+	sim_intr(gt.dev);
+	sim_clock_advance(SBT_1MS * 3);
+	sim_taskqueue_run();
+	sim_check(sim_sysctl_u64(gt.dev, "latency_us") >= 3000,
+		"goodix: latency %ju us measured from the interrupt",
+		(uintmax_t)sim_sysctl_u64(gt.dev, "latency_us"));
+
+	gt_frame(&gt, &one, 0);
+}
+
+static void
+gt_sysctl_str(const char *name, char *buf, size_t len)
+{
+	buf[0] = '\0';
+	if (sim_sysctl_get(gt.dev, name, buf, &len) != 0)
+		buf[0] = '\0';
+}
+
+/*
+ * Every frame carries its interrupt time as MSC_TIMESTAMP and lands in the
+ * stage histograms, including after sbttous() would have overflowed.
+ */
+static void
+test_latency(void)
+{
+	static const struct gt_contact one = { 0, 10, 20, 30 };
+	struct evdev_dev *evdev;
+	char buf[512];
+	sbintime_t before;
+	uintmax_t irq, i2c, sync, us;
+	uint32_t ts;
+
+	evdev = gt_evdev();
+	sim_clock_advance(SBT_1S * 3600);
+
+	gt_post(&gt, &one, 1);
+	before = sbinuptime();
+	sim_intr(gt.dev);
+	sim_clock_advance(SBT_1MS * 2);
+	sim_taskqueue_run();
+
+	gt_sysctl_str("last_frame", buf, sizeof(buf));
+	if (!sim_check(sscanf(buf, "irq %ju i2c %ju sync %ju", &irq, &i2c,
+	    &sync) == 3, "goodix: last frame %s", buf))
+		return;
+	us = (before >> 32) * 1000000 +
+		(((before & 0xffffffff) * 1000000) >> 32);
+	sim_check(irq >= us && irq < us + 100 && i2c - irq >= 2000 &&
+	    i2c - irq < 2100 && sync >= i2c,
+		"goodix: stamped after an hour of uptime");
+
+	ts = (uint32_t)sim_evdev_msc(evdev, MSC_TIMESTAMP);
+	sim_check(ts == (uint32_t)irq,
+		"goodix: MSC_TIMESTAMP %u is the interrupt time", ts);
+
+	gt_sysctl_str("latency_read", buf, sizeof(buf));
+	sim_check(strstr(buf, "<2048us: 1") != NULL,
+		"goodix: 2 ms read in the 1-2 ms bucket");
+	gt_sysctl_str("latency_total", buf, sizeof(buf));
+	sim_check(strstr(buf, "<2048us: 1") != NULL,
+		"goodix: total latency histogram");
+	gt_sysctl_str("latency_report", buf, sizeof(buf));
+	sim_check(buf[0] != '\0' && strstr(buf, "<4096us") == NULL,
+		"goodix: report stage histogram");
+
+	gt_frame(&gt, &one, 0);
+}
+
+static int
+gt_report(const struct gt_contact *c, struct sim_evdev_slot *s)
+{
+	gt_frame(&gt, c, 1);
+	return (sim_evdev_slot(gt_evdev(), 0, s));
+}
+
+/*
+ * The panel is mounted rotated against the controller, orientation comes
+ * from tunables at attach and calibration can change at any time.
+ */
+static void
+test_transform(void)
+{
+	static const struct gt_contact c = { 0, 100, 200, 30 };
+	static const struct gt_contact edge = { 0, 1199, 0, 30 };
+	struct evdev_dev *evdev;
+	struct sim_evdev_slot s;
+	const char *cal;
+	int active;
+
+	gt_detach();
+	sim_setenv("dev.goodix.0.rotate", "90");
+	if (!sim_check(gt_attach() == 0, "goodix: attach rotated"))
+		return;
+
+	evdev = gt_evdev();
+	sim_check(sim_evdev_abs_max(evdev, ABS_MT_POSITION_X) == 1919 &&
+	    sim_evdev_abs_max(evdev, ABS_MT_POSITION_Y) == 1199,
+		"goodix: rotated range %d x %d",
+		sim_evdev_abs_max(evdev, ABS_MT_POSITION_X) + 1,
+		sim_evdev_abs_max(evdev, ABS_MT_POSITION_Y) + 1);
+	active = gt_report(&c, &s);
+	sim_check(active && s.x == 1719 && s.y == 100,
+		"goodix: 100,200 rotated to %d,%d", s.x, s.y);
+	active = gt_report(&edge, &s);
+	sim_check(active && s.x == 1919 && s.y == 1199,
+		"goodix: corner rotated to %d,%d", s.x, s.y);
+
+	cal = "65536 0 655360 0 65536 -327680";
+	sim_sysctl_set(gt.dev, "calibration", cal, strlen(cal) + 1);
+	active = gt_report(&c, &s);
+	sim_check(active && s.x == 1729 && s.y == 95,
+		"goodix: calibration offset to %d,%d", s.x, s.y);
+
+	cal = "32768 0 0 0 32768 0";
+	sim_sysctl_set(gt.dev, "calibration", cal, strlen(cal) + 1);
+	active = gt_report(&c, &s);
+	sim_check(active && s.x == 860 && s.y == 50,
+		"goodix: calibration scale to %d,%d", s.x, s.y);
+	cal = "1 2 3";
+	sim_check(sim_sysctl_set(gt.dev, "calibration", cal,
+	    strlen(cal) + 1) == EINVAL, "goodix: short calibration refused");
+	cal = "32768 0 0 0 32768 0 junk";
+	sim_check(sim_sysctl_set(gt.dev, "calibration", cal,
+	    strlen(cal) + 1) == EINVAL, "goodix: trailing garbage refused");
+	cal = "1048577 0 0 0 65536 0";
+	sim_check(sim_sysctl_set(gt.dev, "calibration", cal,
+	    strlen(cal) + 1) == EINVAL, "goodix: scale over 16 refused");
+	cal = "65536 0 4294967296 0 65536 0";
+	sim_check(sim_sysctl_set(gt.dev, "calibration", cal,
+	    strlen(cal) + 1) == EINVAL, "goodix: offset over 65535 refused");
+	cal = "65536 0 0 0 65536 99999999999999999999";
+	sim_check(sim_sysctl_set(gt.dev, "calibration", cal,
+	    strlen(cal) + 1) == EINVAL, "goodix: overflowing entry refused");
+	cal = "32768 0 0 0 32768 0 \n";
+	sim_check(sim_sysctl_set(gt.dev, "calibration", cal,
+	    strlen(cal) + 1) == 0, "goodix: trailing whitespace accepted");
+	active = gt_report(&c, &s);
+	sim_check(active && s.x == 860 && s.y == 50,
+		"goodix: calibration kept at %d,%d", s.x, s.y);
+	gt_frame(&gt, &c, 0);
+
+	/* A swap followed by an inversion is the same rotation */
+	gt_detach();
+	sim_setenv("dev.goodix.0.rotate", "0");
+	sim_setenv("dev.goodix.0.swap_xy", "1");
+	sim_setenv("dev.goodix.0.invert_x", "1");
+	if (!sim_check(gt_attach() == 0, "goodix: attach swapped"))
+		return;
+	active = gt_report(&c, &s);
+	sim_check(active && s.x == 1719 && s.y == 100,
+		"goodix: 100,200 swapped and inverted to %d,%d", s.x, s.y);
+	gt_frame(&gt, &c, 0);
+
+	gt_detach();
+	sim_setenv("dev.goodix.0.swap_xy", "0");
+	sim_setenv("dev.goodix.0.invert_x", "0");
+	sim_check(gt_attach() == 0, "goodix: attach unrotated");
+}
+
+static int
+gt_sysctl_int(const char *name)
+{
+	size_t len;
+	int val;
+
+	len = sizeof(val);
+	if (sim_sysctl_get(gt.dev, name, &val, &len) != 0)
+		return (-1);
+	return (val);
+}
+
+/*
+ * Tuning the config rewrites the whole block in one transfer with a valid
+ * checksum, values the controller can't take never reach the bus.
+ */
+static void
+test_config(void)
+{
+	static const struct gt_contact one = { 0, 10, 20, 30 };
+	struct sim_evdev_slot s;
+	int val, error, active;
+
+	sim_check(gt_sysctl_int("report_rate") == 100,
+		"goodix: report rate %d Hz", gt_sysctl_int("report_rate"));
+	sim_check(gt_sysctl_int("touch_threshold") == 80,
+		"goodix: touch threshold %d", gt_sysctl_int("touch_threshold"));
+	sim_check(gt_sysctl_int("max_contacts") == 10,
+		"goodix: max contacts %d", gt_sysctl_int("max_contacts"));
+
+	gt_reset_counters(&gt);
+	val = 200;
+	error = sim_sysctl_set(gt.dev, "report_rate", &val, sizeof(val));
+	sim_check(error == 0 && gt.c.xfers == 1 && gt.c.config_writes == 1 &&
+	    gt.c.config_bad == 0 && (gt.regs[GOODIX_CONFIG +
+	    GOODIX_CONFIG_RATE] & 0x0f) == 0,
+		"goodix: report rate 200 Hz in %ju transfer",
+		(uintmax_t)gt.c.xfers);
+
+	val = 40;
+	error = sim_sysctl_set(gt.dev, "touch_threshold", &val, sizeof(val));
+	sim_check(error == 0 && gt.c.xfers == 2 && gt.c.config_bad == 0 &&
+	    gt.regs[GOODIX_CONFIG + GOODIX_CONFIG_THRESHOLD] == 40,
+		"goodix: threshold written");
+
+	/* Writing the same value again costs nothing */
+	error = sim_sysctl_set(gt.dev, "touch_threshold", &val, sizeof(val));
+	sim_check(error == 0 && gt.c.xfers == 2, "goodix: unchanged skipped");
+
+	val = 300;
+	error = sim_sysctl_set(gt.dev, "report_rate", &val, sizeof(val));
+	sim_check(error == EINVAL && gt.c.xfers == 2,
+		"goodix: 300 Hz refused");
+	val = 0;
+	error = sim_sysctl_set(gt.dev, "touch_threshold", &val, sizeof(val));
+	sim_check(error == EINVAL, "goodix: zero threshold refused");
+	val = 11;
+	error = sim_sysctl_set(gt.dev, "max_contacts", &val, sizeof(val));
+	sim_check(error == EINVAL, "goodix: 11 contacts refused");
+
+	val = 5;
+	error = sim_sysctl_set(gt.dev, "max_contacts", &val, sizeof(val));
+	sim_check(error == 0 && gt.c.config_writes == 3 &&
+	    gt.c.config_bad == 0, "goodix: 5 contacts written");
+	sim_check(sim_sysctl_u64(gt.dev, "config_writes") == 3,
+		"goodix: %ju config writes counted",
+		(uintmax_t)sim_sysctl_u64(gt.dev, "config_writes"));
+
+	gt_reset_counters(&gt);
+	gt_frame(&gt, &one, 1);
+	active = sim_evdev_slot(gt_evdev(), 0, &s);
+	sim_check(active && gt.c.read_bytes == 1 + 5 * GOODIX_CONTACT_LEN,
+		"goodix: 5 contact frame read is %ju bytes",
+		(uintmax_t)gt.c.read_bytes);
+	gt_frame(&gt, &one, 0);
+
+	val = 10;
+	sim_sysctl_set(gt.dev, "max_contacts", &val, sizeof(val));
+	val = 100;
+	sim_sysctl_set(gt.dev, "report_rate", &val, sizeof(val));
+	val = 80;
+	sim_sysctl_set(gt.dev, "touch_threshold", &val, sizeof(val));
+}
+
+/* Write a threshold on a part with its own config layout */
+static int
+gt_part_tune(const char *id, int len, int bad_sum)
+{
+	int val, error;
+
+	gt_detach();
+	gt_part.id = id;
+	gt_part.config_len = len;
+	gt_part.bad_sum = bad_sum;
+	if (gt_attach() != 0)
+		return (-1);
+	gt_reset_counters(&gt);
+	val = 40;
+	error = sim_sysctl_set(gt.dev, "touch_threshold", &val, sizeof(val));
+	if (error != 0)
+		return (error);
+	return (gt.c.config_writes == 1 && gt.c.config_bad == 0 &&
+	    gt.regs[GOODIX_CONFIG + GOODIX_CONFIG_THRESHOLD] == 40 ? 0 : -1);
+}
+
+/*
+ * GT912 has the GT967 layout and GT9271 the GT911 one. With a checksum
+ * that does not add up the layout is not known, so nothing is written.
+ */
+static void
+test_config_parts(void)
+{
+	int error;
+
+	error = gt_part_tune("912", GOODIX_CONFIG_967_LEN, 0);
+	sim_check(error == 0, "goodix: GT912 config is 228 bytes");
+	error = gt_part_tune("9271", GOODIX_CONFIG_911_LEN, 0);
+	sim_check(error == 0, "goodix: GT9271 config is 186 bytes");
+	error = gt_part_tune("911", GOODIX_CONFIG_911_LEN, 1);
+	sim_check(error == ENOENT && gt.c.config_writes == 0 &&
+	    gt_sysctl_int("report_rate") == -1,
+		"goodix: bad checksum, config left alone (error %d)", error);
+
+	gt_detach();
+	gt_part.id = "911";
+	gt_part.config_len = GOODIX_CONFIG_911_LEN;
+	gt_part.bad_sum = 0;
+	sim_check(gt_attach() == 0, "goodix: attach the GT911 again");
+}
+
+/*
+ * Move the clock in 1 ms steps, reposting the frame every report period
+ * while a finger is down like the controller does.
+ */
+static void
+gt_poll_run(int ms, const struct gt_contact *c, int n)
+{
+	int i;
+
+	for (i = 0; i < ms; i++) {
+		if (n > 0 && i % 10 == 0)
+			gt_post(&gt, c, n);
+		sim_clock_advance(SBT_1MS);
+		sim_taskqueue_run();
+	}
+}
+
+/*
+ * With no interrupt the status is polled at the 10 ms report rate while a
+ * finger is down and backs off to the 100 ms idle interval otherwise.
+ */
+static void
+test_poll(void)
+{
+	static const struct gt_contact one = { 0, 10, 20, 30 };
+	struct evdev_dev *evdev;
+	struct sim_evdev_slot s;
+	size_t len;
+	int polling, active;
+	uint64_t reads;
+
+	gt_detach();
+	gt_irq = 0;
+	if (!sim_check(gt_attach() == 0, "goodix: attach without interrupt"))
+		return;
+	evdev = gt_evdev();
+	len = sizeof(polling);
+	sim_check(sim_sysctl_get(gt.dev, "polling", &polling, &len) == 0 &&
+	    polling == 1, "goodix: polling");
+
+	/* 10, 20, 40, 80 ms then every 100 ms */
+	gt_reset_counters(&gt);
+	gt_poll_run(1000, NULL, 0);
+	sim_check(gt.c.reads == 12 && gt.c.writes == 0,
+		"goodix: %ju polls in an idle second", (uintmax_t)gt.c.reads);
+
+	gt_reset_counters(&gt);
+	gt_post(&gt, &one, 1);
+	gt_poll_run(100, NULL, 0);
+	active = sim_evdev_slot(evdev, 0, &s);
+	sim_check(active && gt.c.clears == 1,
+		"goodix: touch picked up within the idle interval");
+
+	gt_reset_counters(&gt);
+	gt_poll_run(1000, &one, 1);
+	active = sim_evdev_slot(evdev, 0, &s);
+	sim_check(active && gt.c.reads >= 99 && gt.c.reads <= 101 &&
+	    gt.c.clears >= 99,
+		"goodix: %ju polls, %ju frames in a second of touch",
+		(uintmax_t)gt.c.reads, (uintmax_t)gt.c.clears);
+
+	gt_post(&gt, &one, 0);
+	gt_poll_run(20, NULL, 0);
+	sim_check(gt_active(evdev) == 0, "goodix: lift seen");
+	gt_reset_counters(&gt);
+	reads = sim_sysctl_u64(gt.dev, "polls");
+	gt_poll_run(1000, NULL, 0);
+	sim_check(gt.c.reads <= 13 &&
+	    sim_sysctl_u64(gt.dev, "polls") - reads == gt.c.reads,
+		"goodix: backed off to %ju polls a second after the lift",
+		(uintmax_t)gt.c.reads);
+
+	gt_detach();
+	gt_irq = 1;
+	sim_check(gt_attach() == 0, "goodix: attach with interrupt");
+	len = sizeof(polling);
+	sim_check(sim_sysctl_get(gt.dev, "polling", &polling, &len) == 0 &&
+	    polling == 0, "goodix: not polling");
+}
+
+/*
+ * Captured records are the raw frames in the order they were read, the
+ * ring keeps the newest GOODIX_CAPTURE_FRAMES.
+ */
+static void
+test_capture(void)
+{
+	static struct goodix_capture ring[GOODIX_CAPTURE_FRAMES + 1];
+	struct gt_contact c = { 3, 0, 500, 40 };
+	size_t len;
+	int i, on, error;
+
+	on = 1;
+	sim_sysctl_set(gt.dev, "capture", &on, sizeof(on));
+	for (i = 0; i < 3; i++) {
+		c.x = 100 + i;
+		gt_frame(&gt, &c, 1);
+	}
+	len = sizeof(ring);
+	error = sim_sysctl_get(gt.dev, "capture_ring", ring, &len);
+	sim_check(error == 0 && len == 3 * sizeof(ring[0]),
+		"goodix: %zu records captured", len / sizeof(ring[0]));
+	sim_check(ring[0].gc_len == GOODIX_FRAME_LEN &&
+	    ring[0].gc_frame[0] == (GOODIX_STATUS_READY | 1) &&
+	    ring[0].gc_frame[1] == 3 && le16dec(&ring[0].gc_frame[2]) == 100 &&
+	    le16dec(&ring[2].gc_frame[2]) == 102 &&
+	    ring[2].gc_us >= ring[0].gc_us, "goodix: raw frames in order");
+
+	for (i = 0; i < 300; i++) {
+		c.x = i;
+		gt_frame(&gt, &c, 1);
+	}
+	len = sizeof(ring);
+	sim_sysctl_get(gt.dev, "capture_ring", ring, &len);
+	sim_check(len == GOODIX_CAPTURE_FRAMES * sizeof(ring[0]) &&
+	    le16dec(&ring[0].gc_frame[2]) == 300 - GOODIX_CAPTURE_FRAMES &&
+	    le16dec(&ring[GOODIX_CAPTURE_FRAMES - 1].gc_frame[2]) == 299,
+		"goodix: ring keeps the newest %d", GOODIX_CAPTURE_FRAMES);
+	gt_frame(&gt, &c, 0);
+
+	on = 0;
+	sim_sysctl_set(gt.dev, "capture", &on, sizeof(on));
+	len = sizeof(ring);
+	sim_check(sim_sysctl_get(gt.dev, "capture_ring", ring, &len) == 0 &&
+	    len == 0, "goodix: capture off");
+}
+
+static int
+gt_sleep(int state)
+{
+	return (sim_sysctl_set(gt.dev, "sleep", &state, sizeof(state)));
+}
+
+/*
+ * Screen off stops interrupts and bus traffic until the host wakes the
+ * controller through INT, gesture mode wakes on the first touch.
+ */
+static void
+test_sleep(void)
+{
+	static const struct gt_contact one = { 0, 10, 20, 30 };
+	struct evdev_dev *evdev;
+	struct sim_evdev_slot s;
+	uint64_t intrs, resets;
+	int i, active, error;
+
+	evdev = gt_evdev();
+	gt_reset_counters(&gt);
+	error = gt_sleep(GOODIX_SLEEP);
+	sim_check(error == 0 && gt.mode == GT_SLEEP &&
+	    gt.c.cmd_writes == 1 && gt.c.cmd_bad == 0,
+		"goodix: screen off in %ju command write",
+		(uintmax_t)gt.c.cmd_writes);
+
+	intrs = sim_sysctl_u64(gt.dev, "intr_count");
+	for (i = 0; i < 100; i++)
+		gt_frame(&gt, &one, 1);
+	sim_check(gt.c.dropped == 100 && gt.c.xfers == 1 &&
+	    sim_sysctl_u64(gt.dev, "intr_count") == intrs,
+		"goodix: no interrupts or transfers while asleep");
+
+	sim_check(gt_sleep(GOODIX_AWAKE) == 0 && gt.mode == GT_AWAKE &&
+	    gt.c.wakes == 1 && !gt.int_out, "goodix: woken through INT");
+	gt_frame(&gt, &one, 1);
+	active = sim_evdev_slot(evdev, 0, &s);
+	sim_check(active && s.x == 10, "goodix: reporting after wake");
+	gt_frame(&gt, &one, 0);
+
+	gt_reset_counters(&gt);
+	sim_check(gt_sleep(GOODIX_GESTURE) == 0 && gt.mode == GT_GESTURE &&
+	    gt.c.cmd_writes == 1 && gt.c.cmd_bad == 0,
+		"goodix: gesture mode");
+	gt_frame(&gt, &one, 1);
+	sim_check(gt.mode == GT_AWAKE && gt.c.wakes == 1 &&
+	    sim_sysctl_u64(gt.dev, "wakes") == 2,
+		"goodix: touch woke the controller");
+	gt_frame(&gt, &one, 1);
+	active = sim_evdev_slot(evdev, 0, &s);
+	sim_check(active, "goodix: reporting after touch wake");
+	gt_frame(&gt, &one, 0);
+
+	sim_check(gt_sleep(3) == EINVAL, "goodix: bad sleep state refused");
+
+	sim_check(goodix_suspend(gt.dev) == 0 && gt.mode == GT_SLEEP,
+		"goodix: asleep over suspend");
+	sim_check(goodix_resume(gt.dev) == 0 && gt.mode == GT_AWAKE,
+		"goodix: awake after resume");
+	sim_check(gt.c.cmd_bad == 0 && sim_sysctl_u64(gt.dev, "sleeps") == 3,
+		"goodix: %ju sleeps",
+		(uintmax_t)sim_sysctl_u64(gt.dev, "sleeps"));
+
+	/* A failed wake falls back to reset, when that fails too it is reported */
+	resets = gt.resets;
+	goodix_suspend(gt.dev);
+	sim_acpi_fail(gt_inti_node, 1);
+	error = goodix_resume(gt.dev);
+	sim_check(error == 0 && gt.mode == GT_AWAKE && gt.resets == resets + 1,
+		"goodix: reset after a failed wake, %d", error);
+	gt_frame(&gt, &one, 1);
+	active = sim_evdev_slot(evdev, 0, &s);
+	sim_check(active, "goodix: reporting after reset");
+	gt_frame(&gt, &one, 0);
+
+	goodix_suspend(gt.dev);
+	sim_acpi_fail(gt_inti_node, 2);
+	error = goodix_resume(gt.dev);
+	sim_check(error == ENXIO, "goodix: failed wake reported, %d", error);
+	sim_check(gt_sleep(GOODIX_AWAKE) == 0 && gt.mode == GT_AWAKE,
+		"goodix: woken again through the sysctl");
+}
+
+/*
+ * Address, bus speed and GPIOs come from _CRS. Reset moves the controller
+ * from the address it powered up at to the one _CRS names.
+ */
+static void
+test_acpi(void)
+{
+	struct goodix_softc *sc;
+	int error, speed;
+
+	sc = device_get_softc(gt.dev);
+	sim_check(sc->sc_addr == GT_ADDR_ALT && gt.addr == GT_ADDR_ALT &&
+	    gt.resets == 1 && !gt.reset_out && !gt.int_out,
+		"goodix: reset selected address 0x%x from _CRS",
+		sc->sc_addr >> 1);
+	speed = sim_iic_speed(gt_iicbus);
+	sim_check(speed == IIC_FAST && gt_sysctl_int("bus_speed") == 400000,
+		"goodix: bus in fast mode (speed %d)", speed);
+	sim_check(gt_sysctl_int("int_pin") == GT_INT_PIN &&
+	    gt_sysctl_int("reset_pin") == GT_RESET_PIN,
+		"goodix: GpioInt and GpioIo pins");
+
+	/* Firmware at 0x5d in standard mode with no reset line */
+	gt_detach();
+	gt_wiring.addr = 0x5d;
+	gt_wiring.speed = 100000;
+	gt_wiring.reset = 0;
+	error = gt_attach();
+	sim_check(error == 0 && gt.resets == 0 &&
+	    sim_iic_speed(gt_iicbus) == IIC_SLOW &&
+	    gt_sysctl_int("reset_pin") == -1,
+		"goodix: 0x5d in standard mode without reset");
+
+	/* An I2cSerialBus on a controller without an iicbus */
+	gt_detach();
+	gt_wiring.bus = "\\_SB.PCI0.I2C1";
+	error = gt_attach();
+	sim_check(error == ENXIO && gt.dev == NULL,
+		"goodix: no attach without the iicbus");
+
+	gt_detach();
+	gt_wiring.addr = 0x14;
+	gt_wiring.speed = 400000;
+	gt_wiring.bus = "\\_SB.PCI0.I2C6";
+	gt_wiring.reset = 1;
+	sim_check(gt_attach() == 0, "goodix: attach from _CRS");
+}
+
+static void
+bench(const char *what, int fingers, int iterations)
+{
+	struct gt_contact contacts[GOODIX_MAX_CONTACTS];
+	uint64_t start, ns;
+	int i, j;
+
+	gt_reset_counters(&gt);
+	start = sim_nsec();
+	for (i = 0; i < iterations; i++) {
+		for (j = 0; j < fingers; j++) {
+			contacts[j].id = j;
+			contacts[j].x = (i + j * 100) % 1200;
+			contacts[j].y = (i * 3 + j * 100) % 1920;
+			contacts[j].size = 20;
+		}
+		gt_frame(&gt, contacts, fingers);
+	}
+	ns = sim_nsec() - start;
+
+	printf("bench %-16s %8.1f ns/frame %6.2f xfers/frame "
+		"%6.1f bytes/frame\n", what, (double)ns / iterations,
+		(double)gt.c.xfers / iterations,
+		(double)(gt.c.read_bytes + gt.c.write_bytes) / iterations);
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: goodix_sim [-n iterations]\n");
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	int ch, iterations;
+
+	iterations = 1000000;
+	while ((ch = getopt(argc, argv, "n:")) != -1) {
+		switch (ch) {
+		case 'n':
+			iterations = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (argc != optind || iterations <= 0)
+		usage();
+
+	if (test_attach() != 0)
+		return (1);
+	test_frames();
+	test_coalesce();
+	test_latency();
+	test_transform();
+	if (gt.dev == NULL)
+		return (1);
+	test_config();
+	test_config_parts();
+	if (gt.dev == NULL)
+		return (1);
+	test_sleep();
+	test_capture();
+	test_poll();
+	test_acpi();
+	if (gt.dev == NULL)
+		return (1);
+
+	bench("1 finger", 1, iterations);
+	bench("10 fingers", 10, iterations);
+
+	sim_check(goodix_acpi_detach(gt.acpi) == 0 &&
+	    device_find_child(gt_iicbus, "goodix", -1) == NULL,
+		"goodix: detach");
+	sim_device_destroy(gt.acpi);
+
+	printf("%d failures\n", sim_failures());
+	return (sim_failures() != 0);
+}
@@ -0,0 +1,4 @@
+#include "sim_kern.h"
+
+extern driver_t		pwmbus_driver;
+extern devclass_t	pwmbus_devclass;
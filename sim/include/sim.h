@@ -0,0 +1,97 @@
+/*-
+ * Copyright (c) 2018 Tom Jones <tj@enoti.me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Harness side of the kernel shim, used by the simulators to build devices,
+ * drive interrupts and time, and read back sysctl state.
+ */
+
+#ifndef SIM_H
+#define SIM_H
+
+struct sim_acpi_node;
+
+/* Devices */
+device_t	sim_device_create(const char *, int, size_t);
+void		sim_device_destroy(device_t);
+void		sim_device_set_acpi(device_t, struct sim_acpi_node *);
+void		sim_device_set_mem(device_t, uint32_t (*)(void *, bus_size_t),
+		    void (*)(void *, bus_size_t, uint32_t), void *);
+void		sim_device_set_addr(device_t, uint16_t);
+void		sim_device_set_irq(device_t, int);
+void		sim_device_set_iic(device_t,
+		    int (*)(void *, struct iic_msg *, uint32_t), void *);
+int		sim_iic_speed(device_t);
+int		sim_intr(device_t);
+int		sim_intr_pending(device_t);
+
+/* ACPI namespace */
+struct sim_acpi_node	*sim_acpi_node(const char *, int);
+void			sim_acpi_set_hid(struct sim_acpi_node *, const char *);
+struct sim_acpi_node	*sim_acpi_method(struct sim_acpi_node *, const char *);
+void			sim_acpi_resources(struct sim_acpi_node *, const char *,
+			    ACPI_RESOURCE *, int);
+u_int			sim_acpi_calls(struct sim_acpi_node *);
+uint64_t		sim_acpi_last_arg(struct sim_acpi_node *);
+void			sim_acpi_hook(struct sim_acpi_node *,
+			    void (*)(void *, uint64_t), void *);
+void			sim_acpi_fail(struct sim_acpi_node *, u_int);
+
+/* Deferred work and time */
+int		sim_taskqueue_run(void);
+void		sim_clock_advance(sbintime_t);
+
+/* evdev, the state of each slot after the last sync */
+struct sim_evdev_slot {
+	int32_t		id;		/* -1 when released */
+	int32_t		x;
+	int32_t		y;
+	int32_t		major;
+};
+struct evdev_dev	*sim_evdev_last(void);
+int		sim_evdev_slot(struct evdev_dev *, int, struct sim_evdev_slot *);
+int32_t		sim_evdev_msc(struct evdev_dev *, uint16_t);
+uint64_t	sim_evdev_events(struct evdev_dev *);
+uint64_t	sim_evdev_syncs(struct evdev_dev *);
+uint64_t	sim_evdev_releases(struct evdev_dev *);
+int		sim_evdev_abs_max(struct evdev_dev *, uint16_t);
+int		sim_evdev_registered(struct evdev_dev *);
+
+/* Sysctl, and tunables picked up by CTLFLAG_TUN oids */
+void		sim_setenv(const char *, const char *);
+int		sim_sysctl_get(device_t, const char *, void *, size_t *);
+int		sim_sysctl_set(device_t, const char *, const void *, size_t);
+uint64_t	sim_sysctl_u64(device_t, const char *);
+
+/* Reporting */
+extern int	sim_quiet;		/* suppress device_printf */
+int		sim_check(int, const char *, ...)
+		    __attribute__((format(printf, 2, 3)));
+int		sim_failures(void);
+uint64_t	sim_nsec(void);
+
+#endif /* SIM_H */
@@ -0,0 +1,652 @@
+/*-
+ * Copyright (c) 2018 Tom Jones <tj@enoti.me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Just enough of the FreeBSD kernel interfaces for the drivers in this tree
+ * to build and run as part of a Linux userland program. Every driver source
+ * is compiled with this header forced in front of it, the headers under
+ * include/ that the drivers pull in are empty stand-ins.
+ */
+
+#ifndef SIM_KERN_H
+#define SIM_KERN_H
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#define __FBSDID(s)
+#define nitems(x)	(sizeof((x)) / sizeof((x)[0]))
+#ifndef MIN
+#define MIN(a, b)	((a) < (b) ? (a) : (b))
+#define MAX(a, b)	((a) > (b) ? (a) : (b))
+#endif
+
+/* Not every libc has strlcpy */
+size_t	sim_strlcpy(char *, const char *, size_t);
+#define	strlcpy(dst, src, size)	sim_strlcpy((dst), (src), (size))
+
+#define	flsll(x)	((x) == 0 ? 0 : 64 - __builtin_clzll(x))
+#define	fls(x)		((x) == 0 ? 0 : 32 - __builtin_clz(x))
+
+#include <endian.h>
+
+static inline uint16_t
+le16dec(const void *pp)
+{
+	const uint8_t *p = pp;
+
+	return ((p[1] << 8) | p[0]);
+}
+
+static inline uint16_t
+be16dec(const void *pp)
+{
+	const uint8_t *p = pp;
+
+	return ((p[0] << 8) | p[1]);
+}
+
+static inline void
+le16enc(void *pp, uint16_t u)
+{
+	uint8_t *p = pp;
+
+	p[0] = u & 0xff;
+	p[1] = u >> 8;
+}
+
+static inline void
+be16enc(void *pp, uint16_t u)
+{
+	uint8_t *p = pp;
+
+	p[0] = u >> 8;
+	p[1] = u & 0xff;
+}
+
+static inline uint32_t
+le32dec(const void *pp)
+{
+	const uint8_t *p = pp;
+
+	return (((uint32_t)p[3] << 24) | (p[2] << 16) | (p[1] << 8) | p[0]);
+}
+
+static inline void
+le32enc(void *pp, uint32_t u)
+{
+	uint8_t *p = pp;
+
+	p[0] = u & 0xff;
+	p[1] = (u >> 8) & 0xff;
+	p[2] = (u >> 16) & 0xff;
+	p[3] = u >> 24;
+}
+
+/* Time */
+typedef int64_t sbintime_t;
+#define	SBT_1S		((sbintime_t)1 << 32)
+#define	SBT_1MS		(SBT_1S / 1000)
+#define	SBT_1US		(SBT_1S / 1000000)
+#define	sbttoms(sbt)	((uint64_t)(((sbt) * 1000) >> 32))
+#define	sbttous(sbt)	((uint64_t)(((sbt) * 1000000) >> 32))
+#define	sbttons(sbt)	((uint64_t)(((sbt) * 1000000000) >> 32))
+#define	ustosbt(us)	((sbintime_t)(us) * SBT_1US)
+#define	mstosbt(ms)	((sbintime_t)(ms) * SBT_1MS)
+#define	nstosbt(ns)	((sbintime_t)(ns) * SBT_1S / 1000000000)
+sbintime_t	sbinuptime(void);
+void		microuptime(struct timeval *);
+extern int	hz;
+extern sbintime_t tick_sbt;
+extern int	bootverbose;
+extern int	ticks;
+
+/* Atomics */
+#define	atomic_cmpset_int(p, cmp, set)					\
+	({ u_int __cmp = (cmp);						\
+	    __atomic_compare_exchange_n((p), &__cmp, (set), 0,		\
+	    __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST); })
+#define	atomic_store_rel_int(p, v)	__atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define	atomic_load_acq_int(p)		__atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define	atomic_add_int(p, v)		__atomic_fetch_add((p), (v), __ATOMIC_SEQ_CST)
+#define	atomic_subtract_int(p, v)	__atomic_fetch_sub((p), (v), __ATOMIC_SEQ_CST)
+#define	atomic_readandclear_int(p)	__atomic_exchange_n((p), 0, __ATOMIC_SEQ_CST)
+
+/* Locking, interrupts are delivered synchronously so these only check */
+struct mtx {
+	const char	*mtx_name;
+	int		mtx_inited;
+	int		mtx_owned;
+};
+#define	mtx_initialized(m)	((m)->mtx_inited)
+#define	MTX_DEF		0
+#define	MTX_SPIN	1
+#define	MA_OWNED	1
+#define	MA_NOTOWNED	0
+void	mtx_init(struct mtx *, const char *, const char *, int);
+void	mtx_destroy(struct mtx *);
+void	mtx_lock(struct mtx *);
+void	mtx_unlock(struct mtx *);
+void	mtx_lock_spin(struct mtx *);
+void	mtx_unlock_spin(struct mtx *);
+void	mtx_assert(struct mtx *, int);
+int	mtx_sleep(void *, struct mtx *, int, const char *, int);
+
+struct sx {
+	const char	*sx_name;
+	int		sx_xowned;
+	int		sx_shared;
+};
+#define	SA_LOCKED	1
+#define	SA_SLOCKED	2
+#define	SA_XLOCKED	4
+#define	SA_UNLOCKED	0
+void	sx_init(struct sx *, const char *);
+void	sx_destroy(struct sx *);
+void	sx_xlock(struct sx *);
+int	sx_try_xlock(struct sx *);
+void	sx_xunlock(struct sx *);
+void	sx_slock(struct sx *);
+void	sx_sunlock(struct sx *);
+void	sx_assert(struct sx *, int);
+void	wakeup(void *);
+#define	pause(wmesg, timo)	sim_pause((wmesg), (timo))
+void	sim_pause(const char *, int);
+int	pause_sbt(const char *, sbintime_t, sbintime_t, int);
+void	DELAY(int);
+
+/* Memory */
+#define	M_DEVBUF	0
+#define	M_TEMP		0
+#define	M_WAITOK	0x0001
+#define	M_NOWAIT	0x0002
+#define	M_ZERO		0x0100
+#ifndef SIM_KERN_IMPL
+#define	malloc(size, type, flags)	sim_malloc((size), (flags))
+#define	free(addr, type)		sim_free(addr)
+#endif
+void	*sim_malloc(size_t, int);
+void	sim_free(void *);
+
+/* Devices */
+typedef struct _device	*device_t;
+typedef uint64_t	bus_size_t;
+typedef uint64_t	rman_res_t;
+typedef struct sim_devclass *devclass_t;
+
+typedef struct {
+	const char	*name;
+	void		*func;
+} device_method_t;
+#define	DEVMETHOD(name, func)	{ #name, (void *)(func) }
+#define	DEVMETHOD_END		{ NULL, NULL }
+
+typedef struct {
+	const char	*name;
+	device_method_t	*methods;
+	size_t		size;
+} driver_t;
+
+/* Drivers register at startup so bus_generic_attach() can find them */
+void	sim_driver_register(driver_t *, devclass_t *, const char *);
+#define	DRIVER_MODULE(name, bus, driver, devclass, evh, arg)		\
+	static void __attribute__((constructor))			\
+	sim_driver_init_##bus##_##name(void)				\
+	{								\
+		sim_driver_register(&(driver), &(devclass), #bus);	\
+	}								\
+	static void *sim_evh_##bus##_##name __attribute__((unused)) =	\
+		(void *)(evh)
+#define	MODULE_DEPEND(a, b, c, d, e)
+#define	MODULE_VERSION(a, b)
+#define	MOD_LOAD	0
+#define	MOD_UNLOAD	1
+struct module;
+int	uprintf(const char *, ...);
+
+void		*device_get_softc(device_t);
+device_t	device_get_parent(device_t);
+const char	*device_get_name(device_t);
+driver_t	*device_get_driver(device_t);
+const char	*device_get_nameunit(device_t);
+const char	*device_get_desc(device_t);
+int		device_get_unit(device_t);
+void		device_set_desc(device_t, const char *);
+int		device_printf(device_t, const char *, ...)
+		    __attribute__((format(printf, 2, 3)));
+int		bus_generic_suspend(device_t);
+int		bus_generic_resume(device_t);
+int		bus_generic_attach(device_t);
+int		bus_generic_detach(device_t);
+device_t	devclass_get_device(devclass_t, int);
+devclass_t	devclass_find(const char *);
+int		devclass_get_maxunit(devclass_t);
+device_t	device_find_child(device_t, const char *, int);
+int		device_delete_child(device_t, device_t);
+int		device_is_attached(device_t);
+device_t	sim_bus_add_child(device_t, u_int, const char *, int);
+#define	device_add_child(dev, name, unit)				\
+	sim_bus_add_child((dev), 0, (name), (unit))
+#define	BUS_ADD_CHILD(bus, order, name, unit)				\
+	sim_bus_add_child((bus), (order), (name), (unit))
+
+/* Bus resources */
+#define	SYS_RES_IRQ	1
+#define	SYS_RES_MEMORY	3
+#define	RF_ACTIVE	0x0002
+#define	RF_SHAREABLE	0x0004
+
+#define	INTR_TYPE_TTY	1
+#define	INTR_TYPE_BIO	2
+#define	INTR_TYPE_NET	4
+#define	INTR_TYPE_CAM	8
+#define	INTR_TYPE_MISC	16
+#define	INTR_TYPE_CLK	32
+#define	INTR_MPSAFE	512
+
+#define	FILTER_STRAY		0x01
+#define	FILTER_HANDLED		0x02
+#define	FILTER_SCHEDULE_THREAD	0x04
+
+typedef int	driver_filter_t(void *);
+typedef void	driver_intr_t(void *);
+
+struct resource;
+struct resource	*bus_alloc_resource_any(device_t, int, int *, u_int);
+int		bus_release_resource(device_t, int, int, struct resource *);
+int		bus_get_resource(device_t, int, int, rman_res_t *, rman_res_t *);
+int		bus_set_resource(device_t, int, int, rman_res_t, rman_res_t);
+int		bus_setup_intr(device_t, struct resource *, int,
+		    driver_filter_t *, driver_intr_t *, void *, void **);
+int		bus_teardown_intr(device_t, struct resource *, void *);
+uint32_t	bus_read_4(struct resource *, bus_size_t);
+void		bus_write_4(struct resource *, bus_size_t, uint32_t);
+
+/* Sysctl */
+struct sysctl_ctx_list;
+struct sysctl_oid;
+struct sysctl_oid_list;
+struct sysctl_req {
+	void		*oldptr;
+	size_t		oldlen;
+	size_t		oldidx;
+	const void	*newptr;
+	size_t		newlen;
+	size_t		newidx;
+};
+#define	SYSCTL_HANDLER_ARGS	struct sysctl_oid *oidp, void *arg1,	\
+				intmax_t arg2, struct sysctl_req *req
+typedef int sysctl_handler_t(SYSCTL_HANDLER_ARGS);
+
+#define	OID_AUTO	(-1)
+#define	CTLTYPE_NODE	1
+#define	CTLTYPE_INT	2
+#define	CTLTYPE_STRING	3
+#define	CTLTYPE_U64	4
+#define	CTLTYPE_OPAQUE	5
+#define	CTLTYPE_UINT	6
+#define	CTLTYPE_U8	7
+#define	CTLTYPE		0xf
+#define	CTLFLAG_RD	0x80000000
+#define	CTLFLAG_WR	0x40000000
+#define	CTLFLAG_RW	(CTLFLAG_RD | CTLFLAG_WR)
+#define	CTLFLAG_TUN	0x00080000
+#define	CTLFLAG_RDTUN	(CTLFLAG_RD | CTLFLAG_TUN)
+#define	CTLFLAG_RWTUN	(CTLFLAG_RW | CTLFLAG_TUN)
+#define	CTLFLAG_MPSAFE	0x00040000
+
+struct sysctl_ctx_list	*device_get_sysctl_ctx(device_t);
+struct sysctl_oid	*device_get_sysctl_tree(device_t);
+struct sysctl_oid_list	*sim_sysctl_children(struct sysctl_oid *);
+struct sysctl_oid	*sim_sysctl_add(struct sysctl_oid_list *, const char *,
+			    int, void *, sysctl_handler_t *, intmax_t);
+#define	SYSCTL_CHILDREN(oid)	sim_sysctl_children(oid)
+/* Tunables are fetched from sim_setenv() values as oids are added */
+#define	SIM_SYSCTL_ADD(ctx, parent, name, kind, arg1, handler, arg2)	\
+	((void)(ctx), sim_sysctl_add((parent), (name), (kind), (arg1),	\
+	    (handler), (arg2)))
+#define	SYSCTL_ADD_NODE(ctx, parent, nbr, name, access, handler, descr) \
+	SIM_SYSCTL_ADD(ctx, parent, name, CTLTYPE_NODE | (access), NULL,	\
+	    NULL, 0)
+#define	SYSCTL_ADD_INT(ctx, parent, nbr, name, access, ptr, val, descr) \
+	SIM_SYSCTL_ADD(ctx, parent, name, CTLTYPE_INT | (access), ptr,	\
+	    NULL, 0)
+#define	SYSCTL_ADD_UINT(ctx, parent, nbr, name, access, ptr, val, descr) \
+	SIM_SYSCTL_ADD(ctx, parent, name, CTLTYPE_UINT | (access), ptr,	\
+	    NULL, 0)
+#define	SYSCTL_ADD_U8(ctx, parent, nbr, name, access, ptr, val, descr) \
+	SIM_SYSCTL_ADD(ctx, parent, name, CTLTYPE_U8 | (access), ptr,	\
+	    NULL, 0)
+#define	SYSCTL_ADD_U64(ctx, parent, nbr, name, access, ptr, val, descr) \
+	SIM_SYSCTL_ADD(ctx, parent, name, CTLTYPE_U64 | (access), ptr,	\
+	    NULL, 0)
+#define	SYSCTL_ADD_PROC(ctx, parent, nbr, name, access, arg1, arg2,	\
+	    handler, fmt, descr)					\
+	SIM_SYSCTL_ADD(ctx, parent, name, access, arg1, handler, arg2)
+int	sysctl_handle_int(struct sysctl_oid *, void *, intmax_t,
+	    struct sysctl_req *);
+int	sysctl_handle_64(struct sysctl_oid *, void *, intmax_t,
+	    struct sysctl_req *);
+int	sysctl_handle_opaque(struct sysctl_oid *, void *, intmax_t,
+	    struct sysctl_req *);
+int	sysctl_handle_string(struct sysctl_oid *, void *, intmax_t,
+	    struct sysctl_req *);
+int	SYSCTL_OUT(struct sysctl_req *, const void *, size_t);
+int	SYSCTL_IN(struct sysctl_req *, void *, size_t);
+
+struct sbuf {
+	char		*s_buf;
+	size_t		s_len;
+	size_t		s_size;
+	int		s_flags;
+#define	SBUF_FIXEDLEN		0x0000
+#define	SBUF_AUTOEXTEND		0x0001
+#define	SBUF_DYNAMIC		0x0100	/* buffer was allocated */
+#define	SBUF_DYNSTRUCT		0x0200	/* sbuf was allocated */
+#define	SBUF_OVERFLOWED		0x0400
+	struct sysctl_req *s_req;
+};
+struct sbuf	*sbuf_new(struct sbuf *, char *, int, int);
+struct sbuf	*sbuf_new_for_sysctl(struct sbuf *, char *, int,
+		    struct sysctl_req *);
+char		*sbuf_data(struct sbuf *);
+ssize_t		sbuf_len(struct sbuf *);
+int		sbuf_printf(struct sbuf *, const char *, ...)
+		    __attribute__((format(printf, 2, 3)));
+int		sbuf_finish(struct sbuf *);
+void		sbuf_delete(struct sbuf *);
+
+/* Task queues, tasks run when the harness calls sim_taskqueue_run() */
+typedef void task_fn_t(void *, int);
+struct task {
+	struct task	*ta_next;
+	int		ta_pending;
+	task_fn_t	*ta_func;
+	void		*ta_context;
+};
+#define	TASK_INIT(task, priority, func, context) do {			\
+	(task)->ta_next = NULL;						\
+	(task)->ta_pending = 0;						\
+	(task)->ta_func = (func);					\
+	(task)->ta_context = (context);					\
+} while (0)
+struct taskqueue;
+typedef void taskqueue_enqueue_fn(void *);
+struct taskqueue	*taskqueue_create(const char *, int,
+			    taskqueue_enqueue_fn *, void *);
+struct taskqueue	*taskqueue_create_fast(const char *, int,
+			    taskqueue_enqueue_fn *, void *);
+void	taskqueue_thread_enqueue(void *);
+int	taskqueue_start_threads(struct taskqueue **, int, int,
+	    const char *, ...);
+int	taskqueue_enqueue(struct taskqueue *, struct task *);
+void	taskqueue_drain(struct taskqueue *, struct task *);
+void	taskqueue_free(struct taskqueue *);
+#define	PWAIT		120
+#define	PI_REALTIME	48
+#define	PI_INTR		0
+#define	PI_SWI(x)	(88 + (x))
+#define	SWI_TQ		6
+
+/* Callouts, run by the harness advancing the clock */
+struct callout {
+	struct callout	*c_next;
+	sbintime_t	c_time;
+	void		(*c_func)(void *);
+	void		*c_arg;
+	struct mtx	*c_mtx;		/* held across c_func */
+	int		c_pending;
+};
+void	callout_init(struct callout *, int);
+void	callout_init_mtx(struct callout *, struct mtx *, int);
+int	callout_reset(struct callout *, int, void (*)(void *), void *);
+int	callout_reset_sbt(struct callout *, sbintime_t, sbintime_t,
+	    void (*)(void *), void *, int);
+int	callout_stop(struct callout *);
+int	callout_drain(struct callout *);
+int	callout_pending(struct callout *);
+#define	C_PREL(x)	0
+#define	C_HARDCLOCK	0
+
+/* ACPI */
+typedef void		*ACPI_HANDLE;
+typedef uint32_t	ACPI_STATUS;
+typedef char		*ACPI_STRING;
+#define	AE_OK		0
+#define	AE_ERROR	1
+#define	AE_NOT_FOUND	5
+#define	ACPI_FAILURE(s)	((s) != AE_OK)
+#define	ACPI_SUCCESS(s)	((s) == AE_OK)
+
+#define	ACPI_RESOURCE_TYPE_IRQ		0
+#define	ACPI_RESOURCE_TYPE_GPIO		17
+#define	ACPI_RESOURCE_TYPE_SERIAL_BUS	19
+#define	ACPI_RESOURCE_GPIO_TYPE_INT	0
+#define	ACPI_RESOURCE_GPIO_TYPE_IO	1
+#define	ACPI_RESOURCE_SERIAL_TYPE_I2C	1
+#define	ACPI_LEVEL_SENSITIVE		0
+#define	ACPI_EDGE_SENSITIVE		1
+#define	ACPI_ACTIVE_HIGH		0
+#define	ACPI_ACTIVE_LOW			1
+#define	ACPI_ACTIVE_BOTH		2
+#define	ACPI_WAKE_CAPABLE		1
+#define	ACPI_IO_RESTRICT_OUTPUT		2
+
+typedef struct {
+	uint8_t		Index;
+	uint16_t	StringLength;
+	char		*StringPtr;
+} ACPI_RESOURCE_SOURCE;
+
+typedef struct {
+	uint8_t		RevisionId;
+	uint8_t		ConnectionType;
+	uint8_t		ProducerConsumer;
+	uint8_t		PinConfig;
+	uint8_t		Sharable;
+	uint8_t		WakeCapable;
+	uint8_t		IoRestriction;
+	uint8_t		Triggering;
+	uint8_t		Polarity;
+	uint8_t		DriveStrength;
+	uint16_t	DebounceTimeout;
+	uint16_t	PinTableLength;
+	uint16_t	VendorLength;
+	ACPI_RESOURCE_SOURCE ResourceSource;
+	uint16_t	*PinTable;
+	uint8_t		*VendorData;
+} ACPI_RESOURCE_GPIO;
+
+#define	ACPI_RESOURCE_SERIAL_COMMON					\
+	uint8_t		RevisionId;					\
+	uint8_t		Type;						\
+	uint8_t		ProducerConsumer;				\
+	uint8_t		SlaveMode;					\
+	uint8_t		ConnectionSharing;				\
+	uint8_t		TypeRevisionId;					\
+	uint16_t	TypeDataLength;					\
+	uint16_t	VendorLength;					\
+	ACPI_RESOURCE_SOURCE ResourceSource;				\
+	uint8_t		*VendorData;
+
+typedef struct {
+	ACPI_RESOURCE_SERIAL_COMMON
+} ACPI_RESOURCE_COMMON_SERIALBUS;
+
+typedef struct {
+	ACPI_RESOURCE_SERIAL_COMMON
+	uint8_t		AccessMode;
+	uint16_t	SlaveAddress;
+	uint32_t	ConnectionSpeed;
+} ACPI_RESOURCE_I2C_SERIALBUS;
+
+typedef struct {
+	uint32_t	Type;
+	uint32_t	Length;
+	union {
+		ACPI_RESOURCE_GPIO		Gpio;
+		ACPI_RESOURCE_COMMON_SERIALBUS	CommonSerialBus;
+		ACPI_RESOURCE_I2C_SERIALBUS	I2cSerialBus;
+	} Data;
+} ACPI_RESOURCE;
+
+typedef ACPI_STATUS (*ACPI_WALK_RESOURCE_CALLBACK)(ACPI_RESOURCE *, void *);
+
+#define	ACPI_TYPE_INTEGER	1
+typedef union {
+	uint32_t	Type;
+	struct {
+		uint32_t	Type;
+		uint64_t	Value;
+	} Integer;
+} ACPI_OBJECT;
+typedef struct {
+	uint32_t	Count;
+	ACPI_OBJECT	*Pointer;
+} ACPI_OBJECT_LIST;
+typedef struct {
+	size_t		Length;
+	void		*Pointer;
+} ACPI_BUFFER;
+
+ACPI_STATUS	AcpiWalkResources(ACPI_HANDLE, char *,
+		    ACPI_WALK_RESOURCE_CALLBACK, void *);
+ACPI_STATUS	AcpiGetHandle(ACPI_HANDLE, const char *, ACPI_HANDLE *);
+ACPI_STATUS	AcpiEvaluateObject(ACPI_HANDLE, ACPI_STRING,
+		    ACPI_OBJECT_LIST *, ACPI_BUFFER *);
+ACPI_STATUS	acpi_GetInteger(ACPI_HANDLE, char *, int *);
+ACPI_STATUS	acpi_SetInteger(ACPI_HANDLE, char *, uint32_t);
+ACPI_HANDLE	acpi_get_handle(device_t);
+device_t	acpi_get_device(ACPI_HANDLE);
+int		acpi_disabled(char *);
+int		acpi_wake_set_enable(device_t, int);
+char		*sim_acpi_id_probe(device_t, char **);
+#define	ACPI_ID_PROBE(bus, dev, ids)	sim_acpi_id_probe((dev), (ids))
+
+/* GPIO */
+#define	GPIOMAXNAME		64
+#define	GPIO_PIN_LOW		0x00
+#define	GPIO_PIN_HIGH		0x01
+#define	GPIO_PIN_INPUT		0x00000001
+#define	GPIO_PIN_OUTPUT		0x00000002
+#define	GPIO_PIN_OPENDRAIN	0x00000004
+#define	GPIO_PIN_PUSHPULL	0x00000008
+#define	GPIO_PIN_TRISTATE	0x00000010
+#define	GPIO_PIN_PULLUP		0x00000020
+#define	GPIO_PIN_PULLDOWN	0x00000040
+int		sim_gpio_pin_set(device_t, uint32_t, unsigned int);
+int		sim_gpio_pin_setflags(device_t, uint32_t, uint32_t);
+#define	GPIO_PIN_SET(dev, pin, value)	sim_gpio_pin_set((dev), (pin), (value))
+#define	GPIO_PIN_SETFLAGS(dev, pin, flags)				\
+	sim_gpio_pin_setflags((dev), (pin), (flags))
+device_t	gpiobus_attach_bus(device_t);
+int		gpiobus_detach_bus(device_t);
+
+/* I2C, transfers go to the handler the harness set on the device */
+struct iic_msg {
+	uint16_t	slave;
+	uint16_t	flags;
+#define	IIC_M_WR	0
+#define	IIC_M_RD	0x0001
+#define	IIC_M_NOSTOP	0x0002
+#define	IIC_M_NOSTART	0x0004
+	uint16_t	len;
+	uint8_t		*buf;
+};
+#define	IICBUS_MINVER	1
+#define	IICBUS_PREFVER	1
+#define	IICBUS_MAXVER	1
+#define	IIC_ENOACK	0x2
+#define	IIC_EBUSERR	0x3
+#define	IIC_EOVERFLOW	0x7
+#define	IIC_DONTWAIT	0x0
+#define	IIC_WAIT	0x1
+#define	IIC_UNKNOWN	0x0
+#define	IIC_SLOW	0x1
+#define	IIC_FAST	0x2
+#define	IIC_FASTEST	0x3
+int		iicbus_transfer(device_t, struct iic_msg *, uint32_t);
+uint32_t	iicbus_get_addr(device_t);
+void		iicbus_set_addr(device_t, uint32_t);
+int		iicbus_request_bus(device_t, device_t, int);
+int		iicbus_release_bus(device_t, device_t);
+int		iicbus_reset(device_t, u_char, u_char, u_char *);
+#define	iic2errno(e)	((e) == 0 ? 0 : (e) == IIC_ENOACK ? EIO : ENXIO)
+
+/* evdev, events are recorded for the harness to inspect */
+#define	EV_SYN			0x00
+#define	EV_KEY			0x01
+#define	EV_ABS			0x03
+#define	EV_MSC			0x04
+#define	SYN_REPORT		0
+#define	ABS_X			0x00
+#define	ABS_Y			0x01
+#define	ABS_MT_SLOT		0x2f
+#define	ABS_MT_TOUCH_MAJOR	0x30
+#define	ABS_MT_POSITION_X	0x35
+#define	ABS_MT_POSITION_Y	0x36
+#define	ABS_MT_TRACKING_ID	0x39
+#define	ABS_CNT			0x40
+#define	MSC_TIMESTAMP		0x05
+#define	MSC_CNT			0x08
+#define	BTN_TOUCH		0x14a
+#define	INPUT_PROP_DIRECT	0x01
+#define	BUS_I2C			0x18
+#define	BUS_VIRTUAL		0x06
+#define	EVDEV_FLAG_MT_STCOMPAT	0x01
+#define	EVDEV_FLAG_MT_AUTOREL	0x02
+
+struct evdev_dev;
+struct evdev_dev	*evdev_alloc(void);
+void	evdev_free(struct evdev_dev *);
+void	evdev_set_name(struct evdev_dev *, const char *);
+void	evdev_set_phys(struct evdev_dev *, const char *);
+void	evdev_set_id(struct evdev_dev *, uint16_t, uint16_t, uint16_t,
+	    uint16_t);
+void	evdev_set_flag(struct evdev_dev *, uint16_t);
+void	evdev_support_prop(struct evdev_dev *, uint16_t);
+void	evdev_support_event(struct evdev_dev *, uint16_t);
+void	evdev_support_key(struct evdev_dev *, uint16_t);
+void	evdev_support_msc(struct evdev_dev *, uint16_t);
+void	evdev_support_abs(struct evdev_dev *, uint16_t, int32_t, int32_t,
+	    int32_t, int32_t, int32_t, int32_t);
+int	evdev_register(struct evdev_dev *);
+int	evdev_push_event(struct evdev_dev *, uint16_t, uint16_t, int32_t);
+void	evdev_sync(struct evdev_dev *);
+int	evdev_get_mt_slot_by_tracking_id(struct evdev_dev *, int32_t);
+
+#endif /* SIM_KERN_H */
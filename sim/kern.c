@@ -0,0 +1,1891 @@
+/*-
+ * Copyright (c) 2018 Tom Jones <tj@enoti.me>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Userland implementation of the kernel interfaces declared in sim_kern.h.
+ * Everything runs on the calling thread: interrupts are delivered when the
+ * harness calls sim_intr(), tasks when it calls sim_taskqueue_run() and
+ * callouts when it moves the clock with sim_clock_advance().
+ */
+
+#define SIM_KERN_IMPL
+#include "sim_kern.h"
+#include "sim.h"
+
+#include <time.h>
+
+int hz = 1000;
+sbintime_t tick_sbt = SBT_1S / 1000;
+int bootverbose;
+int ticks;
+int sim_quiet;
+
+static int sim_nfailures;
+static sbintime_t sim_clock_offset;
+
+struct resource {
+	int		r_type;
+	uint32_t	(*r_read4)(void *, bus_size_t);
+	void		(*r_write4)(void *, bus_size_t, uint32_t);
+	void		*r_ctx;
+};
+
+struct sysctl_oid {
+	struct sysctl_oid *oid_parent;
+	char		*oid_name;
+	int		oid_kind;
+	void		*oid_arg1;
+	intmax_t	oid_arg2;
+	sysctl_handler_t *oid_handler;
+	struct sysctl_oid *oid_children;
+	struct sysctl_oid *oid_next;
+};
+
+#define	SIM_DC_BUSES	4
+
+struct sim_devclass {
+	char		dc_name[32];
+	driver_t	*dc_driver;	/* NULL for devices without one */
+	const char	*dc_buses[SIM_DC_BUSES];	/* it attaches under */
+	int		dc_maxunit;
+	struct sim_devclass *dc_next;
+};
+
+struct _device {
+	char		d_name[32];
+	char		d_nameunit[32];
+	char		d_sysctl_name[40];
+	const char	*d_desc;
+	int		d_unit;
+	void		*d_softc;
+	uint16_t	d_addr;
+	struct sim_acpi_node *d_acpi;
+
+	devclass_t	d_devclass;
+	device_t	d_parent;
+	device_t	d_children;
+	device_t	d_sibling;
+	device_t	d_all;		/* every device, for lookups */
+	int		d_attached;
+
+	struct resource	d_mem;
+	int		d_has_mem;
+	struct resource	d_irq;
+	int		d_no_irq;
+
+	int		(*d_iic)(void *, struct iic_msg *, uint32_t);
+	void		*d_iic_ctx;
+	device_t	d_iic_owner;	/* iicbus_request_bus */
+	int		d_iic_speed;	/* last iicbus_reset */
+
+	driver_filter_t	*d_filter;
+	driver_intr_t	*d_ithread;
+	void		*d_intr_arg;
+
+	struct sysctl_oid d_sysctl;
+};
+
+#define	SIM_ACPI_RESOURCES	4
+
+struct sim_acpi_node {
+	char		n_name[32];
+	char		n_hid[16];
+	int		n_uid;
+	struct sim_acpi_node *n_children;
+	struct sim_acpi_node *n_next;
+	struct sim_acpi_node *n_abs;	/* next node with an absolute path */
+
+	struct {
+		const char	*method;
+		ACPI_RESOURCE	*res;
+		int		nres;
+	} n_res[SIM_ACPI_RESOURCES];
+
+	u_int		n_calls;
+	uint64_t	n_last_arg;
+	void		(*n_hook)(void *, uint64_t);	/* model side effect */
+	void		*n_hook_ctx;
+	u_int		n_fail;		/* evaluations left to fail */
+};
+
+size_t
+sim_strlcpy(char *dst, const char *src, size_t size)
+{
+	size_t len;
+
+	len = strlen(src);
+	if (size > 0) {
+		memcpy(dst, src, MIN(len, size - 1));
+		dst[MIN(len, size - 1)] = '\0';
+	}
+	return (len);
+}
+
+/*
+ * Time
+ */
+uint64_t
+sim_nsec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+sbintime_t
+sbinuptime(void)
+{
+	uint64_t ns;
+
+	ns = sim_nsec();
+	return (((sbintime_t)(ns / 1000000000) << 32) +
+		(sbintime_t)(((ns % 1000000000) << 32) / 1000000000) +
+		sim_clock_offset);
+}
+
+void
+microuptime(struct timeval *tv)
+{
+	sbintime_t sbt;
+
+	sbt = sbinuptime();
+	tv->tv_sec = sbt >> 32;
+	tv->tv_usec = sbttous(sbt & 0xffffffff);
+}
+
+void
+DELAY(int us)
+{
+	sim_clock_advance(ustosbt(us));
+}
+
+void
+sim_pause(const char *wmesg, int timo)
+{
+	sim_clock_advance(timo * (SBT_1S / hz));
+}
+
+int
+pause_sbt(const char *wmesg, sbintime_t sbt, sbintime_t pr, int flags)
+{
+	sim_clock_advance(sbt);
+	return (0);
+}
+
+/*
+ * Locking
+ */
+void
+mtx_init(struct mtx *m, const char *name, const char *type, int opts)
+{
+	m->mtx_name = name;
+	m->mtx_inited = 1;
+	m->mtx_owned = 0;
+}
+
+void
+mtx_destroy(struct mtx *m)
+{
+	if (m->mtx_owned) {
+		fprintf(stderr, "mutex %s destroyed while held\n", m->mtx_name);
+		abort();
+	}
+	m->mtx_inited = 0;
+}
+
+void
+mtx_lock(struct mtx *m)
+{
+	if (m->mtx_owned) {
+		fprintf(stderr, "mutex %s recursed\n", m->mtx_name);
+		abort();
+	}
+	m->mtx_owned = 1;
+}
+
+void
+mtx_unlock(struct mtx *m)
+{
+	if (!m->mtx_owned) {
+		fprintf(stderr, "mutex %s not held\n", m->mtx_name);
+		abort();
+	}
+	m->mtx_owned = 0;
+}
+
+void
+mtx_lock_spin(struct mtx *m)
+{
+	mtx_lock(m);
+}
+
+void
+mtx_unlock_spin(struct mtx *m)
+{
+	mtx_unlock(m);
+}
+
+void
+mtx_assert(struct mtx *m, int what)
+{
+	if ((what == MA_OWNED) != (m->mtx_owned != 0)) {
+		fprintf(stderr, "mutex %s assertion failed\n", m->mtx_name);
+		abort();
+	}
+}
+
+void
+sx_init(struct sx *sx, const char *name)
+{
+	sx->sx_name = name;
+	sx->sx_xowned = 0;
+	sx->sx_shared = 0;
+}
+
+void
+sx_destroy(struct sx *sx)
+{
+	if (sx->sx_xowned || sx->sx_shared) {
+		fprintf(stderr, "sx %s destroyed while held\n", sx->sx_name);
+		abort();
+	}
+}
+
+void
+sx_xlock(struct sx *sx)
+{
+	if (sx->sx_xowned || sx->sx_shared) {
+		fprintf(stderr, "sx %s recursed\n", sx->sx_name);
+		abort();
+	}
+	sx->sx_xowned = 1;
+}
+
+int
+sx_try_xlock(struct sx *sx)
+{
+	if (sx->sx_xowned || sx->sx_shared)
+		return (0);
+	sx->sx_xowned = 1;
+	return (1);
+}
+
+void
+sx_xunlock(struct sx *sx)
+{
+	if (!sx->sx_xowned) {
+		fprintf(stderr, "sx %s not held\n", sx->sx_name);
+		abort();
+	}
+	sx->sx_xowned = 0;
+}
+
+void
+sx_slock(struct sx *sx)
+{
+	if (sx->sx_xowned) {
+		fprintf(stderr, "sx %s recursed\n", sx->sx_name);
+		abort();
+	}
+	sx->sx_shared++;
+}
+
+void
+sx_sunlock(struct sx *sx)
+{
+	if (sx->sx_shared == 0) {
+		fprintf(stderr, "sx %s not held\n", sx->sx_name);
+		abort();
+	}
+	sx->sx_shared--;
+}
+
+void
+sx_assert(struct sx *sx, int what)
+{
+	int ok;
+
+	switch (what) {
+	case SA_XLOCKED:
+		ok = sx->sx_xowned;
+		break;
+	case SA_SLOCKED:
+		ok = sx->sx_shared != 0;
+		break;
+	case SA_LOCKED:
+		ok = sx->sx_xowned || sx->sx_shared != 0;
+		break;
+	default:
+		ok = !sx->sx_xowned && sx->sx_shared == 0;
+		break;
+	}
+	if (!ok) {
+		fprintf(stderr, "sx %s assertion failed\n", sx->sx_name);
+		abort();
+	}
+}
+
+int
+mtx_sleep(void *chan, struct mtx *m, int pri, const char *wmesg, int timo)
+{
+	/* Nothing else can run to wake us, so every sleep times out */
+	if (timo > 0)
+		sim_clock_advance(timo * (SBT_1S / hz));
+	return (EWOULDBLOCK);
+}
+
+void
+wakeup(void *chan)
+{
+}
+
+/*
+ * Memory
+ */
+void *
+sim_malloc(size_t size, int flags)
+{
+	void *p;
+
+	p = (flags & M_ZERO) ? calloc(1, size) : malloc(size);
+	if (p == NULL && (flags & M_NOWAIT) == 0)
+		abort();
+	return (p);
+}
+
+void
+sim_free(void *p)
+{
+	free(p);
+}
+
+/*
+ * Devices and resources
+ */
+/*
+ * Devices and resources
+ *
+ * Devices form a tree, BUS_ADD_CHILD and bus_generic_attach() probe and
+ * attach children with the driver DRIVER_MODULE registered under their
+ * name, when it was registered for the parent's class as newbus has it.
+ * Devices the harness creates stand in for the buses and controllers.
+ */
+static struct sim_devclass *sim_devclasses;
+static device_t sim_devices;
+
+static devclass_t
+sim_devclass_get(const char *name)
+{
+	struct sim_devclass *dc;
+
+	for (dc = sim_devclasses; dc != NULL; dc = dc->dc_next)
+		if (strcmp(dc->dc_name, name) == 0)
+			return (dc);
+	dc = calloc(1, sizeof(*dc));
+	snprintf(dc->dc_name, sizeof(dc->dc_name), "%s", name);
+	dc->dc_next = sim_devclasses;
+	sim_devclasses = dc;
+	return (dc);
+}
+
+void
+sim_driver_register(driver_t *driver, devclass_t *dcp, const char *bus)
+{
+	devclass_t dc;
+	int i;
+
+	dc = sim_devclass_get(driver->name);
+	dc->dc_driver = driver;
+	for (i = 0; i < SIM_DC_BUSES; i++)
+		if (dc->dc_buses[i] == NULL) {
+			dc->dc_buses[i] = bus;
+			break;
+		}
+	if (i == SIM_DC_BUSES) {
+		fprintf(stderr, "driver %s on too many buses\n", driver->name);
+		abort();
+	}
+	*dcp = dc;
+}
+
+static int
+sim_driver_on(device_t child, device_t bus)
+{
+	devclass_t dc;
+	int i;
+
+	dc = child->d_devclass;
+	for (i = 0; i < SIM_DC_BUSES && dc->dc_buses[i] != NULL; i++)
+		if (strcmp(dc->dc_buses[i], bus->d_devclass->dc_name) == 0)
+			return (1);
+	return (0);
+}
+
+devclass_t
+devclass_find(const char *name)
+{
+	struct sim_devclass *dc;
+
+	for (dc = sim_devclasses; dc != NULL; dc = dc->dc_next)
+		if (strcmp(dc->dc_name, name) == 0)
+			return (dc);
+	return (NULL);
+}
+
+int
+devclass_get_maxunit(devclass_t dc)
+{
+	return (dc == NULL ? -1 : dc->dc_maxunit);
+}
+
+device_t
+sim_device_create(const char *name, int unit, size_t softc_size)
+{
+	devclass_t dc;
+	device_t dev;
+
+	dc = sim_devclass_get(name);
+	if (unit < 0)
+		unit = dc->dc_maxunit;
+	if (unit >= dc->dc_maxunit)
+		dc->dc_maxunit = unit + 1;
+	if (softc_size == 0 && dc->dc_driver != NULL)
+		softc_size = dc->dc_driver->size;
+
+	dev = calloc(1, sizeof(*dev));
+	snprintf(dev->d_name, sizeof(dev->d_name), "%s", name);
+	snprintf(dev->d_nameunit, sizeof(dev->d_nameunit), "%s%d", name, unit);
+	dev->d_unit = unit;
+	dev->d_devclass = dc;
+	dev->d_softc = calloc(1, softc_size > 0 ? softc_size : 1);
+	dev->d_irq.r_type = SYS_RES_IRQ;
+	snprintf(dev->d_sysctl_name, sizeof(dev->d_sysctl_name), "dev.%s.%d",
+		name, unit);
+	dev->d_sysctl.oid_name = dev->d_sysctl_name;
+	dev->d_sysctl.oid_kind = CTLTYPE_NODE;
+	dev->d_all = sim_devices;
+	sim_devices = dev;
+	return (dev);
+}
+
+static void
+sim_sysctl_free(struct sysctl_oid *oid)
+{
+	struct sysctl_oid *child, *next;
+
+	for (child = oid->oid_children; child != NULL; child = next) {
+		next = child->oid_next;
+		sim_sysctl_free(child);
+		free(child->oid_name);
+		free(child);
+	}
+	oid->oid_children = NULL;
+}
+
+void
+sim_device_destroy(device_t dev)
+{
+	device_t *pp;
+
+	while (dev->d_children != NULL)
+		sim_device_destroy(dev->d_children);
+	if (dev->d_parent != NULL)
+		for (pp = &dev->d_parent->d_children; *pp != NULL;
+		    pp = &(*pp)->d_sibling)
+			if (*pp == dev) {
+				*pp = dev->d_sibling;
+				break;
+			}
+	for (pp = &sim_devices; *pp != NULL; pp = &(*pp)->d_all)
+		if (*pp == dev) {
+			*pp = dev->d_all;
+			break;
+		}
+	if (dev->d_unit == dev->d_devclass->dc_maxunit - 1)
+		dev->d_devclass->dc_maxunit--;
+	sim_sysctl_free(&dev->d_sysctl);
+	free(dev->d_softc);
+	free(dev);
+}
+
+void
+sim_device_set_acpi(device_t dev, struct sim_acpi_node *node)
+{
+	dev->d_acpi = node;
+}
+
+void
+sim_device_set_mem(device_t dev, uint32_t (*read4)(void *, bus_size_t),
+    void (*write4)(void *, bus_size_t, uint32_t), void *ctx)
+{
+	dev->d_mem.r_type = SYS_RES_MEMORY;
+	dev->d_mem.r_read4 = read4;
+	dev->d_mem.r_write4 = write4;
+	dev->d_mem.r_ctx = ctx;
+	dev->d_has_mem = 1;
+}
+
+void
+sim_device_set_addr(device_t dev, uint16_t addr)
+{
+	dev->d_addr = addr;
+}
+
+void
+sim_device_set_irq(device_t dev, int present)
+{
+	dev->d_no_irq = !present;
+}
+
+void
+sim_device_set_iic(device_t dev,
+    int (*xfer)(void *, struct iic_msg *, uint32_t), void *ctx)
+{
+	dev->d_iic = xfer;
+	dev->d_iic_ctx = ctx;
+}
+
+void *
+device_get_softc(device_t dev)
+{
+	return (dev->d_softc);
+}
+
+device_t
+device_get_parent(device_t dev)
+{
+	return (dev->d_parent);
+}
+
+const char *
+device_get_name(device_t dev)
+{
+	return (dev->d_name);
+}
+
+driver_t *
+device_get_driver(device_t dev)
+{
+	return (dev->d_devclass->dc_driver);
+}
+
+const char *
+device_get_nameunit(device_t dev)
+{
+	return (dev->d_nameunit);
+}
+
+const char *
+device_get_desc(device_t dev)
+{
+	return (dev->d_desc);
+}
+
+int
+device_get_unit(device_t dev)
+{
+	return (dev->d_unit);
+}
+
+void
+device_set_desc(device_t dev, const char *desc)
+{
+	dev->d_desc = desc;
+}
+
+int
+device_printf(device_t dev, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	if (sim_quiet)
+		return (0);
+	n = printf("%s: ", dev->d_nameunit);
+	va_start(ap, fmt);
+	n += vprintf(fmt, ap);
+	va_end(ap);
+	return (n);
+}
+
+int
+uprintf(const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	if (sim_quiet)
+		return (0);
+	va_start(ap, fmt);
+	n = vprintf(fmt, ap);
+	va_end(ap);
+	return (n);
+}
+
+int
+bus_generic_suspend(device_t dev)
+{
+	return (0);
+}
+
+int
+bus_generic_resume(device_t dev)
+{
+	return (0);
+}
+
+static void *
+sim_method(device_t dev, const char *name)
+{
+	device_method_t *m;
+	driver_t *driver;
+
+	driver = dev->d_devclass->dc_driver;
+	if (driver == NULL)
+		return (NULL);
+	for (m = driver->methods; m->name != NULL; m++)
+		if (strcmp(m->name, name) == 0)
+			return (m->func);
+	return (NULL);
+}
+
+device_t
+sim_bus_add_child(device_t bus, u_int order, const char *name, int unit)
+{
+	device_t child, *pp;
+
+	child = sim_device_create(name, unit, 0);
+	child->d_parent = bus;
+	child->d_no_irq = 1;		/* until bus_set_resource() */
+	for (pp = &bus->d_children; *pp != NULL; pp = &(*pp)->d_sibling)
+		;
+	*pp = child;
+	return (child);
+}
+
+device_t
+device_find_child(device_t dev, const char *name, int unit)
+{
+	device_t child;
+
+	for (child = dev->d_children; child != NULL; child = child->d_sibling)
+		if (strcmp(child->d_name, name) == 0 &&
+		    (unit == -1 || child->d_unit == unit))
+			return (child);
+	return (NULL);
+}
+
+int
+device_delete_child(device_t dev, device_t child)
+{
+	int (*detach)(device_t);
+	int error;
+
+	detach = sim_method(child, "device_detach");
+	if (child->d_attached && detach != NULL) {
+		error = detach(child);
+		if (error)
+			return (error);
+	}
+	sim_device_destroy(child);
+	return (0);
+}
+
+int
+device_is_attached(device_t dev)
+{
+	return (dev->d_attached);
+}
+
+int
+bus_generic_attach(device_t dev)
+{
+	int (*probe)(device_t), (*attach)(device_t);
+	device_t child;
+
+	for (child = dev->d_children; child != NULL; child = child->d_sibling) {
+		probe = sim_method(child, "device_probe");
+		attach = sim_method(child, "device_attach");
+		if (child->d_attached || probe == NULL || attach == NULL ||
+		    !sim_driver_on(child, dev))
+			continue;
+		if (probe(child) > 0)
+			continue;
+		child->d_attached = attach(child) == 0;
+	}
+	return (0);
+}
+
+int
+bus_generic_detach(device_t dev)
+{
+	return (0);
+}
+
+device_t
+devclass_get_device(devclass_t dc, int unit)
+{
+	device_t dev;
+
+	if (dc == NULL)
+		return (NULL);
+	for (dev = sim_devices; dev != NULL; dev = dev->d_all)
+		if (dev->d_devclass == dc && dev->d_unit == unit)
+			return (dev);
+	return (NULL);
+}
+
+struct resource *
+bus_alloc_resource_any(device_t dev, int type, int *rid, u_int flags)
+{
+	switch (type) {
+	case SYS_RES_MEMORY:
+		return (dev->d_has_mem ? &dev->d_mem : NULL);
+	case SYS_RES_IRQ:
+		return (dev->d_no_irq ? NULL : &dev->d_irq);
+	default:
+		return (NULL);
+	}
+}
+
+int
+bus_release_resource(device_t dev, int type, int rid, struct resource *r)
+{
+	return (0);
+}
+
+/* Only the interrupt can be handed between devices */
+int
+bus_get_resource(device_t dev, int type, int rid, rman_res_t *startp,
+    rman_res_t *countp)
+{
+	if (type != SYS_RES_IRQ || rid != 0 || dev->d_no_irq)
+		return (ENOENT);
+	if (startp != NULL)
+		*startp = 0;
+	if (countp != NULL)
+		*countp = 1;
+	return (0);
+}
+
+int
+bus_set_resource(device_t dev, int type, int rid, rman_res_t start,
+    rman_res_t count)
+{
+	if (type != SYS_RES_IRQ || rid != 0)
+		return (EINVAL);
+	dev->d_no_irq = 0;
+	return (0);
+}
+
+int
+bus_setup_intr(device_t dev, struct resource *r, int flags,
+    driver_filter_t *filter, driver_intr_t *ithread, void *arg, void **cookie)
+{
+	dev->d_filter = filter;
+	dev->d_ithread = ithread;
+	dev->d_intr_arg = arg;
+	*cookie = dev;
+	return (0);
+}
+
+int
+bus_teardown_intr(device_t dev, struct resource *r, void *cookie)
+{
+	dev->d_filter = NULL;
+	dev->d_ithread = NULL;
+	return (0);
+}
+
+uint32_t
+bus_read_4(struct resource *r, bus_size_t off)
+{
+	return (r->r_read4(r->r_ctx, off));
+}
+
+void
+bus_write_4(struct resource *r, bus_size_t off, uint32_t val)
+{
+	r->r_write4(r->r_ctx, off, val);
+}
+
+/*
+ * Deliver the device's interrupt, the filter first and then the ithread
+ * handler if the filter asks for it.
+ */
+int
+sim_intr(device_t dev)
+{
+	int rv;
+
+	if (dev->d_filter == NULL && dev->d_ithread == NULL)
+		return (0);
+
+	rv = FILTER_SCHEDULE_THREAD;
+	if (dev->d_filter != NULL)
+		rv = dev->d_filter(dev->d_intr_arg);
+	if ((rv & FILTER_SCHEDULE_THREAD) && dev->d_ithread != NULL)
+		dev->d_ithread(dev->d_intr_arg);
+	return (1);
+}
+
+int
+sim_intr_pending(device_t dev)
+{
+	return (dev->d_filter != NULL || dev->d_ithread != NULL);
+}
+
+/* Transfers go to the nearest device up the tree with a handler */
+int
+iicbus_transfer(device_t dev, struct iic_msg *msgs, uint32_t nmsgs)
+{
+	while (dev != NULL && dev->d_iic == NULL)
+		dev = dev->d_parent;
+	if (dev == NULL)
+		return (IIC_ENOACK);
+	return (dev->d_iic(dev->d_iic_ctx, msgs, nmsgs));
+}
+
+uint32_t
+iicbus_get_addr(device_t dev)
+{
+	return (dev->d_addr);
+}
+
+void
+iicbus_set_addr(device_t dev, uint32_t addr)
+{
+	dev->d_addr = addr;
+}
+
+int
+iicbus_request_bus(device_t bus, device_t dev, int how)
+{
+	if (bus->d_iic_owner != NULL && bus->d_iic_owner != dev)
+		return (EWOULDBLOCK);
+	bus->d_iic_owner = dev;
+	return (0);
+}
+
+int
+iicbus_release_bus(device_t bus, device_t dev)
+{
+	if (bus->d_iic_owner != dev)
+		return (EINVAL);
+	bus->d_iic_owner = NULL;
+	return (0);
+}
+
+int
+iicbus_reset(device_t bus, u_char speed, u_char addr, u_char *oldaddr)
+{
+	bus->d_iic_speed = speed;
+	return (0);
+}
+
+int
+sim_iic_speed(device_t bus)
+{
+	return (bus->d_iic_speed);
+}
+
+/* GPIO methods, through the controller's driver */
+int
+sim_gpio_pin_set(device_t dev, uint32_t pin, unsigned int value)
+{
+	int (*set)(device_t, uint32_t, unsigned int);
+
+	set = sim_method(dev, "gpio_pin_set");
+	return (set == NULL ? ENXIO : set(dev, pin, value));
+}
+
+int
+sim_gpio_pin_setflags(device_t dev, uint32_t pin, uint32_t flags)
+{
+	int (*setflags)(device_t, uint32_t, uint32_t);
+
+	setflags = sim_method(dev, "gpio_pin_setflags");
+	return (setflags == NULL ? ENXIO : setflags(dev, pin, flags));
+}
+
+device_t
+gpiobus_attach_bus(device_t dev)
+{
+	static struct _device gpiobus = { .d_nameunit = "gpiobus" };
+
+	return (&gpiobus);
+}
+
+int
+gpiobus_detach_bus(device_t dev)
+{
+	return (0);
+}
+
+/* pwmbus(4), registered for "pwm" parents as the kernel has it */
+static int
+pwmbus_probe(device_t dev)
+{
+	device_set_desc(dev, "PWM bus");
+	return (0);
+}
+
+static int
+pwmbus_attach(device_t dev)
+{
+	return (0);
+}
+
+static device_method_t pwmbus_methods[] = {
+	DEVMETHOD(device_probe,		pwmbus_probe),
+	DEVMETHOD(device_attach,	pwmbus_attach),
+	DEVMETHOD_END
+};
+
+driver_t pwmbus_driver = {
+	.name = "pwmbus",
+	.methods = pwmbus_methods,
+};
+devclass_t pwmbus_devclass;
+DRIVER_MODULE(pwmbus, pwm, pwmbus_driver, pwmbus_devclass, NULL, NULL);
+
+/*
+ * Sysctl
+ */
+struct sysctl_ctx_list *
+device_get_sysctl_ctx(device_t dev)
+{
+	return (NULL);
+}
+
+struct sysctl_oid *
+device_get_sysctl_tree(device_t dev)
+{
+	return (&dev->d_sysctl);
+}
+
+struct sysctl_oid_list *
+sim_sysctl_children(struct sysctl_oid *oid)
+{
+	return ((struct sysctl_oid_list *)oid);
+}
+
+struct sim_env {
+	char		*name;
+	char		*value;
+	struct sim_env	*next;
+};
+static struct sim_env *sim_env;
+
+void
+sim_setenv(const char *name, const char *value)
+{
+	struct sim_env *e;
+
+	for (e = sim_env; e != NULL; e = e->next)
+		if (strcmp(e->name, name) == 0)
+			break;
+	if (e == NULL) {
+		e = calloc(1, sizeof(*e));
+		e->name = strdup(name);
+		e->next = sim_env;
+		sim_env = e;
+	} else
+		free(e->value);
+	e->value = strdup(value);
+}
+
+static void
+sim_sysctl_path(struct sysctl_oid *oid, char *buf, size_t len)
+{
+	if (oid->oid_parent != NULL) {
+		sim_sysctl_path(oid->oid_parent, buf, len);
+		strncat(buf, ".", len - strlen(buf) - 1);
+	}
+	strncat(buf, oid->oid_name, len - strlen(buf) - 1);
+}
+
+static int sim_sysctl_write(struct sysctl_oid *, const void *, size_t);
+static size_t sim_sysctl_size(int);
+
+/* Set a CTLFLAG_TUN oid from the environment like the kernel would */
+static void
+sim_sysctl_tunable(struct sysctl_oid *oid)
+{
+	struct sim_env *e;
+	char path[256];
+	uint64_t u64;
+	int32_t i32;
+	uint8_t u8;
+
+	path[0] = '\0';
+	sim_sysctl_path(oid, path, sizeof(path));
+	for (e = sim_env; e != NULL; e = e->next)
+		if (strcmp(e->name, path) == 0)
+			break;
+	if (e == NULL)
+		return;
+
+	switch (oid->oid_kind & CTLTYPE) {
+	case CTLTYPE_INT:
+	case CTLTYPE_UINT:
+		i32 = strtol(e->value, NULL, 0);
+		sim_sysctl_write(oid, &i32, sizeof(i32));
+		break;
+	case CTLTYPE_U8:
+		u8 = strtoul(e->value, NULL, 0);
+		sim_sysctl_write(oid, &u8, sizeof(u8));
+		break;
+	case CTLTYPE_U64:
+		u64 = strtoull(e->value, NULL, 0);
+		sim_sysctl_write(oid, &u64, sizeof(u64));
+		break;
+	case CTLTYPE_STRING:
+		sim_sysctl_write(oid, e->value, strlen(e->value) + 1);
+		break;
+	}
+}
+
+struct sysctl_oid *
+sim_sysctl_add(struct sysctl_oid_list *parent, const char *name, int kind,
+    void *arg1, sysctl_handler_t *handler, intmax_t arg2)
+{
+	struct sysctl_oid *p, *oid, **tail;
+
+	p = (struct sysctl_oid *)parent;
+	oid = calloc(1, sizeof(*oid));
+	oid->oid_parent = p;
+	oid->oid_name = strdup(name);
+	oid->oid_kind = kind;
+	oid->oid_arg1 = arg1;
+	oid->oid_arg2 = arg2;
+	oid->oid_handler = handler;
+
+	for (tail = &p->oid_children; *tail != NULL; tail = &(*tail)->oid_next)
+		;
+	*tail = oid;
+
+	if (kind & CTLFLAG_TUN)
+		sim_sysctl_tunable(oid);
+	return (oid);
+}
+
+static struct sysctl_oid *
+sim_sysctl_find(device_t dev, const char *path)
+{
+	struct sysctl_oid *oid;
+	const char *end;
+	size_t len;
+
+	oid = &dev->d_sysctl;
+	while (*path != '\0') {
+		end = strchr(path, '.');
+		len = end != NULL ? (size_t)(end - path) : strlen(path);
+		for (oid = oid->oid_children; oid != NULL; oid = oid->oid_next)
+			if (strlen(oid->oid_name) == len &&
+			    strncmp(oid->oid_name, path, len) == 0)
+				break;
+		if (oid == NULL)
+			return (NULL);
+		path += len;
+		if (*path == '.')
+			path++;
+	}
+	return (oid);
+}
+
+static size_t
+sim_sysctl_size(int kind)
+{
+	switch (kind & CTLTYPE) {
+	case CTLTYPE_U8:
+		return (1);
+	case CTLTYPE_INT:
+	case CTLTYPE_UINT:
+		return (4);
+	case CTLTYPE_U64:
+		return (8);
+	default:
+		return (0);
+	}
+}
+
+int
+sim_sysctl_get(device_t dev, const char *path, void *buf, size_t *len)
+{
+	struct sysctl_oid *oid;
+	struct sysctl_req req;
+	size_t size;
+	int error;
+
+	oid = sim_sysctl_find(dev, path);
+	if (oid == NULL)
+		return (ENOENT);
+
+	if (oid->oid_handler == NULL) {
+		size = sim_sysctl_size(oid->oid_kind);
+		if (size == 0 || size > *len)
+			return (EINVAL);
+		memcpy(buf, oid->oid_arg1, size);
+		*len = size;
+		return (0);
+	}
+
+	memset(&req, 0, sizeof(req));
+	req.oldptr = buf;
+	req.oldlen = *len;
+	error = oid->oid_handler(oid, oid->oid_arg1, oid->oid_arg2, &req);
+	*len = req.oldidx;
+	return (error);
+}
+
+int
+sim_sysctl_set(device_t dev, const char *path, const void *buf, size_t len)
+{
+	struct sysctl_oid *oid;
+
+	oid = sim_sysctl_find(dev, path);
+	if (oid == NULL)
+		return (ENOENT);
+	return (sim_sysctl_write(oid, buf, len));
+}
+
+static int
+sim_sysctl_write(struct sysctl_oid *oid, const void *buf, size_t len)
+{
+	struct sysctl_req req;
+
+	if (oid->oid_handler == NULL) {
+		if (len != sim_sysctl_size(oid->oid_kind))
+			return (EINVAL);
+		memcpy(oid->oid_arg1, buf, len);
+		return (0);
+	}
+
+	memset(&req, 0, sizeof(req));
+	req.newptr = buf;
+	req.newlen = len;
+	return (oid->oid_handler(oid, oid->oid_arg1, oid->oid_arg2, &req));
+}
+
+uint64_t
+sim_sysctl_u64(device_t dev, const char *path)
+{
+	union {
+		uint8_t		u8;
+		uint32_t	u32;
+		uint64_t	u64;
+	} v;
+	size_t len;
+
+	v.u64 = 0;
+	len = sizeof(v);
+	if (sim_sysctl_get(dev, path, &v, &len) != 0) {
+		fprintf(stderr, "no sysctl %s.%s\n", dev->d_nameunit, path);
+		return (0);
+	}
+	switch (len) {
+	case 1:
+		return (v.u8);
+	case 4:
+		return (v.u32);
+	default:
+		return (v.u64);
+	}
+}
+
+int
+SYSCTL_OUT(struct sysctl_req *req, const void *p, size_t l)
+{
+	size_t n;
+
+	if (req->oldptr != NULL) {
+		n = req->oldidx < req->oldlen ? req->oldlen - req->oldidx : 0;
+		memcpy((char *)req->oldptr + req->oldidx, p, MIN(n, l));
+		if (n < l) {
+			req->oldidx += MIN(n, l);
+			return (ENOMEM);
+		}
+	}
+	req->oldidx += l;
+	return (0);
+}
+
+int
+SYSCTL_IN(struct sysctl_req *req, void *p, size_t l)
+{
+	if (req->newptr == NULL)
+		return (0);
+	if (req->newlen - req->newidx < l)
+		return (EINVAL);
+	memcpy(p, (const char *)req->newptr + req->newidx, l);
+	req->newidx += l;
+	return (0);
+}
+
+static int
+sim_sysctl_handle(void *arg1, void *tmp, size_t size, struct sysctl_req *req)
+{
+	int error;
+
+	error = SYSCTL_OUT(req, tmp, size);
+	if (error || req->newptr == NULL)
+		return (error);
+	error = SYSCTL_IN(req, tmp, size);
+	if (error == 0 && arg1 != NULL)
+		memcpy(arg1, tmp, size);
+	return (error);
+}
+
+int
+sysctl_handle_int(struct sysctl_oid *oidp, void *arg1, intmax_t arg2,
+    struct sysctl_req *req)
+{
+	int tmp;
+
+	tmp = arg1 != NULL ? *(int *)arg1 : (int)arg2;
+	return (sim_sysctl_handle(arg1, &tmp, sizeof(tmp), req));
+}
+
+int
+sysctl_handle_64(struct sysctl_oid *oidp, void *arg1, intmax_t arg2,
+    struct sysctl_req *req)
+{
+	uint64_t tmp;
+
+	tmp = arg1 != NULL ? *(uint64_t *)arg1 : (uint64_t)arg2;
+	return (sim_sysctl_handle(arg1, &tmp, sizeof(tmp), req));
+}
+
+int
+sysctl_handle_opaque(struct sysctl_oid *oidp, void *arg1, intmax_t arg2,
+    struct sysctl_req *req)
+{
+	int error;
+
+	error = SYSCTL_OUT(req, arg1, arg2);
+	if (error || req->newptr == NULL)
+		return (error);
+	return (SYSCTL_IN(req, arg1, arg2));
+}
+
+int
+sysctl_handle_string(struct sysctl_oid *oidp, void *arg1, intmax_t arg2,
+    struct sysctl_req *req)
+{
+	size_t len;
+	int error;
+
+	error = SYSCTL_OUT(req, arg1, strlen(arg1) + 1);
+	if (error || req->newptr == NULL)
+		return (error);
+
+	len = req->newlen - req->newidx;
+	if (len >= (size_t)arg2)
+		return (EINVAL);
+	error = SYSCTL_IN(req, arg1, len);
+	((char *)arg1)[len] = '\0';
+	return (error);
+}
+
+struct sbuf *
+sbuf_new(struct sbuf *s, char *buf, int length, int flags)
+{
+	int dyn;
+
+	dyn = 0;
+	if (s == NULL) {
+		s = calloc(1, sizeof(*s));
+		dyn = SBUF_DYNSTRUCT;
+	} else
+		memset(s, 0, sizeof(*s));
+	s->s_flags = flags | dyn;
+	s->s_size = length > 0 ? length : 64;
+	if (buf == NULL) {
+		buf = calloc(1, s->s_size);
+		s->s_flags |= SBUF_DYNAMIC | SBUF_AUTOEXTEND;
+	}
+	s->s_buf = buf;
+	s->s_buf[0] = '\0';
+	return (s);
+}
+
+struct sbuf *
+sbuf_new_for_sysctl(struct sbuf *s, char *buf, int length,
+    struct sysctl_req *req)
+{
+	s = sbuf_new(s, buf, length, SBUF_AUTOEXTEND);
+	s->s_req = req;
+	return (s);
+}
+
+int
+sbuf_printf(struct sbuf *s, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	for (;;) {
+		va_start(ap, fmt);
+		n = vsnprintf(s->s_buf + s->s_len, s->s_size - s->s_len, fmt,
+			ap);
+		va_end(ap);
+		if ((size_t)n < s->s_size - s->s_len)
+			break;
+		if ((s->s_flags & SBUF_DYNAMIC) == 0) {
+			s->s_len = s->s_size - 1;
+			s->s_flags |= SBUF_OVERFLOWED;
+			return (-1);
+		}
+		s->s_size *= 2;
+		s->s_buf = realloc(s->s_buf, s->s_size);
+	}
+	s->s_len += n;
+	return (0);
+}
+
+char *
+sbuf_data(struct sbuf *s)
+{
+	return (s->s_buf);
+}
+
+ssize_t
+sbuf_len(struct sbuf *s)
+{
+	return (s->s_len);
+}
+
+int
+sbuf_finish(struct sbuf *s)
+{
+	if (s->s_req != NULL)
+		return (SYSCTL_OUT(s->s_req, s->s_buf, s->s_len + 1));
+	return ((s->s_flags & SBUF_OVERFLOWED) ? ENOMEM : 0);
+}
+
+void
+sbuf_delete(struct sbuf *s)
+{
+	if (s->s_flags & SBUF_DYNAMIC)
+		free(s->s_buf);
+	if (s->s_flags & SBUF_DYNSTRUCT)
+		free(s);
+}
+
+/*
+ * Task queues
+ */
+struct taskqueue {
+	struct task	*tq_head;
+	struct taskqueue *tq_next;
+};
+
+static struct taskqueue *sim_taskqueues;
+
+struct taskqueue *
+taskqueue_create(const char *name, int flags, taskqueue_enqueue_fn *enqueue,
+    void *context)
+{
+	struct taskqueue *tq;
+
+	tq = calloc(1, sizeof(*tq));
+	tq->tq_next = sim_taskqueues;
+	sim_taskqueues = tq;
+	return (tq);
+}
+
+struct taskqueue *
+taskqueue_create_fast(const char *name, int flags,
+    taskqueue_enqueue_fn *enqueue, void *context)
+{
+	return (taskqueue_create(name, flags, enqueue, context));
+}
+
+void
+taskqueue_thread_enqueue(void *context)
+{
+}
+
+int
+taskqueue_start_threads(struct taskqueue **tqp, int count, int pri,
+    const char *name, ...)
+{
+	return (0);
+}
+
+int
+taskqueue_enqueue(struct taskqueue *tq, struct task *task)
+{
+	struct task **tail;
+
+	if (task->ta_pending) {
+		task->ta_pending++;
+		return (0);
+	}
+	for (tail = &tq->tq_head; *tail != NULL; tail = &(*tail)->ta_next)
+		;
+	task->ta_next = NULL;
+	task->ta_pending = 1;
+	*tail = task;
+	return (0);
+}
+
+static int
+sim_taskqueue_run_one(struct taskqueue *tq, struct task *only)
+{
+	struct task *task, **prev;
+	int pending, n;
+
+	n = 0;
+	prev = &tq->tq_head;
+	while ((task = *prev) != NULL) {
+		if (only != NULL && task != only) {
+			prev = &task->ta_next;
+			continue;
+		}
+		*prev = task->ta_next;
+		pending = task->ta_pending;
+		task->ta_pending = 0;
+		task->ta_func(task->ta_context, pending);
+		n++;
+		prev = &tq->tq_head;
+	}
+	return (n);
+}
+
+void
+taskqueue_drain(struct taskqueue *tq, struct task *task)
+{
+	sim_taskqueue_run_one(tq, task);
+}
+
+void
+taskqueue_free(struct taskqueue *tq)
+{
+	struct taskqueue **prev;
+
+	for (prev = &sim_taskqueues; *prev != NULL; prev = &(*prev)->tq_next)
+		if (*prev == tq) {
+			*prev = tq->tq_next;
+			break;
+		}
+	free(tq);
+}
+
+int
+sim_taskqueue_run(void)
+{
+	struct taskqueue *tq;
+	int n, total;
+
+	total = 0;
+	do {
+		n = 0;
+		for (tq = sim_taskqueues; tq != NULL; tq = tq->tq_next)
+			n += sim_taskqueue_run_one(tq, NULL);
+		total += n;
+	} while (n != 0);
+	return (total);
+}
+
+/*
+ * Callouts
+ */
+static struct callout *sim_callouts;
+
+void
+callout_init(struct callout *c, int mpsafe)
+{
+	memset(c, 0, sizeof(*c));
+}
+
+void
+callout_init_mtx(struct callout *c, struct mtx *m, int flags)
+{
+	memset(c, 0, sizeof(*c));
+	c->c_mtx = m;
+}
+
+int
+callout_stop(struct callout *c)
+{
+	struct callout **prev;
+
+	if (!c->c_pending)
+		return (0);
+	for (prev = &sim_callouts; *prev != NULL; prev = &(*prev)->c_next)
+		if (*prev == c) {
+			*prev = c->c_next;
+			break;
+		}
+	c->c_pending = 0;
+	return (1);
+}
+
+int
+callout_drain(struct callout *c)
+{
+	return (callout_stop(c));
+}
+
+int
+callout_pending(struct callout *c)
+{
+	return (c->c_pending);
+}
+
+int
+callout_reset_sbt(struct callout *c, sbintime_t sbt, sbintime_t prec,
+    void (*func)(void *), void *arg, int flags)
+{
+	int cancelled;
+
+	cancelled = callout_stop(c);
+	c->c_time = sbinuptime() + sbt;
+	c->c_func = func;
+	c->c_arg = arg;
+	c->c_pending = 1;
+	c->c_next = sim_callouts;
+	sim_callouts = c;
+	return (cancelled);
+}
+
+int
+callout_reset(struct callout *c, int to_ticks, void (*func)(void *), void *arg)
+{
+	return (callout_reset_sbt(c, (sbintime_t)to_ticks * (SBT_1S / hz), 0,
+		func, arg, 0));
+}
+
+/*
+ * Move the clock forward, firing callouts in deadline order as they expire.
+ */
+void
+sim_clock_advance(sbintime_t delta)
+{
+	struct callout *c, *next;
+	sbintime_t now;
+
+	sim_clock_offset += delta;
+	for (;;) {
+		now = sbinuptime();
+		next = NULL;
+		for (c = sim_callouts; c != NULL; c = c->c_next)
+			if (c->c_time <= now &&
+			    (next == NULL || c->c_time < next->c_time))
+				next = c;
+		if (next == NULL)
+			break;
+		callout_stop(next);
+		if (next->c_mtx != NULL)
+			mtx_lock(next->c_mtx);
+		next->c_func(next->c_arg);
+		if (next->c_mtx != NULL)
+			mtx_unlock(next->c_mtx);
+	}
+}
+
+/*
+ * ACPI namespace
+ */
+static struct sim_acpi_node *sim_acpi_abs;
+
+/*
+ * Nodes named with an absolute path, "\\_SB_.PCI0.I2C6", can be looked up
+ * with AcpiGetHandle(NULL, ...).
+ */
+struct sim_acpi_node *
+sim_acpi_node(const char *name, int uid)
+{
+	struct sim_acpi_node *node;
+
+	node = calloc(1, sizeof(*node));
+	snprintf(node->n_name, sizeof(node->n_name), "%s", name);
+	node->n_uid = uid;
+	if (name[0] == '\\') {
+		node->n_abs = sim_acpi_abs;
+		sim_acpi_abs = node;
+	}
+	return (node);
+}
+
+void
+sim_acpi_set_hid(struct sim_acpi_node *node, const char *hid)
+{
+	snprintf(node->n_hid, sizeof(node->n_hid), "%s", hid);
+}
+
+struct sim_acpi_node *
+sim_acpi_method(struct sim_acpi_node *parent, const char *name)
+{
+	struct sim_acpi_node *node;
+
+	node = sim_acpi_node(name, -1);
+	node->n_next = parent->n_children;
+	parent->n_children = node;
+	return (node);
+}
+
+void
+sim_acpi_resources(struct sim_acpi_node *node, const char *method,
+    ACPI_RESOURCE *res, int nres)
+{
+	int i;
+
+	for (i = 0; i < SIM_ACPI_RESOURCES; i++)
+		if (node->n_res[i].method == NULL ||
+		    strcmp(node->n_res[i].method, method) == 0)
+			break;
+	if (i == SIM_ACPI_RESOURCES)
+		abort();
+	node->n_res[i].method = method;
+	node->n_res[i].res = res;
+	node->n_res[i].nres = nres;
+}
+
+u_int
+sim_acpi_calls(struct sim_acpi_node *node)
+{
+	return (node->n_calls);
+}
+
+uint64_t
+sim_acpi_last_arg(struct sim_acpi_node *node)
+{
+	return (node->n_last_arg);
+}
+
+void
+sim_acpi_hook(struct sim_acpi_node *node, void (*hook)(void *, uint64_t),
+    void *ctx)
+{
+	node->n_hook = hook;
+	node->n_hook_ctx = ctx;
+}
+
+/* The next count evaluations of the method fail */
+void
+sim_acpi_fail(struct sim_acpi_node *node, u_int count)
+{
+	node->n_fail = count;
+}
+
+static struct sim_acpi_node *
+sim_acpi_child(struct sim_acpi_node *parent, const char *name)
+{
+	struct sim_acpi_node *node;
+
+	for (node = parent->n_children; node != NULL; node = node->n_next)
+		if (strcmp(node->n_name, name) == 0)
+			return (node);
+	return (NULL);
+}
+
+ACPI_STATUS
+AcpiWalkResources(ACPI_HANDLE handle, char *method,
+    ACPI_WALK_RESOURCE_CALLBACK cb, void *context)
+{
+	struct sim_acpi_node *node;
+	int i, r;
+
+	node = handle;
+	if (node == NULL)
+		return (AE_NOT_FOUND);
+	for (i = 0; i < SIM_ACPI_RESOURCES; i++) {
+		if (node->n_res[i].method == NULL ||
+		    strcmp(node->n_res[i].method, method) != 0)
+			continue;
+		for (r = 0; r < node->n_res[i].nres; r++)
+			if (cb(&node->n_res[i].res[r], context) != AE_OK)
+				break;
+		return (AE_OK);
+	}
+	return (AE_NOT_FOUND);
+}
+
+/*
+ * Compare paths the way ACPICA resolves them, name segments shorter than
+ * four characters are padded with underscores.
+ */
+static int
+sim_acpi_path_eq(const char *a, const char *b)
+{
+	int na, nb;
+
+	while (*a != '\0' && *b != '\0') {
+		if (*a == '\\' || *a == '.' || *b == '\\' || *b == '.') {
+			if (*a++ != *b++)
+				return (0);
+			continue;
+		}
+		na = strcspn(a, ".");
+		nb = strcspn(b, ".");
+		if (na > 4 || nb > 4 || strncmp(a, b, MIN(na, nb)) != 0 ||
+		    strspn(a + MIN(na, nb), "_") < (size_t)(na - MIN(na, nb)) ||
+		    strspn(b + MIN(na, nb), "_") < (size_t)(nb - MIN(na, nb)))
+			return (0);
+		a += na;
+		b += nb;
+	}
+	return (*a == *b);
+}
+
+ACPI_STATUS
+AcpiGetHandle(ACPI_HANDLE parent, const char *path, ACPI_HANDLE *handle)
+{
+	struct sim_acpi_node *node;
+
+	if (parent == NULL) {
+		for (node = sim_acpi_abs; node != NULL; node = node->n_abs)
+			if (sim_acpi_path_eq(node->n_name, path))
+				break;
+	} else
+		node = sim_acpi_child(parent, path);
+	if (node == NULL)
+		return (AE_NOT_FOUND);
+	*handle = node;
+	return (AE_OK);
+}
+
+ACPI_STATUS
+AcpiEvaluateObject(ACPI_HANDLE handle, ACPI_STRING path,
+    ACPI_OBJECT_LIST *args, ACPI_BUFFER *ret)
+{
+	struct sim_acpi_node *node;
+
+	node = handle;
+	if (path != NULL)
+		node = sim_acpi_child(node, path);
+	if (node == NULL)
+		return (AE_NOT_FOUND);
+	node->n_calls++;
+	if (node->n_fail > 0) {
+		node->n_fail--;
+		return (AE_ERROR);
+	}
+	node->n_last_arg = (args != NULL && args->Count > 0) ?
+		args->Pointer[0].Integer.Value : 0;
+	if (node->n_hook != NULL)
+		node->n_hook(node->n_hook_ctx, node->n_last_arg);
+	return (AE_OK);
+}
+
+ACPI_STATUS
+acpi_SetInteger(ACPI_HANDLE handle, char *path, uint32_t number)
+{
+	ACPI_OBJECT arg;
+	ACPI_OBJECT_LIST args;
+
+	arg.Integer.Type = ACPI_TYPE_INTEGER;
+	arg.Integer.Value = number;
+	args.Count = 1;
+	args.Pointer = &arg;
+	return (AcpiEvaluateObject(handle, path, &args, NULL));
+}
+
+ACPI_STATUS
+acpi_GetInteger(ACPI_HANDLE handle, char *path, int *value)
+{
+	struct sim_acpi_node *node;
+
+	node = handle;
+	if (node == NULL || strcmp(path, "_UID") != 0 || node->n_uid < 0)
+		return (AE_NOT_FOUND);
+	*value = node->n_uid;
+	return (AE_OK);
+}
+
+ACPI_HANDLE
+acpi_get_handle(device_t dev)
+{
+	return (dev->d_acpi);
+}
+
+device_t
+acpi_get_device(ACPI_HANDLE handle)
+{
+	device_t dev;
+
+	for (dev = sim_devices; dev != NULL; dev = dev->d_all)
+		if (dev->d_acpi == handle)
+			return (dev);
+	return (NULL);
+}
+
+int
+acpi_disabled(char *subsys)
+{
+	return (0);
+}
+
+int
+acpi_wake_set_enable(device_t dev, int enable)
+{
+	if (dev->d_acpi == NULL || sim_acpi_child(dev->d_acpi, "_PRW") == NULL)
+		return (ENXIO);
+	return (0);
+}
+
+/* Nodes without a _HID match the first id */
+char *
+sim_acpi_id_probe(device_t dev, char **ids)
+{
+	int i;
+
+	if (dev->d_acpi == NULL || dev->d_acpi->n_hid[0] == '\0')
+		return (ids[0]);
+	for (i = 0; ids[i] != NULL; i++)
+		if (strcmp(ids[i], dev->d_acpi->n_hid) == 0)
+			return (ids[i]);
+	return (NULL);
+}
+
+/*
+ * Reporting
+ */
+int
+sim_check(int cond, const char *fmt, ...)
+{
+	va_list ap;
+
+	printf("%s ", cond ? "ok  " : "FAIL");
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+	printf("\n");
+	if (!cond)
+		sim_nfailures++;
+	return (cond);
+}
+
+int
+sim_failures(void)
+{
+	return (sim_nfailures);
+}